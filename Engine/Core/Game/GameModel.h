@@ -1,8 +1,19 @@
 #pragma once
 #include <vulkan/vulkan.h>
 #include <vector>
+#include <array>
+#include <random>
+#include <functional>
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
 #include "../../Vulkan/VulkanTypes.h"
 #include "../../Vulkan/VulkanGlobals.h"
+#include "../Systems/TaskScheduler.h"
+#include "../Raytracing/WideBVH.h"
+#include "../Raytracing/CompactBVH.h"
+#include "../Raytracing/TriangleFormats.h"
+#include "../Raytracing/BVHStatistics.h"
 
 namespace Engine
 {
@@ -21,8 +32,8 @@ namespace Engine
 		}
 
 		void expand(const AABB& box) {
-			expand(box.min);
-			expand(box.max);
+			min = glm::min(min, box.min);
+			max = glm::max(max, box.max);
 		}
 
 		int longestAxis() const {
@@ -31,17 +42,69 @@ namespace Engine
 			if (extents.y > extents.z) return 1;
 			return 2;
 		}
+
+		float surfaceArea() const {
+			return areaOf(min, max);
+		}
+
+		static float areaOf(const glm::vec3& min, const glm::vec3& max) {
+			if (min.x > max.x) return 0.0f; // Empty box
+			glm::vec3 d = max - min;
+			return 2.f * (d.x * d.y + d.y * d.z + d.z * d.x);
+		}
 	};
 
+	enum class BVHBuilder
+	{
+		Naive,     // buildNaive: sorted median split
+		Midpoint,  // buildBVH: spatial midpoint of the longest axis
+		Recursive, // buildBVH2: centroid midpoint with median fallback
+		BinnedSAH, // buildBVHBinnedSAH: binned surface area heuristic
+		LBVH,      // buildLBVH: Morton ordered linear BVH, Karras style
+		SBVH       // buildSBVH: binned SAH with spatial splits, duplicates triangle references
+	};
+
+	inline const char* bvhBuilderName(BVHBuilder builder)
+	{
+		switch (builder)
+		{
+		case BVHBuilder::Naive: return "Naive";
+		case BVHBuilder::Midpoint: return "Midpoint";
+		case BVHBuilder::Recursive: return "Recursive";
+		case BVHBuilder::BinnedSAH: return "BinnedSAH";
+		case BVHBuilder::LBVH: return "LBVH";
+		case BVHBuilder::SBVH: return "SBVH";
+		}
+		return "Unknown";
+	}
+
 	class GameModel
 	{
 	private:
 		int maxLeafSize = 2;
+		static constexpr int minSAHBinCount = 16;
+		static constexpr int maxSAHBinCount = 32;
+		int sahMaxLeafSize = 8;
+		float sahTraversalCost = 1.0f;
+		float sahIntersectionCost = 1.0f;
 		std::vector<int> triIndices;
 		std::string name = "model";
+		size_t nodeCapacity = 0; // Global buffer ranges of the first placement, rebuilds reuse them when they fit
+		size_t triangleCapacity = 0;
+		size_t wideNodeCapacity = 0;
+		std::vector<std::vector<int>> refitLevels; // Local node indices per depth, root first, filled by the first refit
+		int sbvhMaxDepth = 60; // Push both traversal needs depth + 1 entries of the 64 entry stacks in compute.glsl, no SBVH leaf ends deeper (see sbvhMedianLevels)
+		int sbvhReferenceCount = 0; // Triangle references of the SBVH being built
+		int sbvhReferenceLimit = 0;
 
 		void createTriangles()
 		{
+			// centroid.w keeps the source triangle as a float, which is exact only up to 2^24
+			if (indices.size() / 3 > (size_t(1) << 24))
+			{
+				throw std::runtime_error("models above 2^24 triangles are not supported!");
+			}
+
 			triangles.clear();
 			for (size_t i = 0; i < indices.size(); i += 3)
 			{
@@ -49,7 +112,7 @@ namespace Engine
 				triangle.v0 = glm::vec4(vertices[indices[i]].pos, 1.0f);
 				triangle.v1 = glm::vec4(vertices[indices[i + 1]].pos, 1.0f);
 				triangle.v2 = glm::vec4(vertices[indices[i + 2]].pos, 1.0f);
-				triangle.centroid = (triangle.v0 + triangle.v1 + triangle.v2) / 3.0f;
+				triangle.centroid = glm::vec4(glm::vec3(triangle.v0 + triangle.v1 + triangle.v2) / 3.0f, static_cast<float>(i / 3)); // w: source triangle, for refits
 				triangles.push_back(triangle);
 			}
 		}
@@ -98,7 +161,7 @@ namespace Engine
 		int buildBVH()
 		{
 			int triangleCount = static_cast<int>(triangles.size());
-			std::atomic<int> atomicNodesUsed(1);
+			if (triangleCount == 0) return -1;
 
 			// Step 1: Create triangle index list and compute centroids
 			std::vector<uint32_t> triIdx(triangleCount);
@@ -106,19 +169,18 @@ namespace Engine
 			{
 				triIdx[i] = i;
 				Triangle& tri = triangles[i];
-				tri.centroid = glm::vec4((glm::vec3(tri.v0) + glm::vec3(tri.v1) + glm::vec3(tri.v2)) / 3.0f, 0);
+				tri.centroid = glm::vec4((glm::vec3(tri.v0) + glm::vec3(tri.v1) + glm::vec3(tri.v2)) / 3.0f, tri.centroid.w);
 			}
 
-			// Step 2: Temporary node storage, using naive logic
-			std::vector<BVHNode> tempNodes(triangleCount * 2);
-			int nodesUsed = 1;
+			// Step 2: Temporary node storage, every subtree owns a fixed slot range (see subtreeSlots)
+			std::vector<BVHNode> tempNodes(subtreeSlots(triangleCount));
 			int rootIdx = 0;
 
 			BVHNode& root = tempNodes[rootIdx];
 			root.firstTriangle = 0;
 			root.triangleCount = triangleCount;
 			updateNodeBounds(tempNodes, triIdx, rootIdx);
-			subdivideBVH(tempNodes, triIdx, 0, maxLeafSize, atomicNodesUsed, 0);
+			subdivideBVH(tempNodes, triIdx, 0, maxLeafSize);
 
 			// Step 3: Remap triangles into triangle list in correct order
 			std::vector<Triangle> orderedTriangles;
@@ -131,12 +193,9 @@ namespace Engine
 				orderedTriangles.push_back(triangles[triIdx[i]]);
 			}
 
-			nodesUsed = atomicNodesUsed.load();
-
 			// Step 4: Rewrite firstTriangle to match new triangle order
-			for (int i = 0; i < nodesUsed; ++i)
+			for (BVHNode& node : tempNodes)
 			{
-				BVHNode& node = tempNodes[i];
 				if (node.triangleCount > 0)
 				{
 					int originalStart = node.firstTriangle;
@@ -146,8 +205,7 @@ namespace Engine
 			}
 
 			// Step 5: Save final results
-			nodes.clear();
-			nodes = std::vector<BVHNode>(tempNodes.begin(), tempNodes.begin() + nodesUsed);
+			compactBVHNodes(tempNodes);
 			triangles = std::move(orderedTriangles);
 
 			return rootIdx;
@@ -169,7 +227,7 @@ namespace Engine
 			node.boundMax = maxBound;
 		}
 
-		void subdivideBVH(std::vector<BVHNode>& nodes, std::vector<uint32_t>& triIdx, uint32_t nodeIdx, int maxLeafSize, std::atomic<int>& atomicNodesUsed, int depth = 0)
+		void subdivideBVH(std::vector<BVHNode>& nodes, std::vector<uint32_t>& triIdx, uint32_t nodeIdx, int maxLeafSize)
 		{
 			BVHNode& node = nodes[nodeIdx];
 			if (node.triangleCount <= maxLeafSize) return;
@@ -192,8 +250,8 @@ namespace Engine
 			int leftCount = i - node.firstTriangle;
 			if (leftCount == 0 || leftCount == node.triangleCount) return;
 
-			int leftIdx = atomicNodesUsed++;
-			int rightIdx = atomicNodesUsed++;
+			int leftIdx = nodeIdx + 1;
+			int rightIdx = nodeIdx + 1 + subtreeSlots(leftCount);
 
 			nodes[leftIdx].firstTriangle = node.firstTriangle;
 			nodes[leftIdx].triangleCount = leftCount;
@@ -203,28 +261,67 @@ namespace Engine
 			nodes[rightIdx].triangleCount = node.triangleCount - leftCount;
 			updateNodeBounds(nodes, triIdx, rightIdx);
 
+			int triangleCount = node.triangleCount;
 			node.left = leftIdx;
 			node.right = rightIdx;
 			node.firstTriangle = -1;
 			node.triangleCount = 0;
 
-			if (depth < 3)  // Parallel spawn limit
+			if (triangleCount >= bvhTaskGranularity)
 			{
-				auto leftFuture = std::async(std::launch::async, [=, &nodes, &triIdx, &atomicNodesUsed]() {
-					subdivideBVH(nodes, triIdx, leftIdx, maxLeafSize, atomicNodesUsed, depth + 1);
+				TaskGroup group;
+				group.run([this, leftIdx, maxLeafSize, &nodes, &triIdx]() {
+					subdivideBVH(nodes, triIdx, leftIdx, maxLeafSize);
 					});
-				auto rightFuture = std::async(std::launch::async, [=, &nodes, &triIdx, &atomicNodesUsed]() {
-					subdivideBVH(nodes, triIdx, rightIdx, maxLeafSize, atomicNodesUsed, depth + 1);
-					});
-				leftFuture.get();
-				rightFuture.get();
+				subdivideBVH(nodes, triIdx, rightIdx, maxLeafSize);
+				group.wait();
 			}
 			else
 			{
-				subdivideBVH(nodes, triIdx, leftIdx, maxLeafSize, atomicNodesUsed, depth + 1);
-				subdivideBVH(nodes, triIdx, rightIdx, maxLeafSize, atomicNodesUsed, depth + 1);
+				subdivideBVH(nodes, triIdx, leftIdx, maxLeafSize);
+				subdivideBVH(nodes, triIdx, rightIdx, maxLeafSize);
+			}
+		}
+
+		#pragma region Parallel build
+		// A binary subtree over n triangles never needs more than 2n - 1 nodes, so each subtree
+		// owns the slots [nodeIdx, nodeIdx + subtreeSlots(n)): the left child sits right after its
+		// parent and the right child after the left child's range. Workers allocate nodes locally
+		// without sharing a counter, and the layout only depends on the mesh, not on scheduling.
+		static int subtreeSlots(int triangleCount)
+		{
+			return 2 * triangleCount - 1;
+		}
+
+		// Drop the slots left unused by subtrees with multi triangle leaves, keeping depth first order
+		void compactBVHNodes(const std::vector<BVHNode>& tempNodes)
+		{
+			std::vector<int> remap(tempNodes.size(), -1);
+			int nodesUsed = 0;
+			for (size_t i = 0; i < tempNodes.size(); ++i)
+			{
+				if (tempNodes[i].left >= 0 || tempNodes[i].triangleCount > 0)
+				{
+					remap[i] = nodesUsed++;
+				}
+			}
+
+			nodes.clear();
+			nodes.reserve(nodesUsed);
+			for (size_t i = 0; i < tempNodes.size(); ++i)
+			{
+				if (remap[i] < 0) continue;
+
+				BVHNode node = tempNodes[i];
+				if (node.triangleCount == 0)
+				{
+					node.left = remap[node.left];
+					node.right = remap[node.right];
+				}
+				nodes.push_back(node);
 			}
 		}
+		#pragma endregion Parallel build
 
 		#pragma region BVH2
 		int buildBVH2()
@@ -263,7 +360,7 @@ namespace Engine
 
 			if (triangleCount <= maxLeafSize)
 			{
-				node.firstTriangle = (int)nodes.size(); // index into the flattened triangle array
+				node.firstTriangle = start; // index into the flattened triangle array
 				node.triangleCount = triangleCount;
 				nodes.push_back(node);
 
@@ -312,194 +409,2036 @@ namespace Engine
 		}
         #pragma endregion BVH2
 
-		//
-		bool validateBVH(int nodeIndex)
+		#pragma region Binned SAH
+		struct SAHBin
 		{
-			if (nodeIndex < 0 || nodeIndex >= nodes.size())
+			AABB bounds;
+			int triangleCount = 0;
+		};
+
+		int buildBVHBinnedSAH()
+		{
+			int triangleCount = static_cast<int>(triangles.size());
+			nodes.clear();
+			if (triangleCount == 0) return -1;
+
+			// Step 1: Per triangle bounds and centroids, computed once
+			std::vector<uint32_t> triIdx(triangleCount);
+			std::vector<AABB> triBounds(triangleCount);
+			for (int i = 0; i < triangleCount; ++i)
 			{
-				return false;
+				triIdx[i] = i;
+				Triangle& tri = triangles[i];
+				tri.centroid = glm::vec4((glm::vec3(tri.v0) + glm::vec3(tri.v1) + glm::vec3(tri.v2)) / 3.0f, tri.centroid.w);
+				triBounds[i].expand(glm::vec3(tri.v0));
+				triBounds[i].expand(glm::vec3(tri.v1));
+				triBounds[i].expand(glm::vec3(tri.v2));
 			}
 
-			const BVHNode& node = nodes[nodeIndex];
+			// Step 2: Root covers every triangle, subtrees own fixed slot ranges (see subtreeSlots)
+			std::vector<BVHNode> tempNodes(subtreeSlots(triangleCount));
+			tempNodes[0].firstTriangle = 0;
+			tempNodes[0].triangleCount = triangleCount;
+			subdivideBinnedSAH(tempNodes, 0, triIdx, triBounds);
+			compactBVHNodes(tempNodes);
 
-			// Check AABB validity
-			for (int i = 0; i < 3; ++i)
+			// Step 3: Reorder triangles so leaf ranges index them directly
+			std::vector<Triangle> orderedTriangles(triangleCount);
+			for (int i = 0; i < triangleCount; ++i)
 			{
-				if (node.boundMin[i] > node.boundMax[i])
-				{
-					printf("Invalid AABB at node %d\n", nodeIndex);
-					return false;
-				}
+				orderedTriangles[i] = triangles[triIdx[i]];
 			}
+			triangles = std::move(orderedTriangles);
 
-			// Leaf node check
-			bool isLeaf = (node.triangleCount > 0);
-			if (isLeaf)
+			return 0;
+		}
+
+		void subdivideBinnedSAH(std::vector<BVHNode>& nodes, uint32_t nodeIdx, std::vector<uint32_t>& triIdx, const std::vector<AABB>& triBounds)
+		{
+			int first = nodes[nodeIdx].firstTriangle;
+			int count = nodes[nodeIdx].triangleCount;
+
+			// Node bounds and centroid bounds
+			AABB bounds, centroidBounds;
+			for (int i = first; i < first + count; ++i)
 			{
-				if (node.left != -1 || node.right != -1)
-				{
-					printf("Leaf node %d has children\n", nodeIndex);
-					return false;
-				}
+				bounds.expand(triBounds[triIdx[i]]);
+				centroidBounds.expand(glm::vec3(triangles[triIdx[i]].centroid));
 			}
-			else
+			nodes[nodeIdx].boundMin = bounds.min;
+			nodes[nodeIdx].boundMax = bounds.max;
+
+			if (count <= 1) return;
+
+			// Evaluate the binned SAH over all three axes
+			int bestAxis = -1;
+			int bestPlane = -1;
+			float bestCost = FLT_MAX;
+			float parentArea = bounds.surfaceArea();
+			int binCount = std::clamp(sahBinCount, minSAHBinCount, maxSAHBinCount);
+
+			for (int axis = 0; axis < 3; ++axis)
 			{
-				// Internal node should have valid children
-				if (node.left < 0 || node.right < 0)
+				float axisMin = centroidBounds.min[axis];
+				float axisExtent = centroidBounds.max[axis] - axisMin;
+				if (axisExtent <= 0.0f) continue;
+
+				SAHBin bins[maxSAHBinCount];
+				float scale = binCount / axisExtent;
+				for (int i = first; i < first + count; ++i)
 				{
-					printf("Internal node %d missing children\n", nodeIndex);
-					return false;
+					int bin = std::min(binCount - 1, static_cast<int>((triangles[triIdx[i]].centroid[axis] - axisMin) * scale));
+					bins[bin].triangleCount++;
+					bins[bin].bounds.expand(triBounds[triIdx[i]]);
 				}
-				if (!validateBVH(node.left) || !validateBVH(node.right))
+
+				// Sweep from both sides to get the cost of every plane between bins
+				float leftArea[maxSAHBinCount - 1], rightArea[maxSAHBinCount - 1];
+				int leftCount[maxSAHBinCount - 1], rightCount[maxSAHBinCount - 1];
+				AABB leftBox, rightBox;
+				int leftSum = 0, rightSum = 0;
+				for (int i = 0; i < binCount - 1; ++i)
 				{
-					return false;
+					leftSum += bins[i].triangleCount;
+					leftCount[i] = leftSum;
+					leftBox.expand(bins[i].bounds);
+					leftArea[i] = leftBox.surfaceArea();
+
+					rightSum += bins[binCount - 1 - i].triangleCount;
+					rightCount[binCount - 2 - i] = rightSum;
+					rightBox.expand(bins[binCount - 1 - i].bounds);
+					rightArea[binCount - 2 - i] = rightBox.surfaceArea();
 				}
-			}
-
-			return true;
-		}
 
-		bool validateBVHTriangles()
-		{
-			for (const BVHNode& node : nodes)
-			{
-				for(int i = node.firstTriangle; i < node.firstTriangle + node.triangleCount; ++i)
+				for (int i = 0; i < binCount - 1; ++i)
 				{
-					if (i < 0 || i >= triangles.size())
+					if (leftCount[i] == 0 || rightCount[i] == 0) continue;
+
+					float cost = sahTraversalCost + sahIntersectionCost * (leftArea[i] * leftCount[i] + rightArea[i] * rightCount[i]) / parentArea;
+					if (cost < bestCost)
 					{
-						printf("Invalid triangle index %d in node %lld.\n", i, &node - &nodes[0]);
-						return false;
+						bestCost = cost;
+						bestAxis = axis;
+						bestPlane = i;
 					}
+				}
+			}
 
-					const Triangle& tri = triangles[i];
+			// SAH driven leaf termination, big leaves are always split
+			float leafCost = sahIntersectionCost * count;
+			if (bestCost >= leafCost && count <= sahMaxLeafSize) return;
 
-					if (!triangleInAABB(tri, node))
+			int mid = first;
+			if (bestAxis >= 0)
+			{
+				float axisMin = centroidBounds.min[bestAxis];
+				float scale = binCount / (centroidBounds.max[bestAxis] - axisMin);
+				auto midIt = std::partition(triIdx.begin() + first, triIdx.begin() + first + count, [&](uint32_t index)
 					{
-						printf("Invalid triangle bounds for node %d: index %lld.\n", i, &node - &nodes[0]);
-						return false;
-					}
-				}
+						int bin = std::min(binCount - 1, static_cast<int>((triangles[index].centroid[bestAxis] - axisMin) * scale));
+						return bin <= bestPlane;
+					});
+				mid = static_cast<int>(midIt - triIdx.begin());
 			}
 
-			return true;
+			// Identical centroids or a degenerate partition, fall back to an object median split
+			if (mid == first || mid == first + count)
+			{
+				int axis = centroidBounds.longestAxis();
+				mid = first + count / 2;
+				std::nth_element(triIdx.begin() + first, triIdx.begin() + mid, triIdx.begin() + first + count, [&](uint32_t a, uint32_t b)
+					{
+						return triangles[a].centroid[axis] < triangles[b].centroid[axis];
+					});
+			}
+
+			int leftIdx = nodeIdx + 1;
+			int rightIdx = nodeIdx + 1 + subtreeSlots(mid - first);
+
+			nodes[leftIdx].firstTriangle = first;
+			nodes[leftIdx].triangleCount = mid - first;
+			nodes[rightIdx].firstTriangle = mid;
+			nodes[rightIdx].triangleCount = first + count - mid;
+
+			nodes[nodeIdx].left = leftIdx;
+			nodes[nodeIdx].right = rightIdx;
+			nodes[nodeIdx].firstTriangle = -1;
+			nodes[nodeIdx].triangleCount = 0;
+
+			if (count >= bvhTaskGranularity)
+			{
+				TaskGroup group;
+				group.run([this, leftIdx, &nodes, &triIdx, &triBounds]() {
+					subdivideBinnedSAH(nodes, leftIdx, triIdx, triBounds);
+					});
+				subdivideBinnedSAH(nodes, rightIdx, triIdx, triBounds);
+				group.wait();
+			}
+			else
+			{
+				subdivideBinnedSAH(nodes, leftIdx, triIdx, triBounds);
+				subdivideBinnedSAH(nodes, rightIdx, triIdx, triBounds);
+			}
 		}
+		#pragma endregion Binned SAH
 
-		bool triangleInAABB(const Triangle& tri, const BVHNode& node) 
+		#pragma region LBVH
+		static uint32_t expandBits10(uint32_t v)
 		{
-			glm::vec3 min = node.boundMin;
-			glm::vec3 max = node.boundMax;
+			v = (v * 0x00010001u) & 0xFF0000FFu;
+			v = (v * 0x00000101u) & 0x0F00F00Fu;
+			v = (v * 0x00000011u) & 0xC30C30C3u;
+			v = (v * 0x00000005u) & 0x49249249u;
+			return v;
+		}
 
-			auto inside = [&](const glm::vec3& v)
-			{
-				return all(glm::greaterThanEqual(v, min)) && all(glm::lessThanEqual(v, max));
-			};
+		static uint64_t expandBits21(uint64_t v)
+		{
+			v &= 0x1fffff;
+			v = (v | v << 32) & 0x1f00000000ffffull;
+			v = (v | v << 16) & 0x1f0000ff0000ffull;
+			v = (v | v << 8) & 0x100f00f00f00f00full;
+			v = (v | v << 4) & 0x10c30c30c30c30c3ull;
+			v = (v | v << 2) & 0x1249249249249249ull;
+			return v;
+		}
 
-			return inside(glm::vec3(tri.v0)) && inside(glm::vec3(tri.v1)) && inside(glm::vec3(tri.v2));
+		static int countLeadingZeros(uint64_t v)
+		{
+#ifdef _MSC_VER
+			unsigned long index;
+			return _BitScanReverse64(&index, v) ? 63 - static_cast<int>(index) : 64;
+#else
+			return v ? __builtin_clzll(v) : 64;
+#endif
 		}
 
-	public:
-		std::vector<Vertex> vertices;
-		std::vector<uint32_t> indices;
+		// Stable LSD radix sort of (code, index) pairs, 8 bits per pass. Chunks are histogrammed and scattered in parallel
+		static void radixSortMortonCodes(std::vector<uint64_t>& codes, std::vector<uint32_t>& values, int codeBits)
+		{
+			const int count = static_cast<int>(codes.size());
+			const int chunkSize = 16384;
+			const int chunkCount = (count + chunkSize - 1) / chunkSize;
+			std::vector<uint64_t> tempCodes(count);
+			std::vector<uint32_t> tempValues(count);
+			std::vector<std::array<uint32_t, 256>> offsets(chunkCount);
+
+			for (int shift = 0; shift < codeBits; shift += 8)
+			{
+				// Step 1: Digit histogram per chunk
+				parallelFor(0, chunkCount, 1, [&](int chunkBegin, int chunkEnd)
+					{
+						for (int chunk = chunkBegin; chunk < chunkEnd; ++chunk)
+						{
+							std::array<uint32_t, 256>& histogram = offsets[chunk];
+							histogram.fill(0);
+							int end = std::min(count, (chunk + 1) * chunkSize);
+							for (int i = chunk * chunkSize; i < end; ++i)
+							{
+								histogram[(codes[i] >> shift) & 0xFF]++;
+							}
+						}
+					});
 
-		int localRoot = 0;
-		int bvhTriangleIndex = 0;
-		int bvhRootNodeIndex = 0;
-		std::vector<Triangle> triangles; // To be appended to the GPU buffer
-		std::vector<BVHNode> nodes; // To be appended to the GPU buffer
+				// Step 2: Exclusive prefix sum, digit major so equal digits keep their chunk order
+				uint32_t sum = 0;
+				for (int digit = 0; digit < 256; ++digit)
+				{
+					for (int chunk = 0; chunk < chunkCount; ++chunk)
+					{
+						uint32_t digitCount = offsets[chunk][digit];
+						offsets[chunk][digit] = sum;
+						sum += digitCount;
+					}
+				}
 
-		VkBuffer vertexBuffer;
-		VkDeviceMemory vertexBufferMemory;
-		VkBuffer indexBuffer;
-		VkDeviceMemory indexBufferMemory;
+				// Step 3: Scatter
+				parallelFor(0, chunkCount, 1, [&](int chunkBegin, int chunkEnd)
+					{
+						for (int chunk = chunkBegin; chunk < chunkEnd; ++chunk)
+						{
+							std::array<uint32_t, 256>& offset = offsets[chunk];
+							int end = std::min(count, (chunk + 1) * chunkSize);
+							for (int i = chunk * chunkSize; i < end; ++i)
+							{
+								uint32_t destination = offset[(codes[i] >> shift) & 0xFF]++;
+								tempCodes[destination] = codes[i];
+								tempValues[destination] = values[i];
+							}
+						}
+					});
 
-		GameModel() 
-			: vertexBuffer(VK_NULL_HANDLE),            // Initialize to default values
-			vertexBufferMemory(VK_NULL_HANDLE),		   // VK_NULL_HANDLE is used to initialize Vulkan handles
-			indexBuffer(VK_NULL_HANDLE),
-			indexBufferMemory(VK_NULL_HANDLE)
-		{};
+				codes.swap(tempCodes);
+				values.swap(tempValues);
+			}
+		}
 
-		GameModel(std::vector<Vertex> vertices, std::vector<uint32_t> indices)
-			: vertices(vertices),
-			indices(indices),
-			vertexBuffer(VK_NULL_HANDLE),            // Initialize to default values
-			vertexBufferMemory(VK_NULL_HANDLE),		   // VK_NULL_HANDLE is used to initialize Vulkan handles
-			indexBuffer(VK_NULL_HANDLE),
-			indexBufferMemory(VK_NULL_HANDLE)
-		{};
+		// Length of the common prefix of two sorted codes, duplicates are told apart by their position
+		static int commonPrefix(const std::vector<uint64_t>& codes, int i, int j)
+		{
+			if (j < 0 || j >= static_cast<int>(codes.size())) return -1;
+			if (codes[i] == codes[j]) return 64 + countLeadingZeros(static_cast<uint64_t>(i ^ j));
+			return countLeadingZeros(codes[i] ^ codes[j]);
+		}
 
-		GameModel
-		(
-			std::vector<Vertex> vertices, 
-			std::vector<uint32_t> indices, 
-			VkBuffer vertexBuffer, 
-			VkDeviceMemory vertexBufferMemory, 
-			VkBuffer indexBuffer, 
-			VkDeviceMemory indexBufferMemory
-		)
-			: vertices(vertices),
-			indices(indices),
-			vertexBuffer(vertexBuffer),
-			vertexBufferMemory(vertexBufferMemory),
-			indexBuffer(indexBuffer),
-			indexBufferMemory(indexBufferMemory)
-		{};
+		static void setNodeBounds(BVHNode& node, const BVHNode& left, const BVHNode& right)
+		{
+			node.boundMin = glm::min(left.boundMin, right.boundMin);
+			node.boundMax = glm::max(left.boundMax, right.boundMax);
+		}
 
-		void createCustomBVH(int meshIndex, bool showDebugMessages = false, bool showOnlyBuildTimes = false)
+		static float unionArea(const BVHNode& a, const BVHNode& b)
 		{
-			// Calculate algorithm time
-			auto start = std::chrono::high_resolution_clock::now();
+			AABB box;
+			box.min = glm::min(a.boundMin, b.boundMin);
+			box.max = glm::max(a.boundMax, b.boundMax);
+			return box.surfaceArea();
+		}
 
-			int bvhNodesSize = (int)bvhNodes.size();
-			int trianglesSize = (int)bvhTriangles.size();
+		// Swap one child of nodeIdx with a grandchild on the other side when that shrinks the rearranged child.
+		// Both subtrees are final here, and the bounds of nodeIdx itself do not change
+		static void rotateLBVHNode(std::vector<BVHNode>& nodes, int nodeIdx)
+		{
+			BVHNode& node = nodes[nodeIdx];
+			float bestGain = 0.0f;
+			int bestChild = -1;      // Child that gets rebuilt
+			int bestGrandchild = -1; // Which of its children is swapped out, 0 or 1
 
-			// Create triangles from the vertices and indices
-			createTriangles();
-			auto endTriangles = std::chrono::high_resolution_clock::now();
+			for (int side = 0; side < 2; ++side)
+			{
+				int childIdx = side == 0 ? node.left : node.right;
+				int otherIdx = side == 0 ? node.right : node.left;
+				const BVHNode& child = nodes[childIdx];
+				if (child.isLeaf()) continue;
+
+				float childArea = AABB::areaOf(child.boundMin, child.boundMax);
+				float keepRightArea = unionArea(nodes[otherIdx], nodes[child.right]); // other <-> child.left
+				float keepLeftArea = unionArea(nodes[child.left], nodes[otherIdx]);  // other <-> child.right
+				if (childArea - keepRightArea > bestGain) { bestGain = childArea - keepRightArea; bestChild = side; bestGrandchild = 0; }
+				if (childArea - keepLeftArea > bestGain) { bestGain = childArea - keepLeftArea; bestChild = side; bestGrandchild = 1; }
+			}
 
-			// Create BVH nodes
-			//localRoot = buildNaive(0, triangles.size());
-			localRoot = buildBVH();
-			//localRoot = buildBVH2();
+			if (bestChild < 0) return;
 
-			// End algorithm time
-			auto endBvh = std::chrono::high_resolution_clock::now();
-			auto durationTriangles = std::chrono::duration_cast<std::chrono::milliseconds>(endTriangles - start).count();
-			auto durationBvh = std::chrono::duration_cast<std::chrono::milliseconds>(endBvh - endTriangles).count();
+			int& childIdx = bestChild == 0 ? node.left : node.right;
+			int& otherIdx = bestChild == 0 ? node.right : node.left;
+			BVHNode& child = nodes[childIdx];
+			int& grandchildIdx = bestGrandchild == 0 ? child.left : child.right;
+			std::swap(grandchildIdx, otherIdx);
+			setNodeBounds(child, nodes[child.left], nodes[child.right]);
+		}
 
-			bool ok1 = validateBVH(localRoot);
-			bool ok2 = validateBVHTriangles();
-			bool ok3 = localRoot >= 0 && localRoot < nodes.size();
-			showDebugMessages && printf("BVH validation: %s\n", ok1 && ok2 && ok3 ? "OK" : "FAILED");
+		int buildLBVH()
+		{
+			int triangleCount = static_cast<int>(triangles.size());
+			nodes.clear();
+			if (triangleCount == 0) return -1;
 
-			// Add base offset to the local bvh children nodes
-			for (auto& node : nodes)
+			const int grainSize = 8192;
+
+			// Step 1: Centroid bounds
+			AABB centroidBounds;
+			for (const Triangle& tri : triangles)
 			{
-				if (node.left != -1) node.left += bvhNodesSize;
-				if (node.right != -1) node.right += bvhNodesSize;
+				centroidBounds.expand(glm::vec3(tri.centroid));
 			}
+			glm::vec3 extent = glm::max(centroidBounds.max - centroidBounds.min, glm::vec3(1e-20f));
+
+			// Step 2: Morton codes of the normalized centroids
+			std::vector<uint64_t> codes(triangleCount);
+			std::vector<uint32_t> order(triangleCount);
+			const int codeBits = lbvhUse63BitMorton ? 63 : 30;
+			const float gridSize = lbvhUse63BitMorton ? 2097151.0f : 1023.0f;
+			const bool use63Bits = lbvhUse63BitMorton;
+			parallelFor(0, triangleCount, grainSize, [&](int begin, int end)
+				{
+					for (int i = begin; i < end; ++i)
+					{
+						glm::vec3 cell = (glm::vec3(triangles[i].centroid) - centroidBounds.min) / extent * gridSize;
+						cell = glm::clamp(cell, glm::vec3(0.0f), glm::vec3(gridSize));
+						if (use63Bits)
+						{
+							codes[i] = expandBits21(static_cast<uint64_t>(cell.x)) << 2 | expandBits21(static_cast<uint64_t>(cell.y)) << 1 | expandBits21(static_cast<uint64_t>(cell.z));
+						}
+						else
+						{
+							codes[i] = expandBits10(static_cast<uint32_t>(cell.x)) << 2 | expandBits10(static_cast<uint32_t>(cell.y)) << 1 | expandBits10(static_cast<uint32_t>(cell.z));
+						}
+						order[i] = i;
+					}
+				});
 
-			// Prepare for GPU buffers
-			bvhRootNodeIndex = bvhNodes.size() + localRoot;
-			bvhTriangleIndex = bvhTriangles.size();
+			// Step 3: Sort triangles along the curve
+			radixSortMortonCodes(codes, order, codeBits);
 
-			// Add to GPU buffers
-			bvhNodes.insert(bvhNodes.end(), nodes.begin(), nodes.end());
-			bvhTriangles.insert(bvhTriangles.end(), triangles.begin(), triangles.end());
+			std::vector<Triangle> orderedTriangles(triangleCount);
+			parallelFor(0, triangleCount, grainSize, [&](int begin, int end)
+				{
+					for (int i = begin; i < end; ++i)
+					{
+						orderedTriangles[i] = triangles[order[i]];
+					}
+				});
+			triangles = std::move(orderedTriangles);
 
-			if (showOnlyBuildTimes)
-			{
-				printf("    BVH nodes build time: %lld ms\n", durationBvh);
-				printf("    Triangles build time: %lld ms\n", durationTriangles);
-			}
-			else if (showDebugMessages)
-			{
-				printf("BVH nodes\n    Count: %zd\n    Build time: %lld ms\n    Global root index: %d\n", nodes.size(), durationBvh, bvhRootNodeIndex);
-				printf("Triangles\n    Count: %zd\n    Build time: %lld ms\n    Global start index: %d\n    Global end index: %lld\n", triangles.size(), durationTriangles, trianglesSize, trianglesSize + triangles.size());
+			// Step 4: Internal nodes are [0, n - 1), leaf i is node n - 1 + i and holds triangle i
+			const int leafOffset = triangleCount - 1;
+			nodes.resize(2 * triangleCount - 1);
+			std::vector<int> parents(nodes.size(), -1);
 
-				printf("Buffer sizes\n");
-				printf("    BVH: %d -> %lld\n", bvhNodesSize, bvhNodes.size());
-				printf("    Triangles: %d -> %lld\n", trianglesSize, bvhTriangles.size());
+			parallelFor(0, triangleCount - 1, grainSize, [&](int begin, int end)
+				{
+					for (int i = begin; i < end; ++i)
+					{
+						// Direction and far end of the key range covered by node i
+						int direction = commonPrefix(codes, i, i + 1) > commonPrefix(codes, i, i - 1) ? 1 : -1;
+						int minPrefix = commonPrefix(codes, i, i - direction);
+						int maxLength = 2;
+						while (commonPrefix(codes, i, i + maxLength * direction) > minPrefix) maxLength *= 2;
+
+						int length = 0;
+						for (int step = maxLength / 2; step >= 1; step /= 2)
+						{
+							if (commonPrefix(codes, i, i + (length + step) * direction) > minPrefix) length += step;
+						}
+						int j = i + length * direction;
+
+						// Split where the highest differing bit flips
+						int nodePrefix = commonPrefix(codes, i, j);
+						int split = 0;
+						int step = length;
+						do
+						{
+							step = (step + 1) / 2;
+							if (commonPrefix(codes, i, i + (split + step) * direction) > nodePrefix) split += step;
+						} while (step > 1);
+						int gamma = i + split * direction + std::min(direction, 0);
+
+						int left = std::min(i, j) == gamma ? leafOffset + gamma : gamma;
+						int right = std::max(i, j) == gamma + 1 ? leafOffset + gamma + 1 : gamma + 1;
+						nodes[i].left = left;
+						nodes[i].right = right;
+						parents[left] = i;
+						parents[right] = i;
+					}
+				});
+
+			// Step 5: Fit bounds bottom up, the second visitor of a node finishes it
+			std::unique_ptr<std::atomic<int>[]> visits(new std::atomic<int>[std::max(1, triangleCount - 1)]());
+			const bool rotate = lbvhTreeRotations;
+			parallelFor(0, triangleCount, grainSize, [&](int begin, int end)
+				{
+					for (int i = begin; i < end; ++i)
+					{
+						BVHNode& leaf = nodes[leafOffset + i];
+						const Triangle& tri = triangles[i];
+						leaf.boundMin = glm::min(glm::vec3(tri.v0), glm::min(glm::vec3(tri.v1), glm::vec3(tri.v2)));
+						leaf.boundMax = glm::max(glm::vec3(tri.v0), glm::max(glm::vec3(tri.v1), glm::vec3(tri.v2)));
+						leaf.firstTriangle = i;
+						leaf.triangleCount = 1;
+
+						int parent = parents[leafOffset + i];
+						while (parent >= 0 && visits[parent].fetch_add(1, std::memory_order_acq_rel) == 1)
+						{
+							BVHNode& node = nodes[parent];
+							setNodeBounds(node, nodes[node.left], nodes[node.right]);
+							if (rotate) rotateLBVHNode(nodes, parent);
+							parent = parents[parent];
+						}
+					}
+				});
+
+			return 0;
+		}
+		#pragma endregion LBVH
+
+		#pragma region SBVH
+		// A triangle, or the part of it left inside earlier spatial split planes
+		struct SBVHReference
+		{
+			AABB bounds;
+			int triangle = -1;
+		};
+
+		struct SBVHSplit
+		{
+			float cost = FLT_MAX;
+			int axis = -1;
+			int plane = -1;        // Object splits: last bin on the left side
+			float position = 0.0f; // Spatial splits: split plane
+			AABB leftBounds, rightBounds;
+		};
+
+		static bool isValidBounds(const AABB& box)
+		{
+			return box.min.x <= box.max.x && box.min.y <= box.max.y && box.min.z <= box.max.z;
+		}
+
+		static float overlapArea(const AABB& a, const AABB& b)
+		{
+			AABB overlap;
+			overlap.min = glm::max(a.min, b.min);
+			overlap.max = glm::min(a.max, b.max);
+			return isValidBounds(overlap) ? overlap.surfaceArea() : 0.0f;
+		}
+
+		static AABB mergedBounds(AABB a, const AABB& b)
+		{
+			a.expand(b);
+			return a;
+		}
+
+		int buildSBVH()
+		{
+			int triangleCount = static_cast<int>(triangles.size());
+			nodes.clear();
+			if (triangleCount == 0) return -1;
+
+			// Step 1: One reference per triangle, bounded by the whole triangle
+			std::vector<SBVHReference> references(triangleCount);
+			AABB rootBounds;
+			for (int i = 0; i < triangleCount; ++i)
+			{
+				Triangle& tri = triangles[i];
+				tri.centroid = glm::vec4((glm::vec3(tri.v0) + glm::vec3(tri.v1) + glm::vec3(tri.v2)) / 3.0f, tri.centroid.w);
+				references[i].triangle = i;
+				references[i].bounds.expand(glm::vec3(tri.v0));
+				references[i].bounds.expand(glm::vec3(tri.v1));
+				references[i].bounds.expand(glm::vec3(tri.v2));
+				rootBounds.expand(references[i].bounds);
+			}
+
+			// Step 2: Depth first build, spatial splits duplicate references until the budget runs out
+			sbvhReferenceCount = triangleCount;
+			sbvhReferenceLimit = triangleCount + static_cast<int>(triangleCount * std::max(sbvhDuplicationBudget, 0.0f));
+			std::vector<Triangle> referencedTriangles;
+			referencedTriangles.reserve(sbvhReferenceLimit);
+			buildSBVHNode(references, 0, rootBounds.surfaceArea(), referencedTriangles);
+
+			// Step 3: Leaves index one triangle copy per reference
+			triangles = std::move(referencedTriangles);
+
+			return 0;
+		}
+
+		int buildSBVHNode(std::vector<SBVHReference>& references, int depth, float rootArea, std::vector<Triangle>& referencedTriangles)
+		{
+			AABB bounds, centroidBounds;
+			for (const SBVHReference& reference : references)
+			{
+				bounds.expand(reference.bounds);
+				centroidBounds.expand(0.5f * (reference.bounds.min + reference.bounds.max));
+			}
+
+			int nodeIndex = static_cast<int>(nodes.size());
+			nodes.push_back(BVHNode());
+			nodes[nodeIndex].boundMin = bounds.min;
+			nodes[nodeIndex].boundMax = bounds.max;
+
+			int count = static_cast<int>(references.size());
+			auto makeLeaf = [&]()
+				{
+					nodes[nodeIndex].firstTriangle = static_cast<int>(referencedTriangles.size());
+					nodes[nodeIndex].triangleCount = count;
+					for (const SBVHReference& reference : references)
+					{
+						referencedTriangles.push_back(triangles[reference.triangle]);
+					}
+					return nodeIndex;
+				};
+
+			if (count <= 1) return makeLeaf();
+
+			// Near the depth cap the rest of the subtree is median splits down to leaves the wide BVH can address,
+			// so splitLargeLeaves has nothing left to split and no leaf ends below sbvhMaxDepth
+			int medianLevels = sbvhMedianLevels(count);
+			if (depth + medianLevels >= sbvhMaxDepth)
+			{
+				if (medianLevels == 0) return makeLeaf();
+
+				std::vector<SBVHReference> left, right;
+				partitionSBVHObject(references, SBVHSplit(), centroidBounds, left, right);
+				std::vector<SBVHReference>().swap(references);
+				int leftIdx = buildSBVHNode(left, depth + 1, rootArea, referencedTriangles);
+				int rightIdx = buildSBVHNode(right, depth + 1, rootArea, referencedTriangles);
+				nodes[nodeIndex].left = leftIdx;
+				nodes[nodeIndex].right = rightIdx;
+				return nodeIndex;
+			}
+
+			// Spatial splits only pay off where the object split children overlap, and only while the budget lasts
+			float parentArea = bounds.surfaceArea();
+			SBVHSplit objectSplit = findSBVHObjectSplit(references, centroidBounds, parentArea);
+			SBVHSplit spatialSplit;
+			if (sbvhReferenceCount < sbvhReferenceLimit && rootArea > 0.0f)
+			{
+				float overlap = objectSplit.axis >= 0 ? overlapArea(objectSplit.leftBounds, objectSplit.rightBounds) : parentArea;
+				if (overlap / rootArea > sbvhOverlapThreshold)
+				{
+					spatialSplit = findSBVHSpatialSplit(references, bounds, parentArea);
+				}
+			}
+
+			float leafCost = sahIntersectionCost * count;
+			if (std::min(objectSplit.cost, spatialSplit.cost) >= leafCost && count <= sahMaxLeafSize) return makeLeaf();
+
+			std::vector<SBVHReference> left, right;
+			if (spatialSplit.cost < objectSplit.cost)
+			{
+				partitionSBVHSpatial(references, spatialSplit, left, right);
+			}
+			if (left.empty() || right.empty())
+			{
+				left.clear(), right.clear();
+				partitionSBVHObject(references, objectSplit, centroidBounds, left, right);
+			}
+
+			// Children own their references from here on
+			std::vector<SBVHReference>().swap(references);
+
+			int leftIdx = buildSBVHNode(left, depth + 1, rootArea, referencedTriangles);
+			int rightIdx = buildSBVHNode(right, depth + 1, rootArea, referencedTriangles);
+			nodes[nodeIndex].left = leftIdx;
+			nodes[nodeIndex].right = rightIdx;
+
+			return nodeIndex;
+		}
+
+		// Levels of median splits until every leaf fits WideBVH::maxLeafTriangles. A median child keeps at most half
+		// the references rounded up, so it needs one level less and depth + levels never grows down the tree.
+		static int sbvhMedianLevels(int count)
+		{
+			int levels = 0;
+			while (count > WideBVH::maxLeafTriangles)
+			{
+				count = (count + 1) / 2;
+				levels++;
+			}
+			return levels;
+		}
+
+		// Binned SAH over the reference centroids, same as buildBVHBinnedSAH
+		SBVHSplit findSBVHObjectSplit(const std::vector<SBVHReference>& references, const AABB& centroidBounds, float parentArea) const
+		{
+			SBVHSplit best;
+			int binCount = std::clamp(sahBinCount, minSAHBinCount, maxSAHBinCount);
+			if (parentArea <= 0.0f) return best;
+
+			for (int axis = 0; axis < 3; ++axis)
+			{
+				float axisMin = centroidBounds.min[axis];
+				float axisExtent = centroidBounds.max[axis] - axisMin;
+				if (axisExtent <= 0.0f) continue;
+
+				SAHBin bins[maxSAHBinCount];
+				float scale = binCount / axisExtent;
+				for (const SBVHReference& reference : references)
+				{
+					float centroid = 0.5f * (reference.bounds.min[axis] + reference.bounds.max[axis]);
+					int bin = std::min(binCount - 1, static_cast<int>((centroid - axisMin) * scale));
+					bins[bin].triangleCount++;
+					bins[bin].bounds.expand(reference.bounds);
+				}
+
+				AABB leftBoxes[maxSAHBinCount - 1], rightBoxes[maxSAHBinCount - 1];
+				int leftCount[maxSAHBinCount - 1], rightCount[maxSAHBinCount - 1];
+				AABB leftBox, rightBox;
+				int leftSum = 0, rightSum = 0;
+				for (int i = 0; i < binCount - 1; ++i)
+				{
+					leftSum += bins[i].triangleCount;
+					leftCount[i] = leftSum;
+					leftBox.expand(bins[i].bounds);
+					leftBoxes[i] = leftBox;
+
+					rightSum += bins[binCount - 1 - i].triangleCount;
+					rightCount[binCount - 2 - i] = rightSum;
+					rightBox.expand(bins[binCount - 1 - i].bounds);
+					rightBoxes[binCount - 2 - i] = rightBox;
+				}
+
+				for (int i = 0; i < binCount - 1; ++i)
+				{
+					if (leftCount[i] == 0 || rightCount[i] == 0) continue;
+
+					float cost = sahTraversalCost + sahIntersectionCost * (leftBoxes[i].surfaceArea() * leftCount[i] + rightBoxes[i].surfaceArea() * rightCount[i]) / parentArea;
+					if (cost < best.cost)
+					{
+						best.cost = cost;
+						best.axis = axis;
+						best.plane = i;
+						best.leftBounds = leftBoxes[i];
+						best.rightBounds = rightBoxes[i];
+					}
+				}
+			}
+
+			return best;
+		}
+
+		// Binned SAH over planes through the node bounds, references are clipped into every bin they cross
+		SBVHSplit findSBVHSpatialSplit(const std::vector<SBVHReference>& references, const AABB& bounds, float parentArea) const
+		{
+			SBVHSplit best;
+			int binCount = std::clamp(sahBinCount, minSAHBinCount, maxSAHBinCount);
+			if (parentArea <= 0.0f) return best;
+
+			for (int axis = 0; axis < 3; ++axis)
+			{
+				float axisMin = bounds.min[axis];
+				float binSize = (bounds.max[axis] - axisMin) / binCount;
+				if (binSize <= 0.0f) continue;
+
+				AABB binBounds[maxSAHBinCount];
+				int entries[maxSAHBinCount] = {};
+				int exits[maxSAHBinCount] = {};
+				auto binOf = [&](float value)
+					{
+						return std::clamp(static_cast<int>((value - axisMin) / binSize), 0, binCount - 1);
+					};
+
+				for (const SBVHReference& reference : references)
+				{
+					int firstBin = binOf(reference.bounds.min[axis]);
+					int lastBin = binOf(reference.bounds.max[axis]);
+					entries[firstBin]++;
+					exits[lastBin]++;
+
+					SBVHReference rest = reference;
+					for (int bin = firstBin; bin < lastBin; ++bin)
+					{
+						SBVHReference leftPart, rightPart;
+						splitSBVHReference(rest, axis, axisMin + binSize * (bin + 1), leftPart, rightPart);
+						binBounds[bin].expand(leftPart.bounds);
+						rest = rightPart;
+					}
+					binBounds[lastBin].expand(rest.bounds);
+				}
+
+				// Entries count the references reaching into the left side, exits the ones reaching into the right
+				AABB leftBoxes[maxSAHBinCount - 1], rightBoxes[maxSAHBinCount - 1];
+				int leftCount[maxSAHBinCount - 1], rightCount[maxSAHBinCount - 1];
+				AABB leftBox, rightBox;
+				int leftSum = 0, rightSum = 0;
+				for (int i = 0; i < binCount - 1; ++i)
+				{
+					leftSum += entries[i];
+					leftCount[i] = leftSum;
+					leftBox.expand(binBounds[i]);
+					leftBoxes[i] = leftBox;
+
+					rightSum += exits[binCount - 1 - i];
+					rightCount[binCount - 2 - i] = rightSum;
+					rightBox.expand(binBounds[binCount - 1 - i]);
+					rightBoxes[binCount - 2 - i] = rightBox;
+				}
+
+				for (int i = 0; i < binCount - 1; ++i)
+				{
+					if (leftCount[i] == 0 || rightCount[i] == 0) continue;
+
+					float cost = sahTraversalCost + sahIntersectionCost * (leftBoxes[i].surfaceArea() * leftCount[i] + rightBoxes[i].surfaceArea() * rightCount[i]) / parentArea;
+					if (cost < best.cost)
+					{
+						best.cost = cost;
+						best.axis = axis;
+						best.position = axisMin + binSize * (i + 1);
+						best.leftBounds = leftBoxes[i];
+						best.rightBounds = rightBoxes[i];
+					}
+				}
+			}
+
+			return best;
+		}
+
+		// Clips the triangle behind a reference to both sides of a plane, both parts stay inside the old reference bounds
+		void splitSBVHReference(const SBVHReference& reference, int axis, float position, SBVHReference& left, SBVHReference& right) const
+		{
+			left = SBVHReference();
+			right = SBVHReference();
+			left.triangle = right.triangle = reference.triangle;
+
+			const Triangle& tri = triangles[reference.triangle];
+			glm::vec3 corners[3] = { glm::vec3(tri.v0), glm::vec3(tri.v1), glm::vec3(tri.v2) };
+			for (int i = 0; i < 3; ++i)
+			{
+				const glm::vec3& v0 = corners[i];
+				const glm::vec3& v1 = corners[(i + 1) % 3];
+				if (v0[axis] <= position) left.bounds.expand(v0);
+				if (v0[axis] >= position) right.bounds.expand(v0);
+
+				// Edges crossing the plane add their intersection to both sides
+				if ((v0[axis] < position && v1[axis] > position) || (v0[axis] > position && v1[axis] < position))
+				{
+					glm::vec3 point = glm::mix(v0, v1, glm::clamp((position - v0[axis]) / (v1[axis] - v0[axis]), 0.0f, 1.0f));
+					point[axis] = position;
+					left.bounds.expand(point);
+					right.bounds.expand(point);
+				}
+			}
+
+			left.bounds.min = glm::max(left.bounds.min, reference.bounds.min);
+			left.bounds.max = glm::min(left.bounds.max, reference.bounds.max);
+			right.bounds.min = glm::max(right.bounds.min, reference.bounds.min);
+			right.bounds.max = glm::min(right.bounds.max, reference.bounds.max);
+		}
+
+		void partitionSBVHSpatial(const std::vector<SBVHReference>& references, const SBVHSplit& split, std::vector<SBVHReference>& left, std::vector<SBVHReference>& right)
+		{
+			int axis = split.axis;
+			float position = split.position;
+
+			// Step 1: References entirely on one side of the plane
+			AABB leftBounds, rightBounds;
+			std::vector<const SBVHReference*> straddling;
+			for (const SBVHReference& reference : references)
+			{
+				if (reference.bounds.max[axis] <= position)
+				{
+					left.push_back(reference);
+					leftBounds.expand(reference.bounds);
+				}
+				else if (reference.bounds.min[axis] >= position)
+				{
+					right.push_back(reference);
+					rightBounds.expand(reference.bounds);
+				}
+				else
+				{
+					straddling.push_back(&reference);
+				}
+			}
+
+			// Step 2: Split the rest, unless moving a reference whole to one side is cheaper (reference unsplitting)
+			for (const SBVHReference* reference : straddling)
+			{
+				SBVHReference leftPart, rightPart;
+				splitSBVHReference(*reference, axis, position, leftPart, rightPart);
+
+				float leftCount = static_cast<float>(left.size());
+				float rightCount = static_cast<float>(right.size());
+				float splitCost = FLT_MAX;
+				if (sbvhReferenceCount < sbvhReferenceLimit && isValidBounds(leftPart.bounds) && isValidBounds(rightPart.bounds))
+				{
+					splitCost = mergedBounds(leftBounds, leftPart.bounds).surfaceArea() * (leftCount + 1) + mergedBounds(rightBounds, rightPart.bounds).surfaceArea() * (rightCount + 1);
+				}
+				float leftCost = mergedBounds(leftBounds, reference->bounds).surfaceArea() * (leftCount + 1) + rightBounds.surfaceArea() * rightCount;
+				float rightCost = leftBounds.surfaceArea() * leftCount + mergedBounds(rightBounds, reference->bounds).surfaceArea() * (rightCount + 1);
+
+				if (splitCost < leftCost && splitCost < rightCost)
+				{
+					left.push_back(leftPart);
+					right.push_back(rightPart);
+					leftBounds.expand(leftPart.bounds);
+					rightBounds.expand(rightPart.bounds);
+					sbvhReferenceCount++;
+				}
+				else if (leftCost <= rightCost)
+				{
+					left.push_back(*reference);
+					leftBounds.expand(reference->bounds);
+				}
+				else
+				{
+					right.push_back(*reference);
+					rightBounds.expand(reference->bounds);
+				}
+			}
+		}
+
+		void partitionSBVHObject(const std::vector<SBVHReference>& references, const SBVHSplit& split, const AABB& centroidBounds, std::vector<SBVHReference>& left, std::vector<SBVHReference>& right)
+		{
+			auto centroidOf = [](const SBVHReference& reference, int axis)
+				{
+					return 0.5f * (reference.bounds.min[axis] + reference.bounds.max[axis]);
+				};
+
+			if (split.axis >= 0)
+			{
+				int binCount = std::clamp(sahBinCount, minSAHBinCount, maxSAHBinCount);
+				float axisMin = centroidBounds.min[split.axis];
+				float scale = binCount / (centroidBounds.max[split.axis] - axisMin);
+				for (const SBVHReference& reference : references)
+				{
+					int bin = std::min(binCount - 1, static_cast<int>((centroidOf(reference, split.axis) - axisMin) * scale));
+					(bin <= split.plane ? left : right).push_back(reference);
+				}
+				if (!left.empty() && !right.empty()) return;
+			}
+
+			// Identical centroids or a degenerate partition, fall back to an object median split
+			int axis = centroidBounds.longestAxis();
+			std::vector<SBVHReference> sorted = references;
+			size_t mid = sorted.size() / 2;
+			std::nth_element(sorted.begin(), sorted.begin() + mid, sorted.end(), [&](const SBVHReference& a, const SBVHReference& b)
+				{
+					return centroidOf(a, axis) < centroidOf(b, axis);
+				});
+			left.assign(sorted.begin(), sorted.begin() + mid);
+			right.assign(sorted.begin() + mid, sorted.end());
+		}
+		#pragma endregion SBVH
+
+		// Returns the root, which is node 0 of the depth first layout unless keepBuilderOrder is set
+		int buildWith(BVHBuilder builder, bool keepBuilderOrder = false)
+		{
+			nodes.clear();
+			int root = -1;
+			switch (builder)
+			{
+			case BVHBuilder::Naive: root = buildNaive(0, static_cast<int>(triangles.size())); break;
+			case BVHBuilder::Midpoint: root = buildBVH(); break;
+			case BVHBuilder::Recursive: root = buildBVH2(); break;
+			case BVHBuilder::BinnedSAH: root = buildBVHBinnedSAH(); break;
+			case BVHBuilder::LBVH: root = buildLBVH(); break;
+			case BVHBuilder::SBVH: root = buildSBVH(); break;
+			}
+			if (keepBuilderOrder) return root;
+			return CompactBVH::reorderDepthFirst(nodes, root, bvhLargerChildFirst);
+		}
+
+		//
+		bool validateBVH(int nodeIndex)
+		{
+			if (nodeIndex < 0 || nodeIndex >= nodes.size())
+			{
+				return false;
+			}
+
+			const BVHNode& node = nodes[nodeIndex];
+
+			// Check AABB validity
+			for (int i = 0; i < 3; ++i)
+			{
+				if (node.boundMin[i] > node.boundMax[i])
+				{
+					printf("Invalid AABB at node %d\n", nodeIndex);
+					return false;
+				}
+			}
+
+			// Leaf node check
+			bool isLeaf = (node.triangleCount > 0);
+			if (isLeaf)
+			{
+				if (node.left != -1 || node.right != -1)
+				{
+					printf("Leaf node %d has children\n", nodeIndex);
+					return false;
+				}
+			}
+			else
+			{
+				// Internal node should have valid children
+				if (node.left < 0 || node.right < 0)
+				{
+					printf("Internal node %d missing children\n", nodeIndex);
+					return false;
+				}
+				if (!validateBVH(node.left) || !validateBVH(node.right))
+				{
+					return false;
+				}
+			}
+
+			return true;
+		}
+
+		bool validateBVHTriangles()
+		{
+			for (const BVHNode& node : nodes)
+			{
+				for(int i = node.firstTriangle; i < node.firstTriangle + node.triangleCount; ++i)
+				{
+					if (i < 0 || i >= triangles.size())
+					{
+						printf("Invalid triangle index %d in node %lld.\n", i, &node - &nodes[0]);
+						return false;
+					}
+
+					const Triangle& tri = triangles[i];
+
+					// SBVH leaves only bound the part of a triangle left after spatial splits
+					bool clipped = bvhBuilder == BVHBuilder::SBVH;
+					if (clipped ? !triangleOverlapsAABB(tri, node) : !triangleInAABB(tri, node))
+					{
+						printf("Invalid triangle bounds for node %d: index %lld.\n", i, &node - &nodes[0]);
+						return false;
+					}
+				}
+			}
+
+			return true;
+		}
+
+		bool triangleInAABB(const Triangle& tri, const BVHNode& node) 
+		{
+			glm::vec3 min = node.boundMin;
+			glm::vec3 max = node.boundMax;
+
+			auto inside = [&](const glm::vec3& v)
+			{
+				return all(glm::greaterThanEqual(v, min)) && all(glm::lessThanEqual(v, max));
+			};
+
+			return inside(glm::vec3(tri.v0)) && inside(glm::vec3(tri.v1)) && inside(glm::vec3(tri.v2));
+		}
+
+		bool triangleOverlapsAABB(const Triangle& tri, const BVHNode& node)
+		{
+			glm::vec3 triMin = glm::min(glm::vec3(tri.v0), glm::min(glm::vec3(tri.v1), glm::vec3(tri.v2)));
+			glm::vec3 triMax = glm::max(glm::vec3(tri.v0), glm::max(glm::vec3(tri.v1), glm::vec3(tri.v2)));
+			return all(glm::lessThanEqual(triMin, node.boundMax)) && all(glm::greaterThanEqual(triMax, node.boundMin));
+		}
+
+		// Packed vertex positions and three global position indices per triangle, in triangle order, for the
+		// indexed ray tracing mode. The source triangle in centroid.w names the model indices.
+		void placeIndexedGeometry(int triangleOffset, int positionOffset)
+		{
+			if (bvhPositions.size() < positionOffset + vertices.size()) bvhPositions.resize(positionOffset + vertices.size());
+			for (size_t i = 0; i < vertices.size(); ++i)
+			{
+				bvhPositions[positionOffset + i] = vertices[i].pos;
+			}
+
+			size_t indexOffset = static_cast<size_t>(triangleOffset) * 3;
+			if (bvhTriangleIndices.size() < indexOffset + triangles.size() * 3) bvhTriangleIndices.resize(indexOffset + triangles.size() * 3);
+			for (size_t i = 0; i < triangles.size(); ++i)
+			{
+				size_t source = static_cast<size_t>(triangles[i].centroid.w) * 3;
+				for (size_t corner = 0; corner < 3; ++corner)
+				{
+					bvhTriangleIndices[indexOffset + i * 3 + corner] = positionOffset + indices[source + corner];
+				}
+			}
+		}
+
+		// Intersection ready copies of the triangles for the precomputed ray tracing mode, in triangle order
+		void placeRayTriangles(int triangleOffset)
+		{
+			if (bvhRayTriangles.size() < triangleOffset + triangles.size()) bvhRayTriangles.resize(triangleOffset + triangles.size());
+			for (size_t i = 0; i < triangles.size(); ++i)
+			{
+				bvhRayTriangles[triangleOffset + i] = makeRayTriangle(triangles[i]);
+			}
+		}
+
+		// Offsets the local node links and writes nodes, triangles and wide nodes to the buffers uploaded to the GPU
+		void placeInGlobalBVHBuffers(int nodeOffset, int triangleOffset, int wideNodeOffset, int positionOffset)
+		{
+			// Add base offset to the local bvh children nodes
+			for (auto& node : nodes)
+			{
+				if (node.left != -1) node.left += nodeOffset;
+				if (node.right != -1) node.right += nodeOffset;
+				node.parent = -1;
+			}
+
+			// Parent links for the short stack traversal, also global
+			for (size_t i = 0; i < nodes.size(); ++i)
+			{
+				if (nodes[i].isLeaf() || nodes[i].left == -1) continue;
+				nodes[nodes[i].left - nodeOffset].parent = nodeOffset + static_cast<int>(i);
+				nodes[nodes[i].right - nodeOffset].parent = nodeOffset + static_cast<int>(i);
+			}
+
+			// Wide nodes address their internal children relative to the start of the wide buffer
+			for (auto& node : wideBVH.nodes)
+			{
+				node.childBaseIndex += wideNodeOffset;
+			}
+
+			// Prepare for GPU buffers
+			bvhNodeOffset = nodeOffset;
+			bvhRootNodeIndex = nodeOffset + localRoot;
+			bvhTriangleIndex = triangleOffset;
+			bvhWideRootNodeIndex = wideBVH.nodes.empty() ? -1 : wideNodeOffset;
+			bvhPositionOffset = positionOffset;
+
+			// Add to GPU buffers
+			auto place = [](auto& buffer, const auto& items, size_t offset)
+				{
+					if (buffer.size() < offset + items.size()) buffer.resize(offset + items.size());
+					std::copy(items.begin(), items.end(), buffer.begin() + offset);
+				};
+			place(bvhNodes, nodes, nodeOffset);
+			CompactBVH::compress(nodes, bvhCompactNodes, nodeOffset);
+			place(bvhTriangles, triangles, triangleOffset);
+			place(bvhWideNodes, wideBVH.nodes, wideNodeOffset);
+			placeIndexedGeometry(triangleOffset, positionOffset);
+			placeRayTriangles(triangleOffset);
+
+			builtSAHCost = computeSAHCost(localRoot, nodeOffset);
+			refitLevels.clear();
+		}
+
+		void appendToGlobalBVHBuffers()
+		{
+			nodeCapacity = nodes.size();
+			triangleCapacity = triangles.size();
+			wideNodeCapacity = wideBVH.nodes.size();
+			placeInGlobalBVHBuffers((int)bvhNodes.size(), (int)bvhTriangles.size(), (int)bvhWideNodes.size(), (int)bvhPositions.size());
+		}
+
+		// Collapses the binary BVH into the compressed wide layout, this also reorders the triangles
+		void buildWideBVH()
+		{
+			wideBVH.nodes.clear();
+			if (wideBVHWidth >= 2)
+			{
+				// Split the leaves the wide nodes cannot address here, so the binary nodes stay depth first
+				if (WideBVH::splitLargeLeaves(nodes, triangles))
+				{
+					localRoot = CompactBVH::reorderDepthFirst(nodes, localRoot, bvhLargerChildFirst);
+				}
+				wideBVH.build(nodes, localRoot, triangles, wideBVHWidth);
+			}
+		}
+
+		#pragma region Refit
+		void computeRefitLevels()
+		{
+			refitLevels.clear();
+			std::vector<int> level = { localRoot };
+			while (!level.empty())
+			{
+				std::vector<int> nextLevel;
+				for (int nodeIndex : level)
+				{
+					const BVHNode& node = nodes[nodeIndex];
+					if (node.isLeaf()) continue;
+					nextLevel.push_back(node.left - bvhNodeOffset);
+					nextLevel.push_back(node.right - bvhNodeOffset);
+				}
+				std::sort(level.begin(), level.end()); // Walk each level in memory order
+				refitLevels.push_back(std::move(level));
+				level = std::move(nextLevel);
+			}
+		}
+
+		// Moves the triangles to the new vertex positions and refits the bounds bottom up, one parallel pass
+		// per tree level. Returns the SAH cost of the refitted tree, which the topology no longer minimizes.
+		float refitLocalBVH(const std::vector<glm::vec3>& positions)
+		{
+			if (positions.size() != vertices.size())
+			{
+				throw std::runtime_error("refit needs one position per vertex!");
+			}
+			if (localRoot < 0 || nodes.empty()) return 0.0f;
+			if (refitLevels.empty()) computeRefitLevels();
+
+			const int grainSize = 4096;
+
+			// Step 1: new vertex positions, then the triangles built from them (centroid.w names the source triangle)
+			parallelFor(0, static_cast<int>(vertices.size()), grainSize, [&](int begin, int end)
+				{
+					for (int i = begin; i < end; ++i) vertices[i].pos = positions[i];
+				});
+			parallelFor(0, static_cast<int>(triangles.size()), grainSize, [&](int begin, int end)
+				{
+					for (int i = begin; i < end; ++i)
+					{
+						Triangle& tri = triangles[i];
+						size_t source = static_cast<size_t>(tri.centroid.w) * 3;
+						tri.v0 = glm::vec4(vertices[indices[source]].pos, 1.0f);
+						tri.v1 = glm::vec4(vertices[indices[source + 1]].pos, 1.0f);
+						tri.v2 = glm::vec4(vertices[indices[source + 2]].pos, 1.0f);
+						tri.centroid = glm::vec4((glm::vec3(tri.v0) + glm::vec3(tri.v1) + glm::vec3(tri.v2)) / 3.0f, tri.centroid.w);
+					}
+				});
+
+			// Step 2: deepest level first, so both children of a node are final when it is refitted
+			double cost = 0.0;
+			std::mutex costMutex;
+			for (int level = static_cast<int>(refitLevels.size()) - 1; level >= 0; --level)
+			{
+				const std::vector<int>& levelNodes = refitLevels[level];
+				parallelFor(0, static_cast<int>(levelNodes.size()), grainSize, [&](int begin, int end)
+					{
+						double chunkCost = 0.0;
+						for (int i = begin; i < end; ++i)
+						{
+							BVHNode& node = nodes[levelNodes[i]];
+							if (node.isLeaf())
+							{
+								node.boundMin = glm::vec3(FLT_MAX);
+								node.boundMax = glm::vec3(-FLT_MAX);
+								for (int t = node.firstTriangle; t < node.firstTriangle + node.triangleCount; ++t)
+								{
+									node.expand(glm::vec3(triangles[t].v0));
+									node.expand(glm::vec3(triangles[t].v1));
+									node.expand(glm::vec3(triangles[t].v2));
+								}
+								chunkCost += sahIntersectionCost * node.triangleCount * node.surfaceArea();
+							}
+							else
+							{
+								setNodeBounds(node, nodes[node.left - bvhNodeOffset], nodes[node.right - bvhNodeOffset]);
+								chunkCost += sahTraversalCost * node.surfaceArea();
+							}
+						}
+						std::lock_guard<std::mutex> lock(costMutex);
+						cost += chunkCost;
+					});
+			}
+
+			// Step 3: quantized wide boxes follow the binary ones
+			if (!wideBVH.nodes.empty())
+			{
+				wideBVH.refit(nodes);
+			}
+
+			float rootArea = nodes[localRoot].surfaceArea();
+			return rootArea > 0.0f ? static_cast<float>(cost / rootArea) : 0.0f;
+		}
+
+		// Full build from the current vertices, placed over the old global ranges when it fits
+		void rebuildBVH()
+		{
+			createTriangles();
+			localRoot = buildWith(bvhBuilder);
+			buildWideBVH();
+
+			if (nodes.size() <= nodeCapacity && triangles.size() <= triangleCapacity && wideBVH.nodes.size() <= wideNodeCapacity)
+			{
+				placeInGlobalBVHBuffers(bvhNodeOffset, bvhTriangleIndex, bvhWideRootNodeIndex < 0 ? (int)bvhWideNodes.size() : bvhWideRootNodeIndex, bvhPositionOffset);
+			}
+			else
+			{
+				appendToGlobalBVHBuffers(); // The old ranges stay behind unused
+			}
+		}
+		#pragma endregion Refit
+
+	public:
+		std::vector<Vertex> vertices;
+		std::vector<uint32_t> indices;
+
+		int localRoot = 0;
+		int bvhTriangleIndex = 0;
+		int bvhRootNodeIndex = 0;
+		int bvhWideRootNodeIndex = -1;
+		int bvhNodeOffset = 0; // Global index of local node 0
+		int bvhPositionOffset = 0; // Global index of vertex 0 in the packed position buffer
+		std::vector<Triangle> triangles; // To be appended to the GPU buffer
+		std::vector<BVHNode> nodes; // To be appended to the GPU buffer
+
+		BVHBuilder bvhBuilder = BVHBuilder::BinnedSAH;
+		int sahBinCount = 16; // Bins per axis for the binned SAH builder, clamped to [16, 32]
+		int bvhTaskGranularity = 4096; // Subtrees with fewer triangles are built serially on one worker
+		bool lbvhUse63BitMorton = false; // 21 instead of 10 bits per axis, for huge or very uneven meshes
+		bool lbvhTreeRotations = true; // Local SAH rotations while fitting LBVH bounds
+		float sbvhDuplicationBudget = 0.3f; // Extra triangle references the SBVH may create, as a fraction of the triangle count
+		float sbvhOverlapThreshold = 1e-5f; // Spatial splits are only tried where object split children overlap more than this fraction of the root area
+		bool bvhLargerChildFirst = true; // The depth first layout puts the child with the larger surface area next to its parent
+		int wideBVHWidth = WideBVH::maxWidth; // Children per compressed wide BVH node (2 to 8), 0 keeps only the binary BVH
+		WideBVH wideBVH;
+		float builtSAHCost = 0.0f; // SAH cost right after the last build
+		float refitSAHCost = 0.0f; // SAH cost after the last refit
+		float refitRebuildThreshold = 1.5f; // Refits rebuild once the SAH cost grew past builtSAHCost times this
+		std::function<void(float seconds, std::vector<glm::vec3>& positions)> deformation; // Moves the rest pose each frame, the renderer refits the BVH to it
+		std::vector<glm::vec3> restPositions; // Vertex positions before the first deformation
+
+		VkBuffer vertexBuffer;
+		VkDeviceMemory vertexBufferMemory;
+		VkBuffer indexBuffer;
+		VkDeviceMemory indexBufferMemory;
+
+		GameModel() 
+			: vertexBuffer(VK_NULL_HANDLE),            // Initialize to default values
+			vertexBufferMemory(VK_NULL_HANDLE),		   // VK_NULL_HANDLE is used to initialize Vulkan handles
+			indexBuffer(VK_NULL_HANDLE),
+			indexBufferMemory(VK_NULL_HANDLE)
+		{};
+
+		GameModel(std::vector<Vertex> vertices, std::vector<uint32_t> indices)
+			: vertices(vertices),
+			indices(indices),
+			vertexBuffer(VK_NULL_HANDLE),            // Initialize to default values
+			vertexBufferMemory(VK_NULL_HANDLE),		   // VK_NULL_HANDLE is used to initialize Vulkan handles
+			indexBuffer(VK_NULL_HANDLE),
+			indexBufferMemory(VK_NULL_HANDLE)
+		{};
+
+		GameModel
+		(
+			std::vector<Vertex> vertices, 
+			std::vector<uint32_t> indices, 
+			VkBuffer vertexBuffer, 
+			VkDeviceMemory vertexBufferMemory, 
+			VkBuffer indexBuffer, 
+			VkDeviceMemory indexBufferMemory
+		)
+			: vertices(vertices),
+			indices(indices),
+			vertexBuffer(vertexBuffer),
+			vertexBufferMemory(vertexBufferMemory),
+			indexBuffer(indexBuffer),
+			indexBufferMemory(indexBufferMemory)
+		{};
+
+		// Identifies the BVH this model would build: mesh geometry, builder and every parameter that changes its output
+		uint64_t computeBVHCacheKey() const
+		{
+			uint64_t hash = 14695981039346656037ull; // FNV-1a offset basis
+			auto mix = [&hash](uint32_t word)
+				{
+					hash ^= word;
+					hash *= 1099511628211ull;
+				};
+			auto mixFloat = [&mix](float value)
+				{
+					uint32_t word;
+					memcpy(&word, &value, sizeof(word));
+					mix(word);
+				};
+
+			mix(static_cast<uint32_t>(sizeof(BVHNode)));
+			mix(static_cast<uint32_t>(sizeof(Triangle)));
+			mix(static_cast<uint32_t>(bvhBuilder));
+			mix(static_cast<uint32_t>(maxLeafSize));
+			mix(static_cast<uint32_t>(std::clamp(sahBinCount, minSAHBinCount, maxSAHBinCount)));
+			mix(static_cast<uint32_t>(sahMaxLeafSize));
+			mixFloat(sahTraversalCost);
+			mixFloat(sahIntersectionCost);
+			mix(lbvhUse63BitMorton ? 1u : 0u);
+			mix(lbvhTreeRotations ? 1u : 0u);
+			mixFloat(sbvhDuplicationBudget);
+			mixFloat(sbvhOverlapThreshold);
+			mix(bvhLargerChildFirst ? 1u : 0u);
+			mix(static_cast<uint32_t>(wideBVHWidth)); // The collapse splits large leaves and reorders triangles
+
+			mix(static_cast<uint32_t>(indices.size()));
+			for (uint32_t index : indices)
+			{
+				const glm::vec3& pos = vertices[index].pos;
+				mixFloat(pos.x);
+				mixFloat(pos.y);
+				mixFloat(pos.z);
+			}
+
+			return hash;
+		}
+
+		// Warm start: adopt a BVH built by an earlier run instead of creating triangles, building and validating.
+		// The arrays are copied twice, into nodes and triangles, which the wide collapse, refits and rebuilds work
+		// on, and from there into the global buffers like a fresh build. The mapping saves the parse, not the copies.
+		void createCustomBVHFromCache(const BVHNode* cachedNodes, size_t nodeCount, const Triangle* cachedTriangles, size_t triangleCount, int root, bool showDebugMessages = false)
+		{
+			auto start = std::chrono::high_resolution_clock::now();
+
+			nodes.assign(cachedNodes, cachedNodes + nodeCount);
+			triangles.assign(cachedTriangles, cachedTriangles + triangleCount);
+			localRoot = root;
+			buildWideBVH(); // Cached triangles are already in wide order, so this leaves them in place
+			appendToGlobalBVHBuffers();
+
+			auto end = std::chrono::high_resolution_clock::now();
+			auto duration = std::chrono::duration_cast<std::chrono::milliseconds>(end - start).count();
+			showDebugMessages && printf("BVH cache\n    Builder: %s\n    Nodes: %zd\n    Triangles: %zd\n    Load time: %lld ms\n", bvhBuilderName(bvhBuilder), nodes.size(), triangles.size(), duration);
+		}
+
+		void createCustomBVH(int meshIndex, bool showDebugMessages = false, bool showOnlyBuildTimes = false)
+		{
+			// Calculate algorithm time
+			auto start = std::chrono::high_resolution_clock::now();
+
+			int bvhNodesSize = (int)bvhNodes.size();
+			int trianglesSize = (int)bvhTriangles.size();
+
+			// Create triangles from the vertices and indices
+			createTriangles();
+			auto endTriangles = std::chrono::high_resolution_clock::now();
+
+			// Create BVH nodes
+			localRoot = buildWith(bvhBuilder);
+
+			// End algorithm time
+			auto endBvh = std::chrono::high_resolution_clock::now();
+			auto durationTriangles = std::chrono::duration_cast<std::chrono::milliseconds>(endTriangles - start).count();
+			auto durationBvh = std::chrono::duration_cast<std::chrono::milliseconds>(endBvh - endTriangles).count();
+
+			bool ok1 = validateBVH(localRoot);
+			bool ok2 = validateBVHTriangles();
+			bool ok3 = localRoot >= 0 && localRoot < nodes.size();
+			bool ok4 = CompactBVH::validateDepthFirst(nodes, localRoot);
+			showDebugMessages && printf("BVH validation: %s\n", ok1 && ok2 && ok3 && ok4 ? "OK" : "FAILED");
+
+			auto startWide = std::chrono::high_resolution_clock::now();
+			buildWideBVH();
+			auto durationWide = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::high_resolution_clock::now() - startWide).count();
+
+			appendToGlobalBVHBuffers();
+
+			if (showOnlyBuildTimes)
+			{
+				printf("    BVH nodes build time: %lld ms\n", durationBvh);
+				printf("    Triangles build time: %lld ms\n", durationTriangles);
+			}
+			else if (showDebugMessages)
+			{
+				printf("BVH nodes\n    Builder: %s\n    Count: %zd\n    Build time: %lld ms\n    SAH cost: %.2f\n    Global root index: %d\n", bvhBuilderName(bvhBuilder), nodes.size(), durationBvh, computeSAHCost(localRoot, bvhNodesSize), bvhRootNodeIndex);
+				printf("Triangles\n    Count: %zd\n    Build time: %lld ms\n    Global start index: %d\n    Global end index: %lld\n", triangles.size(), durationTriangles, trianglesSize, trianglesSize + triangles.size());
+				printf("Wide BVH\n    Width: %d\n    Nodes: %zd (binary %zd)\n    Bytes per triangle: %.1f (binary %.1f)\n    Collapse time: %lld ms\n", wideBVH.width, wideBVH.nodes.size(), nodes.size(), double(wideBVH.nodes.size() * sizeof(WideBVHNode)) / triangles.size(), double(nodes.size() * sizeof(BVHNode)) / triangles.size(), durationWide);
+
+				printf("Buffer sizes\n");
+				printf("    BVH: %d -> %lld\n", bvhNodesSize, bvhNodes.size());
+				printf("    Triangles: %d -> %lld\n", trianglesSize, bvhTriangles.size());
+			}
+		}
+
+		// Updates the BVH in place for new vertex positions (one per vertex, same topology) and queues only this
+		// model's node and triangle ranges for upload. Rebuilds instead once the SAH cost degraded past
+		// refitRebuildThreshold, returns true when it did.
+		bool refitBVH(const std::vector<glm::vec3>& positions)
+		{
+			refitSAHCost = refitLocalBVH(positions);
+			bool rebuild = builtSAHCost > 0.0f && refitSAHCost > builtSAHCost * refitRebuildThreshold;
+
+			if (rebuild)
+			{
+				rebuildBVH();
+				refitSAHCost = builtSAHCost;
+			}
+			else
+			{
+				std::copy(nodes.begin(), nodes.end(), bvhNodes.begin() + bvhNodeOffset);
+				CompactBVH::compress(nodes, bvhCompactNodes, bvhNodeOffset);
+				std::copy(triangles.begin(), triangles.end(), bvhTriangles.begin() + bvhTriangleIndex);
+				placeIndexedGeometry(bvhTriangleIndex, bvhPositionOffset);
+				placeRayTriangles(bvhTriangleIndex);
+				if (bvhWideRootNodeIndex >= 0)
+				{
+					std::copy(wideBVH.nodes.begin(), wideBVH.nodes.end(), bvhWideNodes.begin() + bvhWideRootNodeIndex);
+				}
+			}
+
+			BVHDirtyRange range{};
+			range.nodeOffset = bvhNodeOffset;
+			range.nodeCount = nodes.size();
+			range.triangleOffset = bvhTriangleIndex;
+			range.triangleCount = triangles.size();
+			range.wideNodeOffset = bvhWideRootNodeIndex < 0 ? 0 : bvhWideRootNodeIndex;
+			range.wideNodeCount = bvhWideRootNodeIndex < 0 ? 0 : wideBVH.nodes.size();
+			range.positionOffset = bvhPositionOffset;
+			range.positionCount = vertices.size();
+			bvhDirtyRanges.push_back(range);
+
+			return rebuild;
+		}
+
+		// Runs the deformation on the rest pose and refits the BVH to it, the renderer calls this once per frame
+		bool deform(float seconds)
+		{
+			if (!deformation || localRoot < 0) return false;
+
+			if (restPositions.empty())
+			{
+				restPositions.resize(vertices.size());
+				for (size_t i = 0; i < vertices.size(); ++i) restPositions[i] = vertices[i].pos;
+			}
+
+			std::vector<glm::vec3> positions = restPositions;
+			deformation(seconds, positions);
+			return refitBVH(positions);
+		}
+
+		// Offsets every position along a sine wave over the mesh, by amplitude times the mesh size
+		static void applyWave(std::vector<glm::vec3>& positions, const glm::vec3& size, float amplitude)
+		{
+			float wavelength = std::max(std::max(size.x, size.y), size.z) * 0.25f;
+			for (glm::vec3& pos : positions)
+			{
+				glm::vec3 wave(std::sin(pos.y / wavelength * 6.2831853f), std::sin(pos.z / wavelength * 6.2831853f), std::sin(pos.x / wavelength * 6.2831853f));
+				pos += wave * size * amplitude;
+			}
+		}
+
+		// Expected cost of a random ray hitting the root, relative to one triangle test
+		float computeSAHCost(int rootIndex, int nodeIndexOffset = 0) const
+		{
+			if (rootIndex < 0 || rootIndex >= static_cast<int>(nodes.size())) return 0.0f;
+
+			float rootArea = nodes[rootIndex].surfaceArea();
+			if (rootArea <= 0.0f) return 0.0f;
+
+			float cost = 0.0f;
+			std::vector<int> stack = { rootIndex };
+			while (!stack.empty())
+			{
+				const BVHNode& node = nodes[stack.back()];
+				stack.pop_back();
+
+				if (node.isLeaf())
+				{
+					cost += sahIntersectionCost * node.triangleCount * node.surfaceArea();
+					continue;
+				}
+
+				cost += sahTraversalCost * node.surfaceArea();
+				stack.push_back(node.left - nodeIndexOffset);
+				stack.push_back(node.right - nodeIndexOffset);
+			}
+
+			return cost / rootArea;
+		}
+
+		// Rays from a sphere around the bounds towards random points inside them, the same for every call
+		static void generateReportRays(const glm::vec3& boundMin, const glm::vec3& boundMax, int rayCount, std::vector<glm::vec3>& origins, std::vector<glm::vec3>& directions)
+		{
+			glm::vec3 center = 0.5f * (boundMin + boundMax);
+			float radius = glm::length(boundMax - boundMin);
+
+			std::mt19937 random(1234);
+			std::uniform_real_distribution<float> unit(0.0f, 1.0f);
+			origins.resize(rayCount);
+			directions.resize(rayCount);
+			for (int i = 0; i < rayCount; ++i)
+			{
+				glm::vec3 onSphere = glm::normalize(glm::vec3(unit(random), unit(random), unit(random)) * 2.0f - 1.0f + glm::vec3(1e-4f));
+				glm::vec3 target = boundMin + glm::vec3(unit(random), unit(random), unit(random)) * (boundMax - boundMin);
+				origins[i] = center + onSphere * radius;
+				directions[i] = glm::normalize(target - origins[i]);
+			}
+		}
+
+		// side x side rays from a camera looking at the bounds, in the 16x16 tiles of the compute dispatch
+		static void generateCameraRays(const glm::vec3& boundMin, const glm::vec3& boundMax, int side, std::vector<glm::vec3>& origins, std::vector<glm::vec3>& directions)
+		{
+			glm::vec3 center = 0.5f * (boundMin + boundMax);
+			float radius = 0.5f * glm::length(boundMax - boundMin);
+			glm::vec3 eye = center + glm::normalize(glm::vec3(0.4f, 0.3f, 1.0f)) * radius * 2.5f;
+			glm::vec3 forward = glm::normalize(center - eye);
+			glm::vec3 right = glm::normalize(glm::cross(forward, glm::vec3(0.0f, 1.0f, 0.0f)));
+			glm::vec3 up = glm::cross(right, forward);
+			origins.assign(static_cast<size_t>(side) * side, eye);
+			directions.clear();
+			directions.reserve(origins.size());
+			for (int tile = 0; tile < side * side / 256; ++tile)
+			{
+				for (int i = 0; i < 256; ++i)
+				{
+					int x = (tile % (side / 16)) * 16 + i % 16;
+					int y = (tile / (side / 16)) * 16 + i / 16;
+					glm::vec2 uv = (glm::vec2(x, y) + 0.5f) / float(side) * 2.0f - 1.0f;
+					directions.push_back(glm::normalize(forward + (uv.x * right + uv.y * up) * 0.45f));
+				}
+			}
+		}
+
+		// Tree quality of the current BVH and the traversal cost of primary, shadow and random rays through it.
+		// Shadow rays start at the primary hits and stop at a light above the model on the first hit.
+		BVHStatistics computeBVHStatistics() const
+		{
+			BVHStatistics stats;
+			stats.modelName = name;
+			stats.builderName = bvhBuilderName(bvhBuilder);
+			if (localRoot < 0 || localRoot >= static_cast<int>(nodes.size())) return stats;
+
+			// Step 1: local links, placed nodes point into the global buffer
+			std::vector<BVHNode> localNodes = nodes;
+			for (BVHNode& node : localNodes)
+			{
+				if (node.left != -1) node.left -= bvhNodeOffset;
+				if (node.right != -1) node.right -= bvhNodeOffset;
+			}
+			stats.computeTreeStatistics(localNodes, localRoot, triangles, sahTraversalCost, sahIntersectionCost);
+
+			stats.bytes = {
+				{ "binaryNodes", nodes.size() * sizeof(BVHNode) },
+				{ "compactNodes", nodes.size() * sizeof(CompactBVHNode) },
+				{ "wideNodes", wideBVH.nodes.size() * sizeof(WideBVHNode) },
+				{ "triangles", triangles.size() * sizeof(Triangle) },
+				{ "precomputedTriangles", triangles.size() * sizeof(RayTriangle) },
+				{ "indexedTriangles", triangles.size() * 3 * sizeof(uint32_t) + vertices.size() * sizeof(glm::vec3) }
+			};
+
+			// Step 2: the three ray sets
+			const BVHNode& rootNode = localNodes[localRoot];
+			std::vector<glm::vec3> origins, directions;
+			std::vector<float> primaryHits;
+			generateCameraRays(rootNode.boundMin, rootNode.boundMax, 256, origins, directions);
+			stats.traceRaySet("primary", localNodes, localRoot, triangles, origins, directions, {}, false, &primaryHits);
+
+			glm::vec3 extent = rootNode.boundMax - rootNode.boundMin;
+			glm::vec3 light = 0.5f * (rootNode.boundMin + rootNode.boundMax) + glm::vec3(0.3f, 1.0f, 0.2f) * glm::length(extent);
+			float offset = 1e-4f * glm::length(extent);
+			std::vector<glm::vec3> shadowOrigins, shadowDirections;
+			std::vector<float> shadowDistances;
+			for (size_t i = 0; i < primaryHits.size(); ++i)
+			{
+				if (primaryHits[i] == FLT_MAX) continue;
+				glm::vec3 hit = origins[i] + directions[i] * primaryHits[i];
+				glm::vec3 toLight = light - hit;
+				float distance = glm::length(toLight);
+				shadowDirections.push_back(toLight / distance);
+				shadowOrigins.push_back(hit + shadowDirections.back() * offset);
+				shadowDistances.push_back(distance - offset);
+			}
+			stats.traceRaySet("shadow", localNodes, localRoot, triangles, shadowOrigins, shadowDirections, shadowDistances, true);
+
+			generateReportRays(rootNode.boundMin, rootNode.boundMax, 65536, origins, directions);
+			stats.traceRaySet("random", localNodes, localRoot, triangles, origins, directions, {}, false);
+			return stats;
+		}
+
+		// Writes computeBVHStatistics as <directory>/<model>.<builder>.json and prints a one line summary, false when it could not be written
+		bool writeBVHStatistics(const std::string& directory) const
+		{
+			auto start = std::chrono::high_resolution_clock::now();
+			BVHStatistics stats = computeBVHStatistics();
+			double milliseconds = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+
+			std::filesystem::create_directories(directory);
+			std::string path = (std::filesystem::path(directory) / (name + "." + bvhBuilderName(bvhBuilder) + ".json")).string();
+			std::ofstream out(path);
+			if (!out)
+			{
+				std::cout << "WARNING: failed to write " << path << std::endl;
+				return false;
+			}
+			out << stats.toJson();
+
+			printf("BVH statistics: %s (%s), SAH %.2f, EPO %.3f, depth %d, %.0f ms -> %s\n", name.c_str(), bvhBuilderName(bvhBuilder), stats.sahCost, stats.epo, stats.maxDepth, milliseconds, path.c_str());
+			return true;
+		}
+
+		// Builds the SBVH of a degenerate mesh, a cluster of triangles in one spot behind a chain of far apart ones the
+		// splits peel off one level at a time, so the cluster starts deep in the tree. Checks that no node is deeper
+		// than the cap after buildWideBVH split the leaves and that every leaf fits the wide nodes. The cap is lowered
+		// so the mesh stays small. main runs it for --check-sbvh-depth.
+		static bool checkSBVHDepthLimit()
+		{
+			const int clusterCount = 2000;
+			const int chainCount = 4;
+			const int triangleCount = clusterCount + chainCount;
+			std::vector<Vertex> vertices(triangleCount * 3);
+			std::vector<uint32_t> indices(triangleCount * 3);
+			for (int i = 0; i < triangleCount * 3; ++i)
+			{
+				int triangle = i / 3;
+				float x = triangle < clusterCount ? 0.0f : std::pow(64.0f, static_cast<float>(triangle - clusterCount + 1));
+				vertices[i].pos = glm::vec3(x + (i % 3 == 1 ? 1.0f : 0.0f), i % 3 == 2 ? 1.0f : 0.0f, 0.0f);
+				indices[i] = static_cast<uint32_t>(i);
+			}
+
+			GameModel model(vertices, indices);
+			model.setName("degenerate");
+			model.bvhBuilder = BVHBuilder::SBVH;
+			model.sbvhMaxDepth = 8;
+			model.createTriangles();
+			model.localRoot = model.buildWith(BVHBuilder::SBVH);
+			model.buildWideBVH();
+
+			int maxDepth = 0;
+			int maxLeafSize = 0;
+			std::vector<std::pair<int, int>> stack = { { model.localRoot, 0 } };
+			while (!stack.empty())
+			{
+				auto [index, depth] = stack.back();
+				stack.pop_back();
+				maxDepth = std::max(maxDepth, depth);
+
+				const BVHNode& node = model.nodes[index];
+				if (node.isLeaf())
+				{
+					maxLeafSize = std::max(maxLeafSize, node.triangleCount);
+					continue;
+				}
+				stack.push_back({ node.left, depth + 1 });
+				stack.push_back({ node.right, depth + 1 });
+			}
+
+			bool passed = maxDepth <= model.sbvhMaxDepth && maxLeafSize <= WideBVH::maxLeafTriangles;
+			printf("SBVH depth check: %d triangles in one spot behind %d, depth cap %d: max depth %d, largest leaf %d -> %s\n",
+				clusterCount, chainCount, model.sbvhMaxDepth, maxDepth, maxLeafSize, passed ? "passed" : "FAILED");
+			return passed;
+		}
+
+		// Builds this model with every builder and prints build time, tree quality and the traversal cost of
+		// the same random rays cast through each binary BVH on one CPU thread
+		void reportBVHBuilders() const
+		{
+			glm::vec3 boundMin(FLT_MAX), boundMax(-FLT_MAX);
+			for (uint32_t index : indices)
+			{
+				boundMin = glm::min(boundMin, vertices[index].pos);
+				boundMax = glm::max(boundMax, vertices[index].pos);
+			}
+
+			const int rayCount = 100000;
+			std::vector<glm::vec3> origins, directions;
+			generateReportRays(boundMin, boundMax, rayCount, origins, directions);
+			std::vector<float> firstHits;
+			BVHBuilder firstBuilder = BVHBuilder::Naive;
+
+			printf("BVH builders: %s (%zd triangles)\n", name.c_str(), indices.size() / 3);
+			printf("    %-10s %12s %10s %9s %9s %9s %9s %12s %12s %12s %9s\n", "Builder", "Build (ms)", "SAH cost", "Nodes", "Leaves", "Max leaf", "Refs", "Fetches/ray", "Boxes/ray", "Tris/ray", "Mrays/s");
+
+			for (BVHBuilder builder : { BVHBuilder::Naive, BVHBuilder::Midpoint, BVHBuilder::Recursive, BVHBuilder::BinnedSAH, BVHBuilder::LBVH, BVHBuilder::SBVH })
+			{
+				GameModel model(vertices, indices);
+				model.bvhBuilder = builder;
+				model.sahBinCount = sahBinCount;
+				model.sbvhDuplicationBudget = sbvhDuplicationBudget;
+				model.sbvhOverlapThreshold = sbvhOverlapThreshold;
+				model.createTriangles();
+
+				auto start = std::chrono::high_resolution_clock::now();
+				int root = model.buildWith(builder);
+				auto end = std::chrono::high_resolution_clock::now();
+				double buildMs = std::chrono::duration<double, std::milli>(end - start).count();
+
+				int leafCount = 0;
+				int largestLeaf = 0;
+				for (const BVHNode& node : model.nodes)
+				{
+					if (!node.isLeaf()) continue;
+					leafCount++;
+					largestLeaf = std::max(largestLeaf, node.triangleCount);
+				}
+
+				bool valid = model.validateBVH(root) && model.validateBVHTriangles();
+
+				WideBVH::TraversalStats stats;
+				std::vector<float> hits(rayCount);
+				auto traceStart = std::chrono::high_resolution_clock::now();
+				for (int i = 0; i < rayCount && valid; ++i)
+				{
+					hits[i] = WideBVH::traverseBinary(model.nodes, root, model.triangles, origins[i], directions[i], stats);
+				}
+				double traceSeconds = std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - traceStart).count();
+
+				printf("    %-10s %12.2f %10.2f %9zd %9d %9d %9zd %12.2f %12.2f %12.2f %9.2f%s\n", bvhBuilderName(builder), buildMs, model.computeSAHCost(root), model.nodes.size(), leafCount, largestLeaf, model.triangles.size(),
+					double(stats.nodeFetches) / rayCount, double(stats.boxTests) / rayCount, double(stats.triangleTests) / rayCount, rayCount / traceSeconds / 1e6, valid ? "" : "  (INVALID)");
+
+				// Every builder must find the same closest hits
+				if (!valid) continue;
+				if (firstHits.empty())
+				{
+					firstHits = hits;
+					firstBuilder = builder;
+					continue;
+				}
+				int mismatches = 0;
+				for (int i = 0; i < rayCount; ++i)
+				{
+					mismatches += std::abs(hits[i] - firstHits[i]) > 1e-4f * std::max(1.0f, firstHits[i]) && hits[i] != firstHits[i];
+				}
+				if (mismatches > 0) printf("    %d rays hit a different distance than %s\n", mismatches, bvhBuilderName(firstBuilder));
+			}
+		}
+
+		// Traces the same random rays through the binary BVH and the 4 and 8 wide BVHs on one CPU thread
+		void reportWideBVH() const
+		{
+			GameModel binary(vertices, indices);
+			binary.createTriangles();
+			int binaryRoot = binary.buildWith(bvhBuilder);
+			if (binaryRoot < 0) return;
+			binary.localRoot = binaryRoot;
+
+			const int rayCount = 100000;
+			std::vector<glm::vec3> origins, directions;
+			const BVHNode& rootNode = binary.nodes[binaryRoot];
+			generateReportRays(rootNode.boundMin, rootNode.boundMax, rayCount, origins, directions);
+
+			printf("Wide BVH: %s (%zd triangles, %s)\n", name.c_str(), binary.triangles.size(), bvhBuilderName(bvhBuilder));
+			printf("    %-7s %9s %11s %9s %12s %12s %12s %9s %9s\n", "Layout", "Nodes", "Node bytes", "Bytes/tri", "Fetches/ray", "Boxes/ray", "Tris/ray", "Mrays/s", "Misses");
+
+			auto printRow = [&](const char* layout, size_t nodeCount, size_t nodeBytes, const WideBVH::TraversalStats& stats, double seconds, int misses)
+				{
+					printf("    %-7s %9zd %11zd %9.1f %12.2f %12.2f %12.2f %9.2f %9d\n", layout, nodeCount, nodeBytes, double(nodeBytes) / binary.triangles.size(),
+						double(stats.nodeFetches) / rayCount, double(stats.boxTests) / rayCount, double(stats.triangleTests) / rayCount, rayCount / seconds / 1e6, misses);
+				};
+
+			std::vector<float> binaryHits(rayCount);
+			{
+				WideBVH::TraversalStats stats;
+				int misses = 0;
+				auto start = std::chrono::high_resolution_clock::now();
+				for (int i = 0; i < rayCount; ++i)
+				{
+					binaryHits[i] = WideBVH::traverseBinary(binary.nodes, binaryRoot, binary.triangles, origins[i], directions[i], stats);
+					misses += binaryHits[i] == FLT_MAX;
+				}
+				double seconds = std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - start).count();
+				printRow("BVH2", binary.nodes.size(), binary.nodes.size() * sizeof(BVHNode), stats, seconds, misses);
+			}
+
+			for (int width : { 4, 8 })
+			{
+				GameModel wide = binary;
+				wide.wideBVHWidth = width;
+				wide.buildWideBVH();
+
+				WideBVH::TraversalStats stats;
+				int misses = 0, mismatches = 0;
+				auto start = std::chrono::high_resolution_clock::now();
+				for (int i = 0; i < rayCount; ++i)
+				{
+					float t = wide.wideBVH.traverse(wide.triangles, origins[i], directions[i], stats);
+					misses += t == FLT_MAX;
+					mismatches += std::abs(t - binaryHits[i]) > 1e-4f * std::max(1.0f, binaryHits[i]) && t != binaryHits[i];
+				}
+				double seconds = std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - start).count();
+
+				std::string layout = "BVH" + std::to_string(width);
+				printRow(layout.c_str(), wide.wideBVH.nodes.size(), wide.wideBVH.nodes.size() * sizeof(WideBVHNode), stats, seconds, misses);
+				if (mismatches > 0) printf("    %d rays hit a different distance than the binary BVH\n", mismatches);
+			}
+		}
+
+		// Traces random and camera rays through the binary BVH in builder order, in depth first order and in
+		// the 32 byte implicit left child layout on one CPU thread. The cache columns replay the node fetches
+		// through a 64 KB, 4 way model of a GPU L1 with 128 byte lines.
+		void reportBVHLayout() const
+		{
+			GameModel builderOrder(vertices, indices);
+			builderOrder.bvhBuilder = bvhBuilder;
+			builderOrder.sahBinCount = sahBinCount;
+			builderOrder.sbvhDuplicationBudget = sbvhDuplicationBudget;
+			builderOrder.sbvhOverlapThreshold = sbvhOverlapThreshold;
+			builderOrder.createTriangles();
+			int builderRoot = builderOrder.buildWith(bvhBuilder, true);
+			if (builderRoot < 0) return;
+
+			std::vector<BVHNode> depthFirstNodes = builderOrder.nodes;
+			int depthFirstRoot = CompactBVH::reorderDepthFirst(depthFirstNodes, builderRoot, bvhLargerChildFirst);
+			std::vector<CompactBVHNode> compactNodes;
+			CompactBVH::compress(depthFirstNodes, compactNodes, 0);
+			const std::vector<Triangle>& tris = builderOrder.triangles;
+
+			// Step 1: incoherent rays, and camera rays in the 16x16 tiles of the compute dispatch
+			const int rayCount = 65536;
+			const BVHNode& rootNode = depthFirstNodes[depthFirstRoot];
+			std::vector<glm::vec3> randomOrigins, randomDirections;
+			generateReportRays(rootNode.boundMin, rootNode.boundMax, rayCount, randomOrigins, randomDirections);
+
+			std::vector<glm::vec3> cameraOrigins, cameraDirections;
+			generateCameraRays(rootNode.boundMin, rootNode.boundMax, 256, cameraOrigins, cameraDirections);
+
+			printf("BVH layout: %s (%zd triangles, %s, %s child first)\n", name.c_str(), tris.size(), bvhBuilderName(bvhBuilder), bvhLargerChildFirst ? "larger" : "builder");
+			printf("    Depth first validation: %s\n", CompactBVH::validateDepthFirst(depthFirstNodes, depthFirstRoot) ? "OK" : "FAILED");
+			printf("    %-7s %-8s %11s %12s %12s %12s %9s\n", "Rays", "Layout", "Node bytes", "Fetches/ray", "Lines/ray", "Misses/ray", "Mrays/s");
+
+			auto measure = [&](const char* rays, const char* layout, size_t nodeBytes, const std::vector<glm::vec3>& origins, const std::vector<glm::vec3>& directions, std::vector<float>& hits, auto&& trace)
+				{
+					WideBVH::TraversalStats stats;
+					auto start = std::chrono::high_resolution_clock::now();
+					for (int i = 0; i < rayCount; ++i)
+					{
+						hits[i] = trace(origins[i], directions[i], stats, nullptr);
+					}
+					double seconds = std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - start).count();
+
+					WideBVH::TraversalStats cachedStats;
+					CompactBVH::CacheModel cache;
+					for (int i = 0; i < rayCount; ++i)
+					{
+						trace(origins[i], directions[i], cachedStats, &cache);
+					}
+
+					printf("    %-7s %-8s %11zd %12.2f %12.2f %12.2f %9.2f\n", rays, layout, nodeBytes, double(stats.nodeFetches) / rayCount,
+						double(cache.accesses) / rayCount, double(cache.misses) / rayCount, rayCount / seconds / 1e6);
+				};
+
+			auto traceBuilderOrder = [&](const glm::vec3& origin, const glm::vec3& direction, WideBVH::TraversalStats& stats, CompactBVH::CacheModel* cache)
+				{
+					return CompactBVH::traverseBinary(builderOrder.nodes, builderRoot, tris, origin, direction, stats, cache);
+				};
+			auto traceDepthFirst = [&](const glm::vec3& origin, const glm::vec3& direction, WideBVH::TraversalStats& stats, CompactBVH::CacheModel* cache)
+				{
+					return CompactBVH::traverseBinary(depthFirstNodes, depthFirstRoot, tris, origin, direction, stats, cache);
+				};
+			auto traceCompact = [&](const glm::vec3& origin, const glm::vec3& direction, WideBVH::TraversalStats& stats, CompactBVH::CacheModel* cache)
+				{
+					return CompactBVH::traverse(compactNodes, depthFirstRoot, tris, origin, direction, stats, cache);
+				};
+
+			for (int set = 0; set < 2; ++set)
+			{
+				const char* rays = set == 0 ? "Random" : "Camera";
+				const std::vector<glm::vec3>& origins = set == 0 ? randomOrigins : cameraOrigins;
+				const std::vector<glm::vec3>& directions = set == 0 ? randomDirections : cameraDirections;
+
+				std::vector<float> builderHits(rayCount), depthFirstHits(rayCount), compactHits(rayCount);
+				measure(rays, "Builder", builderOrder.nodes.size() * sizeof(BVHNode), origins, directions, builderHits, traceBuilderOrder);
+				measure(rays, "DFS", depthFirstNodes.size() * sizeof(BVHNode), origins, directions, depthFirstHits, traceDepthFirst);
+				measure(rays, "DFS32", compactNodes.size() * sizeof(CompactBVHNode), origins, directions, compactHits, traceCompact);
+
+				// Every layout must find the same closest hits
+				int mismatches = 0;
+				for (int i = 0; i < rayCount; ++i)
+				{
+					mismatches += depthFirstHits[i] != builderHits[i] || compactHits[i] != builderHits[i];
+				}
+				if (mismatches > 0) printf("    %d %s rays hit a different distance than the builder order\n", mismatches, rays);
+			}
+		}
+
+		// Traces the same rays through the 32 byte node BVH once per TriangleFormat on one CPU thread. The cache
+		// columns replay the node and geometry fetches through the 64 KB model of reportBVHLayout.
+		void reportTriangleFormats() const
+		{
+			GameModel model(vertices, indices);
+			model.bvhBuilder = bvhBuilder;
+			model.sahBinCount = sahBinCount;
+			model.wideBVHWidth = wideBVHWidth;
+			model.createTriangles();
+			model.localRoot = model.buildWith(bvhBuilder);
+			if (model.localRoot < 0) return;
+			model.buildWideBVH(); // Same triangle order as on the GPU
+
+			std::vector<CompactBVHNode> compactNodes;
+			CompactBVH::compress(model.nodes, compactNodes, 0);
+
+			std::vector<glm::vec3> positions(vertices.size());
+			for (size_t i = 0; i < vertices.size(); ++i) positions[i] = vertices[i].pos;
+			std::vector<uint32_t> triangleIndices(model.triangles.size() * 3);
+			std::vector<RayTriangle> rayTriangles(model.triangles.size());
+			for (size_t i = 0; i < model.triangles.size(); ++i)
+			{
+				size_t source = static_cast<size_t>(model.triangles[i].centroid.w) * 3;
+				for (size_t corner = 0; corner < 3; ++corner) triangleIndices[i * 3 + corner] = indices[source + corner];
+				rayTriangles[i] = makeRayTriangle(model.triangles[i]);
+			}
+
+			const int rayCount = 65536;
+			std::vector<glm::vec3> origins, directions;
+			const BVHNode& rootNode = model.nodes[model.localRoot];
+			generateReportRays(rootNode.boundMin, rootNode.boundMax, rayCount, origins, directions);
+
+			// Geometry lives far behind the nodes in the cache model, positions far behind the indices
+			const size_t geometryBase = size_t(1) << 40;
+			const size_t positionBase = size_t(1) << 41;
+
+			printf("Triangle formats: %s (%zd triangles, %zd vertices, %s)\n", name.c_str(), model.triangles.size(), positions.size(), bvhBuilderName(bvhBuilder));
+			printf("    %-11s %14s %9s %12s %12s %12s %9s\n", "Format", "Geometry bytes", "Bytes/tri", "Tris/ray", "Lines/ray", "Misses/ray", "Mrays/s");
+
+			const int formatCount = static_cast<int>(TriangleFormat::Count);
+			std::vector<std::vector<float>> hits(formatCount, std::vector<float>(rayCount));
+			for (int formatIndex = 0; formatIndex < formatCount; ++formatIndex)
+			{
+				TriangleFormat format = static_cast<TriangleFormat>(formatIndex);
+				CompactBVH::CacheModel* cache = nullptr;
+				const glm::vec3* origin = nullptr;
+				const glm::vec3* direction = nullptr;
+				auto intersectTriangleAt = [&](int index, float& t)
+					{
+						if (format == TriangleFormat::Precomputed)
+						{
+							const RayTriangle& tri = rayTriangles[index];
+							if (cache) cache->access(geometryBase + index * sizeof(RayTriangle), sizeof(RayTriangle));
+							return intersectRayTriangleEdges(glm::vec3(tri.v0), glm::vec3(tri.edge1), glm::vec3(tri.edge2), *origin, *direction, t);
+						}
+
+						glm::vec3 v0, v1, v2;
+						if (format == TriangleFormat::Triangles)
+						{
+							const Triangle& tri = model.triangles[index];
+							if (cache) cache->access(geometryBase + index * sizeof(Triangle), sizeof(Triangle));
+							v0 = tri.v0;
+							v1 = tri.v1;
+							v2 = tri.v2;
+						}
+						else
+						{
+							const uint32_t* corners = triangleIndices.data() + size_t(index) * 3;
+							if (cache)
+							{
+								cache->access(geometryBase + size_t(index) * 3 * sizeof(uint32_t), 3 * sizeof(uint32_t));
+								for (int corner = 0; corner < 3; ++corner) cache->access(positionBase + corners[corner] * sizeof(glm::vec3), sizeof(glm::vec3));
+							}
+							v0 = positions[corners[0]];
+							v1 = positions[corners[1]];
+							v2 = positions[corners[2]];
+						}
+						return intersectRayTriangleEdges(v0, v1 - v0, v2 - v0, *origin, *direction, t);
+					};
+
+				WideBVH::TraversalStats stats;
+				auto start = std::chrono::high_resolution_clock::now();
+				for (int i = 0; i < rayCount; ++i)
+				{
+					origin = &origins[i];
+					direction = &directions[i];
+					hits[formatIndex][i] = CompactBVH::traverseWith(compactNodes, model.localRoot, intersectTriangleAt, origins[i], directions[i], stats);
+				}
+				double seconds = std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - start).count();
+
+				WideBVH::TraversalStats cachedStats;
+				CompactBVH::CacheModel cacheModel;
+				cache = &cacheModel;
+				for (int i = 0; i < rayCount; ++i)
+				{
+					origin = &origins[i];
+					direction = &directions[i];
+					CompactBVH::traverseWith(compactNodes, model.localRoot, intersectTriangleAt, origins[i], directions[i], cachedStats, cache);
+				}
+
+				size_t bytes = model.triangles.size() * sizeof(Triangle);
+				if (format == TriangleFormat::Indexed) bytes = triangleIndices.size() * sizeof(uint32_t) + positions.size() * sizeof(glm::vec3);
+				if (format == TriangleFormat::Precomputed) bytes = rayTriangles.size() * sizeof(RayTriangle);
+				printf("    %-11s %14zd %9.1f %12.2f %12.2f %12.2f %9.2f\n", triangleFormatName(format), bytes, double(bytes) / model.triangles.size(),
+					double(stats.triangleTests) / rayCount, double(cacheModel.accesses) / rayCount, double(cacheModel.misses) / rayCount, rayCount / seconds / 1e6);
+			}
+
+			for (int formatIndex = 1; formatIndex < formatCount; ++formatIndex)
+			{
+				int mismatches = 0;
+				for (int i = 0; i < rayCount; ++i) mismatches += hits[formatIndex][i] != hits[0][i];
+				if (mismatches > 0) printf("    %d rays hit a different distance with %s triangles\n", mismatches, triangleFormatName(static_cast<TriangleFormat>(formatIndex)));
+			}
+		}
+
+		// Deforms a copy of the mesh with a growing wave and compares refits against full rebuilds
+		void reportBVHRefit() const
+		{
+			GameModel model(vertices, indices);
+			model.bvhBuilder = bvhBuilder;
+			model.sahBinCount = sahBinCount;
+			model.wideBVHWidth = wideBVHWidth;
+			model.createTriangles();
+			model.localRoot = model.buildWith(bvhBuilder);
+			if (model.localRoot < 0) return;
+			model.buildWideBVH();
+			model.builtSAHCost = model.computeSAHCost(model.localRoot);
+
+			const BVHNode& root = model.nodes[model.localRoot];
+			glm::vec3 size = root.boundMax - root.boundMin;
+
+			printf("BVH refit: %s (%zd triangles, %s, rebuild past %.2fx SAH)\n", name.c_str(), model.triangles.size(), bvhBuilderName(bvhBuilder), refitRebuildThreshold);
+			printf("    %-9s %12s %10s %9s %13s %12s\n", "Amplitude", "Refit (us)", "SAH cost", "SAH x", "Rebuild (ms)", "Rebuilt SAH");
+
+			std::vector<glm::vec3> positions(vertices.size());
+			for (float amplitude : { 0.0f, 0.01f, 0.05f, 0.1f, 0.2f, 0.4f })
+			{
+				for (size_t i = 0; i < vertices.size(); ++i) positions[i] = vertices[i].pos;
+				applyWave(positions, size, amplitude);
+
+				const int frames = 10;
+				float cost = 0.0f;
+				auto refitStart = std::chrono::high_resolution_clock::now();
+				for (int frame = 0; frame < frames; ++frame)
+				{
+					cost = model.refitLocalBVH(positions);
+				}
+				double refitUs = std::chrono::duration<double, std::micro>(std::chrono::high_resolution_clock::now() - refitStart).count() / frames;
+
+				GameModel rebuilt(model.vertices, indices);
+				rebuilt.bvhBuilder = bvhBuilder;
+				rebuilt.sahBinCount = sahBinCount;
+				rebuilt.wideBVHWidth = wideBVHWidth;
+				auto rebuildStart = std::chrono::high_resolution_clock::now();
+				rebuilt.createTriangles();
+				rebuilt.localRoot = rebuilt.buildWith(bvhBuilder);
+				rebuilt.buildWideBVH();
+				double rebuildMs = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - rebuildStart).count();
+
+				printf("    %-9.2f %12.1f %10.2f %9.2f %13.2f %12.2f%s\n", amplitude, refitUs, cost, cost / model.builtSAHCost, rebuildMs, rebuilt.computeSAHCost(rebuilt.localRoot),
+					cost > model.builtSAHCost * refitRebuildThreshold ? "  (rebuild)" : "");
 			}
 		}
 
@@ -23,6 +23,7 @@ namespace Engine
 
 		glm::vec3 color = glm::vec3(1, 1, 1);
 		float intensity = 1;
+		float lightRadius = 0; // Disk the shadow rays of a light aim at, 0 gives hard shadows
 
 		std::string model = "bunny";
 		std::string texture = "default";
@@ -0,0 +1,159 @@
+#pragma once
+#include <fstream>
+#include <filesystem>
+#include "../../Vulkan/VulkanTypes.h"
+
+namespace Engine
+{
+	struct MeshHeader {
+		uint32_t vertexCount;
+		uint32_t indexCount;
+		// Add material, AABB, LODs, etc. if needed
+	};
+
+	// Reads OBJ models and their binary mesh cache, shared by VulkanModel and the headless tools
+	class MeshLoader
+	{
+	public:
+		static void loadModel(std::string modelPath, std::vector<Vertex>& vertices, std::vector<uint32_t>& indices, bool debug = true)
+		{
+			tinyobj::attrib_t attrib;
+			std::vector<tinyobj::shape_t> shapes;
+			std::vector<tinyobj::material_t> materials;
+			std::string warn, err;
+
+			auto start = std::chrono::high_resolution_clock::now();
+
+			if (!tinyobj::LoadObj(&attrib, &shapes, nullptr, &warn, &err, modelPath.c_str()))
+			{
+				throw std::runtime_error(warn + err);
+			}
+
+			auto end1 = std::chrono::high_resolution_clock::now();
+			auto duration1 = std::chrono::duration_cast<std::chrono::milliseconds>(end1 - start).count();
+
+			std::unordered_map<Vertex, uint32_t> uniqueVertices{};
+
+			for (const auto& shape : shapes)
+			{
+				for (const auto& index : shape.mesh.indices)
+				{
+					Vertex vertex{};
+
+					vertex.pos =
+					{
+						attrib.vertices[3 * index.vertex_index + 0],
+						attrib.vertices[3 * index.vertex_index + 1],
+						attrib.vertices[3 * index.vertex_index + 2]
+					};
+
+					// Texture coordinates
+					if (index.texcoord_index >= 0 && attrib.texcoords.size() > 0)
+					{
+						vertex.texCoord =
+						{
+							attrib.texcoords[2 * index.texcoord_index + 0],
+							1.0f - attrib.texcoords[2 * index.texcoord_index + 1]
+						};
+					}
+					else
+					{
+						vertex.texCoord = { 0.0f, 0.0f }; // Default UV
+					}
+
+					// Normal coordinates
+					if (index.normal_index >= 0) // Check if normals are available
+					{
+						vertex.normal =
+						{
+							attrib.normals[3 * index.normal_index + 0],
+							attrib.normals[3 * index.normal_index + 1],
+							attrib.normals[3 * index.normal_index + 2]
+						};
+					}
+					else
+					{
+						vertex.normal = { 0.0f, 0.0f, 0.0f }; // Default normal if not available
+					}
+
+					vertex.color = { 1.0f, 1.0f, 1.0f };
+
+					if (uniqueVertices.count(vertex) == 0)
+					{
+						uniqueVertices[vertex] = static_cast<uint32_t>(vertices.size());
+						vertices.push_back(vertex);
+					}
+
+					indices.push_back(uniqueVertices[vertex]);
+				}
+			}
+
+			// Step 1: Compute AABB
+			glm::vec3 minPos = glm::vec3(FLT_MAX);
+			glm::vec3 maxPos = glm::vec3(-FLT_MAX);
+
+			for (const auto& v : vertices) {
+				minPos = glm::min(minPos, v.pos);
+				maxPos = glm::max(maxPos, v.pos);
+			}
+
+			// Step 2: Center and scale
+			glm::vec3 center = (minPos + maxPos) * 0.5f;
+			glm::vec3 extents = maxPos - minPos;
+			float maxExtent = std::max(extents.x, std::max(extents.y, extents.z));
+			float scale = 1.0f / maxExtent * 0.5f;
+
+			for (auto& v : vertices) {
+				v.pos = (v.pos - center) * scale;
+			}
+
+			auto end2 = std::chrono::high_resolution_clock::now();
+			auto duration2 = std::chrono::duration_cast<std::chrono::milliseconds>(end2 - start).count();
+
+			debug && printf("1: %lld\n2: %lld", duration1, duration2);
+		};
+
+		static void saveMeshBinary(const std::string& path, const std::vector<Vertex>& vertices, const std::vector<uint32_t>& indices)
+		{
+			std::ofstream out(path, std::ios::binary);
+			if (!out) throw std::runtime_error("Failed to open file for writing");
+
+			MeshHeader header{};
+			header.vertexCount = static_cast<uint32_t>(vertices.size());
+			header.indexCount = static_cast<uint32_t>(indices.size());
+
+			out.write(reinterpret_cast<const char*>(&header), sizeof(header));
+			out.write(reinterpret_cast<const char*>(vertices.data()), vertices.size() * sizeof(Vertex));
+			out.write(reinterpret_cast<const char*>(indices.data()), indices.size() * sizeof(uint32_t));
+		}
+
+		static void loadMeshBinary(const std::string& path, std::vector<Vertex>& vertices, std::vector<uint32_t>& indices)
+		{
+			std::ifstream in(path, std::ios::binary);
+			if (!in) throw std::runtime_error("Failed to open file for reading");
+
+			MeshHeader header;
+			in.read(reinterpret_cast<char*>(&header), sizeof(header));
+
+			vertices.resize(header.vertexCount);
+			indices.resize(header.indexCount);
+
+			in.read(reinterpret_cast<char*>(vertices.data()), header.vertexCount * sizeof(Vertex));
+			in.read(reinterpret_cast<char*>(indices.data()), header.indexCount * sizeof(uint32_t));
+		}
+
+		static void loadModelWithCache(const std::string& objPath, const std::string& objName, std::vector<Vertex>& vertices, std::vector<uint32_t>& indices, bool debug = false)
+		{
+			std::string cachedPath = "Resources/Cache/Models/" + objName + ".bin";
+
+			if (std::filesystem::exists(cachedPath)) {
+				loadMeshBinary(cachedPath, vertices, indices);
+				return;
+			}
+
+			// Fallback to OBJ load
+			loadModel(objPath, vertices, indices, debug);
+			saveMeshBinary(cachedPath, vertices, indices);
+		}
+	};
+}
@@ -20,4 +20,57 @@ VkDeviceSize normalBufferSize = bufferDefaultValue;
 
 inline bool usingGpgpuRaytracing = true;
 
-inline bool showOnlyRaytracing = true;
\ No newline at end of file
+inline bool showOnlyRaytracing = false; // Show the ray traced image alone instead of blending it over the rasterized one
+
+inline bool showBVHBuilderReport = false; // Compare every BVH builder on each model at load time
+inline bool useBVHCache = true; // Reuse BVHs stored in Resources/Cache/BVH when mesh and builder settings match
+inline bool useWideBVH = true; // Traverse the compressed 8 wide BVHs in the compute shader instead of the binary ones
+inline bool useCompactBVH = true; // Traverse the 32 byte depth first nodes wherever the binary BVHs are used, they replace the 48 byte BLAS nodes on the GPU (read when the buffers are created)
+inline bool showBVHLayoutReport = false; // Compare CPU rays/s and modelled cache misses of the builder order, depth first and 32 byte node layouts
+inline Engine::TriangleFormat triangleFormat = Engine::TriangleFormat::Triangles; // Geometry layout the compute shader reads, the buffers are filled at the first frame
+inline bool runTriangleFormatAB = false; // Cycle through every triangle format each second and print their average GPU ray tracing times
+inline int abTestRounds = 5; // Seconds measured per mode before an A/B prints its results
+inline bool showTriangleFormatReport = false; // Compare bytes per triangle, modelled cache misses and CPU rays/s of the triangle formats
+inline bool showWideBVHReport = false; // Compare node count, bytes per triangle and CPU rays/s of the binary and wide BVHs
+inline bool useTraversalInstrumentation = false; // Ray trace with the instrumented pipeline: per pixel traversal counters and frame totals, shown with the FPS
+inline int traversalHeatmap = 0; // With instrumentation: 0 shades normally, 1 nodes visited, 2 triangles tested, 3 stack high-water mark per pixel
+inline int traversalHeatmapMax = 128; // Counter value drawn red in the heatmap
+inline bool useShortStackTraversal = false; // Create the ray tracing pipelines with the shared memory short stack traversal of binary BVHs, parent links take over when it overflows. It walks the binary BLAS nodes even with useWideBVH or useCompactBVH on
+inline bool compactBVHReplacesBinary() { return useCompactBVH && !useShortStackTraversal; } // The compact nodes take the place of the binary BLAS nodes on the GPU, the short stack needs the binary nodes and their parent links
+inline bool useWavefrontPathTracing = false; // Ray trace with separate generate, extend, shade and shadow dispatches connected by queues instead of the megakernel, V toggles it
+inline bool runWavefrontAB = false; // Alternate megakernel and wavefront each second and print their average GPU ray tracing times
+inline bool useSwizzledDispatch = false; // Map ray tracing workgroups to 16x16 tiles in Morton order within 8x8 tile blocks and pixels in Morton order within tiles, M toggles it
+inline bool useRayBinning = false; // Wavefront: sort shadow rays by direction octant and origin cell before tracing them, B toggles it
+inline bool runRayOrderAB = false; // Cycle row major, swizzled, binned and both each second and print GPU ray tracing times and traversal counters
+inline int shadowSamplesPerPixel = 3; // Megakernel shadow rays per pixel without the denoiser, at most SHADOW_SAMPLES keeps the original brightness weighting
+inline bool useShadowDenoiser = false; // Megakernel: temporal accumulation and an a-trous filter of the shadow visibility, N toggles it
+inline int denoisedShadowSamplesPerPixel = 1; // Shadow rays per pixel the denoiser starts from
+inline int shadowDenoiseAtrousIterations = 4; // A-trous passes, taps 1, 2, 4, 8... pixels apart
+inline bool shadowDenoiseSplitScreen = false; // Left half without the denoiser at shadowSamplesPerPixel, right half denoised at denoisedShadowSamplesPerPixel
+inline bool runShadowDenoiseAB = false; // Alternate the raw and denoised shadows each second and print their average GPU ray tracing times
+inline bool useProgressiveRefinement = false; // Megakernel: while the camera and instances stay put, add one sample per pixel each frame to a running average, P toggles it
+inline int progressiveShadowSamplesPerPixel = 1; // Shadow rays per pixel of each progressive sample
+inline int progressiveMaxSamples = 4096; // Samples after which the accumulated image is only shown
+inline int progressiveReportSamples = 256; // Print how long a static view took to reach this many samples
+inline bool useDynamicResolution = false; // Trace fewer pixels than the swap chain has, as many as fit dynamicResolutionBudgetMs, and upscale them, R toggles it
+inline double dynamicResolutionBudgetMs = 8.0; // GPU ray tracing time per frame the trace resolution is steered towards
+inline float dynamicResolutionMinScale = 0.5f; // Bounds of the trace resolution per axis, as a fraction of the swap chain
+inline float dynamicResolutionMaxScale = 1.0f;
+inline int shadowResolutionDivisor = 1; // Megakernel: 2 or 4 trace the shadow rays of one pixel per 2x2 or 4x4 block and upsample them, H cycles 1, 2 and 4
+inline bool runShadowResolutionAB = false; // Cycle full, half and quarter resolution shadows each second and print their average GPU ray tracing times
+inline bool useHybridRendering = false; // Rasterize world space normals and depth into a G-buffer and ray trace only the shadow rays from it, G toggles it
+inline bool runHybridAB = false; // Cycle the blend, ray traced only and hybrid modes each second and print their average GPU frame times
+inline int lightBenchmarkCount = 0; // Extra random point lights over the default scene, to time many light sampling on the GPU
+inline bool runLightScalingAB = false; // Cycle 1, 10, 100 and 1000 lights each second and print their average GPU ray tracing times
+inline bool writeBVHStatistics = false; // Write SAH cost, EPO, depth and leaf size histograms, byte footprints and ray set traversal counts of every model as JSON
+inline std::string bvhStatisticsDirectory = "Resources/Stats/"; // Where writeBVHStatistics puts <model>.<builder>.json
+inline bool showBVHRefitReport = false; // Time BVH refits of a deforming copy of each model against full rebuilds
+inline float deformModelsAmplitude = 0.0f; // Above 0, every model waves by up to this fraction of its size and its BVH is refitted each frame (ray traced only, the raster vertex buffers keep the rest pose)
+inline bool showRayPacketBenchmark = false; // Time scalar, SSE and AVX2 CPU ray packets on camera and shadow rays for each model
+
+inline bool useTLAS = true; // Traverse instances through a top level BVH instead of one by one
+inline bool showTLASBenchmark = false; // Print TLAS build, refit and traversal cost for 10 to 10k instances at startup
+inline int tlasBenchmarkInstanceCount = 0; // Extra static teapots in the default scene, to time TLAS traversal on the GPU
+
+inline bool renderCpuReference = false; // Also trace every frame with CpuTracer, save it as PNG and log its rays per second
+inline std::string cpuReferenceDirectory = "Resources/Captures/";
@@ -0,0 +1,343 @@
+#pragma once
+#include <vector>
+#include <string>
+#include <sstream>
+#include <cfloat>
+#include "../../Vulkan/VulkanTypes.h"
+#include "../Systems/TaskScheduler.h"
+#include "RayIntersection.h"
+
+namespace Engine
+{
+	// Quality and traversal numbers of one binary BVH, written as JSON so builder changes can be compared
+	// across runs. Node links must be local, leaves address the triangles passed in.
+	class BVHStatistics
+	{
+	public:
+		struct RaySet
+		{
+			std::string name;
+			int rays = 0;
+			int hits = 0;
+			long long nodesVisited = 0; // Nodes whose box test passed
+			long long boxTests = 0;
+			long long triangleTests = 0;
+			bool anyHit = false;        // Stops at the first hit before the ray end, like a shadow ray
+		};
+
+		std::string modelName;
+		std::string builderName;
+		int nodeCount = 0;
+		int leafCount = 0;
+		int triangleReferences = 0;
+		int sourceTriangles = 0;
+		int maxDepth = 0;
+		double averageLeafDepth = 0.0;
+		double averageLeafSize = 0.0;
+		float sahCost = 0.0f;
+		float epo = 0.0f;
+		std::vector<int> leafDepthHistogram; // Leaves per depth, the root being depth 0
+		std::vector<int> leafSizeHistogram;  // Leaves per triangle count
+		std::vector<std::pair<std::string, size_t>> bytes; // Buffer footprints, filled by the caller
+		std::vector<RaySet> raySets;
+
+		// Tree shape, SAH cost relative to one triangle test and EPO (effective parent overlap, Aila et al. 2013).
+		// EPO is the surface area of triangles inside a node box that belong to other subtrees, weighted like
+		// the SAH terms and divided by the total triangle area. Spatial split references count with their part
+		// inside their leaf box.
+		void computeTreeStatistics(const std::vector<BVHNode>& nodes, int root, const std::vector<Triangle>& triangles, float traversalCost, float intersectionCost)
+		{
+			nodeCount = static_cast<int>(nodes.size());
+			triangleReferences = static_cast<int>(triangles.size());
+			if (root < 0 || root >= nodeCount) return;
+
+			std::vector<bool> seen(triangles.size(), false);
+			sourceTriangles = 0;
+			for (const Triangle& tri : triangles)
+			{
+				size_t source = static_cast<size_t>(tri.centroid.w);
+				if (source >= seen.size()) seen.resize(source + 1, false);
+				sourceTriangles += !seen[source];
+				seen[source] = true;
+			}
+
+			// Step 1: preorder walk for depths, subtree ranges and the SAH sum
+			std::vector<int> order;                      // Nodes in preorder
+			std::vector<int> preorderIndex(nodes.size(), -1);
+			std::vector<int> subtreeEnd(nodes.size(), 0); // One past the last preorder index of the subtree
+			std::vector<std::pair<int, int>> stack = { { root, 0 } };
+			float rootArea = nodes[root].surfaceArea();
+			double sah = 0.0;
+			long long leafDepthSum = 0;
+			leafCount = 0;
+			maxDepth = 0;
+			leafDepthHistogram.clear();
+			leafSizeHistogram.clear();
+			while (!stack.empty())
+			{
+				auto [index, depth] = stack.back();
+				stack.pop_back();
+				preorderIndex[index] = static_cast<int>(order.size());
+				order.push_back(index);
+				maxDepth = std::max(maxDepth, depth);
+
+				const BVHNode& node = nodes[index];
+				if (node.isLeaf())
+				{
+					leafCount++;
+					leafDepthSum += depth;
+					if (static_cast<int>(leafDepthHistogram.size()) <= depth) leafDepthHistogram.resize(depth + 1, 0);
+					leafDepthHistogram[depth]++;
+					if (static_cast<int>(leafSizeHistogram.size()) <= node.triangleCount) leafSizeHistogram.resize(node.triangleCount + 1, 0);
+					leafSizeHistogram[node.triangleCount]++;
+					sah += intersectionCost * node.triangleCount * node.surfaceArea();
+					continue;
+				}
+
+				sah += traversalCost * node.surfaceArea();
+				stack.push_back({ node.right, depth + 1 });
+				stack.push_back({ node.left, depth + 1 });
+			}
+			for (int i = static_cast<int>(order.size()) - 1; i >= 0; --i)
+			{
+				const BVHNode& node = nodes[order[i]];
+				subtreeEnd[order[i]] = node.isLeaf() ? i + 1 : std::max(subtreeEnd[node.left], subtreeEnd[node.right]);
+			}
+
+			sahCost = rootArea > 0.0f ? static_cast<float>(sah / rootArea) : 0.0f;
+			averageLeafDepth = leafCount > 0 ? double(leafDepthSum) / leafCount : 0.0;
+			averageLeafSize = leafCount > 0 ? double(triangleReferences) / leafCount : 0.0;
+
+			// Step 2: total triangle area, each reference clipped to its leaf box
+			double totalArea = 0.0;
+			for (int index : order)
+			{
+				const BVHNode& leaf = nodes[index];
+				if (!leaf.isLeaf()) continue;
+				for (int i = leaf.firstTriangle; i < leaf.firstTriangle + leaf.triangleCount; ++i)
+				{
+					totalArea += clippedArea(triangles[i], leaf.boundMin, leaf.boundMax);
+				}
+			}
+
+			// Step 3: per node, the leaves of other subtrees whose triangles reach into its box
+			std::vector<double> overlap(order.size(), 0.0);
+			parallelFor(0, static_cast<int>(order.size()), 64, [&](int begin, int end)
+				{
+					std::vector<int> queryStack;
+					for (int i = begin; i < end; ++i)
+					{
+						const BVHNode& node = nodes[order[i]];
+						int subtreeBegin = i;
+						int subtreeLast = subtreeEnd[order[i]];
+						double area = 0.0;
+
+						queryStack.assign(1, root);
+						while (!queryStack.empty())
+						{
+							int otherIndex = queryStack.back();
+							queryStack.pop_back();
+							int otherOrder = preorderIndex[otherIndex];
+							if (otherOrder >= subtreeBegin && otherOrder < subtreeLast) continue;
+
+							const BVHNode& other = nodes[otherIndex];
+							glm::vec3 boxMin = glm::max(node.boundMin, other.boundMin);
+							glm::vec3 boxMax = glm::min(node.boundMax, other.boundMax);
+							if (boxMin.x > boxMax.x || boxMin.y > boxMax.y || boxMin.z > boxMax.z) continue;
+
+							if (!other.isLeaf())
+							{
+								queryStack.push_back(other.left);
+								queryStack.push_back(other.right);
+								continue;
+							}
+
+							for (int t = other.firstTriangle; t < other.firstTriangle + other.triangleCount; ++t)
+							{
+								area += clippedArea(triangles[t], boxMin, boxMax);
+							}
+						}
+
+						float cost = node.isLeaf() ? intersectionCost * node.triangleCount : traversalCost;
+						overlap[i] = cost * area;
+					}
+				});
+
+			double overlapSum = 0.0;
+			for (double area : overlap) overlapSum += area;
+			epo = totalArea > 0.0 ? static_cast<float>(overlapSum / totalArea) : 0.0f;
+		}
+
+		// Traces rays front to back through the binary BVH, maxDistances may be empty for unbounded rays.
+		// Closest hit distances, FLT_MAX for misses, go to hitDistances when it is given.
+		void traceRaySet(const std::string& name, const std::vector<BVHNode>& nodes, int root, const std::vector<Triangle>& triangles, const std::vector<glm::vec3>& origins, const std::vector<glm::vec3>& directions,
+			const std::vector<float>& maxDistances, bool anyHit, std::vector<float>* hitDistances = nullptr)
+		{
+			RaySet set;
+			set.name = name;
+			set.rays = static_cast<int>(origins.size());
+			set.anyHit = anyHit;
+			if (hitDistances) hitDistances->assign(origins.size(), FLT_MAX);
+
+			for (size_t i = 0; i < origins.size() && root >= 0; ++i)
+			{
+				float tMax = maxDistances.empty() ? FLT_MAX : maxDistances[i];
+				float t = trace(nodes, root, triangles, origins[i], directions[i], tMax, anyHit, set);
+				set.hits += t < tMax;
+				if (hitDistances) (*hitDistances)[i] = t < tMax ? t : FLT_MAX;
+			}
+			raySets.push_back(set);
+		}
+
+		std::string toJson() const
+		{
+			std::ostringstream json;
+			json << "{\n";
+			json << "  \"model\": \"" << escape(modelName) << "\",\n";
+			json << "  \"builder\": \"" << escape(builderName) << "\",\n";
+			json << "  \"nodes\": " << nodeCount << ",\n";
+			json << "  \"leaves\": " << leafCount << ",\n";
+			json << "  \"triangleReferences\": " << triangleReferences << ",\n";
+			json << "  \"sourceTriangles\": " << sourceTriangles << ",\n";
+			json << "  \"sahCost\": " << sahCost << ",\n";
+			json << "  \"epo\": " << epo << ",\n";
+			json << "  \"maxDepth\": " << maxDepth << ",\n";
+			json << "  \"averageLeafDepth\": " << averageLeafDepth << ",\n";
+			json << "  \"averageLeafSize\": " << averageLeafSize << ",\n";
+			json << "  \"leafDepthHistogram\": " << arrayJson(leafDepthHistogram) << ",\n";
+			json << "  \"leafSizeHistogram\": " << arrayJson(leafSizeHistogram) << ",\n";
+
+			json << "  \"bytes\": {";
+			for (size_t i = 0; i < bytes.size(); ++i)
+			{
+				json << (i ? ", " : " ") << "\"" << escape(bytes[i].first) << "\": " << bytes[i].second;
+			}
+			json << " },\n";
+
+			json << "  \"raySets\": [";
+			for (size_t i = 0; i < raySets.size(); ++i)
+			{
+				const RaySet& set = raySets[i];
+				double rays = std::max(1, set.rays);
+				json << (i ? "," : "") << "\n    { \"name\": \"" << escape(set.name) << "\", \"rays\": " << set.rays << ", \"anyHit\": " << (set.anyHit ? "true" : "false")
+					<< ", \"hits\": " << set.hits << ", \"nodesPerRay\": " << set.nodesVisited / rays << ", \"boxTestsPerRay\": " << set.boxTests / rays
+					<< ", \"trianglesPerRay\": " << set.triangleTests / rays << " }";
+			}
+			json << "\n  ]\n}\n";
+			return json.str();
+		}
+
+	private:
+		static float trace(const std::vector<BVHNode>& nodes, int root, const std::vector<Triangle>& triangles, const glm::vec3& origin, const glm::vec3& direction, float tMax, bool anyHit, RaySet& set)
+		{
+			glm::vec3 inverseDirection = 1.0f / glm::max(glm::abs(direction), glm::vec3(1e-8f)) * glm::sign(direction);
+			float closestT = tMax;
+
+			set.boxTests++;
+			float tNear;
+			if (!intersectBox(nodes[root].boundMin, nodes[root].boundMax, origin, inverseDirection, tNear) || tNear > closestT) return closestT;
+
+			std::vector<std::pair<int, float>> stack = { { root, tNear } };
+			while (!stack.empty())
+			{
+				auto [index, entry] = stack.back();
+				stack.pop_back();
+				if (entry > closestT) continue;
+
+				const BVHNode& node = nodes[index];
+				set.nodesVisited++;
+				if (node.isLeaf())
+				{
+					for (int i = node.firstTriangle; i < node.firstTriangle + node.triangleCount; ++i)
+					{
+						set.triangleTests++;
+						float t;
+						if (intersectTriangle(triangles[i], origin, direction, t) && t < closestT)
+						{
+							closestT = t;
+							if (anyHit) return closestT;
+						}
+					}
+					continue;
+				}
+
+				// Step 1: the nearer child is visited first, the other one waits on the stack
+				float leftT, rightT;
+				set.boxTests += 2;
+				bool hitLeft = intersectBox(nodes[node.left].boundMin, nodes[node.left].boundMax, origin, inverseDirection, leftT) && leftT <= closestT;
+				bool hitRight = intersectBox(nodes[node.right].boundMin, nodes[node.right].boundMax, origin, inverseDirection, rightT) && rightT <= closestT;
+				if (hitLeft && hitRight)
+				{
+					bool leftFirst = leftT <= rightT;
+					stack.push_back(leftFirst ? std::make_pair(node.right, rightT) : std::make_pair(node.left, leftT));
+					stack.push_back(leftFirst ? std::make_pair(node.left, leftT) : std::make_pair(node.right, rightT));
+				}
+				else if (hitLeft) stack.push_back({ node.left, leftT });
+				else if (hitRight) stack.push_back({ node.right, rightT });
+			}
+
+			return closestT;
+		}
+
+		// Area of the part of the triangle inside the box, Sutherland–Hodgman against the six box planes
+		static double clippedArea(const Triangle& tri, const glm::vec3& boxMin, const glm::vec3& boxMax)
+		{
+			glm::vec3 polygon[9] = { glm::vec3(tri.v0), glm::vec3(tri.v1), glm::vec3(tri.v2) };
+			glm::vec3 clipped[9];
+			int count = 3;
+			for (int plane = 0; plane < 6 && count > 0; ++plane)
+			{
+				int axis = plane / 2;
+				bool upper = plane % 2 == 1;
+				float bound = upper ? boxMax[axis] : boxMin[axis];
+				auto inside = [&](const glm::vec3& p) { return upper ? p[axis] <= bound : p[axis] >= bound; };
+
+				int clippedCount = 0;
+				for (int i = 0; i < count; ++i)
+				{
+					const glm::vec3& current = polygon[i];
+					const glm::vec3& next = polygon[(i + 1) % count];
+					bool currentInside = inside(current);
+					if (currentInside) clipped[clippedCount++] = current;
+					if (currentInside != inside(next))
+					{
+						float s = (bound - current[axis]) / (next[axis] - current[axis]);
+						glm::vec3 crossing = current + (next - current) * s;
+						crossing[axis] = bound;
+						clipped[clippedCount++] = crossing;
+					}
+				}
+				count = clippedCount;
+				std::copy(clipped, clipped + count, polygon);
+			}
+
+			glm::dvec3 doubleArea(0.0);
+			for (int i = 1; i + 1 < count; ++i)
+			{
+				doubleArea += glm::cross(glm::dvec3(polygon[i] - polygon[0]), glm::dvec3(polygon[i + 1] - polygon[0]));
+			}
+			return 0.5 * glm::length(doubleArea);
+		}
+
+		template <typename T>
+		static std::string arrayJson(const std::vector<T>& values)
+		{
+			std::ostringstream json;
+			json << "[";
+			for (size_t i = 0; i < values.size(); ++i) json << (i ? ", " : "") << values[i];
+			json << "]";
+			return json.str();
+		}
+
+		static std::string escape(const std::string& text)
+		{
+			std::string escaped;
+			for (char c : text)
+			{
+				if (c == '"' || c == '\\') escaped += '\\';
+				escaped += c;
+			}
+			return escaped;
+		}
+	};
+}
@@ -0,0 +1,259 @@
+#pragma once
+#include <vector>
+#include <cfloat>
+#include "../../Vulkan/VulkanTypes.h"
+#include "WideBVH.h"
+#include "RayIntersection.h"
+
+namespace Engine
+{
+	// Depth first layout of a binary BVH. Every internal node is directly followed by its left child and
+	// the left child subtree, so a CompactBVHNode only keeps the right child index next to its bounds and
+	// a traversal entering the left child usually reads the cache line it already has.
+	// The compact nodes mirror the binary nodes index for index, the instances need no second root.
+	// Internal nodes store the axis that separates their children best and whether the left child lies
+	// on its upper side as a negative triangle count, so traversals visit the nearer child first.
+	class CompactBVH
+	{
+	public:
+		// Set associative LRU model of one GPU L1, fed with the byte offsets of the node fetches
+		struct CacheModel
+		{
+			static constexpr int lineBytes = 128;
+
+			int setCount;
+			int ways;
+			std::vector<uint64_t> lines; // setCount * ways line addresses, most recently used first, ~0 for empty
+			long long accesses = 0;
+			long long misses = 0;
+
+			CacheModel(int cacheBytes = 64 * 1024, int ways = 4)
+				: setCount(std::max(1, cacheBytes / (lineBytes * ways))), ways(ways), lines(static_cast<size_t>(setCount) * ways, ~0ull)
+			{
+			}
+
+			void access(size_t byteOffset, size_t bytes)
+			{
+				for (uint64_t line = byteOffset / lineBytes; line <= (byteOffset + bytes - 1) / lineBytes; ++line)
+				{
+					accesses++;
+					uint64_t* set = lines.data() + (line % setCount) * ways;
+					int way = 0;
+					while (way < ways - 1 && set[way] != line) ++way;
+					misses += set[way] != line;
+					for (; way > 0; --way) set[way] = set[way - 1]; // The hit or the evicted line moves to the front
+					set[0] = line;
+				}
+			}
+		};
+
+		// Rewrites nodes in depth first order with the root at 0 and returns the new root. Internal nodes keep
+		// explicit links so every BVHNode consumer still works, the left one always being the next node.
+		static int reorderDepthFirst(std::vector<BVHNode>& nodes, int root, bool largerChildFirst)
+		{
+			if (root < 0 || root >= static_cast<int>(nodes.size())) return root;
+
+			std::vector<BVHNode> ordered;
+			ordered.reserve(nodes.size());
+
+			// Right children waiting for a place, with the new index of the parent that links to them
+			std::vector<std::pair<int, int>> stack = { { root, -1 } };
+			while (!stack.empty())
+			{
+				auto [index, parent] = stack.back();
+				stack.pop_back();
+				if (parent >= 0) ordered[parent].right = static_cast<int>(ordered.size());
+
+				// Step 1: walk down the left spine, the right children are placed once it ends in a leaf
+				while (true)
+				{
+					BVHNode node = nodes[index];
+					int newIndex = static_cast<int>(ordered.size());
+					if (node.isLeaf())
+					{
+						node.left = -1;
+						node.right = -1;
+						ordered.push_back(node);
+						break;
+					}
+
+					// Step 2: the child a random ray most likely enters goes next to its parent
+					int first = node.left;
+					int second = node.right;
+					if (largerChildFirst && nodes[second].surfaceArea() > nodes[first].surfaceArea()) std::swap(first, second);
+
+					node.left = newIndex + 1;
+					node.right = -1;
+					ordered.push_back(node);
+					stack.push_back({ second, newIndex });
+					index = first;
+				}
+			}
+
+			nodes = std::move(ordered);
+			return 0;
+		}
+
+		// True when a preorder walk from root meets every node exactly at its index, left child first
+		static bool validateDepthFirst(const std::vector<BVHNode>& nodes, int root)
+		{
+			if (root < 0 || root >= static_cast<int>(nodes.size()))
+			{
+				printf("Depth first root %d out of range\n", root);
+				return false;
+			}
+
+			int expected = root;
+			std::vector<int> stack = { root };
+			while (!stack.empty())
+			{
+				int index = stack.back();
+				stack.pop_back();
+				if (index != expected || index >= static_cast<int>(nodes.size()))
+				{
+					printf("Node %d is not in depth first order, expected node %d\n", index, expected);
+					return false;
+				}
+				expected++;
+
+				const BVHNode& node = nodes[index];
+				if (node.isLeaf()) continue;
+				if (node.left != index + 1)
+				{
+					printf("Left child of node %d is %d, not the next node\n", index, node.left);
+					return false;
+				}
+				stack.push_back(node.right);
+				stack.push_back(node.left);
+			}
+
+			if (expected != static_cast<int>(nodes.size()))
+			{
+				printf("%zd nodes are not reachable from root %d\n", nodes.size() - expected, root);
+				return false;
+			}
+			return true;
+		}
+
+		// -1 - (axis | leftIsUpper << 2), the triangle count of internal compact nodes
+		static int encodeSplit(const BVHNode& left, const BVHNode& right)
+		{
+			glm::vec3 offset = (right.boundMin + right.boundMax) - (left.boundMin + left.boundMax);
+			glm::vec3 distance = glm::abs(offset);
+			int axis = distance.x > distance.y && distance.x > distance.z ? 0 : (distance.y > distance.z ? 1 : 2);
+			return -1 - (axis | (offset[axis] < 0.0f ? 4 : 0));
+		}
+
+		// Compact copy of depth first nodes whose links are offset by nodeOffset, written from there on
+		static void compress(const std::vector<BVHNode>& nodes, std::vector<CompactBVHNode>& compactNodes, size_t nodeOffset)
+		{
+			if (compactNodes.size() < nodeOffset + nodes.size()) compactNodes.resize(nodeOffset + nodes.size());
+			for (size_t i = 0; i < nodes.size(); ++i)
+			{
+				const BVHNode& node = nodes[i];
+				CompactBVHNode& compact = compactNodes[nodeOffset + i];
+				compact.boundMin = node.boundMin;
+				compact.boundMax = node.boundMax;
+				if (node.isLeaf())
+				{
+					compact.rightOrFirstTriangle = node.firstTriangle;
+					compact.triangleCount = node.triangleCount;
+					continue;
+				}
+				compact.rightOrFirstTriangle = node.right;
+				compact.triangleCount = encodeSplit(nodes[node.left - nodeOffset], nodes[node.right - nodeOffset]);
+			}
+		}
+
+		static float traverse(const std::vector<CompactBVHNode>& compactNodes, int root, const std::vector<Triangle>& triangles, const glm::vec3& origin, const glm::vec3& direction, WideBVH::TraversalStats& stats, CacheModel* cache = nullptr)
+		{
+			return traverseWith(compactNodes, root, [&](int index, float& t) { return intersectTriangle(triangles[index], origin, direction, t); }, origin, direction, stats, cache);
+		}
+
+		// Closest hit in the same order as traceInstanceCompact in compute.glsl: nearer child first, the
+		// other one goes on the stack. intersectTriangleAt(index, t) tests one triangle, so the geometry format can vary.
+		template <typename IntersectTriangleAt>
+		static float traverseWith(const std::vector<CompactBVHNode>& compactNodes, int root, IntersectTriangleAt&& intersectTriangleAt, const glm::vec3& origin, const glm::vec3& direction, WideBVH::TraversalStats& stats, CacheModel* cache = nullptr)
+		{
+			float closestT = FLT_MAX;
+			if (root < 0) return closestT;
+
+			glm::vec3 inverseDirection = safeInverse(direction);
+			int stack[WideBVH::stackSize];
+			int stackIndex = 0;
+			int nodeIndex = root;
+			while (true)
+			{
+				const CompactBVHNode& node = compactNodes[nodeIndex];
+				stats.nodeFetches++;
+				stats.boxTests++;
+				if (cache) cache->access(nodeIndex * sizeof(CompactBVHNode), sizeof(CompactBVHNode));
+
+				float tNear;
+				if (intersectBox(node.boundMin, node.boundMax, origin, inverseDirection, tNear) && tNear <= closestT)
+				{
+					if (node.triangleCount < 0)
+					{
+						int split = -1 - node.triangleCount;
+						bool leftFirst = (direction[split & 3] < 0.0f) == ((split & 4) != 0);
+						int left = nodeIndex + 1;
+						if (stackIndex < WideBVH::stackSize) stack[stackIndex++] = leftFirst ? node.rightOrFirstTriangle : left;
+						nodeIndex = leftFirst ? left : node.rightOrFirstTriangle;
+						continue;
+					}
+
+					for (int i = node.rightOrFirstTriangle; i < node.rightOrFirstTriangle + node.triangleCount; ++i)
+					{
+						stats.triangleTests++;
+						float t;
+						if (intersectTriangleAt(i, t) && t < closestT) closestT = t;
+					}
+				}
+
+				if (stackIndex == 0) break;
+				nodeIndex = stack[--stackIndex];
+			}
+
+			return closestT;
+		}
+
+		// Closest hit in the same order as traceInstance in compute.glsl, both children pushed, right popped first
+		static float traverseBinary(const std::vector<BVHNode>& nodes, int root, const std::vector<Triangle>& triangles, const glm::vec3& origin, const glm::vec3& direction, WideBVH::TraversalStats& stats, CacheModel* cache = nullptr)
+		{
+			float closestT = FLT_MAX;
+			if (root < 0) return closestT;
+
+			glm::vec3 inverseDirection = safeInverse(direction);
+			int stack[WideBVH::stackSize];
+			int stackIndex = 0;
+			stack[stackIndex++] = root;
+			while (stackIndex > 0)
+			{
+				int nodeIndex = stack[--stackIndex];
+				const BVHNode& node = nodes[nodeIndex];
+				stats.nodeFetches++;
+				stats.boxTests++;
+				if (cache) cache->access(nodeIndex * sizeof(BVHNode), sizeof(BVHNode));
+
+				float tNear;
+				if (!intersectBox(node.boundMin, node.boundMax, origin, inverseDirection, tNear) || tNear > closestT) continue;
+
+				if (!node.isLeaf())
+				{
+					if (stackIndex < WideBVH::stackSize) stack[stackIndex++] = node.left;
+					if (stackIndex < WideBVH::stackSize) stack[stackIndex++] = node.right;
+					continue;
+				}
+
+				for (int i = node.firstTriangle; i < node.firstTriangle + node.triangleCount; ++i)
+				{
+					stats.triangleTests++;
+					float t;
+					if (intersectTriangle(triangles[i], origin, direction, t) && t < closestT) closestT = t;
+				}
+			}
+
+			return closestT;
+		}
+	};
+}
@@ -0,0 +1,525 @@
+#pragma once
+#include <atomic>
+#include "../../Vulkan/VulkanTypes.h"
+#include "../Systems/TaskScheduler.h"
+#include "RayPacket.h"
+#include "RayIntersection.h"
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define ENGINE_CPU_TRACER_SSE 1
+#endif
+
+#define STB_IMAGE_WRITE_IMPLEMENTATION
+#include <stb_image_write.h>
+
+namespace Engine
+{
+	// CPU port of traceRay2, isInShadow and rayTrace from compute.glsl. It reads the arrays the compute pass
+	// gets (binary BVH nodes with the TLAS appended, triangles, instances and the camera), so frames can be
+	// rendered and compared on machines without a GPU. Wide BVHs are not read: they return the same hits.
+	class CpuTracer
+	{
+	private:
+		static constexpr float epsilon = rayBoxEpsilon;
+		static constexpr int stackSize = 64;             // Same as traceInstance, deeper nodes are dropped like on the GPU
+		static constexpr int tileSize = 16;              // Matches the compute local size
+
+		struct Ray
+		{
+			glm::vec3 origin;
+			glm::vec3 direction;
+			glm::vec3 inverseDirection;
+		};
+
+		struct HitInfo
+		{
+			float t = 1e20f;
+			glm::vec3 position = glm::vec3(0.0f);
+			glm::vec3 normal = glm::vec3(0.0f);
+			bool hit = false;
+		};
+
+		const std::vector<BVHNode>& nodes;
+		const std::vector<Triangle>& triangles;
+		const std::vector<BVHInstance>& instances;
+		int tlasRootIndex;
+
+		// Slab test of one box, entry and exit distances of the ray
+		static bool intersectAABB(const Ray& ray, const BVHNode& node, float& entry)
+		{
+#if ENGINE_CPU_TRACER_SSE
+			// boundMin and boundMax are followed by their pad, so each loads as one 4 lane register
+			__m128 origin = _mm_set_ps(0.0f, ray.origin.z, ray.origin.y, ray.origin.x);
+			__m128 inverseDirection = _mm_set_ps(0.0f, ray.inverseDirection.z, ray.inverseDirection.y, ray.inverseDirection.x);
+			__m128 t0 = _mm_mul_ps(_mm_sub_ps(_mm_loadu_ps(&node.boundMin.x), origin), inverseDirection);
+			__m128 t1 = _mm_mul_ps(_mm_sub_ps(_mm_loadu_ps(&node.boundMax.x), origin), inverseDirection);
+			__m128 tNear = _mm_min_ps(t0, t1);
+			__m128 tFar = _mm_max_ps(t0, t1);
+
+			// Reduce x, y and z only, the pad lane is ignored
+			__m128 nearYZ = _mm_max_ss(_mm_shuffle_ps(tNear, tNear, _MM_SHUFFLE(1, 1, 1, 1)), _mm_shuffle_ps(tNear, tNear, _MM_SHUFFLE(2, 2, 2, 2)));
+			__m128 farYZ = _mm_min_ss(_mm_shuffle_ps(tFar, tFar, _MM_SHUFFLE(1, 1, 1, 1)), _mm_shuffle_ps(tFar, tFar, _MM_SHUFFLE(2, 2, 2, 2)));
+			entry = _mm_cvtss_f32(_mm_max_ss(tNear, nearYZ));
+			float exit = _mm_cvtss_f32(_mm_min_ss(tFar, farYZ));
+			return entry <= exit + epsilon && exit >= 0.0f;
+#else
+			return intersectBox(node.boundMin, node.boundMax, ray.origin, ray.inverseDirection, entry);
+#endif
+		}
+
+		// intersectTriangle plus the face normal, as intersectRayTriangle
+		static bool intersectRayTriangle(const Ray& ray, const Triangle& tri, float& t, glm::vec3& normal)
+		{
+			if (!intersectTriangle(tri, ray.origin, ray.direction, t)) return false;
+
+			normal = glm::normalize(glm::cross(glm::vec3(tri.v1 - tri.v0), glm::vec3(tri.v2 - tri.v0)));
+			return true;
+		}
+
+		// Closest hit against one instance BLAS. Both children are tested before descending into the nearer
+		// one, which finds the same hits as the shader's pop-then-test order with fewer box tests.
+		void traceInstance(const Ray& ray, int instanceIndex, HitInfo& closestHit, uint64_t& boxTests) const
+		{
+			const BVHInstance& instance = instances[instanceIndex];
+
+			Ray localRay;
+			localRay.origin = glm::vec3(instance.inverseModelMatrix * glm::vec4(ray.origin, 1.0f));
+			localRay.direction = glm::vec3(instance.inverseModelMatrix * glm::vec4(ray.direction, 0.0f));
+			localRay.inverseDirection = safeInverse(localRay.direction);
+
+			float entry;
+			int nodeIndex = instance.bvhRootNodeIndex;
+			++boxTests;
+			if (nodeIndex < 0 || !intersectAABB(localRay, nodes[nodeIndex], entry) || entry > closestHit.t) return;
+
+			int stack[stackSize];
+			float stackEntry[stackSize];
+			int stackIndex = 0;
+
+			while (true)
+			{
+				const BVHNode& node = nodes[nodeIndex];
+				if (node.triangleCount <= 0)
+				{
+					float leftEntry, rightEntry;
+					bool hitLeft = intersectAABB(localRay, nodes[node.left], leftEntry) && leftEntry <= closestHit.t;
+					bool hitRight = intersectAABB(localRay, nodes[node.right], rightEntry) && rightEntry <= closestHit.t;
+					boxTests += 2;
+
+					if (hitLeft && hitRight)
+					{
+						bool leftFirst = leftEntry <= rightEntry;
+						if (stackIndex < stackSize)
+						{
+							stack[stackIndex] = leftFirst ? node.right : node.left;
+							stackEntry[stackIndex++] = leftFirst ? rightEntry : leftEntry;
+						}
+						nodeIndex = leftFirst ? node.left : node.right;
+						continue;
+					}
+					if (hitLeft || hitRight)
+					{
+						nodeIndex = hitLeft ? node.left : node.right;
+						continue;
+					}
+				}
+				else
+				{
+					int first = instance.triangleOffset + node.firstTriangle;
+					for (int i = first; i < first + node.triangleCount; ++i)
+					{
+						float t;
+						glm::vec3 n;
+						if (intersectRayTriangle(localRay, triangles[i], t, n) && t < closestHit.t)
+						{
+							closestHit.t = t;
+							closestHit.position = glm::vec3(instance.modelMatrix * glm::vec4(localRay.origin + t * localRay.direction, 1.0f));
+							closestHit.hit = true;
+							closestHit.normal = glm::normalize(glm::mat3(instance.modelMatrix) * n);
+						}
+					}
+				}
+
+				// Next pushed node that is still closer than the closest hit
+				nodeIndex = -1;
+				while (stackIndex > 0)
+				{
+					--stackIndex;
+					if (stackEntry[stackIndex] <= closestHit.t)
+					{
+						nodeIndex = stack[stackIndex];
+						break;
+					}
+				}
+				if (nodeIndex < 0) return;
+			}
+		}
+
+		HitInfo traceRay2(const Ray& ray, uint64_t& boxTests) const
+		{
+			HitInfo closestHit;
+
+			if (tlasRootIndex < 0)
+			{
+				for (int i = 0; i < static_cast<int>(instances.size()); ++i)
+				{
+					traceInstance(ray, i, closestHit, boxTests);
+				}
+				return closestHit;
+			}
+
+			// Walk the TLAS in world space, its leaves name the instance to descend into
+			int stack[stackSize];
+			int stackIndex = 0;
+			stack[stackIndex++] = tlasRootIndex;
+
+			Ray worldRay = ray;
+			worldRay.inverseDirection = safeInverse(ray.direction);
+
+			while (stackIndex > 0)
+			{
+				const BVHNode& node = nodes[stack[--stackIndex]];
+				float entry;
+				++boxTests;
+				if (!intersectAABB(worldRay, node, entry) || entry > closestHit.t) continue;
+
+				if (node.triangleCount <= 0)
+				{
+					if (stackIndex < stackSize) stack[stackIndex++] = node.left;
+					if (stackIndex < stackSize) stack[stackIndex++] = node.right;
+					continue;
+				}
+
+				traceInstance(ray, node.firstTriangle, closestHit, boxTests);
+			}
+
+			return closestHit;
+		}
+
+		// Any hit against one instance BLAS, as occludedInstance
+		bool occludedInstance(const Ray& ray, int instanceIndex, float tMax, uint64_t& boxTests) const
+		{
+			const BVHInstance& instance = instances[instanceIndex];
+
+			Ray localRay;
+			localRay.origin = glm::vec3(instance.inverseModelMatrix * glm::vec4(ray.origin, 1.0f));
+			localRay.direction = glm::vec3(instance.inverseModelMatrix * glm::vec4(ray.direction, 0.0f));
+			localRay.inverseDirection = safeInverse(localRay.direction);
+
+			int stack[stackSize];
+			int stackIndex = 0;
+			stack[stackIndex++] = instance.bvhRootNodeIndex;
+
+			while (stackIndex > 0)
+			{
+				int nodeIndex = stack[--stackIndex];
+				if (nodeIndex < 0) continue;
+
+				const BVHNode& node = nodes[nodeIndex];
+				float entry;
+				++boxTests;
+				if (!intersectAABB(localRay, node, entry) || entry > tMax) continue;
+
+				if (node.triangleCount <= 0)
+				{
+					if (stackIndex < stackSize) stack[stackIndex++] = node.left;
+					if (stackIndex < stackSize) stack[stackIndex++] = node.right;
+					continue;
+				}
+
+				int first = instance.triangleOffset + node.firstTriangle;
+				for (int i = first; i < first + node.triangleCount; ++i)
+				{
+					float t;
+					glm::vec3 n;
+					if (intersectRayTriangle(localRay, triangles[i], t, n) && t < tMax) return true;
+				}
+			}
+			return false;
+		}
+
+		// True at the first hit closer than tMax, as traceOcclusion
+		bool traceOcclusion(const Ray& ray, float tMax, uint64_t& boxTests) const
+		{
+			if (tlasRootIndex < 0)
+			{
+				for (int i = 0; i < static_cast<int>(instances.size()); ++i)
+				{
+					if (occludedInstance(ray, i, tMax, boxTests)) return true;
+				}
+				return false;
+			}
+
+			int stack[stackSize];
+			int stackIndex = 0;
+			stack[stackIndex++] = tlasRootIndex;
+
+			Ray worldRay = ray;
+			worldRay.inverseDirection = safeInverse(ray.direction);
+
+			while (stackIndex > 0)
+			{
+				const BVHNode& node = nodes[stack[--stackIndex]];
+				float entry;
+				++boxTests;
+				if (!intersectAABB(worldRay, node, entry) || entry > tMax) continue;
+
+				if (node.triangleCount <= 0)
+				{
+					if (stackIndex < stackSize) stack[stackIndex++] = node.left;
+					if (stackIndex < stackSize) stack[stackIndex++] = node.right;
+					continue;
+				}
+
+				if (occludedInstance(ray, node.firstTriangle, tMax, boxTests)) return true;
+			}
+			return false;
+		}
+
+		bool isInShadow(const glm::vec3& point, const glm::vec3& toLight, float maxDist, uint64_t& boxTests) const
+		{
+			Ray shadowRay;
+			shadowRay.origin = point + 0.1f * toLight;
+			shadowRay.direction = toLight;
+			shadowRay.inverseDirection = 1.0f / shadowRay.direction;
+			return traceOcclusion(shadowRay, maxDist, boxTests);
+		}
+
+		static float rand(const glm::vec2& co)
+		{
+			float value = std::sin(glm::dot(co, glm::vec2(12.9898f, 78.233f))) * 43758.5453f;
+			return value - std::floor(value);
+		}
+
+		// Instances whose TLAS leaf the ray reaches, every instance without a TLAS
+		void collectInstanceCandidates(const Ray& ray, std::vector<int>& candidates) const
+		{
+			if (tlasRootIndex < 0)
+			{
+				for (int i = 0; i < static_cast<int>(instances.size()); ++i) candidates.push_back(i);
+				return;
+			}
+
+			int stack[stackSize];
+			int stackIndex = 0;
+			stack[stackIndex++] = tlasRootIndex;
+
+			Ray worldRay = ray;
+			worldRay.inverseDirection = safeInverse(ray.direction);
+
+			while (stackIndex > 0)
+			{
+				const BVHNode& node = nodes[stack[--stackIndex]];
+				float entry;
+				if (!intersectAABB(worldRay, node, entry)) continue;
+
+				if (node.triangleCount <= 0)
+				{
+					if (stackIndex < stackSize) stack[stackIndex++] = node.left;
+					if (stackIndex < stackSize) stack[stackIndex++] = node.right;
+					continue;
+				}
+
+				candidates.push_back(node.firstTriangle);
+			}
+		}
+
+		// traceRay2 for up to 8 camera rays of neighbouring pixels, each instance BLAS is traversed as one packet
+		void traceRay2Packet(const Ray* rays, int count, HitInfo* hits) const
+		{
+			std::vector<int> candidates;
+			for (int lane = 0; lane < count; ++lane)
+			{
+				hits[lane] = HitInfo();
+				collectInstanceCandidates(rays[lane], candidates);
+			}
+			std::sort(candidates.begin(), candidates.end());
+			candidates.erase(std::unique(candidates.begin(), candidates.end()), candidates.end());
+
+			RayPacketTraversal::RayQuery queries[8];
+			RayPacketTraversal::RayHit results[8];
+			for (int instanceIndex : candidates)
+			{
+				const BVHInstance& instance = instances[instanceIndex];
+				for (int lane = 0; lane < count; ++lane)
+				{
+					queries[lane].origin = glm::vec3(instance.inverseModelMatrix * glm::vec4(rays[lane].origin, 1.0f));
+					queries[lane].direction = glm::vec3(instance.inverseModelMatrix * glm::vec4(rays[lane].direction, 0.0f));
+					queries[lane].tMax = hits[lane].t;
+				}
+
+				RayPacketTraversal traversal(nodes, instance.bvhRootNodeIndex, triangles, instance.triangleOffset);
+				traversal.intersect(queries, count, results, packetIsa);
+
+				for (int lane = 0; lane < count; ++lane)
+				{
+					if (results[lane].triangle < 0) continue;
+
+					const Triangle& tri = triangles[results[lane].triangle];
+					glm::vec3 normal = glm::normalize(glm::cross(glm::vec3(tri.v1 - tri.v0), glm::vec3(tri.v2 - tri.v0)));
+					hits[lane].t = results[lane].t;
+					hits[lane].position = glm::vec3(instance.modelMatrix * glm::vec4(queries[lane].origin + results[lane].t * queries[lane].direction, 1.0f));
+					hits[lane].hit = true;
+					hits[lane].normal = glm::normalize(glm::mat3(instance.modelMatrix) * normal);
+				}
+			}
+		}
+
+		glm::vec3 rayTrace(const Ray& primaryRay, uint64_t& rays, uint64_t& boxTests) const
+		{
+			HitInfo hit = traceRay2(primaryRay, boxTests);
+			return shade(hit, rays, boxTests);
+		}
+
+		// Everything rayTrace does after the camera ray hit
+		glm::vec3 shade(const HitInfo& hit, uint64_t& rays, uint64_t& boxTests) const
+		{
+			glm::vec3 pixelColor(0.0f);
+			++rays;
+			if (!hit.hit) return pixelColor;
+
+			const glm::vec3 lightPosition(1.0f, 10035.0f, 0.0f);
+			const glm::vec3 lightColor(1.0f);
+			const float lightRadius = 1000.0f;
+			const int numShadowSamples = 3;
+			float shadowFactor = 0.0f;
+
+			for (int i = 0; i < numShadowSamples; ++i)
+			{
+				glm::vec2 seed(static_cast<float>(i), glm::dot(glm::vec2(hit.position), glm::vec2(12.9898f, 78.233f)));
+				float angle = (static_cast<float>(i) + rand(seed)) / static_cast<float>(numShadowSamples) * 6.2831853f;
+				float r = std::sqrt(rand(seed + 1.23f));
+				glm::vec2 diskPos = r * glm::vec2(std::cos(angle), std::sin(angle)) * lightRadius;
+
+				glm::vec3 forward = glm::normalize(hit.position - lightPosition);
+				glm::vec3 up = std::abs(glm::dot(forward, glm::vec3(0.0f, 1.0f, 0.0f))) > 0.99f ? glm::vec3(1.0f, 0.0f, 0.0f) : glm::vec3(0.0f, 1.0f, 0.0f);
+				glm::vec3 right = glm::normalize(glm::cross(up, forward));
+				glm::vec3 realUp = glm::normalize(glm::cross(forward, right));
+				glm::vec3 samplePosition = lightPosition + diskPos.x * right + diskPos.y * realUp;
+
+				glm::vec3 toSample = samplePosition - hit.position;
+				float sampleDist = glm::length(toSample);
+				glm::vec3 shadowRayOrigin = hit.position + hit.normal * 0.001f;
+
+				++rays;
+				if (!isInShadow(shadowRayOrigin, glm::normalize(toSample), sampleDist, boxTests))
+				{
+					shadowFactor += 1.0f;
+				}
+			}
+
+			shadowFactor /= static_cast<float>(numShadowSamples) + 1;
+
+			float ndotl = std::max(glm::dot(hit.normal, glm::normalize(lightPosition - hit.position)), 0.0f);
+			pixelColor += lightColor * ndotl * shadowFactor;
+			return pixelColor;
+		}
+
+	public:
+		struct FrameStats
+		{
+			int width = 0;
+			int height = 0;
+			uint64_t rays = 0;     // Camera and shadow rays
+			uint64_t boxTests = 0; // Counted by single ray traversals only
+			double milliseconds = 0.0;
+
+			double megaRaysPerSecond() const
+			{
+				return milliseconds > 0.0 ? rays / (milliseconds * 1000.0) : 0.0;
+			}
+		};
+
+		SimdIsa packetIsa = detectSimdIsa(); // Camera rays of neighbouring pixels are traced as packets, Scalar traces them one by one
+
+		// Nodes must hold the TLAS at the same place as the compute node buffer when tlasRootIndex >= 0
+		CpuTracer(const std::vector<BVHNode>& nodes, const std::vector<Triangle>& triangles, const std::vector<BVHInstance>& instances, int tlasRootIndex = -1)
+			: nodes(nodes),
+			triangles(triangles),
+			instances(instances),
+			tlasRootIndex(tlasRootIndex)
+		{};
+
+		// Renders the frame the compute shader would, 16x16 tiles are spread over every worker
+		FrameStats render(const CameraUBO& camera, int width, int height, std::vector<glm::vec4>& pixels) const
+		{
+			FrameStats stats;
+			stats.width = width;
+			stats.height = height;
+			pixels.assign(size_t(width) * height, glm::vec4(0.0f, 0.0f, 0.0f, 1.0f));
+			if (width <= 0 || height <= 0) return stats;
+
+			SimdIsa isa = std::min(packetIsa, detectSimdIsa());
+			int packetWidth = isa == SimdIsa::AVX2 ? 8 : isa == SimdIsa::SSE ? 4 : 1;
+			int tilesX = (width + tileSize - 1) / tileSize;
+			int tilesY = (height + tileSize - 1) / tileSize;
+			std::atomic<uint64_t> rays{ 0 };
+			std::atomic<uint64_t> boxTests{ 0 };
+
+			auto start = std::chrono::high_resolution_clock::now();
+			parallelFor(0, tilesX * tilesY, 1, [&](int begin, int end)
+				{
+					uint64_t tileRays = 0, tileBoxTests = 0;
+					for (int tile = begin; tile < end; ++tile)
+					{
+						int x0 = (tile % tilesX) * tileSize;
+						int y0 = (tile / tilesX) * tileSize;
+						for (int y = y0; y < std::min(y0 + tileSize, height); ++y)
+						{
+							int xEnd = std::min(x0 + tileSize, width);
+							for (int x = x0; x < xEnd; x += packetWidth)
+							{
+								Ray primaryRays[8];
+								int count = std::min(packetWidth, xEnd - x);
+								for (int lane = 0; lane < count; ++lane)
+								{
+									glm::vec2 uv = (glm::vec2(x + lane, y) + 0.5f) / glm::vec2(width, height) * 2.0f - 1.0f;
+									uv.y = -uv.y;
+
+									primaryRays[lane].origin = glm::vec3(camera.position);
+									primaryRays[lane].direction = glm::normalize(uv.x * glm::vec3(camera.right) + uv.y * glm::vec3(camera.up) + glm::vec3(camera.direction));
+									primaryRays[lane].inverseDirection = 1.0f / primaryRays[lane].direction;
+								}
+
+								if (packetWidth == 1)
+								{
+									pixels[size_t(y) * width + x] = glm::vec4(rayTrace(primaryRays[0], tileRays, tileBoxTests), 1.0f);
+									continue;
+								}
+
+								HitInfo hits[8];
+								traceRay2Packet(primaryRays, count, hits);
+								for (int lane = 0; lane < count; ++lane)
+								{
+									pixels[size_t(y) * width + x + lane] = glm::vec4(shade(hits[lane], tileRays, tileBoxTests), 1.0f);
+								}
+							}
+						}
+					}
+					rays += tileRays;
+					boxTests += tileBoxTests;
+				});
+
+			stats.milliseconds = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+			stats.rays = rays.load();
+			stats.boxTests = boxTests.load();
+			return stats;
+		}
+
+		// Clamped to [0, 1] like the UNORM swap chain shows the storage image
+		static bool writePNG(const std::string& path, const std::vector<glm::vec4>& pixels, int width, int height)
+		{
+			std::vector<uint8_t> bytes(size_t(width) * height * 4);
+			for (size_t i = 0; i < pixels.size(); ++i)
+			{
+				glm::vec4 color = glm::clamp(pixels[i], 0.0f, 1.0f) * 255.0f + 0.5f;
+				for (int channel = 0; channel < 4; ++channel)
+				{
+					bytes[i * 4 + channel] = static_cast<uint8_t>(color[channel]);
+				}
+			}
+			return stbi_write_png(path.c_str(), width, height, 4, bytes.data(), width * 4) != 0;
+		}
+	};
+}
@@ -0,0 +1,73 @@
+#pragma once
+#include "../Game/GameModel.h"
+#include "../Game/GameCamera.h"
+#include "../Game/MeshLoader.h"
+#include "CpuTracer.h"
+
+namespace Engine
+{
+	// Loads one model, builds its BVH and traces it with CpuTracer without a Vulkan device or a window, so
+	// reference images can be made on machines without a GPU. main runs it for --cpu-reference.
+	class HeadlessReference
+	{
+	public:
+		// Loads an OBJ through the mesh cache and builds its BVH into the global buffers, like VulkanModel does
+		static GameModel loadModel(const std::string& modelPath)
+		{
+			std::string modelName = std::filesystem::path(modelPath).stem().string();
+
+			GameModel gameModel;
+			MeshLoader::loadModelWithCache(modelPath, modelName, gameModel.vertices, gameModel.indices);
+			gameModel.setName(modelName);
+			gameModel.createCustomBVH(0);
+			return gameModel;
+		}
+
+		// Traces the model from the front at width x height and writes it as PNG, false when it could not be written
+		static bool renderImage(const std::string& modelPath, const std::string& outputPath, int width, int height)
+		{
+			GameModel gameModel = loadModel(modelPath);
+
+			BVHInstance instance{};
+			instance.modelMatrix = glm::mat4(1.0f);
+			instance.inverseModelMatrix = glm::mat4(1.0f);
+			instance.bvhRootNodeIndex = gameModel.bvhRootNodeIndex;
+			instance.triangleOffset = gameModel.bvhTriangleIndex;
+			instance.triangleCount = static_cast<int>(gameModel.triangles.size());
+			instance.wideRootNodeIndex = gameModel.bvhWideRootNodeIndex;
+			std::vector<BVHInstance> instances = { instance };
+
+			// From the front and above, far enough back for the bounding sphere to fit the 45 degree field of view
+			const BVHNode& root = bvhNodes[gameModel.bvhRootNodeIndex];
+			glm::vec3 center = 0.5f * (root.boundMin + root.boundMax);
+			float radius = 0.5f * glm::length(root.boundMax - root.boundMin);
+			GameCamera camera;
+			camera.position = center + glm::normalize(glm::vec3(0.0f, 0.5f, 1.0f)) * radius * 2.8f;
+			camera.lookAt = center;
+			CameraUBO ubo = camera.computeCameraData(width, height);
+
+			CpuTracer tracer(bvhNodes, bvhTriangles, instances);
+			std::vector<glm::vec4> pixels;
+			CpuTracer::FrameStats stats = tracer.render(ubo, width, height, pixels);
+
+			std::filesystem::path parent = std::filesystem::path(outputPath).parent_path();
+			if (!parent.empty()) std::filesystem::create_directories(parent);
+			if (!CpuTracer::writePNG(outputPath, pixels, stats.width, stats.height))
+			{
+				std::cout << "WARNING: failed to write " << outputPath << std::endl;
+				return false;
+			}
+
+			printf("CPU reference: %s, %dx%d, %.2f M rays in %.0f ms, %.2f Mrays/s -> %s\n", modelPath.c_str(),
+				stats.width, stats.height, stats.rays / 1e6, stats.milliseconds, stats.megaRaysPerSecond(), outputPath.c_str());
+			return true;
+		}
+
+		// Writes the BVH statistics JSON of the model into directory, the same file VulkanModel writes with writeBVHStatistics on
+		static bool writeStatistics(const std::string& modelPath, const std::string& directory)
+		{
+			GameModel gameModel = loadModel(modelPath);
+			return gameModel.writeBVHStatistics(directory);
+		}
+	};
+}
@@ -0,0 +1,82 @@
+#pragma once
+#include <vector>
+#include <algorithm>
+#include "../../Vulkan/VulkanTypes.h"
+
+namespace Engine
+{
+	// Power of a light for importance sampling: intensity times the luminance of its color. The radius only
+	// widens the penumbra in the compute shader, the light it sends stays the same.
+	inline double lightSamplingWeight(const LightInstance& light)
+	{
+		double luminance = 0.2126 * light.color.r + 0.7152 * light.color.g + 0.0722 * light.color.b;
+		return std::max(static_cast<double>(light.intensity), 0.0) * std::max(luminance, 0.0);
+	}
+
+	// Fills the alias table fields of every light, Vose's variant of Walker's alias method. Slot i keeps light i
+	// with aliasProbability and hands over to aliasIndex otherwise, so picking a light in proportion to its weight
+	// takes one uniform slot and one coin flip however many lights there are. Without any weight all lights are
+	// equally likely.
+	inline void buildLightAliasTable(std::vector<LightInstance>& lights)
+	{
+		const size_t count = lights.size();
+		if (count == 0)
+		{
+			return;
+		}
+
+		// Step 1: weights, normalized so the average slot holds 1
+		std::vector<double> weights(count);
+		double total = 0.0;
+		for (size_t i = 0; i < count; ++i)
+		{
+			weights[i] = lightSamplingWeight(lights[i]);
+			total += weights[i];
+		}
+		if (total <= 0.0)
+		{
+			std::fill(weights.begin(), weights.end(), 1.0);
+			total = static_cast<double>(count);
+		}
+
+		std::vector<double> scaled(count);
+		std::vector<int> small;
+		std::vector<int> large;
+		for (size_t i = 0; i < count; ++i)
+		{
+			lights[i].selectionPdf = static_cast<float>(weights[i] / total);
+			scaled[i] = weights[i] * static_cast<double>(count) / total;
+			(scaled[i] < 1.0 ? small : large).push_back(static_cast<int>(i));
+		}
+
+		// Step 2: top every slot below 1 up from one above it
+		while (!small.empty() && !large.empty())
+		{
+			int under = small.back();
+			small.pop_back();
+			int over = large.back();
+
+			lights[under].aliasProbability = static_cast<float>(scaled[under]);
+			lights[under].aliasIndex = over;
+
+			scaled[over] += scaled[under] - 1.0;
+			if (scaled[over] < 1.0)
+			{
+				large.pop_back();
+				small.push_back(over);
+			}
+		}
+
+		// Step 3: what is left is full up to rounding and keeps its own light
+		for (int index : large)
+		{
+			lights[index].aliasProbability = 1.0f;
+			lights[index].aliasIndex = index;
+		}
+		for (int index : small)
+		{
+			lights[index].aliasProbability = 1.0f;
+			lights[index].aliasIndex = index;
+		}
+	}
+}
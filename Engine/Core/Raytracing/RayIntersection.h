@@ -0,0 +1,55 @@
+#pragma once
+#include <cmath>
+#include <algorithm>
+#include "../../Vulkan/VulkanTypes.h"
+
+namespace Engine
+{
+	// Scalar ray tests shared by the CPU traversals, they match the ones in compute.glsl so CPU and GPU hits agree
+	inline constexpr float rayBoxEpsilon = 0.0001f;           // EPSILON in compute.glsl
+	inline constexpr float rayTriangleEpsilon = 0.00000001f;  // SMALL_EPSILON
+
+	// 1 / direction without infinities, zero components become a huge value with their sign kept
+	inline glm::vec3 safeInverse(const glm::vec3& direction)
+	{
+		return 1.0f / glm::max(glm::abs(direction), glm::vec3(1e-8f)) * glm::sign(direction);
+	}
+
+	// Slab test, tNear is the entry distance (negative when the origin is inside)
+	inline bool intersectBox(const glm::vec3& boxMin, const glm::vec3& boxMax, const glm::vec3& origin, const glm::vec3& inverseDirection, float& tNear)
+	{
+		glm::vec3 t0 = (boxMin - origin) * inverseDirection;
+		glm::vec3 t1 = (boxMax - origin) * inverseDirection;
+		glm::vec3 tMin = glm::min(t0, t1);
+		glm::vec3 tMax = glm::max(t0, t1);
+		tNear = std::max(std::max(tMin.x, tMin.y), tMin.z);
+		float tFar = std::min(std::min(tMax.x, tMax.y), tMax.z);
+		return tNear <= tFar + rayBoxEpsilon && tFar >= 0.0f;
+	}
+
+	// Möller–Trumbore on precomputed edges, same as intersectRayTriangleEdges in compute.glsl
+	inline bool intersectRayTriangleEdges(const glm::vec3& v0, const glm::vec3& edge1, const glm::vec3& edge2, const glm::vec3& origin, const glm::vec3& direction, float& t)
+	{
+		glm::vec3 h = glm::cross(direction, edge2);
+		float a = glm::dot(edge1, h);
+		if (std::abs(a) < rayTriangleEpsilon) return false;
+
+		float f = 1.0f / a;
+		glm::vec3 s = origin - v0;
+		float u = f * glm::dot(s, h);
+		if (u < 0.0f || u > 1.0f) return false;
+
+		glm::vec3 q = glm::cross(s, edge1);
+		float v = f * glm::dot(direction, q);
+		if (v < 0.0f || u + v > 1.0f) return false;
+
+		t = f * glm::dot(edge2, q);
+		return t > rayTriangleEpsilon;
+	}
+
+	// Same as intersectRayTriangle in compute.glsl
+	inline bool intersectTriangle(const Triangle& tri, const glm::vec3& origin, const glm::vec3& direction, float& t)
+	{
+		return intersectRayTriangleEdges(glm::vec3(tri.v0), glm::vec3(tri.v1 - tri.v0), glm::vec3(tri.v2 - tri.v0), origin, direction, t);
+	}
+}
@@ -0,0 +1,605 @@
+#pragma once
+#include <random>
+#include "../../Vulkan/VulkanTypes.h"
+#include "../Systems/TaskScheduler.h"
+#include "RayIntersection.h"
+
+#if defined(__x86_64__) || defined(_M_X64)
+#include <immintrin.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+#define ENGINE_RAY_PACKETS_X86 1
+#endif
+
+// MSVC compiles AVX intrinsics anywhere, GCC and Clang need the AVX2 code paths marked and fully inlined
+#if defined(_MSC_VER) && !defined(__clang__)
+#define ENGINE_TARGET_AVX2
+#define ENGINE_FLATTEN
+#else
+#define ENGINE_TARGET_AVX2 __attribute__((target("avx2")))
+#define ENGINE_FLATTEN __attribute__((flatten))
+#endif
+
+namespace Engine
+{
+	enum class SimdIsa
+	{
+		Scalar, // One ray at a time
+		SSE,    // 4 ray packets
+		AVX2    // 8 ray packets
+	};
+
+	inline const char* simdIsaName(SimdIsa isa)
+	{
+		switch (isa)
+		{
+		case SimdIsa::Scalar: return "Scalar";
+		case SimdIsa::SSE: return "SSE";
+		case SimdIsa::AVX2: return "AVX2";
+		}
+		return "Unknown";
+	}
+
+	// Widest packet the running CPU supports, SSE is part of every x64 CPU
+	inline SimdIsa detectSimdIsa()
+	{
+#if ENGINE_RAY_PACKETS_X86
+#if defined(_MSC_VER) && !defined(__clang__)
+		int info[4];
+		__cpuid(info, 0);
+		if (info[0] < 7) return SimdIsa::SSE;
+
+		__cpuid(info, 1);
+		bool osSavesAvx = (info[2] & (1 << 27)) && (info[2] & (1 << 28)) && (_xgetbv(0) & 6) == 6;
+		__cpuidex(info, 7, 0);
+		return osSavesAvx && (info[1] & (1 << 5)) ? SimdIsa::AVX2 : SimdIsa::SSE;
+#else
+		__builtin_cpu_init();
+		return __builtin_cpu_supports("avx2") ? SimdIsa::AVX2 : SimdIsa::SSE;
+#endif
+#else
+		return SimdIsa::Scalar;
+#endif
+	}
+
+#if ENGINE_RAY_PACKETS_X86
+	struct SseLanes
+	{
+		static constexpr int width = 4;
+		__m128 v;
+
+		static SseLanes set1(float value) { return { _mm_set1_ps(value) }; }
+		static SseLanes load(const float* values) { return { _mm_loadu_ps(values) }; }
+		void store(float* values) const { _mm_storeu_ps(values, v); }
+
+		// All bits set in the lanes named by the low bits of mask
+		static SseLanes fromMask(int mask)
+		{
+			__m128i bits = _mm_setr_epi32(1, 2, 4, 8);
+			return { _mm_castsi128_ps(_mm_cmpeq_epi32(_mm_and_si128(_mm_set1_epi32(mask), bits), bits)) };
+		}
+
+		static int mask(SseLanes a) { return _mm_movemask_ps(a.v); }
+		static SseLanes select(SseLanes condition, SseLanes a, SseLanes b) { return { _mm_or_ps(_mm_and_ps(condition.v, a.v), _mm_andnot_ps(condition.v, b.v)) }; }
+		static SseLanes min(SseLanes a, SseLanes b) { return { _mm_min_ps(a.v, b.v) }; }
+		static SseLanes max(SseLanes a, SseLanes b) { return { _mm_max_ps(a.v, b.v) }; }
+		static SseLanes abs(SseLanes a) { return { _mm_andnot_ps(_mm_set1_ps(-0.0f), a.v) }; }
+
+		friend SseLanes operator+(SseLanes a, SseLanes b) { return { _mm_add_ps(a.v, b.v) }; }
+		friend SseLanes operator-(SseLanes a, SseLanes b) { return { _mm_sub_ps(a.v, b.v) }; }
+		friend SseLanes operator*(SseLanes a, SseLanes b) { return { _mm_mul_ps(a.v, b.v) }; }
+		friend SseLanes operator/(SseLanes a, SseLanes b) { return { _mm_div_ps(a.v, b.v) }; }
+		friend SseLanes operator&(SseLanes a, SseLanes b) { return { _mm_and_ps(a.v, b.v) }; }
+		friend SseLanes operator<(SseLanes a, SseLanes b) { return { _mm_cmplt_ps(a.v, b.v) }; }
+		friend SseLanes operator<=(SseLanes a, SseLanes b) { return { _mm_cmple_ps(a.v, b.v) }; }
+		friend SseLanes operator>(SseLanes a, SseLanes b) { return { _mm_cmpgt_ps(a.v, b.v) }; }
+		friend SseLanes operator>=(SseLanes a, SseLanes b) { return { _mm_cmpge_ps(a.v, b.v) }; }
+	};
+
+	struct Avx2Lanes
+	{
+		static constexpr int width = 8;
+		__m256 v;
+
+		ENGINE_TARGET_AVX2 static Avx2Lanes set1(float value) { return { _mm256_set1_ps(value) }; }
+		ENGINE_TARGET_AVX2 static Avx2Lanes load(const float* values) { return { _mm256_loadu_ps(values) }; }
+		ENGINE_TARGET_AVX2 void store(float* values) const { _mm256_storeu_ps(values, v); }
+
+		ENGINE_TARGET_AVX2 static Avx2Lanes fromMask(int mask)
+		{
+			__m256i bits = _mm256_setr_epi32(1, 2, 4, 8, 16, 32, 64, 128);
+			return { _mm256_castsi256_ps(_mm256_cmpeq_epi32(_mm256_and_si256(_mm256_set1_epi32(mask), bits), bits)) };
+		}
+
+		ENGINE_TARGET_AVX2 static int mask(Avx2Lanes a) { return _mm256_movemask_ps(a.v); }
+		ENGINE_TARGET_AVX2 static Avx2Lanes select(Avx2Lanes condition, Avx2Lanes a, Avx2Lanes b) { return { _mm256_blendv_ps(b.v, a.v, condition.v) }; }
+		ENGINE_TARGET_AVX2 static Avx2Lanes min(Avx2Lanes a, Avx2Lanes b) { return { _mm256_min_ps(a.v, b.v) }; }
+		ENGINE_TARGET_AVX2 static Avx2Lanes max(Avx2Lanes a, Avx2Lanes b) { return { _mm256_max_ps(a.v, b.v) }; }
+		ENGINE_TARGET_AVX2 static Avx2Lanes abs(Avx2Lanes a) { return { _mm256_andnot_ps(_mm256_set1_ps(-0.0f), a.v) }; }
+
+		ENGINE_TARGET_AVX2 friend Avx2Lanes operator+(Avx2Lanes a, Avx2Lanes b) { return { _mm256_add_ps(a.v, b.v) }; }
+		ENGINE_TARGET_AVX2 friend Avx2Lanes operator-(Avx2Lanes a, Avx2Lanes b) { return { _mm256_sub_ps(a.v, b.v) }; }
+		ENGINE_TARGET_AVX2 friend Avx2Lanes operator*(Avx2Lanes a, Avx2Lanes b) { return { _mm256_mul_ps(a.v, b.v) }; }
+		ENGINE_TARGET_AVX2 friend Avx2Lanes operator/(Avx2Lanes a, Avx2Lanes b) { return { _mm256_div_ps(a.v, b.v) }; }
+		ENGINE_TARGET_AVX2 friend Avx2Lanes operator&(Avx2Lanes a, Avx2Lanes b) { return { _mm256_and_ps(a.v, b.v) }; }
+		ENGINE_TARGET_AVX2 friend Avx2Lanes operator<(Avx2Lanes a, Avx2Lanes b) { return { _mm256_cmp_ps(a.v, b.v, _CMP_LT_OQ) }; }
+		ENGINE_TARGET_AVX2 friend Avx2Lanes operator<=(Avx2Lanes a, Avx2Lanes b) { return { _mm256_cmp_ps(a.v, b.v, _CMP_LE_OQ) }; }
+		ENGINE_TARGET_AVX2 friend Avx2Lanes operator>(Avx2Lanes a, Avx2Lanes b) { return { _mm256_cmp_ps(a.v, b.v, _CMP_GT_OQ) }; }
+		ENGINE_TARGET_AVX2 friend Avx2Lanes operator>=(Avx2Lanes a, Avx2Lanes b) { return { _mm256_cmp_ps(a.v, b.v, _CMP_GE_OQ) }; }
+	};
+#endif
+
+	// Closest hit queries against one binary BVH, traced 4 or 8 rays at a time. Box and triangle tests match
+	// intersectAABB and intersectRayTriangle in compute.glsl. Once only a few lanes of a packet still reach a
+	// node, those rays finish the subtree on their own.
+	class RayPacketTraversal
+	{
+	public:
+		struct RayQuery
+		{
+			glm::vec3 origin;
+			float tMax = FLT_MAX; // Only hits closer than this are reported
+			glm::vec3 direction;
+			float pad = 0.0f;
+		};
+
+		struct RayHit
+		{
+			float t = FLT_MAX;  // tMax when nothing closer was hit
+			int triangle = -1; // Index into the triangle array, -1 for a miss
+		};
+
+		struct PacketStats
+		{
+			uint64_t packetNodeVisits = 0; // Nodes reached by a packet with at least one active lane
+			uint64_t activeLanes = 0;      // Summed over those visits
+			uint64_t singleRayTraversals = 0;
+
+			void add(const PacketStats& other)
+			{
+				packetNodeVisits += other.packetNodeVisits;
+				activeLanes += other.activeLanes;
+				singleRayTraversals += other.singleRayTraversals;
+			}
+		};
+
+		float minActiveLaneFraction = 0.25f; // Nodes reached by fewer active lanes than this share are finished one ray at a time
+
+	private:
+		static constexpr float epsilon = rayBoxEpsilon;
+		static constexpr float smallEpsilon = rayTriangleEpsilon;
+		static constexpr int stackSize = 64;
+		static constexpr int maxWidth = 8;
+
+		const std::vector<BVHNode>& nodes;
+		int rootIndex;
+		const std::vector<Triangle>& triangles;
+		int triangleOffset;
+
+		struct alignas(32) PacketData
+		{
+			float origin[3][maxWidth];
+			float direction[3][maxWidth];
+			float inverseDirection[3][maxWidth];
+			float t[maxWidth];
+			int triangle[maxWidth];
+		};
+
+		static int countBits(int mask)
+		{
+			int count = 0;
+			for (; mask; mask &= mask - 1) ++count;
+			return count;
+		}
+
+		// One ray through the subtree below startNode, children are visited near to far
+		void traverseSingle(int startNode, const glm::vec3& origin, const glm::vec3& direction, const glm::vec3& inverseDirection, float& tHit, int& triangleHit) const
+		{
+			int stack[stackSize];
+			float stackEntry[stackSize];
+			int stackIndex = 0;
+
+			float entry;
+			if (!intersectBox(nodes[startNode].boundMin, nodes[startNode].boundMax, origin, inverseDirection, entry) || entry > tHit) return;
+			int nodeIndex = startNode;
+
+			while (true)
+			{
+				const BVHNode& node = nodes[nodeIndex];
+				if (node.triangleCount <= 0)
+				{
+					float leftEntry, rightEntry;
+					bool hitLeft = intersectBox(nodes[node.left].boundMin, nodes[node.left].boundMax, origin, inverseDirection, leftEntry) && leftEntry <= tHit;
+					bool hitRight = intersectBox(nodes[node.right].boundMin, nodes[node.right].boundMax, origin, inverseDirection, rightEntry) && rightEntry <= tHit;
+
+					if (hitLeft && hitRight)
+					{
+						bool leftFirst = leftEntry <= rightEntry;
+						if (stackIndex < stackSize)
+						{
+							stack[stackIndex] = leftFirst ? node.right : node.left;
+							stackEntry[stackIndex++] = leftFirst ? rightEntry : leftEntry;
+						}
+						nodeIndex = leftFirst ? node.left : node.right;
+						continue;
+					}
+					if (hitLeft || hitRight)
+					{
+						nodeIndex = hitLeft ? node.left : node.right;
+						continue;
+					}
+				}
+				else
+				{
+					int first = triangleOffset + node.firstTriangle;
+					for (int i = first; i < first + node.triangleCount; ++i)
+					{
+						float t;
+						if (intersectTriangle(triangles[i], origin, direction, t) && t < tHit)
+						{
+							tHit = t;
+							triangleHit = i;
+						}
+					}
+				}
+
+				nodeIndex = -1;
+				while (stackIndex > 0)
+				{
+					--stackIndex;
+					if (stackEntry[stackIndex] <= tHit)
+					{
+						nodeIndex = stack[stackIndex];
+						break;
+					}
+				}
+				if (nodeIndex < 0) return;
+			}
+		}
+
+		// Möller–Trumbore on every lane in laneMask against one triangle
+		template <class Lanes>
+		static void intersectTrianglePacket(const Lanes origin[3], const Lanes direction[3], const Triangle& tri, int triangleIndex, int laneMask, Lanes& tHit, int* triangleHit)
+		{
+			Lanes v0[3] = { Lanes::set1(tri.v0.x), Lanes::set1(tri.v0.y), Lanes::set1(tri.v0.z) };
+			Lanes edge1[3] = { Lanes::set1(tri.v1.x - tri.v0.x), Lanes::set1(tri.v1.y - tri.v0.y), Lanes::set1(tri.v1.z - tri.v0.z) };
+			Lanes edge2[3] = { Lanes::set1(tri.v2.x - tri.v0.x), Lanes::set1(tri.v2.y - tri.v0.y), Lanes::set1(tri.v2.z - tri.v0.z) };
+
+			// h = cross(direction, edge2)
+			Lanes h[3] = {
+				direction[1] * edge2[2] - direction[2] * edge2[1],
+				direction[2] * edge2[0] - direction[0] * edge2[2],
+				direction[0] * edge2[1] - direction[1] * edge2[0] };
+			Lanes a = edge1[0] * h[0] + edge1[1] * h[1] + edge1[2] * h[2];
+			Lanes f = Lanes::set1(1.0f) / a;
+
+			Lanes s[3] = { origin[0] - v0[0], origin[1] - v0[1], origin[2] - v0[2] };
+			Lanes u = f * (s[0] * h[0] + s[1] * h[1] + s[2] * h[2]);
+
+			// q = cross(s, edge1)
+			Lanes q[3] = {
+				s[1] * edge1[2] - s[2] * edge1[1],
+				s[2] * edge1[0] - s[0] * edge1[2],
+				s[0] * edge1[1] - s[1] * edge1[0] };
+			Lanes v = f * (direction[0] * q[0] + direction[1] * q[1] + direction[2] * q[2]);
+			Lanes t = f * (edge2[0] * q[0] + edge2[1] * q[1] + edge2[2] * q[2]);
+
+			Lanes zero = Lanes::set1(0.0f);
+			Lanes one = Lanes::set1(1.0f);
+			Lanes valid = (Lanes::abs(a) >= Lanes::set1(smallEpsilon)) & (u >= zero) & (u <= one) & (v >= zero) & (u + v <= one)
+				& (t > Lanes::set1(smallEpsilon)) & (t < tHit) & Lanes::fromMask(laneMask);
+
+			int hitMask = Lanes::mask(valid);
+			if (!hitMask) return;
+
+			tHit = Lanes::select(valid, t, tHit);
+			for (int lane = 0; lane < Lanes::width; ++lane)
+			{
+				if (hitMask & (1 << lane)) triangleHit[lane] = triangleIndex;
+			}
+		}
+
+		// Traces the packet in data, laneMask names the lanes that hold a ray
+		template <class Lanes>
+		void tracePacket(PacketData& data, int laneMask, PacketStats& stats) const
+		{
+			Lanes origin[3], direction[3], inverseDirection[3];
+			for (int axis = 0; axis < 3; ++axis)
+			{
+				origin[axis] = Lanes::load(data.origin[axis]);
+				direction[axis] = Lanes::load(data.direction[axis]);
+				inverseDirection[axis] = Lanes::load(data.inverseDirection[axis]);
+			}
+			Lanes tHit = Lanes::load(data.t);
+
+			// Packet wide order: the child whose center lies further along the packet direction is pushed first
+			glm::vec3 packetDirection(0.0f);
+			for (int lane = 0; lane < Lanes::width; ++lane)
+			{
+				if (laneMask & (1 << lane)) packetDirection += glm::vec3(data.direction[0][lane], data.direction[1][lane], data.direction[2][lane]);
+			}
+
+			int singleRayLanes = std::max(1, static_cast<int>(Lanes::width * minActiveLaneFraction));
+			int stack[stackSize];
+			int stackIndex = 0;
+			stack[stackIndex++] = rootIndex;
+
+			while (stackIndex > 0)
+			{
+				int nodeIndex = stack[--stackIndex];
+				const BVHNode& node = nodes[nodeIndex];
+
+				Lanes tNear = Lanes::set1(-FLT_MAX), tFar = Lanes::set1(FLT_MAX);
+				for (int axis = 0; axis < 3; ++axis)
+				{
+					Lanes t0 = (Lanes::set1(node.boundMin[axis]) - origin[axis]) * inverseDirection[axis];
+					Lanes t1 = (Lanes::set1(node.boundMax[axis]) - origin[axis]) * inverseDirection[axis];
+					tNear = Lanes::max(tNear, Lanes::min(t0, t1));
+					tFar = Lanes::min(tFar, Lanes::max(t0, t1));
+				}
+				int mask = Lanes::mask((tNear <= tFar + Lanes::set1(epsilon)) & (tFar >= Lanes::set1(0.0f)) & (tNear <= tHit)) & laneMask;
+				if (!mask) continue;
+
+				int activeLanes = countBits(mask);
+				stats.packetNodeVisits++;
+				stats.activeLanes += activeLanes;
+
+				// Lost coherence, the remaining rays finish this subtree one by one
+				if (activeLanes <= singleRayLanes && Lanes::width > 1)
+				{
+					tHit.store(data.t);
+					for (int lane = 0; lane < Lanes::width; ++lane)
+					{
+						if (!(mask & (1 << lane))) continue;
+						glm::vec3 laneOrigin(data.origin[0][lane], data.origin[1][lane], data.origin[2][lane]);
+						glm::vec3 laneDirection(data.direction[0][lane], data.direction[1][lane], data.direction[2][lane]);
+						glm::vec3 laneInverse(data.inverseDirection[0][lane], data.inverseDirection[1][lane], data.inverseDirection[2][lane]);
+						traverseSingle(nodeIndex, laneOrigin, laneDirection, laneInverse, data.t[lane], data.triangle[lane]);
+						stats.singleRayTraversals++;
+					}
+					tHit = Lanes::load(data.t);
+					continue;
+				}
+
+				if (node.triangleCount > 0)
+				{
+					int first = triangleOffset + node.firstTriangle;
+					for (int i = first; i < first + node.triangleCount; ++i)
+					{
+						intersectTrianglePacket(origin, direction, triangles[i], i, mask, tHit, data.triangle);
+					}
+					continue;
+				}
+
+				const BVHNode& left = nodes[node.left];
+				const BVHNode& right = nodes[node.right];
+				glm::vec3 leftToRight = (right.boundMin + right.boundMax) - (left.boundMin + left.boundMax);
+				bool leftFirst = glm::dot(leftToRight, packetDirection) >= 0.0f;
+				if (stackIndex + 2 <= stackSize)
+				{
+					stack[stackIndex++] = leftFirst ? node.right : node.left;
+					stack[stackIndex++] = leftFirst ? node.left : node.right;
+				}
+			}
+
+			tHit.store(data.t);
+		}
+
+		template <class Lanes>
+		void intersectPackets(const RayQuery* rays, int count, RayHit* hits, PacketStats& stats) const
+		{
+			PacketData data;
+			for (int first = 0; first < count; first += Lanes::width)
+			{
+				int laneCount = std::min(Lanes::width, count - first);
+				for (int lane = 0; lane < Lanes::width; ++lane)
+				{
+					// Unused lanes repeat the last ray and stay masked out
+					const RayQuery& ray = rays[first + std::min(lane, laneCount - 1)];
+					glm::vec3 inverseDirection = safeInverse(ray.direction);
+					for (int axis = 0; axis < 3; ++axis)
+					{
+						data.origin[axis][lane] = ray.origin[axis];
+						data.direction[axis][lane] = ray.direction[axis];
+						data.inverseDirection[axis][lane] = inverseDirection[axis];
+					}
+					data.t[lane] = ray.tMax;
+					data.triangle[lane] = -1;
+				}
+
+				// Rays heading into different octants share few nodes, trace them one by one from the root
+				bool coherent = true;
+				for (int lane = 1; lane < laneCount && coherent; ++lane)
+				{
+					for (int axis = 0; axis < 3; ++axis)
+					{
+						coherent &= (data.direction[axis][lane] < 0.0f) == (data.direction[axis][0] < 0.0f);
+					}
+				}
+
+				if (coherent)
+				{
+					tracePacket<Lanes>(data, (1 << laneCount) - 1, stats);
+				}
+				else
+				{
+					for (int lane = 0; lane < laneCount; ++lane)
+					{
+						glm::vec3 laneOrigin(data.origin[0][lane], data.origin[1][lane], data.origin[2][lane]);
+						glm::vec3 laneDirection(data.direction[0][lane], data.direction[1][lane], data.direction[2][lane]);
+						glm::vec3 laneInverse(data.inverseDirection[0][lane], data.inverseDirection[1][lane], data.inverseDirection[2][lane]);
+						traverseSingle(rootIndex, laneOrigin, laneDirection, laneInverse, data.t[lane], data.triangle[lane]);
+					}
+					stats.singleRayTraversals += laneCount;
+				}
+
+				for (int lane = 0; lane < laneCount; ++lane)
+				{
+					hits[first + lane].t = data.t[lane];
+					hits[first + lane].triangle = data.triangle[lane];
+				}
+			}
+		}
+
+#if ENGINE_RAY_PACKETS_X86
+		ENGINE_TARGET_AVX2 ENGINE_FLATTEN void intersectPacketsAvx2(const RayQuery* rays, int count, RayHit* hits, PacketStats& stats) const
+		{
+			intersectPackets<Avx2Lanes>(rays, count, hits, stats);
+		}
+#endif
+
+	public:
+		// Triangles of this BVH start at triangleOffset, like BVHInstance::triangleOffset on the GPU
+		RayPacketTraversal(const std::vector<BVHNode>& nodes, int rootIndex, const std::vector<Triangle>& triangles, int triangleOffset = 0)
+			: nodes(nodes),
+			rootIndex(rootIndex),
+			triangles(triangles),
+			triangleOffset(triangleOffset)
+		{};
+
+		// Closest hits of count rays on the calling thread, packed in the order given. Asking for a wider ISA
+		// than the CPU has runs the widest one it supports.
+		void intersect(const RayQuery* rays, int count, RayHit* hits, SimdIsa isa, PacketStats* stats = nullptr) const
+		{
+			PacketStats localStats;
+			isa = std::min(isa, detectSimdIsa());
+			if (rootIndex < 0) isa = SimdIsa::Scalar;
+
+			switch (isa)
+			{
+#if ENGINE_RAY_PACKETS_X86
+			case SimdIsa::AVX2:
+				intersectPacketsAvx2(rays, count, hits, localStats);
+				break;
+			case SimdIsa::SSE:
+				intersectPackets<SseLanes>(rays, count, hits, localStats);
+				break;
+#endif
+			default:
+				for (int i = 0; i < count; ++i)
+				{
+					hits[i].t = rays[i].tMax;
+					hits[i].triangle = -1;
+					if (rootIndex < 0) continue;
+					traverseSingle(rootIndex, rays[i].origin, rays[i].direction, safeInverse(rays[i].direction), hits[i].t, hits[i].triangle);
+				}
+				localStats.singleRayTraversals += count;
+				break;
+			}
+
+			if (stats) stats->add(localStats);
+		}
+
+		// Batch query spread over every worker, grainSize rays per task
+		void intersectParallel(const std::vector<RayQuery>& rays, std::vector<RayHit>& hits, SimdIsa isa, PacketStats* stats = nullptr, int grainSize = 1024) const
+		{
+			hits.resize(rays.size());
+			std::mutex statsMutex;
+			parallelFor(0, static_cast<int>(rays.size()), grainSize, [&](int begin, int end)
+				{
+					PacketStats chunkStats;
+					intersect(rays.data() + begin, end - begin, hits.data() + begin, isa, &chunkStats);
+					if (!stats) return;
+					std::lock_guard<std::mutex> lock(statsMutex);
+					stats->add(chunkStats);
+				});
+		}
+
+		// Coherent camera rays against incoherent shadow rays towards an area light, on one thread per ISA
+		static void runBenchmark(const std::vector<BVHNode>& nodes, int rootIndex, const std::vector<Triangle>& triangles, int triangleOffset, const std::string& name)
+		{
+			if (rootIndex < 0) return;
+			RayPacketTraversal traversal(nodes, rootIndex, triangles, triangleOffset);
+
+			const BVHNode& root = nodes[rootIndex];
+			glm::vec3 center = 0.5f * (root.boundMin + root.boundMax);
+			float radius = 0.5f * glm::length(root.boundMax - root.boundMin);
+
+			// Step 1: 512x512 pinhole camera, each 4x2 pixel block is stored consecutively so packets cover blocks
+			const int resolution = 512;
+			glm::vec3 eye = center + glm::vec3(0.0f, 0.3f, 1.0f) * radius * 2.2f;
+			glm::vec3 forward = glm::normalize(center - eye);
+			glm::vec3 right = glm::normalize(glm::cross(forward, glm::vec3(0.0f, 1.0f, 0.0f)));
+			glm::vec3 up = glm::cross(right, forward);
+			float tanHalfFov = std::tan(glm::radians(25.0f));
+
+			std::vector<RayQuery> primaryRays;
+			primaryRays.reserve(resolution * resolution);
+			for (int blockY = 0; blockY < resolution; blockY += 2)
+			{
+				for (int blockX = 0; blockX < resolution; blockX += 4)
+				{
+					for (int i = 0; i < 8; ++i)
+					{
+						glm::vec2 uv = (glm::vec2(blockX + i % 4, blockY + i / 4) + 0.5f) / float(resolution) * 2.0f - 1.0f;
+						RayQuery ray;
+						ray.origin = eye;
+						ray.direction = glm::normalize(forward + (uv.x * right - uv.y * up) * tanHalfFov);
+						primaryRays.push_back(ray);
+					}
+				}
+			}
+
+			std::vector<RayHit> primaryHits(primaryRays.size());
+			traversal.intersect(primaryRays.data(), static_cast<int>(primaryRays.size()), primaryHits.data(), SimdIsa::Scalar);
+
+			// Step 2: One shadow ray per camera hit to a random point on a spherical light, in random order
+			std::mt19937 random(1234);
+			std::uniform_real_distribution<float> unit(0.0f, 1.0f);
+			glm::vec3 lightCenter = center + glm::vec3(2.0f, 3.0f, 1.0f) * radius;
+			std::vector<RayQuery> shadowRays;
+			for (size_t i = 0; i < primaryRays.size(); ++i)
+			{
+				if (primaryHits[i].triangle < 0) continue;
+
+				glm::vec3 hitPoint = primaryRays[i].origin + primaryRays[i].direction * primaryHits[i].t * 0.9999f;
+				glm::vec3 onLight = lightCenter + glm::normalize(glm::vec3(unit(random), unit(random), unit(random)) * 2.0f - 1.0f + glm::vec3(1e-4f)) * radius;
+				RayQuery ray;
+				ray.origin = hitPoint;
+				ray.direction = glm::normalize(onLight - hitPoint);
+				ray.tMax = glm::length(onLight - hitPoint);
+				shadowRays.push_back(ray);
+			}
+			std::shuffle(shadowRays.begin(), shadowRays.end(), random);
+
+			printf("Ray packets: %s (%zd camera rays, %zd shadow rays, best ISA %s)\n", name.c_str(), primaryRays.size(), shadowRays.size(), simdIsaName(detectSimdIsa()));
+			printf("    %-8s %-7s %9s %9s %13s %15s %11s\n", "Rays", "ISA", "Mrays/s", "Speedup", "Active lanes", "Single ray (%)", "Mismatches");
+
+			auto runSet = [&](const char* label, const std::vector<RayQuery>& rays)
+				{
+					std::vector<RayHit> reference;
+					double scalarSeconds = 0.0;
+					for (SimdIsa isa : { SimdIsa::Scalar, SimdIsa::SSE, SimdIsa::AVX2 })
+					{
+						if (isa > detectSimdIsa()) continue;
+
+						std::vector<RayHit> hits(rays.size());
+						PacketStats stats;
+						auto start = std::chrono::high_resolution_clock::now();
+						traversal.intersect(rays.data(), static_cast<int>(rays.size()), hits.data(), isa, &stats);
+						double seconds = std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - start).count();
+
+						int mismatches = 0;
+						if (reference.empty())
+						{
+							reference = hits;
+							scalarSeconds = seconds;
+						}
+						for (size_t i = 0; i < rays.size(); ++i)
+						{
+							float expected = reference[i].t;
+							mismatches += std::abs(hits[i].t - expected) > 1e-4f * std::max(1.0f, expected) && hits[i].t != expected;
+						}
+
+						double activeLanes = stats.packetNodeVisits ? double(stats.activeLanes) / stats.packetNodeVisits : 1.0;
+						printf("    %-8s %-7s %9.2f %9.2f %13.2f %15.1f %11d\n", label, simdIsaName(isa), rays.size() / seconds / 1e6, scalarSeconds / seconds,
+							activeLanes, 100.0 * stats.singleRayTraversals / std::max<size_t>(rays.size(), 1), mismatches);
+					}
+				};
+
+			runSet("Primary", primaryRays);
+			runSet("Shadow", shadowRays);
+		}
+	};
+}
@@ -0,0 +1,387 @@
+#pragma once
+#include <random>
+#include "../../Vulkan/VulkanTypes.h"
+
+namespace Engine
+{
+	// BVH over the world space bounds of every BVHInstance. It shares the BVHNode layout with the
+	// per model BVHs: a leaf holds one instance, its firstTriangle is the index into bvhInstances.
+	// Parents are always stored before their children, so a reverse sweep refits the whole tree.
+	class TopLevelBVH
+	{
+	private:
+		static constexpr int binCount = 12;
+
+		struct Bounds
+		{
+			glm::vec3 min = glm::vec3(FLT_MAX);
+			glm::vec3 max = glm::vec3(-FLT_MAX);
+
+			void expand(const Bounds& other)
+			{
+				min = glm::min(min, other.min);
+				max = glm::max(max, other.max);
+			}
+
+			float surfaceArea() const
+			{
+				if (min.x > max.x) return 0.0f;
+				glm::vec3 d = max - min;
+				return 2.f * (d.x * d.y + d.y * d.z + d.z * d.x);
+			}
+		};
+
+		std::vector<Bounds> instanceBounds;
+		std::vector<int> instanceIndices; // Instances that have a BLAS, reordered while building
+		std::vector<int> builtBLASRoots; // BLAS root of every instance at the last build, -1 without one
+		float builtSAHCost = 0.0f;
+
+		static Bounds nodeBounds(const BVHNode& node)
+		{
+			Bounds bounds;
+			bounds.min = node.boundMin;
+			bounds.max = node.boundMax;
+			return bounds;
+		}
+
+		// Transforms the BLAS root box by center and absolute extent instead of all eight corners
+		static Bounds worldBounds(const BVHInstance& instance, const BVHNode& blasRoot)
+		{
+			glm::vec3 center = 0.5f * (blasRoot.boundMin + blasRoot.boundMax);
+			glm::vec3 extent = 0.5f * (blasRoot.boundMax - blasRoot.boundMin);
+			glm::vec3 worldCenter = glm::vec3(instance.modelMatrix * glm::vec4(center, 1.0f));
+
+			glm::vec3 worldExtent(0.0f);
+			for (int column = 0; column < 3; ++column)
+			{
+				worldExtent += glm::abs(glm::vec3(instance.modelMatrix[column])) * extent[column];
+			}
+
+			Bounds bounds;
+			bounds.min = worldCenter - worldExtent;
+			bounds.max = worldCenter + worldExtent;
+			return bounds;
+		}
+
+		void setNode(int nodeIndex, const Bounds& bounds)
+		{
+			nodes[nodeIndex].boundMin = bounds.min;
+			nodes[nodeIndex].boundMax = bounds.max;
+		}
+
+		void subdivide(int nodeIndex, int first, int count)
+		{
+			Bounds bounds, centroidBounds;
+			for (int i = first; i < first + count; ++i)
+			{
+				const Bounds& box = instanceBounds[instanceIndices[i]];
+				bounds.expand(box);
+				Bounds centroid;
+				centroid.min = centroid.max = 0.5f * (box.min + box.max);
+				centroidBounds.expand(centroid);
+			}
+			setNode(nodeIndex, bounds);
+
+			if (count == 1)
+			{
+				nodes[nodeIndex].firstTriangle = instanceIndices[first];
+				nodes[nodeIndex].triangleCount = 1;
+				return;
+			}
+
+			// Binned SAH over all three axes
+			int bestAxis = -1, bestPlane = -1;
+			float bestCost = FLT_MAX;
+			for (int axis = 0; axis < 3; ++axis)
+			{
+				float axisMin = centroidBounds.min[axis];
+				float axisExtent = centroidBounds.max[axis] - axisMin;
+				if (axisExtent <= 0.0f) continue;
+
+				Bounds binBounds[binCount];
+				int binCounts[binCount] = {};
+				float scale = binCount / axisExtent;
+				for (int i = first; i < first + count; ++i)
+				{
+					const Bounds& box = instanceBounds[instanceIndices[i]];
+					int bin = std::min(binCount - 1, static_cast<int>((0.5f * (box.min[axis] + box.max[axis]) - axisMin) * scale));
+					binCounts[bin]++;
+					binBounds[bin].expand(box);
+				}
+
+				float rightCost[binCount - 1];
+				Bounds rightBox;
+				int rightSum = 0;
+				for (int i = binCount - 1; i > 0; --i)
+				{
+					rightSum += binCounts[i];
+					rightBox.expand(binBounds[i]);
+					rightCost[i - 1] = rightSum * rightBox.surfaceArea();
+				}
+
+				Bounds leftBox;
+				int leftSum = 0;
+				for (int i = 0; i < binCount - 1; ++i)
+				{
+					leftSum += binCounts[i];
+					leftBox.expand(binBounds[i]);
+					if (leftSum == 0 || leftSum == count) continue;
+
+					float cost = leftSum * leftBox.surfaceArea() + rightCost[i];
+					if (cost < bestCost)
+					{
+						bestCost = cost;
+						bestAxis = axis;
+						bestPlane = i;
+					}
+				}
+			}
+
+			int mid = first + count / 2;
+			if (bestAxis >= 0)
+			{
+				float axisMin = centroidBounds.min[bestAxis];
+				float scale = binCount / (centroidBounds.max[bestAxis] - axisMin);
+				auto midIt = std::partition(instanceIndices.begin() + first, instanceIndices.begin() + first + count, [&](int index)
+					{
+						const Bounds& box = instanceBounds[index];
+						return std::min(binCount - 1, static_cast<int>((0.5f * (box.min[bestAxis] + box.max[bestAxis]) - axisMin) * scale)) <= bestPlane;
+					});
+				mid = static_cast<int>(midIt - instanceIndices.begin());
+			}
+
+			int leftIndex = static_cast<int>(nodes.size());
+			nodes.push_back(BVHNode());
+			nodes.push_back(BVHNode());
+			nodes[nodeIndex].left = leftIndex;
+			nodes[nodeIndex].right = leftIndex + 1;
+
+			subdivide(leftIndex, first, mid - first);
+			subdivide(leftIndex + 1, mid, first + count - mid);
+		}
+
+	public:
+		std::vector<BVHNode> nodes; // Links are local, add the upload offset when copying to the GPU
+		int rootIndex = -1;
+		float rebuildThreshold = 1.5f; // Rebuild once refitting made the SAH cost this much worse
+
+		// Per frame statistics
+		bool lastUpdateRebuilt = false;
+		double lastUpdateMs = 0.0;
+
+		// Collects the world bounds of every instance, then refits, or rebuilds when the instance set changed
+		// or refitting degraded the tree too much
+		void update(const std::vector<BVHInstance>& instances, const std::vector<BVHNode>& blasNodes)
+		{
+			auto start = std::chrono::high_resolution_clock::now();
+
+			instanceBounds.resize(instances.size());
+			for (size_t i = 0; i < instances.size(); ++i)
+			{
+				if (instances[i].bvhRootNodeIndex < 0) continue;
+				instanceBounds[i] = worldBounds(instances[i], blasNodes[instances[i].bvhRootNodeIndex]);
+			}
+
+			lastUpdateRebuilt = rootIndex < 0 || instanceSetChanged(instances);
+			if (!lastUpdateRebuilt)
+			{
+				refit();
+				lastUpdateRebuilt = sahCost() > builtSAHCost * rebuildThreshold;
+			}
+			if (lastUpdateRebuilt)
+			{
+				build(instances);
+			}
+
+			auto end = std::chrono::high_resolution_clock::now();
+			lastUpdateMs = std::chrono::duration<double, std::milli>(end - start).count();
+		}
+
+		// Leaves name instances by index, so an instance that now has another BLAS, or none, needs a new tree
+		// even when the number of instances stayed the same
+		bool instanceSetChanged(const std::vector<BVHInstance>& instances) const
+		{
+			if (instances.size() != builtBLASRoots.size()) return true;
+			for (size_t i = 0; i < instances.size(); ++i)
+			{
+				if (instances[i].bvhRootNodeIndex != builtBLASRoots[i]) return true;
+			}
+			return false;
+		}
+
+		void build(const std::vector<BVHInstance>& instances)
+		{
+			nodes.clear();
+			instanceIndices.clear();
+			builtBLASRoots.resize(instances.size());
+			for (size_t i = 0; i < instances.size(); ++i)
+			{
+				builtBLASRoots[i] = instances[i].bvhRootNodeIndex;
+				if (instances[i].bvhRootNodeIndex >= 0) instanceIndices.push_back(static_cast<int>(i));
+			}
+
+			rootIndex = -1;
+			builtSAHCost = 0.0f;
+			if (instanceIndices.empty()) return;
+
+			nodes.reserve(instanceIndices.size() * 2);
+			nodes.push_back(BVHNode());
+			rootIndex = 0;
+			subdivide(rootIndex, 0, static_cast<int>(instanceIndices.size()));
+			builtSAHCost = sahCost();
+		}
+
+		void refit()
+		{
+			for (int i = static_cast<int>(nodes.size()) - 1; i >= 0; --i)
+			{
+				BVHNode& node = nodes[i];
+				if (node.isLeaf())
+				{
+					setNode(i, instanceBounds[node.firstTriangle]);
+					continue;
+				}
+
+				Bounds bounds = nodeBounds(nodes[node.left]);
+				bounds.expand(nodeBounds(nodes[node.right]));
+				setNode(i, bounds);
+			}
+		}
+
+		float sahCost() const
+		{
+			if (rootIndex < 0) return 0.0f;
+
+			float rootArea = std::max(nodeBounds(nodes[rootIndex]).surfaceArea(), FLT_MIN);
+			float cost = 0.0f;
+			for (const BVHNode& node : nodes)
+			{
+				cost += nodeBounds(node).surfaceArea();
+			}
+			return cost / rootArea;
+		}
+
+		// Writes the nodes with their links moved to where the TLAS starts inside the node buffer
+		void copyTo(BVHNode* destination, int nodeOffset) const
+		{
+			for (size_t i = 0; i < nodes.size(); ++i)
+			{
+				BVHNode node = nodes[i];
+				if (!node.isLeaf())
+				{
+					node.left += nodeOffset;
+					node.right += nodeOffset;
+				}
+				node.parent = -1;
+				destination[i] = node;
+			}
+
+			// Parent links for the short stack traversal
+			for (size_t i = 0; i < nodes.size(); ++i)
+			{
+				if (nodes[i].isLeaf()) continue;
+				destination[nodes[i].left].parent = nodeOffset + static_cast<int>(i);
+				destination[nodes[i].right].parent = nodeOffset + static_cast<int>(i);
+			}
+		}
+
+		// Number of instance BLAS roots a ray reaches, the work traceRay2 does per instance
+		int countInstanceCandidates(const glm::vec3& origin, const glm::vec3& direction, int& nodesVisited) const
+		{
+			nodesVisited = 0;
+			if (rootIndex < 0) return 0;
+
+			glm::vec3 inverseDirection = 1.0f / direction;
+			int stack[64];
+			int stackIndex = 0;
+			int candidates = 0;
+			stack[stackIndex++] = rootIndex;
+
+			while (stackIndex > 0)
+			{
+				const BVHNode& node = nodes[stack[--stackIndex]];
+				++nodesVisited;
+
+				glm::vec3 t0 = (node.boundMin - origin) * inverseDirection;
+				glm::vec3 t1 = (node.boundMax - origin) * inverseDirection;
+				glm::vec3 tNear = glm::min(t0, t1);
+				glm::vec3 tFar = glm::max(t0, t1);
+				float entry = std::max(std::max(tNear.x, tNear.y), tNear.z);
+				float exit = std::min(std::min(tFar.x, tFar.y), tFar.z);
+				if (entry > exit || exit < 0.0f) continue;
+
+				if (node.isLeaf())
+				{
+					++candidates;
+					continue;
+				}
+
+				if (stackIndex < 63)
+				{
+					stack[stackIndex++] = node.left;
+					stack[stackIndex++] = node.right;
+				}
+			}
+
+			return candidates;
+		}
+
+		// Scatters copies of one BLAS in a cube and reports TLAS build, refit and traversal cost per frame
+		static void runBenchmark(const BVHNode& blasRoot, int blasRootIndex)
+		{
+			printf("TLAS benchmark\n");
+			printf("    %9s %11s %11s %9s %14s %14s %12s\n", "Instances", "Build (ms)", "Refit (ms)", "Nodes", "Visits/ray", "BLAS/ray", "Linear/ray");
+
+			const int rayCount = 10000;
+			std::mt19937 random(1234);
+
+			for (int instanceCount : { 10, 100, 1000, 10000 })
+			{
+				float sceneSize = std::cbrt(static_cast<float>(instanceCount));
+				std::uniform_real_distribution<float> position(-sceneSize, sceneSize);
+				std::uniform_real_distribution<float> angle(0.0f, 6.2831853f);
+
+				std::vector<BVHInstance> instances(instanceCount);
+				for (BVHInstance& instance : instances)
+				{
+					instance.modelMatrix = glm::translate(glm::mat4(1.0f), glm::vec3(position(random), position(random), position(random)));
+					instance.modelMatrix = glm::rotate(instance.modelMatrix, angle(random), glm::vec3(0.0f, 1.0f, 0.0f));
+					instance.bvhRootNodeIndex = blasRootIndex;
+				}
+
+				std::vector<BVHNode> blasNodes(blasRootIndex + 1);
+				blasNodes[blasRootIndex] = blasRoot;
+
+				TopLevelBVH tlas;
+				auto buildStart = std::chrono::high_resolution_clock::now();
+				tlas.update(instances, blasNodes);
+				auto buildEnd = std::chrono::high_resolution_clock::now();
+
+				// Move every instance a bit, like a physics step would
+				for (BVHInstance& instance : instances)
+				{
+					instance.modelMatrix = glm::translate(instance.modelMatrix, glm::vec3(0.1f, 0.0f, 0.0f));
+				}
+				auto refitStart = std::chrono::high_resolution_clock::now();
+				tlas.update(instances, blasNodes);
+				auto refitEnd = std::chrono::high_resolution_clock::now();
+
+				long long visits = 0, candidates = 0;
+				std::uniform_real_distribution<float> unit(-1.0f, 1.0f);
+				for (int i = 0; i < rayCount; ++i)
+				{
+					glm::vec3 origin(position(random), position(random), position(random));
+					glm::vec3 direction = glm::normalize(glm::vec3(unit(random), unit(random), unit(random)) + glm::vec3(1e-4f));
+					int nodesVisited;
+					candidates += tlas.countInstanceCandidates(origin, direction, nodesVisited);
+					visits += nodesVisited;
+				}
+
+				printf("    %9d %11.3f %11.3f %9zd %14.2f %14.2f %12d\n", instanceCount,
+					std::chrono::duration<double, std::milli>(buildEnd - buildStart).count(),
+					std::chrono::duration<double, std::milli>(refitEnd - refitStart).count(),
+					tlas.nodes.size(), double(visits) / rayCount, double(candidates) / rayCount, instanceCount);
+			}
+		}
+	};
+}
@@ -0,0 +1,80 @@
+#pragma once
+#include <cmath>
+#include <cstring>
+#include "../../Vulkan/VulkanTypes.h"
+#include "RayIntersection.h"
+
+namespace Engine
+{
+	// Triangle layouts the compute shader can read, the builders always work on Triangle
+	enum class TriangleFormat
+	{
+		Triangles,   // 64 byte Triangle: three corners and the build time centroid
+		Indexed,     // Three 32 bit indices into packed positions
+		Precomputed, // 48 byte RayTriangle: first corner and both edges, packed geometric normal
+		Count
+	};
+
+	inline const char* triangleFormatName(TriangleFormat format)
+	{
+		switch (format)
+		{
+		case TriangleFormat::Triangles: return "Triangles";
+		case TriangleFormat::Indexed: return "Indexed";
+		case TriangleFormat::Precomputed: return "Precomputed";
+		default: return "Unknown";
+		}
+	}
+
+	// Unit vector to two snorm16 octahedral coordinates, x in the low half like unpackSnorm2x16 in GLSL
+	inline uint32_t packOctahedralNormal(const glm::vec3& normal)
+	{
+		glm::vec3 n = normal / (std::abs(normal.x) + std::abs(normal.y) + std::abs(normal.z));
+		glm::vec2 p(n.x, n.y);
+		if (n.z < 0.0f)
+		{
+			p = (1.0f - glm::abs(glm::vec2(n.y, n.x))) * glm::vec2(p.x >= 0.0f ? 1.0f : -1.0f, p.y >= 0.0f ? 1.0f : -1.0f);
+		}
+
+		auto snorm16 = [](float value)
+			{
+				return static_cast<uint32_t>(static_cast<int32_t>(std::round(glm::clamp(value, -1.0f, 1.0f) * 32767.0f)) & 0xFFFF);
+			};
+		return snorm16(p.x) | (snorm16(p.y) << 16);
+	}
+
+	inline glm::vec3 unpackOctahedralNormal(uint32_t packed)
+	{
+		auto snorm16 = [](uint32_t bits)
+			{
+				return std::max(static_cast<float>(static_cast<int16_t>(bits & 0xFFFF)) / 32767.0f, -1.0f);
+			};
+		glm::vec2 p(snorm16(packed), snorm16(packed >> 16));
+		glm::vec3 n(p.x, p.y, 1.0f - std::abs(p.x) - std::abs(p.y));
+		if (n.z < 0.0f)
+		{
+			glm::vec2 folded = (1.0f - glm::abs(glm::vec2(n.y, n.x))) * glm::vec2(n.x >= 0.0f ? 1.0f : -1.0f, n.y >= 0.0f ? 1.0f : -1.0f);
+			n.x = folded.x;
+			n.y = folded.y;
+		}
+		return glm::normalize(n);
+	}
+
+	inline RayTriangle makeRayTriangle(const Triangle& tri, uint32_t materialId = 0)
+	{
+		RayTriangle rayTriangle;
+		glm::vec3 edge1 = glm::vec3(tri.v1 - tri.v0);
+		glm::vec3 edge2 = glm::vec3(tri.v2 - tri.v0);
+		glm::vec3 normal = glm::cross(edge1, edge2);
+		float length = glm::length(normal);
+		uint32_t packedNormal = packOctahedralNormal(length > 0.0f ? normal / length : glm::vec3(0.0f, 0.0f, 1.0f));
+
+		float packedNormalBits, materialBits;
+		memcpy(&packedNormalBits, &packedNormal, sizeof(float));
+		memcpy(&materialBits, &materialId, sizeof(float));
+		rayTriangle.v0 = glm::vec4(glm::vec3(tri.v0), packedNormalBits);
+		rayTriangle.edge1 = glm::vec4(edge1, materialBits);
+		rayTriangle.edge2 = glm::vec4(edge2, 0.0f);
+		return rayTriangle;
+	}
+}
@@ -0,0 +1,373 @@
+#pragma once
+#include <cmath>
+#include "../../Vulkan/VulkanTypes.h"
+#include "../Systems/TaskScheduler.h"
+#include "RayIntersection.h"
+
+namespace Engine
+{
+	// Compressed wide BVH collapsed from a finished binary BVH. A node holds up to eight children whose
+	// boxes are quantized to 8 bits per plane on a power of two grid anchored at the node origin.
+	// Internal children are stored next to each other from childBaseIndex on and the triangles of the
+	// leaf children next to each other from triangleBaseIndex on, so a child needs no full pointer.
+	class WideBVH
+	{
+	public:
+		static constexpr int maxWidth = 8;
+		static constexpr int maxLeafTriangles = 31; // 5 bit triangle count in the child meta
+		static constexpr uint32_t internalChildFlag = 0x8000;
+		static constexpr int stackSize = 256; // CPU traversal stacks, the shader ones are smaller
+
+		struct TraversalStats
+		{
+			long long nodeFetches = 0;
+			long long boxTests = 0;
+			long long triangleTests = 0;
+		};
+
+		// Binary nodes each wide node was collapsed from, kept on the CPU for refits
+		struct NodeSource
+		{
+			int binaryIndex = -1;
+			int children[maxWidth] = {};
+		};
+
+		std::vector<WideBVHNode> nodes;
+		std::vector<NodeSource> nodeSources;
+		int width = maxWidth;
+
+		// Binary leaves above the meta triangle count are split at the centroid median of their longest axis,
+		// the new leaves are appended. Returns true when a leaf was split.
+		static bool splitLargeLeaves(std::vector<BVHNode>& binaryNodes, std::vector<Triangle>& triangles)
+		{
+			bool split = false;
+			for (size_t i = 0; i < binaryNodes.size(); ++i)
+			{
+				if (binaryNodes[i].triangleCount <= maxLeafTriangles) continue;
+
+				int first = binaryNodes[i].firstTriangle;
+				int count = binaryNodes[i].triangleCount;
+				glm::vec3 extent = binaryNodes[i].boundMax - binaryNodes[i].boundMin;
+				int axis = extent.x > extent.y ? (extent.x > extent.z ? 0 : 2) : (extent.y > extent.z ? 1 : 2);
+				std::sort(triangles.begin() + first, triangles.begin() + first + count, [axis](const Triangle& a, const Triangle& b)
+					{
+						return a.centroid[axis] < b.centroid[axis];
+					});
+
+				int leftIndex = static_cast<int>(binaryNodes.size());
+				binaryNodes.push_back(leafNode(triangles, first, count / 2));
+				binaryNodes.push_back(leafNode(triangles, first + count / 2, count - count / 2));
+				binaryNodes[i].left = leftIndex;
+				binaryNodes[i].right = leftIndex + 1;
+				binaryNodes[i].triangleCount = 0;
+				split = true;
+			}
+			return split;
+		}
+
+	private:
+		struct Pending
+		{
+			int wideIndex;
+			int binaryIndex;
+		};
+
+		static BVHNode leafNode(const std::vector<Triangle>& triangles, int first, int count)
+		{
+			BVHNode node;
+			node.boundMin = glm::vec3(FLT_MAX);
+			node.boundMax = glm::vec3(-FLT_MAX);
+			node.firstTriangle = first;
+			node.triangleCount = count;
+			for (int i = first; i < first + count; ++i)
+			{
+				node.expand(glm::vec3(triangles[i].v0));
+				node.expand(glm::vec3(triangles[i].v1));
+				node.expand(glm::vec3(triangles[i].v2));
+			}
+			return node;
+		}
+
+		static float nodeArea(const BVHNode& node)
+		{
+			glm::vec3 d = node.boundMax - node.boundMin;
+			return d.x * d.y + d.y * d.z + d.z * d.x;
+		}
+
+		// Biased exponent of the smallest power of two step that spans the extent in 255 steps
+		static uint32_t quantizationExponent(float extent)
+		{
+			int exponent;
+			std::frexp(extent / 255.0f, &exponent);
+			return static_cast<uint32_t>(std::clamp(exponent, -126, 127) + 127);
+		}
+
+		// Same bit trick as uintBitsToFloat(exponent << 23) in compute.glsl
+		static float exponentScale(uint32_t biasedExponent)
+		{
+			uint32_t bits = biasedExponent << 23;
+			float scale;
+			memcpy(&scale, &bits, sizeof(scale));
+			return scale;
+		}
+
+		// Rounds outwards, checked against the decoded plane so the quantized box always contains the child
+		static void quantizeChild(WideBVHNode& node, int child, const glm::vec3& origin, const glm::vec3& scale, const glm::vec3& inverseScale, const BVHNode& box)
+		{
+			for (int axis = 0; axis < 3; ++axis)
+			{
+				int low = std::clamp(static_cast<int>(std::floor((box.boundMin[axis] - origin[axis]) * inverseScale[axis])), 0, 255);
+				int high = std::clamp(static_cast<int>(std::ceil((box.boundMax[axis] - origin[axis]) * inverseScale[axis])), 0, 255);
+				while (low > 0 && origin[axis] + low * scale[axis] > box.boundMin[axis]) low--;
+				while (high < 255 && origin[axis] + high * scale[axis] < box.boundMax[axis]) high++;
+
+				int word = axis * 2 + child / 4;
+				int shift = (child % 4) * 8;
+				node.quantizedMin[word] |= static_cast<uint32_t>(low) << shift;
+				node.quantizedMax[word] |= static_cast<uint32_t>(high) << shift;
+			}
+		}
+
+		// Grid spanning the parent box, origin at its min corner and the exponent chosen per axis
+		static void quantizeNode(WideBVHNode& node, const BVHNode& parent, const std::vector<BVHNode>& binaryNodes, const int* children, int childCount)
+		{
+			glm::vec3 origin = parent.boundMin;
+			glm::vec3 extent = parent.boundMax - parent.boundMin;
+			uint32_t exponents[3] = { quantizationExponent(extent.x), quantizationExponent(extent.y), quantizationExponent(extent.z) };
+			glm::vec3 scale(exponentScale(exponents[0]), exponentScale(exponents[1]), exponentScale(exponents[2]));
+			glm::vec3 inverseScale(exponentScale(254 - exponents[0]), exponentScale(254 - exponents[1]), exponentScale(254 - exponents[2])); // Exact, powers of two
+
+			node.origin[0] = origin.x;
+			node.origin[1] = origin.y;
+			node.origin[2] = origin.z;
+			node.exponentsAndCount = exponents[0] | (exponents[1] << 8) | (exponents[2] << 16) | (static_cast<uint32_t>(childCount) << 24);
+			std::fill(std::begin(node.quantizedMin), std::end(node.quantizedMin), 0u);
+			std::fill(std::begin(node.quantizedMax), std::end(node.quantizedMax), 0u);
+			for (int i = 0; i < childCount; ++i)
+			{
+				quantizeChild(node, i, origin, scale, inverseScale, binaryNodes[children[i]]);
+			}
+		}
+
+	public:
+		// Splits oversized binary leaves, reorders the triangles so the leaf children of every wide node are
+		// contiguous and rewrites the binary leaves to match, so both layouts share one triangle buffer.
+		// Each wide node opens its largest internal child until it has width children.
+		void build(std::vector<BVHNode>& binaryNodes, int binaryRoot, std::vector<Triangle>& triangles, int nodeWidth)
+		{
+			width = std::clamp(nodeWidth, 2, maxWidth);
+			nodes.clear();
+			nodeSources.clear();
+			if (binaryRoot < 0 || binaryRoot >= static_cast<int>(binaryNodes.size())) return;
+
+			splitLargeLeaves(binaryNodes, triangles);
+
+			std::vector<Triangle> orderedTriangles;
+			orderedTriangles.reserve(triangles.size());
+
+			nodes.emplace_back();
+			nodeSources.emplace_back();
+			std::vector<Pending> stack = { { 0, binaryRoot } };
+			while (!stack.empty())
+			{
+				Pending pending = stack.back();
+				stack.pop_back();
+
+				// Step 1: collapse binary levels into this node, largest internal child first
+				int children[maxWidth];
+				int childCount = 0;
+				const BVHNode& binaryNode = binaryNodes[pending.binaryIndex];
+				if (binaryNode.isLeaf())
+				{
+					children[childCount++] = pending.binaryIndex;
+				}
+				else
+				{
+					children[childCount++] = binaryNode.left;
+					children[childCount++] = binaryNode.right;
+				}
+
+				while (childCount < width)
+				{
+					int best = -1;
+					float bestArea = -1.0f;
+					for (int i = 0; i < childCount; ++i)
+					{
+						const BVHNode& child = binaryNodes[children[i]];
+						if (!child.isLeaf() && nodeArea(child) > bestArea)
+						{
+							best = i;
+							bestArea = nodeArea(child);
+						}
+					}
+					if (best < 0) break;
+
+					const BVHNode& opened = binaryNodes[children[best]];
+					children[best] = opened.left;
+					children[childCount++] = opened.right;
+				}
+
+				// Step 2: children address their triangles and siblings relative to these bases
+				WideBVHNode node{};
+				node.childBaseIndex = static_cast<uint32_t>(nodes.size());
+				node.triangleBaseIndex = static_cast<uint32_t>(orderedTriangles.size());
+
+				// Step 3: leaf triangles go to the end of the new order, internal children get consecutive slots
+				int internalChildren[maxWidth];
+				int internalCount = 0;
+				for (int i = 0; i < childCount; ++i)
+				{
+					BVHNode& child = binaryNodes[children[i]];
+
+					uint32_t meta;
+					if (child.isLeaf())
+					{
+						uint32_t offset = static_cast<uint32_t>(orderedTriangles.size()) - node.triangleBaseIndex;
+						orderedTriangles.insert(orderedTriangles.end(), triangles.begin() + child.firstTriangle, triangles.begin() + child.firstTriangle + child.triangleCount);
+						child.firstTriangle = static_cast<int>(node.triangleBaseIndex + offset);
+						meta = (static_cast<uint32_t>(child.triangleCount) << 10) | offset;
+					}
+					else
+					{
+						meta = internalChildFlag | static_cast<uint32_t>(internalCount);
+						internalChildren[internalCount++] = children[i];
+					}
+					node.childMeta[i / 2] |= meta << ((i % 2) * 16);
+				}
+
+				// Step 4: quantize the children on a grid spanning this node
+				quantizeNode(node, binaryNode, binaryNodes, children, childCount);
+
+				nodes.resize(nodes.size() + internalCount);
+				nodeSources.resize(nodes.size());
+				for (int i = internalCount - 1; i >= 0; --i)
+				{
+					stack.push_back({ static_cast<int>(node.childBaseIndex) + i, internalChildren[i] });
+				}
+				nodes[pending.wideIndex] = node;
+				nodeSources[pending.wideIndex].binaryIndex = pending.binaryIndex;
+				std::copy(children, children + childCount, nodeSources[pending.wideIndex].children);
+			}
+
+			triangles.swap(orderedTriangles);
+		}
+
+		// Quantizes every node again from refitted binary bounds, the topology and triangle order stay the same
+		void refit(const std::vector<BVHNode>& binaryNodes, int grainSize = 1024)
+		{
+			parallelFor(0, static_cast<int>(nodes.size()), grainSize, [&](int begin, int end)
+				{
+					for (int i = begin; i < end; ++i)
+					{
+						const NodeSource& source = nodeSources[i];
+						quantizeNode(nodes[i], binaryNodes[source.binaryIndex], binaryNodes, source.children, static_cast<int>(nodes[i].exponentsAndCount >> 24));
+					}
+				});
+		}
+
+		// Closest hit distance or FLT_MAX, mirrors traceInstanceWide in compute.glsl
+		float traverse(const std::vector<Triangle>& triangles, const glm::vec3& origin, const glm::vec3& direction, TraversalStats& stats) const
+		{
+			float closestT = FLT_MAX;
+			if (nodes.empty()) return closestT;
+
+			glm::vec3 inverseDirection = safeInverse(direction);
+			std::pair<uint32_t, float> stack[stackSize];
+			int stackIndex = 0;
+			stack[stackIndex++] = { 0u, 0.0f };
+			while (stackIndex > 0)
+			{
+				auto [nodeIndex, entryT] = stack[--stackIndex];
+				if (entryT > closestT) continue;
+
+				const WideBVHNode& node = nodes[nodeIndex];
+				stats.nodeFetches++;
+
+				glm::vec3 nodeOrigin(node.origin[0], node.origin[1], node.origin[2]);
+				glm::vec3 scale(exponentScale(node.exponentsAndCount & 0xFF), exponentScale((node.exponentsAndCount >> 8) & 0xFF), exponentScale((node.exponentsAndCount >> 16) & 0xFF));
+				int childCount = static_cast<int>(node.exponentsAndCount >> 24);
+
+				std::pair<uint32_t, float> hits[maxWidth];
+				int hitCount = 0;
+				for (int child = 0; child < childCount; ++child)
+				{
+					int shift = (child % 4) * 8;
+					glm::vec3 quantizedMin, quantizedMax;
+					for (int axis = 0; axis < 3; ++axis)
+					{
+						quantizedMin[axis] = static_cast<float>((node.quantizedMin[axis * 2 + child / 4] >> shift) & 0xFF);
+						quantizedMax[axis] = static_cast<float>((node.quantizedMax[axis * 2 + child / 4] >> shift) & 0xFF);
+					}
+
+					stats.boxTests++;
+					float tNear;
+					if (!intersectBox(nodeOrigin + quantizedMin * scale, nodeOrigin + quantizedMax * scale, origin, inverseDirection, tNear) || tNear > closestT) continue;
+
+					uint32_t meta = (node.childMeta[child / 2] >> ((child % 2) * 16)) & 0xFFFF;
+					if (meta & internalChildFlag)
+					{
+						int j = hitCount++;
+						while (j > 0 && hits[j - 1].second > tNear)
+						{
+							hits[j] = hits[j - 1];
+							--j;
+						}
+						hits[j] = { node.childBaseIndex + (meta & 0x7FFF), tNear };
+						continue;
+					}
+
+					int first = static_cast<int>(node.triangleBaseIndex + (meta & 0x3FF));
+					for (int i = first; i < first + static_cast<int>(meta >> 10); ++i)
+					{
+						stats.triangleTests++;
+						float t;
+						if (intersectTriangle(triangles[i], origin, direction, t) && t < closestT) closestT = t;
+					}
+				}
+
+				// Far to near, so the nearest child is popped first
+				for (int i = hitCount - 1; i >= 0 && stackIndex < stackSize; --i)
+				{
+					stack[stackIndex++] = hits[i];
+				}
+			}
+
+			return closestT;
+		}
+
+		// Closest hit through the binary nodes, mirrors traceInstance in compute.glsl
+		static float traverseBinary(const std::vector<BVHNode>& binaryNodes, int root, const std::vector<Triangle>& triangles, const glm::vec3& origin, const glm::vec3& direction, TraversalStats& stats)
+		{
+			float closestT = FLT_MAX;
+			glm::vec3 inverseDirection = safeInverse(direction);
+			int stack[stackSize];
+			int stackIndex = 0;
+			stack[stackIndex++] = root;
+			while (stackIndex > 0)
+			{
+				const BVHNode& node = binaryNodes[stack[--stackIndex]];
+				stats.nodeFetches++;
+				stats.boxTests++;
+
+				float tNear;
+				if (!intersectBox(node.boundMin, node.boundMax, origin, inverseDirection, tNear) || tNear > closestT) continue;
+
+				if (!node.isLeaf())
+				{
+					if (stackIndex < stackSize) stack[stackIndex++] = node.left;
+					if (stackIndex < stackSize) stack[stackIndex++] = node.right;
+					continue;
+				}
+
+				for (int i = node.firstTriangle; i < node.firstTriangle + node.triangleCount; ++i)
+				{
+					stats.triangleTests++;
+					float t;
+					if (intersectTriangle(triangles[i], origin, direction, t) && t < closestT) closestT = t;
+				}
+			}
+
+			return closestT;
+		}
+	};
+}
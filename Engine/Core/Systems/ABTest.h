@@ -0,0 +1,82 @@
+#pragma once
+#include <vector>
+#include <functional>
+
+namespace Engine
+{
+	// Per second numbers every A/B averages for each of its modes
+	struct ABMetrics
+	{
+		double computeMs = 0.0;       // Compute ray trace time
+		double rasterMs = 0.0;        // Rasterization time
+		double nodesPerRay = 0.0;     // Instrumented traversal counters, 0 without instrumentation
+		double trianglesPerRay = 0.0;
+		double lights = 0.0;          // Lights uploaded
+
+		void add(const ABMetrics& other, double scale = 1.0)
+		{
+			computeMs += other.computeMs * scale;
+			rasterMs += other.rasterMs * scale;
+			nodesPerRay += other.nodesPerRay * scale;
+			trianglesPerRay += other.trianglesPerRay * scale;
+			lights += other.lights * scale;
+		}
+	};
+
+	// Switches a setting to its next mode each second while *run is set and averages the metrics per mode.
+	// The first second still holds the frames before the switch and only starts the cycle. After rounds
+	// seconds per mode report gets the averages, the starting mode comes back and *run is cleared.
+	class ABTest
+	{
+	public:
+		bool* run = nullptr;
+		int modeCount = 0;
+		std::function<int()> currentMode;
+		std::function<void(int mode)> applyMode;
+		std::function<void(const std::vector<ABMetrics>& averages)> report;
+
+		ABTest(bool* run, int modeCount, std::function<int()> currentMode, std::function<void(int mode)> applyMode, std::function<void(const std::vector<ABMetrics>& averages)> report)
+			: run(run),
+			modeCount(modeCount),
+			currentMode(std::move(currentMode)),
+			applyMode(std::move(applyMode)),
+			report(std::move(report))
+		{};
+
+		// Called once per second while *run is set
+		void sample(const ABMetrics& metrics, int rounds)
+		{
+			int mode = currentMode();
+			if (seconds++ == 0)
+			{
+				firstMode = mode;
+				sums.assign(modeCount, ABMetrics());
+			}
+			else
+			{
+				sums[mode].add(metrics);
+			}
+
+			if (seconds > rounds * modeCount)
+			{
+				std::vector<ABMetrics> averages(modeCount);
+				for (int i = 0; i < modeCount; ++i)
+				{
+					averages[i].add(sums[i], 1.0 / rounds);
+				}
+				report(averages);
+				applyMode(firstMode);
+				*run = false;
+				seconds = 0;
+				return;
+			}
+
+			applyMode((mode + 1) % modeCount);
+		}
+
+	private:
+		std::vector<ABMetrics> sums;
+		int seconds = 0;
+		int firstMode = 0;
+	};
+}
@@ -113,6 +113,54 @@ namespace Engine
 				}
 			}
 
+			if (keys[GLFW_KEY_V] == GLFW_PRESS && !keyboardPressIsTooFast(tStart))
+			{
+				keyPressed = true;
+				useWavefrontPathTracing = !useWavefrontPathTracing;
+			}
+
+			if (keys[GLFW_KEY_M] == GLFW_PRESS && !keyboardPressIsTooFast(tStart))
+			{
+				keyPressed = true;
+				useSwizzledDispatch = !useSwizzledDispatch;
+			}
+
+			if (keys[GLFW_KEY_B] == GLFW_PRESS && !keyboardPressIsTooFast(tStart))
+			{
+				keyPressed = true;
+				useRayBinning = !useRayBinning;
+			}
+
+			if (keys[GLFW_KEY_N] == GLFW_PRESS && !keyboardPressIsTooFast(tStart))
+			{
+				keyPressed = true;
+				useShadowDenoiser = !useShadowDenoiser;
+			}
+
+			if (keys[GLFW_KEY_P] == GLFW_PRESS && !keyboardPressIsTooFast(tStart))
+			{
+				keyPressed = true;
+				useProgressiveRefinement = !useProgressiveRefinement;
+			}
+
+			if (keys[GLFW_KEY_R] == GLFW_PRESS && !keyboardPressIsTooFast(tStart))
+			{
+				keyPressed = true;
+				useDynamicResolution = !useDynamicResolution;
+			}
+
+			if (keys[GLFW_KEY_H] == GLFW_PRESS && !keyboardPressIsTooFast(tStart))
+			{
+				keyPressed = true;
+				shadowResolutionDivisor = shadowResolutionDivisor >= 4 ? 1 : shadowResolutionDivisor * 2;
+			}
+
+			if (keys[GLFW_KEY_G] == GLFW_PRESS && !keyboardPressIsTooFast(tStart))
+			{
+				keyPressed = true;
+				useHybridRendering = !useHybridRendering;
+			}
+
 			if (keyPressed)
 			{
 				InputManager::lastKeyPress = tStart;
@@ -0,0 +1,110 @@
+#pragma once
+#include <cstddef>
+#include <string>
+
+#ifdef _WIN32
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN
+#endif
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace Engine
+{
+	// Read only memory mapping of a whole file, unmapped when it goes out of scope
+	class MappedFile
+	{
+	private:
+		const char* mappedData = nullptr;
+		size_t mappedSize = 0;
+#ifdef _WIN32
+		HANDLE file = INVALID_HANDLE_VALUE;
+		HANDLE mapping = nullptr;
+#endif
+
+	public:
+		MappedFile() = default;
+
+		explicit MappedFile(const std::string& path)
+		{
+			open(path);
+		}
+
+		~MappedFile()
+		{
+			close();
+		}
+
+		MappedFile(const MappedFile&) = delete;
+		MappedFile& operator=(const MappedFile&) = delete;
+
+		bool open(const std::string& path)
+		{
+			close();
+#ifdef _WIN32
+			file = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+			if (file == INVALID_HANDLE_VALUE) return false;
+
+			LARGE_INTEGER fileSize;
+			if (!GetFileSizeEx(file, &fileSize) || fileSize.QuadPart == 0)
+			{
+				close();
+				return false;
+			}
+
+			mapping = CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+			if (!mapping)
+			{
+				close();
+				return false;
+			}
+
+			mappedData = static_cast<const char*>(MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0));
+			mappedSize = mappedData ? static_cast<size_t>(fileSize.QuadPart) : 0;
+#else
+			int descriptor = ::open(path.c_str(), O_RDONLY);
+			if (descriptor < 0) return false;
+
+			struct stat fileStat;
+			if (fstat(descriptor, &fileStat) == 0 && fileStat.st_size > 0)
+			{
+				void* data = mmap(nullptr, static_cast<size_t>(fileStat.st_size), PROT_READ, MAP_PRIVATE, descriptor, 0);
+				if (data != MAP_FAILED)
+				{
+					mappedData = static_cast<const char*>(data);
+					mappedSize = static_cast<size_t>(fileStat.st_size);
+				}
+			}
+			::close(descriptor); // The mapping stays valid after the descriptor is closed
+#endif
+			return mappedData != nullptr;
+		}
+
+		void close()
+		{
+#ifdef _WIN32
+			if (mappedData) UnmapViewOfFile(mappedData);
+			if (mapping) CloseHandle(mapping);
+			if (file != INVALID_HANDLE_VALUE) CloseHandle(file);
+			mapping = nullptr;
+			file = INVALID_HANDLE_VALUE;
+#else
+			if (mappedData) munmap(const_cast<char*>(mappedData), mappedSize);
+#endif
+			mappedData = nullptr;
+			mappedSize = 0;
+		}
+
+		bool isOpen() const { return mappedData != nullptr; }
+		const char* data() const { return mappedData; }
+		size_t size() const { return mappedSize; }
+	};
+}
@@ -0,0 +1,243 @@
+#pragma once
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace Engine
+{
+	// Work stealing thread pool. Each worker owns a deque: it pushes and pops its own tasks
+	// from the back (LIFO, cache friendly for recursive splits) and steals from the front of
+	// the other workers' deques when it runs dry. Threads that wait on a TaskGroup help
+	// run tasks instead of blocking, so nested fork/join never deadlocks.
+	class TaskScheduler
+	{
+	private:
+		struct WorkQueue
+		{
+			std::mutex mutex;
+			std::deque<std::function<void()>> tasks;
+		};
+
+		std::vector<std::unique_ptr<WorkQueue>> queues; // One per worker, plus one shared by outside threads
+		std::vector<std::thread> workers;
+		std::atomic<int> queuedTasks{ 0 };
+		std::atomic<unsigned int> nextQueue{ 0 };
+		std::mutex sleepMutex;
+		std::condition_variable sleepCondition;
+		bool stopping = false;
+
+		static int& currentWorker()
+		{
+			thread_local int workerIndex = -1;
+			return workerIndex;
+		}
+
+		bool popLocal(int queueIndex, std::function<void()>& task)
+		{
+			WorkQueue& queue = *queues[queueIndex];
+			std::lock_guard<std::mutex> lock(queue.mutex);
+			if (queue.tasks.empty()) return false;
+			task = std::move(queue.tasks.back());
+			queue.tasks.pop_back();
+			return true;
+		}
+
+		bool steal(int thiefIndex, std::function<void()>& task)
+		{
+			int queueCount = static_cast<int>(queues.size());
+			for (int i = 1; i <= queueCount; ++i)
+			{
+				WorkQueue& queue = *queues[(thiefIndex + i) % queueCount];
+				std::lock_guard<std::mutex> lock(queue.mutex);
+				if (queue.tasks.empty()) continue;
+				task = std::move(queue.tasks.front());
+				queue.tasks.pop_front();
+				return true;
+			}
+			return false;
+		}
+
+		void workerLoop(int workerIndex)
+		{
+			currentWorker() = workerIndex;
+			while (true)
+			{
+				if (tryRunOne()) continue;
+
+				std::unique_lock<std::mutex> lock(sleepMutex);
+				sleepCondition.wait(lock, [this]() { return stopping || queuedTasks.load() > 0; });
+				if (stopping && queuedTasks.load() == 0) return;
+			}
+		}
+
+	public:
+		explicit TaskScheduler(unsigned int workerCount = std::thread::hardware_concurrency())
+		{
+			workerCount = std::max(1u, workerCount);
+			for (unsigned int i = 0; i <= workerCount; ++i)
+			{
+				queues.push_back(std::make_unique<WorkQueue>());
+			}
+			for (unsigned int i = 0; i < workerCount; ++i)
+			{
+				workers.emplace_back(&TaskScheduler::workerLoop, this, static_cast<int>(i));
+			}
+		}
+
+		~TaskScheduler()
+		{
+			{
+				std::lock_guard<std::mutex> lock(sleepMutex);
+				stopping = true;
+			}
+			sleepCondition.notify_all();
+			for (std::thread& worker : workers)
+			{
+				worker.join();
+			}
+		}
+
+		TaskScheduler(const TaskScheduler&) = delete;
+		TaskScheduler& operator=(const TaskScheduler&) = delete;
+
+		static TaskScheduler& instance()
+		{
+			static TaskScheduler scheduler;
+			return scheduler;
+		}
+
+		int workerCount() const { return static_cast<int>(workers.size()); }
+
+		void submit(std::function<void()> task)
+		{
+			int queueIndex = currentWorker();
+			if (queueIndex < 0)
+			{
+				// Outside threads spread their tasks so the workers start stealing right away
+				queueIndex = static_cast<int>(nextQueue++ % queues.size());
+			}
+
+			{
+				WorkQueue& queue = *queues[queueIndex];
+				std::lock_guard<std::mutex> lock(queue.mutex);
+				queue.tasks.push_back(std::move(task));
+			}
+			{
+				std::lock_guard<std::mutex> lock(sleepMutex);
+				queuedTasks++;
+			}
+			sleepCondition.notify_one();
+		}
+
+		// Runs one pending task on the calling thread, returns false when there was nothing to do
+		bool tryRunOne()
+		{
+			int queueIndex = currentWorker();
+			if (queueIndex < 0) queueIndex = static_cast<int>(queues.size()) - 1;
+
+			std::function<void()> task;
+			if (!popLocal(queueIndex, task) && !steal(queueIndex, task)) return false;
+
+			queuedTasks--;
+			task();
+			return true;
+		}
+	};
+
+	// Fork/join helper: run() spawns a task, wait() helps execute tasks until all of them finished.
+	// The first exception a task throws is kept and rethrown by wait() once every task is done.
+	class TaskGroup
+	{
+	private:
+		TaskScheduler& scheduler;
+		std::atomic<int> pending{ 0 };
+		std::mutex exceptionMutex;
+		std::exception_ptr exception;
+
+		// Counts a task as finished when it leaves, thrown or not
+		struct PendingGuard
+		{
+			std::atomic<int>& pending;
+			~PendingGuard() { pending--; }
+		};
+
+		void drain()
+		{
+			while (pending.load() > 0)
+			{
+				if (!scheduler.tryRunOne())
+				{
+					std::this_thread::yield();
+				}
+			}
+		}
+
+	public:
+		explicit TaskGroup(TaskScheduler& scheduler = TaskScheduler::instance())
+			: scheduler(scheduler)
+		{}
+
+		// Never throws, an exception nobody waited for is dropped
+		~TaskGroup() { drain(); }
+
+		template <typename Function>
+		void run(Function&& function)
+		{
+			pending++;
+			scheduler.submit([this, function = std::forward<Function>(function)]() mutable
+				{
+					PendingGuard guard{ pending };
+					try
+					{
+						function();
+					}
+					catch (...)
+					{
+						std::lock_guard<std::mutex> lock(exceptionMutex);
+						if (!exception) exception = std::current_exception();
+					}
+				});
+		}
+
+		void wait()
+		{
+			drain();
+
+			std::exception_ptr thrown;
+			{
+				std::lock_guard<std::mutex> lock(exceptionMutex);
+				std::swap(thrown, exception);
+			}
+			if (thrown)
+			{
+				std::rethrow_exception(thrown);
+			}
+		}
+	};
+
+	// Splits [begin, end) into chunks of grainSize and runs body(chunkBegin, chunkEnd) on the pool
+	template <typename Function>
+	void parallelFor(int begin, int end, int grainSize, Function&& body)
+	{
+		if (end - begin <= grainSize)
+		{
+			if (begin < end) body(begin, end);
+			return;
+		}
+
+		TaskGroup group;
+		for (int chunkBegin = begin; chunkBegin < end; chunkBegin += grainSize)
+		{
+			int chunkEnd = std::min(end, chunkBegin + grainSize);
+			group.run([&body, chunkBegin, chunkEnd]() { body(chunkBegin, chunkEnd); });
+		}
+		group.wait();
+	}
+}
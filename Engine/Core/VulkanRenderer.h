@@ -13,6 +13,9 @@
 
 #include "Game/GameManager.h"
 #include "Globals.h"
+#include "Raytracing/TopLevelBVH.h"
+#include "Raytracing/CpuTracer.h"
+#include "Raytracing/LightAliasTable.h"
 
 #include "UI/Button.h"
 #include "UI/Image.h"
@@ -37,6 +40,8 @@ namespace Engine
 		VulkanSync syncManager;
 
         Window* window;
+        TopLevelBVH tlas;
+        uint64_t cpuReferenceFrameIndex = 0;
 
         #pragma region Asset loading
 		void loadTextures(string path)
@@ -107,6 +112,23 @@ namespace Engine
 			gameManager.gameScenes[gameManager.currentScene].addGameObject(quad);
             //descriptorManager.updateDescriptorSet(1, uniformBuffers[0], sizeof(UniformBufferObject), gameManager.textures["default"].textureImageView, gameManager.textures["default"].textureSampler);
 
+            // Static teapots scattered around the scene, to time TLAS traversal on the GPU
+            for (int i = 0; i < tlasBenchmarkInstanceCount; ++i)
+            {
+                float spread = 2.0f * std::cbrt(static_cast<float>(tlasBenchmarkInstanceCount));
+                GameObject teapot;
+                teapot.mass = 0.0f;
+                teapot.setPosition(glm::vec3(spread * (float(rand()) / RAND_MAX - 0.5f), 1 + spread * float(rand()) / RAND_MAX, spread * (float(rand()) / RAND_MAX - 0.5f)));
+                teapot.CreateRigidBody(gameManager.models["teapot"]);
+                gameManager.gameScenes[gameManager.currentScene].addGameObject(teapot);
+            }
+
+            if (showTLASBenchmark)
+            {
+                GameModel& teapot = gameManager.models["teapot"];
+                TopLevelBVH::runBenchmark(bvhNodes[teapot.bvhRootNodeIndex], teapot.bvhRootNodeIndex);
+            }
+
             //GameObject sun(&gameManager.models["viking_room"], true);
             //sun.isStatic = true;
             //sun.isTerrain = true;
@@ -151,6 +173,16 @@ namespace Engine
                 vkWaitForFences(device, 1, &inFlightFences[currentFrame], VK_TRUE, UINT64_MAX);
             }
 
+            // Read the traversal totals of the instrumented frame that used this slot, its fence has signalled
+            if (traversalTotalsPending[currentFrame])
+            {
+                void* data;
+                vkMapMemory(device, traversalTotalsBufferMemory, traversalTotalsStride * currentFrame, sizeof(TraversalTotals), 0, &data);
+                memcpy(&traversalTotals, data, sizeof(TraversalTotals));
+                vkUnmapMemory(device, traversalTotalsBufferMemory);
+                traversalTotalsPending[currentFrame] = false;
+            }
+
             /// Acquire next image from swap chain
             {
                 VkResult result = vkAcquireNextImageKHR(device, swapChain, UINT64_MAX, imageAvailableSemaphores[currentFrame], VK_NULL_HANDLE, &imageIndex);
@@ -185,29 +217,104 @@ namespace Engine
 
         void imageBarrierToGeneral(VkCommandBuffer commandBuffer)
         {
-            VkImageMemoryBarrier barrier{};
-            barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
-            barrier.oldLayout = VK_IMAGE_LAYOUT_UNDEFINED;
-            barrier.newLayout = VK_IMAGE_LAYOUT_GENERAL;
-            barrier.srcAccessMask = 0;  // Because VK_IMAGE_LAYOUT_UNDEFINED implies no accesses
-            barrier.dstAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+            // The ray tracing image, the dynamic resolution trace image and the reduced resolution shadow visibility
+            VkImage images[3] = { raytracingImage, raytracingTraceImage, shadowVisibilityImage };
+            VkImageMemoryBarrier barriers[3] = {};
+            for (int i = 0; i < 3; ++i)
+            {
+                VkImageMemoryBarrier& barrier = barriers[i];
+                barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+                barrier.oldLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+                barrier.newLayout = VK_IMAGE_LAYOUT_GENERAL;
+                barrier.srcAccessMask = 0;  // Because VK_IMAGE_LAYOUT_UNDEFINED implies no accesses
+                barrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT;
+                barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+                barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+                barrier.image = images[i];
+                barrier.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+                barrier.subresourceRange.baseMipLevel = 0;
+                barrier.subresourceRange.levelCount = 1;
+                barrier.subresourceRange.baseArrayLayer = 0;
+                barrier.subresourceRange.layerCount = 1;
+            }
+
+            vkCmdPipelineBarrier(
+                commandBuffer,
+                VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT,    // srcStage
+                VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, // dstStage
+                0,
+                0, nullptr,
+                0, nullptr,
+                3, barriers
+            );
+        }
+
+        // Zeroes this frame's traversal totals before the instrumented dispatch adds to them
+        void clearTraversalTotals(VkCommandBuffer commandBuffer)
+        {
+            vkCmdFillBuffer(commandBuffer, traversalTotalsBuffer, traversalTotalsStride * currentFrame, sizeof(TraversalTotals), 0);
+
+            VkBufferMemoryBarrier barrier{};
+            barrier.sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER;
+            barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+            barrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT;
             barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
             barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
-            barrier.image = raytracingImage;
-            barrier.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
-            barrier.subresourceRange.baseMipLevel = 0;
-            barrier.subresourceRange.levelCount = 1;
-            barrier.subresourceRange.baseArrayLayer = 0;
-            barrier.subresourceRange.layerCount = 1;
+            barrier.buffer = traversalTotalsBuffer;
+            barrier.offset = traversalTotalsStride * currentFrame;
+            barrier.size = sizeof(TraversalTotals);
 
             vkCmdPipelineBarrier(
                 commandBuffer,
-                VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT,    // srcStage
+                VK_PIPELINE_STAGE_TRANSFER_BIT,       // srcStage
                 VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, // dstStage
                 0,
                 0, nullptr,
+                1, &barrier,
+                0, nullptr
+            );
+        }
+
+        // Makes the totals written by the instrumented dispatch visible to the host read after the frame
+        void traversalTotalsBarrierToHost(VkCommandBuffer commandBuffer)
+        {
+            VkBufferMemoryBarrier barrier{};
+            barrier.sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER;
+            barrier.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+            barrier.dstAccessMask = VK_ACCESS_HOST_READ_BIT;
+            barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+            barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+            barrier.buffer = traversalTotalsBuffer;
+            barrier.offset = traversalTotalsStride * currentFrame;
+            barrier.size = sizeof(TraversalTotals);
+
+            vkCmdPipelineBarrier(
+                commandBuffer,
+                VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, // srcStage
+                VK_PIPELINE_STAGE_HOST_BIT,           // dstStage
+                0,
                 0, nullptr,
-                1, &barrier
+                1, &barrier,
+                0, nullptr
+            );
+        }
+
+        // Makes everything a wavefront stage or denoiser pass wrote, queue entries, lengths, dispatch arguments, buffers and pixels, visible to the next one
+        void computePassBarrier(VkCommandBuffer commandBuffer, VkPipelineStageFlags srcStage, VkAccessFlags srcAccess)
+        {
+            VkMemoryBarrier barrier{};
+            barrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+            barrier.srcAccessMask = srcAccess;
+            barrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT | VK_ACCESS_INDIRECT_COMMAND_READ_BIT;
+
+            vkCmdPipelineBarrier(
+                commandBuffer,
+                srcStage,                                                                    // srcStage
+                VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT | VK_PIPELINE_STAGE_DRAW_INDIRECT_BIT, // dstStage
+                0,
+                1, &barrier,
+                0, nullptr,
+                0, nullptr
             );
         }
 
@@ -353,13 +460,21 @@ namespace Engine
 
             vkCmdResetQueryPool(rayTracingCommandBuffers[currentFrame], timestampQueryPool, 4 * currentFrame + 0, 2);
 
+            if (useTraversalInstrumentation && !useWavefrontPathTracing)
+            {
+                clearTraversalTotals(rayTracingCommandBuffers[currentFrame]);
+            }
+
             sendBufferSizesToCompute();
 
             // Mandatory image barrier
             imageBarrierToGeneral(rayTracingCommandBuffers[currentFrame]);
 
-			// Bind the ray tracing pipeline and descriptor set
-            vkCmdBindPipeline(rayTracingCommandBuffers[currentFrame], VK_PIPELINE_BIND_POINT_COMPUTE, rayTracingPipeline);
+			// Bind the ray tracing pipeline and descriptor set, the wavefront binds a pipeline per stage
+            if (!useWavefrontPathTracing)
+            {
+                vkCmdBindPipeline(rayTracingCommandBuffers[currentFrame], VK_PIPELINE_BIND_POINT_COMPUTE, useTraversalInstrumentation ? rayTracingInstrumentedPipeline : rayTracingPipeline);
+            }
             vkCmdBindDescriptorSets(
                 rayTracingCommandBuffers[currentFrame],
                 VK_PIPELINE_BIND_POINT_COMPUTE,
@@ -377,18 +492,56 @@ namespace Engine
             {
 				// Create non dynamic buffers
                 sendBvhDataToCompute();
-                sendTriangleDataToCompute();
+                sendWideBvhDataToCompute();
+                sendCompactBvhDataToCompute();
+                if (usesTriangleFormat(TriangleFormat::Indexed))
+                {
+                    sendIndexedTriangleDataToCompute();
+                }
+                if (usesTriangleFormat(TriangleFormat::Precomputed))
+                {
+                    sendRayTriangleDataToCompute();
+                }
+                if (usesTriangleFormat(TriangleFormat::Triangles))
+                {
+                    sendTriangleDataToCompute();
+                }
 
                 firstFrame = false;
+                bvhDirtyRanges.clear();
             }
 
+            refitDeformingModels();
+            sendBvhRefitsToCompute();
             sendTextureDataToCompute();
             sendBvhInstancesDataToCompute();
+            sendTlasDataToCompute();
             sendLightDataToCompute();
             sendCameraDataToCompute();
+
+            // Turning progressive refinement on starts a new accumulation
+            if (progressiveRefinementActive() && !progressiveWasActive)
+            {
+                resetProgressiveAccumulation();
+            }
+            progressiveWasActive = progressiveRefinementActive();
+
+            // The accumulation and the denoiser history are kept per traced pixel, a new trace resolution drops both
+            VkExtent2D traceExtent = rayTracingTraceExtent();
+            if (traceExtent.width != lastTraceExtent.width || traceExtent.height != lastTraceExtent.height)
+            {
+                resetProgressiveAccumulation();
+                shadowHistoryValid = false;
+                lastTraceExtent = traceExtent;
+            }
+
+            if (renderCpuReference)
+            {
+                renderCpuReferenceFrame();
+            }
         }
 
-        void sendBufferSizesToCompute()
+        void sendBufferSizesToCompute(int atrousIteration = 0)
         {
             // Send the sizes of the buffers to the compute shader via push constants
             GameScene scene = gameManager.gameScenes[gameManager.currentScene];
@@ -398,9 +551,19 @@ namespace Engine
             size_t bvhNodeSize = bvhNodes.size();
             size_t triangleSize = bvhTriangles.size();
             size_t instanceSize = bvhInstances.size();
-            size_t lightInstanceSize = scene.lightSources.size();
+            size_t lightInstanceSize = lightInstances.size();
 
-            int data[computePushConstantCountInteger] = { bvhNodeSize , triangleSize, instanceSize, lightInstanceSize };
+            int tlasRootIndex = useTLAS && tlas.rootIndex >= 0 ? tlasNodeOffset() + tlas.rootIndex : -1;
+            VkExtent2D traceExtent = rayTracingTraceExtent();
+
+            bool progressive = progressiveRefinementActive();
+            bool progressiveConverged = progressive && progressiveSampleCount >= progressiveMaxSamples;
+            int progressiveSample = progressive && !progressiveConverged ? progressiveSampleCount : -1;
+
+            int data[computePushConstantCountInteger] = { bvhNodeSize , triangleSize, instanceSize, lightInstanceSize, tlasRootIndex, useWideBVH ? 1 : 0, compactBVHReplacesBinary() ? 1 : 0, static_cast<int>(triangleFormat), traversalHeatmap, traversalHeatmapMax, useSwizzledDispatch ? 1 : 0, useRayBinning ? 1 : 0,
+                progressive ? progressiveShadowSamplesPerPixel : shadowSamplesPerPixel, denoisedShadowSamplesPerPixel, shadowDenoiserMode(), shadowDenoiseSplitScreen ? static_cast<int>(traceExtent.width / 2) : 0,
+                static_cast<int>(rayTracingFrameIndex), atrousIteration, std::max(shadowDenoiseAtrousIterations, 1), progressiveSample, progressiveConverged ? 1 : 0,
+                static_cast<int>(traceExtent.width), static_cast<int>(traceExtent.height), reducedResolutionShadowsActive() ? shadowResolutionDivisor : 1 };
 
             vkCmdPushConstants(rayTracingCommandBuffers[currentFrame], rayTracingPipelineLayout, VK_SHADER_STAGE_COMPUTE_BIT, 0, integerByteSize * computePushConstantCountInteger, data);
         }
@@ -412,6 +575,12 @@ namespace Engine
 
         void sendBvhDataToCompute()
         {
+            // The compact nodes replace the BLAS nodes, the node buffer then only holds the TLAS
+            if (compactBVHReplacesBinary())
+            {
+                return;
+            }
+
             size_t instanceCount = bvhNodes.size();
             int actualBufferSize = bvhNodes.size() * sizeof(BVHNode);
             int fullBufferSize = sizeof(uint32_t) + bvhNodes.size() * sizeof(BVHNode);
@@ -445,6 +614,164 @@ namespace Engine
             */
         }
 
+        // Refits the BVH of every model with a deformation, sendBvhRefitsToCompute uploads the changed ranges
+        void refitDeformingModels()
+        {
+            float seconds = static_cast<float>(glfwGetTime());
+            for (auto& [modelName, model] : gameManager.models)
+            {
+                model.deform(seconds);
+            }
+        }
+
+        // Uploads only the node and triangle ranges of models refitted since the last frame
+        void sendBvhRefitsToCompute()
+        {
+            auto upload = [](VkDeviceMemory memory, const void* source, VkDeviceSize offset, VkDeviceSize size)
+            {
+                if (size == 0 || offset + size > largeBufferSize)
+                {
+                    return;
+                }
+
+                void* data;
+                vkMapMemory(device, memory, offset, size, 0, &data);
+                memcpy(data, source, size);
+                vkUnmapMemory(device, memory);
+            };
+
+            if (!bvhDirtyRanges.empty())
+            {
+                resetProgressiveAccumulation();
+            }
+
+            for (const BVHDirtyRange& range : bvhDirtyRanges)
+            {
+                if (!compactBVHReplacesBinary())
+                {
+                    upload(bvhBufferMemory, bvhNodes.data() + range.nodeOffset, range.nodeOffset * sizeof(BVHNode), range.nodeCount * sizeof(BVHNode));
+                }
+                if (usesTriangleFormat(TriangleFormat::Indexed))
+                {
+                    upload(positionBufferMemory, bvhPositions.data() + range.positionOffset, range.positionOffset * sizeof(glm::vec3), range.positionCount * sizeof(glm::vec3));
+                    upload(triangleIndexBufferMemory, bvhTriangleIndices.data() + range.triangleOffset * 3, range.triangleOffset * 3 * sizeof(uint32_t), range.triangleCount * 3 * sizeof(uint32_t));
+                }
+                if (usesTriangleFormat(TriangleFormat::Precomputed))
+                {
+                    upload(rayTriangleBufferMemory, bvhRayTriangles.data() + range.triangleOffset, range.triangleOffset * sizeof(RayTriangle), range.triangleCount * sizeof(RayTriangle));
+                }
+                if (usesTriangleFormat(TriangleFormat::Triangles))
+                {
+                    upload(triangleBufferMemory, bvhTriangles.data() + range.triangleOffset, range.triangleOffset * sizeof(Triangle), range.triangleCount * sizeof(Triangle));
+                }
+                if (compactBVHReplacesBinary())
+                {
+                    upload(compactBvhBufferMemory, bvhCompactNodes.data() + range.nodeOffset, range.nodeOffset * sizeof(CompactBVHNode), range.nodeCount * sizeof(CompactBVHNode));
+                }
+                upload(wideBvhBufferMemory, bvhWideNodes.data() + range.wideNodeOffset, range.wideNodeOffset * sizeof(WideBVHNode), range.wideNodeCount * sizeof(WideBVHNode));
+            }
+            bvhDirtyRanges.clear();
+        }
+
+        void sendWideBvhDataToCompute()
+        {
+            VkDeviceSize actualBufferSize = bvhWideNodes.size() * sizeof(WideBVHNode);
+            if (actualBufferSize == 0)
+            {
+                return;
+            }
+            if (actualBufferSize > largeBufferSize)
+            {
+                std::cout << "WARNING: wide BVH does not fit in its buffer, using the binary BVH!" << std::endl;
+                useWideBVH = false;
+                return;
+            }
+
+            void* data;
+            vkMapMemory(device, wideBvhBufferMemory, 0, actualBufferSize, 0, &data);
+            memcpy(data, bvhWideNodes.data(), actualBufferSize);
+            vkUnmapMemory(device, wideBvhBufferMemory);
+        }
+
+        void sendCompactBvhDataToCompute()
+        {
+            VkDeviceSize actualBufferSize = bvhCompactNodes.size() * sizeof(CompactBVHNode);
+            if (!compactBVHReplacesBinary() || actualBufferSize == 0)
+            {
+                return;
+            }
+            if (actualBufferSize > largeBufferSize)
+            {
+                std::cout << "WARNING: compact BVH does not fit in its buffer!" << std::endl;
+                return;
+            }
+
+            void* data;
+            vkMapMemory(device, compactBvhBufferMemory, 0, actualBufferSize, 0, &data);
+            memcpy(data, bvhCompactNodes.data(), actualBufferSize);
+            vkUnmapMemory(device, compactBvhBufferMemory);
+        }
+
+        // Only the buffers of the selected triangle format are filled, all of them while the format A/B runs
+        bool usesTriangleFormat(TriangleFormat format) const
+        {
+            return runTriangleFormatAB || triangleFormat == format;
+        }
+
+        // Falls back to the 64 byte triangles when another format does not fit its buffers, sendDataToCompute
+        // uploads them after the other formats
+        void fallBackToTriangleBuffer(const char* formatName)
+        {
+            std::cout << "WARNING: " << formatName << " triangles do not fit in their buffers, using the triangle buffer!" << std::endl;
+            triangleFormat = TriangleFormat::Triangles;
+            runTriangleFormatAB = false;
+        }
+
+        // Positions and indices replace the 64 byte triangles, the triangle buffer stays empty in this mode
+        void sendIndexedTriangleDataToCompute()
+        {
+            VkDeviceSize positionBytes = bvhPositions.size() * sizeof(glm::vec3);
+            VkDeviceSize indexBytes = bvhTriangleIndices.size() * sizeof(uint32_t);
+            if (positionBytes > largeBufferSize || indexBytes > largeBufferSize)
+            {
+                fallBackToTriangleBuffer("indexed");
+                return;
+            }
+            if (positionBytes == 0 || indexBytes == 0)
+            {
+                return;
+            }
+
+            void* data;
+            vkMapMemory(device, positionBufferMemory, 0, positionBytes, 0, &data);
+            memcpy(data, bvhPositions.data(), positionBytes);
+            vkUnmapMemory(device, positionBufferMemory);
+
+            vkMapMemory(device, triangleIndexBufferMemory, 0, indexBytes, 0, &data);
+            memcpy(data, bvhTriangleIndices.data(), indexBytes);
+            vkUnmapMemory(device, triangleIndexBufferMemory);
+        }
+
+        // Triangles with precomputed edges replace the 64 byte triangles, the triangle buffer stays empty in this mode
+        void sendRayTriangleDataToCompute()
+        {
+            VkDeviceSize actualBufferSize = bvhRayTriangles.size() * sizeof(RayTriangle);
+            if (actualBufferSize > largeBufferSize)
+            {
+                fallBackToTriangleBuffer("precomputed");
+                return;
+            }
+            if (actualBufferSize == 0)
+            {
+                return;
+            }
+
+            void* data;
+            vkMapMemory(device, rayTriangleBufferMemory, 0, actualBufferSize, 0, &data);
+            memcpy(data, bvhRayTriangles.data(), actualBufferSize);
+            vkUnmapMemory(device, rayTriangleBufferMemory);
+        }
+
         void sendTriangleDataToCompute()
         {
             size_t instanceCount = bvhTriangles.size();
@@ -485,7 +812,14 @@ namespace Engine
 
                 if (gameObject.bvhInstanceIndex >= 0)
                 {
-                    bvhInstances[gameObject.bvhInstanceIndex].modelMatrix = gameObject.calculateModel();
+                    // A refit that had to rebuild may have moved the model BVH to the end of the buffers
+                    const GameModel& model = gameManager.models[gameObject.model];
+                    BVHInstance& bvhInstance = bvhInstances[gameObject.bvhInstanceIndex];
+                    bvhInstance.bvhRootNodeIndex = model.bvhRootNodeIndex;
+                    bvhInstance.wideRootNodeIndex = model.bvhWideRootNodeIndex;
+                    bvhInstance.triangleOffset = model.bvhTriangleIndex;
+                    bvhInstance.modelMatrix = gameObject.calculateModel();
+                    bvhInstance.inverseModelMatrix = glm::inverse(bvhInstance.modelMatrix);
                     continue;
                 }
 
@@ -496,7 +830,9 @@ namespace Engine
                 bvhInstance.bvhRootNodeIndex = model->bvhRootNodeIndex;
                 bvhInstance.triangleOffset = model->bvhTriangleIndex;
                 bvhInstance.triangleCount = model->triangles.size();
+                bvhInstance.wideRootNodeIndex = model->bvhWideRootNodeIndex;
                 bvhInstance.modelMatrix = gameObject.calculateModel();
+                bvhInstance.inverseModelMatrix = glm::inverse(bvhInstance.modelMatrix);
                 bvhInstances.push_back(bvhInstance);
             }
 
@@ -538,6 +874,13 @@ namespace Engine
                 vkUnmapMemory(device, instanceBufferMemory);
             }
 
+            // A moved, added or removed instance invalidates the progressive accumulation
+            if (progressiveInstances.size() != bvhInstances.size() || memcmp(progressiveInstances.data(), bvhInstances.data(), actualBufferSize) != 0)
+            {
+                progressiveInstances = bvhInstances;
+                resetProgressiveAccumulation();
+            }
+
             /*
             {
                 // Map and copy data to staging buffer
@@ -559,38 +902,98 @@ namespace Engine
             */
         }
 
-        void sendLightDataToCompute()
+        // The TLAS lives right after the model BVHs inside the node buffer, at its start when the compact nodes replace them
+        int tlasNodeOffset() const
         {
-            GameScene scene = gameManager.gameScenes[gameManager.currentScene];
-            int lightCount = scene.lightSources.size();
+            return compactBVHReplacesBinary() ? 0 : static_cast<int>(bvhNodes.size());
+        }
 
-            // Prevent invalid copy
-            if (lightCount == 0)
+        void sendTlasDataToCompute()
+        {
+            if (!useTLAS)
             {
                 return;
             }
 
-			std::vector<LightInstance> lightArray(lightCount);
-            size_t lightIndex = 0;
+            tlas.update(bvhInstances, bvhNodes);
+            if (tlas.nodes.empty())
+            {
+                return;
+            }
 
-            // Then copy light structs
+            VkDeviceSize offset = tlasNodeOffset() * sizeof(BVHNode);
+            VkDeviceSize size = tlas.nodes.size() * sizeof(BVHNode);
+            if (offset + size > (compactBVHReplacesBinary() ? normalBufferSize : largeBufferSize))
+            {
+                std::cout << "WARNING: TLAS does not fit in the BVH buffer!" << std::endl;
+                tlas.rootIndex = -1;
+                return;
+            }
+
+            void* data;
+            vkMapMemory(device, bvhBufferMemory, offset, size, 0, &data);
+            tlas.copyTo(static_cast<BVHNode*>(data), tlasNodeOffset());
+            vkUnmapMemory(device, bvhBufferMemory);
+        }
+
+        // Scene lights, the sun the compute shader used to hard code when there are none and the benchmark lights. Uploaded
+        // with a new alias table only when one of them changed, the shader then picks a light per shadow ray from it
+        void sendLightDataToCompute()
+        {
+            GameScene& scene = gameManager.gameScenes[gameManager.currentScene];
+
+            // Step 1: collect the lights of this frame
+            std::vector<LightInstance> lightArray;
             for (auto& gameObject : scene.gameObjects)
             {
                 if (gameObject.isLight)
                 {
-                    lightArray[lightIndex].position = gameObject.getPosition();
-                    lightArray[lightIndex].color = gameObject.color;
-                    lightArray[lightIndex].intensity = gameObject.intensity;
-                    ++lightIndex;
+                    LightInstance light{};
+                    light.position = gameObject.getPosition();
+                    light.color = gameObject.color;
+                    light.intensity = gameObject.intensity;
+                    light.radius = gameObject.lightRadius;
+                    lightArray.push_back(light);
                 }
             }
 
-            int actualBufferSize = lightCount * sizeof(LightInstance);
+            if (lightArray.empty())
+            {
+                LightInstance sun{};
+                sun.position = glm::vec3(1.0f, 10035.0f, 0.0f);
+                sun.color = glm::vec3(1.0f);
+                sun.intensity = 1.0f;
+                sun.radius = 1000.0f;
+                lightArray.push_back(sun);
+            }
+
+            appendBenchmarkLights(lightArray);
+
+            // Step 2: nothing to do while the lights stay the same
+            if (lightArray.size() == lightSourceCache.size() &&
+                memcmp(lightArray.data(), lightSourceCache.data(), lightArray.size() * sizeof(LightInstance)) == 0)
+            {
+                return;
+            }
+
+            size_t actualBufferSize = lightArray.size() * sizeof(LightInstance);
+            if (actualBufferSize > normalBufferSize)
+            {
+                std::cout << "WARNING: Lights do not fit in the light buffer!" << std::endl;
+                return;
+            }
+
+            // Step 3: rebuild the alias table, the accumulation and the shadow history were lit by the old lights
+            lightSourceCache = lightArray;
+            buildLightAliasTable(lightArray);
+            lightInstances = lightArray;
+            resetProgressiveAccumulation();
+            shadowHistoryValid = false;
 
             // Map and copy data to staging buffer
             void* data;
             vkMapMemory(device, lightStagingBufferMemory, 0, actualBufferSize, 0, &data);
-            memcpy(data, lightArray.data(), actualBufferSize);
+            memcpy(data, lightInstances.data(), actualBufferSize);
             vkUnmapMemory(device, lightStagingBufferMemory);
 
             // Copy from staging buffer to device buffer
@@ -603,11 +1006,48 @@ namespace Engine
             endSingleTimeCommands(commandBuffer);
         }
 
+        // lightBenchmarkCount small colored point lights above the scene, the same ones every frame
+        void appendBenchmarkLights(std::vector<LightInstance>& lightArray)
+        {
+            std::mt19937 random(1234);
+            std::uniform_real_distribution<float> spread(-20.0f, 20.0f);
+            std::uniform_real_distribution<float> height(2.0f, 12.0f);
+            std::uniform_real_distribution<float> unit(0.0f, 1.0f);
+
+            for (int i = 0; i < lightBenchmarkCount; ++i)
+            {
+                LightInstance light{};
+                light.position = glm::vec3(spread(random), height(random), spread(random));
+                light.color = glm::vec3(unit(random), unit(random), unit(random));
+                light.intensity = 1.0f;
+                light.radius = 0.25f;
+                lightArray.push_back(light);
+            }
+        }
+
         void sendCameraDataToCompute()
         {
 			GameCamera& camera = gameManager.gameCameras[gameManager.currentCamera];
             CameraUBO ubo = camera.computeCameraData(window->WINDOW_WIDTH, window->WINDOW_HEIGHT);
 
+            // Any change of the camera itself restarts the progressive accumulation, last frame's matrices aside
+            if (!hasPreviousCamera || memcmp(&ubo, &previousCameraUBO, offsetof(CameraUBO, previousViewProjection)) != 0)
+            {
+                resetProgressiveAccumulation();
+            }
+
+            // Last frame's camera for the denoiser's reprojection, the first frame reprojects onto itself
+            const CameraUBO& previous = hasPreviousCamera ? previousCameraUBO : ubo;
+            ubo.previousViewProjection = previous.projectionMatrix * previous.viewMatrix;
+            ubo.previousPosition = previous.position;
+            previousCameraUBO = ubo;
+            hasPreviousCamera = true;
+
+            // The rasterizer's matrices, Y flipped like in VulkanUniform, for the hybrid mode's depth reconstruction
+            glm::mat4 rasterProjection = camera.calculateProjectionMatrix();
+            rasterProjection[1][1] *= -1;
+            ubo.inverseRasterViewProjection = glm::inverse(rasterProjection * camera.calculateViewMatrix());
+
             void* data;
             vkMapMemory(device, cameraBufferMemory, 0, sizeof(CameraUBO), 0, &data);
             memcpy(data, &ubo, sizeof(CameraUBO));
@@ -615,23 +1055,257 @@ namespace Engine
         }
         #pragma endregion
 
+        // Traces the frame the compute pass is about to render on the CPU, saves it and logs its rays per second
+        void renderCpuReferenceFrame()
+        {
+            std::vector<BVHNode> nodes = bvhNodes;
+            int tlasRootIndex = -1;
+            if (useTLAS && tlas.rootIndex >= 0)
+            {
+                nodes.resize(bvhNodes.size() + tlas.nodes.size());
+                tlas.copyTo(nodes.data() + bvhNodes.size(), static_cast<int>(bvhNodes.size()));
+                tlasRootIndex = static_cast<int>(bvhNodes.size()) + tlas.rootIndex;
+            }
+
+            GameCamera& camera = gameManager.gameCameras[gameManager.currentCamera];
+            CameraUBO ubo = camera.computeCameraData(window->WINDOW_WIDTH, window->WINDOW_HEIGHT);
+
+            CpuTracer tracer(nodes, bvhTriangles, bvhInstances, tlasRootIndex);
+            std::vector<glm::vec4> pixels;
+            CpuTracer::FrameStats stats = tracer.render(ubo, swapChainExtent.width, swapChainExtent.height, pixels);
+
+            std::filesystem::create_directories(cpuReferenceDirectory);
+            char fileName[64];
+            snprintf(fileName, sizeof(fileName), "cpu_%05llu.png", static_cast<unsigned long long>(cpuReferenceFrameIndex));
+            std::string path = cpuReferenceDirectory + fileName;
+            if (!CpuTracer::writePNG(path, pixels, stats.width, stats.height))
+            {
+                std::cout << "WARNING: failed to write " << path << std::endl;
+            }
+
+            // One line per frame, so rays per second can be tracked across runs
+            std::string statsPath = cpuReferenceDirectory + "cpu_stats.csv";
+            bool newFile = !std::filesystem::exists(statsPath);
+            std::ofstream statsFile(statsPath, std::ios::app);
+            if (newFile) statsFile << "frame,width,height,rays,box_tests,ms,mrays_per_s,workers\n";
+            statsFile << cpuReferenceFrameIndex << "," << stats.width << "," << stats.height << "," << stats.rays << "," << stats.boxTests << ","
+                << stats.milliseconds << "," << stats.megaRaysPerSecond() << "," << TaskScheduler::instance().workerCount() << "\n";
+
+            printf("CPU reference: frame %llu, %dx%d, %.2f M rays in %.0f ms, %.2f Mrays/s -> %s\n", static_cast<unsigned long long>(cpuReferenceFrameIndex),
+                stats.width, stats.height, stats.rays / 1e6, stats.milliseconds, stats.megaRaysPerSecond(), path.c_str());
+            cpuReferenceFrameIndex++;
+        }
+
+        // Generate, extend, shade, shadow and resolve as separate dispatches, the queue stages sized by what the stage before appended
+        void recordWavefrontPathTracing(VkCommandBuffer commandBuffer, uint32_t pixelGroupsX, uint32_t pixelGroupsY)
+        {
+            auto bindStage = [&](WavefrontStage stage)
+                {
+                    vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, rayTracingWavefrontPipelines[static_cast<int>(stage)]);
+                };
+            auto queueOffset = [](int queue)
+                {
+                    return static_cast<VkDeviceSize>(sizeof(WavefrontQueue) * queue);
+                };
+
+            // Step 1: empty queues, the previous frame may still be reading them
+            {
+                computePassBarrier(commandBuffer, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT | VK_PIPELINE_STAGE_DRAW_INDIRECT_BIT, VK_ACCESS_SHADER_WRITE_BIT);
+
+                WavefrontQueue emptyQueues[wavefrontQueueCount];
+                for (WavefrontQueue& queue : emptyQueues)
+                {
+                    queue = { 0, 1, 1, 0 };
+                }
+                vkCmdUpdateBuffer(commandBuffer, wavefrontStateBuffer, 0, sizeof(emptyQueues), emptyQueues);
+
+                computePassBarrier(commandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_ACCESS_TRANSFER_WRITE_BIT);
+            }
+
+            // Step 2: camera rays, one per pixel
+            bindStage(WavefrontStage::Generate);
+            vkCmdDispatch(commandBuffer, pixelGroupsX, pixelGroupsY, 1);
+            computePassBarrier(commandBuffer, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_ACCESS_SHADER_WRITE_BIT);
+
+            // Step 3: extend, shade and shadow, each as large as the queue it reads
+            WavefrontStage queueStages[wavefrontQueueCount] = { WavefrontStage::Extend, WavefrontStage::Shade, WavefrontStage::Shadow };
+            for (int queue = 0; queue < wavefrontQueueCount; ++queue)
+            {
+                // Shadow rays sorted by bin before they are traced
+                if (queueStages[queue] == WavefrontStage::Shadow && useRayBinning)
+                {
+                    bindStage(WavefrontStage::BinCount);
+                    vkCmdDispatchIndirect(commandBuffer, wavefrontStateBuffer, queueOffset(queue));
+                    computePassBarrier(commandBuffer, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_ACCESS_SHADER_WRITE_BIT);
+
+                    bindStage(WavefrontStage::BinScan);
+                    vkCmdDispatch(commandBuffer, 1, 1, 1);
+                    computePassBarrier(commandBuffer, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_ACCESS_SHADER_WRITE_BIT);
+
+                    bindStage(WavefrontStage::BinScatter);
+                    vkCmdDispatchIndirect(commandBuffer, wavefrontStateBuffer, queueOffset(queue));
+                    computePassBarrier(commandBuffer, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_ACCESS_SHADER_WRITE_BIT);
+                }
+
+                bindStage(queueStages[queue]);
+                vkCmdDispatchIndirect(commandBuffer, wavefrontStateBuffer, queueOffset(queue));
+                computePassBarrier(commandBuffer, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_ACCESS_SHADER_WRITE_BIT);
+            }
+
+            // Step 4: lighting times visibility
+            bindStage(WavefrontStage::Resolve);
+            vkCmdDispatch(commandBuffer, pixelGroupsX, pixelGroupsY, 1);
+        }
+
+        // Progressive refinement runs in the megakernel only, the hybrid mode traces no camera rays to accumulate
+        bool progressiveRefinementActive()
+        {
+            return useProgressiveRefinement && !useWavefrontPathTracing && !useHybridRendering;
+        }
+
+        void resetProgressiveAccumulation()
+        {
+            progressiveSampleCount = 0;
+            progressiveResetTime = glfwGetTime();
+            progressiveReportSeconds = -1.0;
+        }
+
+        // 0 without the denoiser, 1 denoising, 2 denoising without a history to reproject
+        int shadowDenoiserMode()
+        {
+            if (!useShadowDenoiser || useWavefrontPathTracing || useHybridRendering || progressiveRefinementActive())
+            {
+                return 0;
+            }
+            return shadowHistoryValid ? 1 : 2;
+        }
+
+        // Shadow rays per block, then the joint bilateral upsample over the pixels
+        void recordReducedResolutionShadows(VkCommandBuffer commandBuffer, uint32_t pixelGroupsX, uint32_t pixelGroupsY)
+        {
+            VkExtent2D traceExtent = rayTracingTraceExtent();
+            uint32_t blocksX = (traceExtent.width + shadowResolutionDivisor - 1) / shadowResolutionDivisor;
+            uint32_t blocksY = (traceExtent.height + shadowResolutionDivisor - 1) / shadowResolutionDivisor;
+
+            // Step 1: trace from the surfaces the megakernel wrote
+            computePassBarrier(commandBuffer, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_ACCESS_SHADER_WRITE_BIT);
+            vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, rayTracingShadowResolutionPipelines[static_cast<int>(ShadowResolutionPass::Trace)]);
+            vkCmdDispatch(commandBuffer, (blocksX + 15) / 16, (blocksY + 15) / 16, 1);
+
+            // Step 2: upsample into the image
+            computePassBarrier(commandBuffer, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_ACCESS_SHADER_WRITE_BIT);
+            vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, rayTracingShadowResolutionPipelines[static_cast<int>(ShadowResolutionPass::Upsample)]);
+            vkCmdDispatch(commandBuffer, pixelGroupsX, pixelGroupsY, 1);
+        }
+
+        // Temporal pass then the a-trous passes, each with its iteration pushed
+        void recordShadowDenoiser(VkCommandBuffer commandBuffer, uint32_t pixelGroupsX, uint32_t pixelGroupsY)
+        {
+            computePassBarrier(commandBuffer, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_ACCESS_SHADER_WRITE_BIT);
+
+            // Step 1: reproject and accumulate
+            vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, rayTracingDenoisePipelines[static_cast<int>(DenoisePass::Temporal)]);
+            vkCmdDispatch(commandBuffer, pixelGroupsX, pixelGroupsY, 1);
+
+            // Step 2: a-trous, the last pass writes the image
+            vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, rayTracingDenoisePipelines[static_cast<int>(DenoisePass::Atrous)]);
+            for (int iteration = 0; iteration < std::max(shadowDenoiseAtrousIterations, 1); ++iteration)
+            {
+                computePassBarrier(commandBuffer, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_ACCESS_SHADER_WRITE_BIT);
+                sendBufferSizesToCompute(iteration);
+                vkCmdDispatch(commandBuffer, pixelGroupsX, pixelGroupsY, 1);
+            }
+        }
+
+        // Scales the trace up to the whole ray tracing image
+        void recordUpscale(VkCommandBuffer commandBuffer)
+        {
+            computePassBarrier(commandBuffer, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_ACCESS_SHADER_WRITE_BIT);
+
+            vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, rayTracingUpscalePipeline);
+            vkCmdDispatch(commandBuffer, (swapChainExtent.width + 15) / 16, (swapChainExtent.height + 15) / 16, 1);
+        }
+
+        // Shadow rays from the G-buffer the raster pass wrote, its command buffer is submitted ahead of this one
+        void recordHybridShadows(VkCommandBuffer commandBuffer)
+        {
+            computePassBarrier(commandBuffer, VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT, VK_ACCESS_SHADER_WRITE_BIT);
+
+            vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, rayTracingHybridPipeline);
+            vkCmdDispatch(commandBuffer, (swapChainExtent.width + 15) / 16, (swapChainExtent.height + 15) / 16, 1);
+        }
+
         void renderComputeRaytracedScene(double deltaTime)
         {
             vkCmdWriteTimestamp(rayTracingCommandBuffers[currentFrame], VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, timestampQueryPool, 4 * currentFrame + 0);
 
             int localSizeX = 16;
 			int localSizeY = 16;
-			int width = swapChainExtent.width;
-			int height = swapChainExtent.height;
+			int width = rayTracingTraceExtent().width;
+			int height = rayTracingTraceExtent().height;
 
-            vkCmdDispatch(
-                rayTracingCommandBuffers[currentFrame],
-                (width + localSizeX - 1) / localSizeX,
-                (height + localSizeY - 1) / localSizeY,
-                1
-            );
+            uint32_t groupCountX = (width + localSizeX - 1) / localSizeX;
+            uint32_t groupCountY = (height + localSizeY - 1) / localSizeY;
+            if (useSwizzledDispatch)
+            {
+                // Whole 8x8 tile blocks, the padding workgroups return at once
+                groupCountX = (groupCountX + swizzleBlockTiles - 1) / swizzleBlockTiles * swizzleBlockTiles;
+                groupCountY = (groupCountY + swizzleBlockTiles - 1) / swizzleBlockTiles * swizzleBlockTiles;
+            }
 
-            vkCmdWriteTimestamp(rayTracingCommandBuffers[currentFrame], VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, timestampQueryPool, 4 * currentFrame + 1);
+            if (useHybridRendering)
+            {
+                recordHybridShadows(rayTracingCommandBuffers[currentFrame]);
+            }
+            else if (useWavefrontPathTracing)
+            {
+                recordWavefrontPathTracing(rayTracingCommandBuffers[currentFrame], groupCountX, groupCountY);
+            }
+            else
+            {
+                vkCmdDispatch(
+                    rayTracingCommandBuffers[currentFrame],
+                    groupCountX,
+                    groupCountY,
+                    1
+                );
+
+                if (shadowDenoiserMode() != 0)
+                {
+                    recordShadowDenoiser(rayTracingCommandBuffers[currentFrame], groupCountX, groupCountY);
+                }
+                else if (reducedResolutionShadowsActive())
+                {
+                    recordReducedResolutionShadows(rayTracingCommandBuffers[currentFrame], groupCountX, groupCountY);
+                }
+            }
+
+            if (useDynamicResolution && !useHybridRendering)
+            {
+                recordUpscale(rayTracingCommandBuffers[currentFrame]);
+            }
+
+            // Bottom of pipe, so the time covers the dispatches and the dynamic resolution controller can trust it
+            vkCmdWriteTimestamp(rayTracingCommandBuffers[currentFrame], VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, timestampQueryPool, 4 * currentFrame + 1);
+
+            if (useTraversalInstrumentation && !useWavefrontPathTracing)
+            {
+                traversalTotalsBarrierToHost(rayTracingCommandBuffers[currentFrame]);
+                traversalTotalsPending[currentFrame] = true;
+            }
+
+            shadowHistoryValid = shadowDenoiserMode() != 0;
+            rayTracingFrameIndex++;
+
+            if (progressiveRefinementActive() && progressiveSampleCount < progressiveMaxSamples)
+            {
+                progressiveSampleCount++;
+                if (progressiveSampleCount == progressiveReportSamples)
+                {
+                    progressiveReportSeconds = glfwGetTime() - progressiveResetTime;
+                    printf("Progressive refinement: %d samples per pixel in %.3f s\n", progressiveSampleCount, progressiveReportSeconds);
+                }
+            }
         }
 
         void finishComputeRaytracing()
@@ -663,6 +1337,11 @@ namespace Engine
 
             imageBarrierToGeneral(commandBuffers[currentFrame]);
 
+            if (useHybridRendering)
+            {
+                clearGBuffer(commandBuffers[currentFrame]);
+            }
+
             /// Begin render pass
             {
                 VkRenderPassBeginInfo renderPassInfo{};
@@ -699,6 +1378,52 @@ namespace Engine
             }
         };
 
+        // Empties the hybrid mode's G-buffer to depth 1, after the last frame's hybrid pass read it and before the fragments write it
+        void clearGBuffer(VkCommandBuffer commandBuffer)
+        {
+            VkImageMemoryBarrier barrier{};
+            barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+            barrier.oldLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+            barrier.newLayout = VK_IMAGE_LAYOUT_GENERAL;
+            barrier.srcAccessMask = 0;
+            barrier.dstAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+            barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+            barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+            barrier.image = gBufferImage;
+            barrier.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+            barrier.subresourceRange.baseMipLevel = 0;
+            barrier.subresourceRange.levelCount = 1;
+            barrier.subresourceRange.baseArrayLayer = 0;
+            barrier.subresourceRange.layerCount = 1;
+
+            vkCmdPipelineBarrier(
+                commandBuffer,
+                VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, // srcStage
+                VK_PIPELINE_STAGE_TRANSFER_BIT,       // dstStage
+                0,
+                0, nullptr,
+                0, nullptr,
+                1, &barrier
+            );
+
+            VkClearColorValue clearColor = { {0.0f, 0.0f, 0.0f, 1.0f} };
+            vkCmdClearColorImage(commandBuffer, gBufferImage, VK_IMAGE_LAYOUT_GENERAL, &clearColor, 1, &barrier.subresourceRange);
+
+            barrier.oldLayout = VK_IMAGE_LAYOUT_GENERAL;
+            barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+            barrier.dstAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+
+            vkCmdPipelineBarrier(
+                commandBuffer,
+                VK_PIPELINE_STAGE_TRANSFER_BIT,        // srcStage
+                VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT, // dstStage
+                0,
+                0, nullptr,
+                0, nullptr,
+                1, &barrier
+            );
+        }
+
         void renderRasterizedScene(double deltaTime)
         {
             // Render current scene objects (non UI)
@@ -736,14 +1461,35 @@ namespace Engine
 
             // Record draw calls
             uint32_t gameObjectIndex = 0;
+            if (useHybridRendering)
+            {
+                // Depth pre-pass, then the G-buffer pass draws the same objects again with an EQUAL depth test
+                vkCmdBindPipeline(commandBuffers[currentFrame], VK_PIPELINE_BIND_POINT_GRAPHICS, depthPrePassPipeline);
+                for (auto gameObject : scene.gameObjects)
+                {
+                    if (!gameObject.isVisible && !gameObject.isTerrain)
+                    {
+                        continue;
+                    }
+                    uniformManager.updateObjectUniformBuffer(gameObject, gameObjectIndex);
+                    commandManager.recordCommandBuffer(gameObjectIndex++, gameObject);
+                }
+
+                vkCmdBindPipeline(commandBuffers[currentFrame], VK_PIPELINE_BIND_POINT_GRAPHICS, gBufferPipeline);
+                gameObjectIndex = 0;
+            }
+
             for (auto gameObject : scene.gameObjects)
             {
                 if (!gameObject.isVisible && !gameObject.isTerrain)
                 {
                     continue;
                 }
-                // Update object specific uniforms
-                uniformManager.updateObjectUniformBuffer(gameObject, gameObjectIndex);
+                // Update object specific uniforms, the depth pre-pass already did
+                if (!useHybridRendering)
+                {
+                    uniformManager.updateObjectUniformBuffer(gameObject, gameObjectIndex);
+                }
                 // Update descriptor sets (shader inputs)
                 commandManager.recordCommandBuffer(gameObjectIndex++, gameObject);
             }
@@ -787,7 +1533,8 @@ namespace Engine
 
 		void finishRasterization()
 		{
-            vkCmdWriteTimestamp(commandBuffers[currentFrame], VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, timestampQueryPool, 4 * currentFrame + 3);
+            // Bottom of pipe, so the hybrid mode A/B times the fragment work and not only its submission
+            vkCmdWriteTimestamp(commandBuffers[currentFrame], VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, timestampQueryPool, 4 * currentFrame + 3);
 		}
 
         #pragma endregion
@@ -1005,6 +1752,64 @@ namespace Engine
 			loadScenes(path);
 		}
 
+        #pragma region Dynamic resolution
+        // Pixels traced this frame, the swap chain scaled by the dynamic resolution controller. The hybrid mode
+        // shades the rasterized G-buffer, which always has the swap chain's size.
+        VkExtent2D rayTracingTraceExtent()
+        {
+            if (!useDynamicResolution || useHybridRendering)
+            {
+                return swapChainExtent;
+            }
+
+            VkExtent2D extent;
+            extent.width = std::max(1u, static_cast<uint32_t>(swapChainExtent.width * dynamicResolutionScale + 0.5f));
+            extent.height = std::max(1u, static_cast<uint32_t>(swapChainExtent.height * dynamicResolutionScale + 0.5f));
+            return extent;
+        }
+
+        // Steers the trace resolution towards dynamicResolutionBudgetMs from the GPU ray tracing time of each frame.
+        // Cost grows with the pixel count, the square of the scale, so the scale moves by the square root of budget over time.
+        void updateDynamicResolution(double computeRayTraceMs)
+        {
+            if (!useDynamicResolution || useHybridRendering || computeRayTraceMs <= 0.0)
+            {
+                dynamicResolutionFrameMs = 0.0;
+                return;
+            }
+
+            // Step 1: smooth out single slow frames
+            dynamicResolutionFrameMs = dynamicResolutionFrameMs <= 0.0 ? computeRayTraceMs : dynamicResolutionFrameMs * 0.9 + computeRayTraceMs * 0.1;
+
+            // Step 2: a progressive accumulation keeps its resolution, any change would restart it
+            if (progressiveRefinementActive())
+            {
+                return;
+            }
+
+            // Step 3: leave the scale alone within 5% of the budget, otherwise move a tenth of the way each frame, slower than the smoothing
+            double ratio = dynamicResolutionBudgetMs / dynamicResolutionFrameMs;
+            if (ratio > 0.95 && ratio < 1.05)
+            {
+                return;
+            }
+            float target = dynamicResolutionScale * static_cast<float>(std::sqrt(ratio));
+            float step = (target - dynamicResolutionScale) * 0.1f;
+
+            // Step 4: whole percents, at least one, so the trace extent only changes when the budget is missed
+            step = step > 0.0f ? std::max(step, 0.01f) : std::min(step, -0.01f);
+            float scale = std::round((dynamicResolutionScale + step) * 100.0f) / 100.0f;
+            dynamicResolutionScale = std::clamp(scale, dynamicResolutionMinScale, dynamicResolutionMaxScale);
+        }
+        #pragma endregion
+
+        // Megakernel without the hybrid mode, the denoiser, progressive refinement or a heatmap, which all need shadows per pixel
+        bool reducedResolutionShadowsActive()
+        {
+            return shadowResolutionDivisor > 1 && !useWavefrontPathTracing && !useHybridRendering && shadowDenoiserMode() == 0 && !progressiveRefinementActive()
+                && !(useTraversalInstrumentation && traversalHeatmap != 0);
+        }
+
 		void renderFrame(double deltaTime)
 		{
             this->waitForPreviousFrame();
@@ -8,6 +8,56 @@ layout(local_size_x = 16, local_size_y = 16) in;
 #define EPSILON 0.0001f
 #define SMALL_EPSILON 0.00000001f
 
+// Set for the instrumented pipeline variant only, the default one compiles every counter away
+layout(constant_id = 0) const bool INSTRUMENTATION = false;
+
+// Set to traverse binary BVHs with a short shared memory stack and parent links, see SHORT STACK TRAVERSAL
+layout(constant_id = 1) const bool SHORT_STACK_TRAVERSAL = false;
+#define SHORT_STACK_SIZE 8u      // BLAS entries per invocation
+#define TLAS_SHORT_STACK_SIZE 4u // TLAS entries per invocation, kept while the BLAS below is traversed
+
+// Megakernel or one stage of the wavefront path tracer, values of WavefrontStage in VulkanTypes.h
+#define WAVEFRONT_MEGAKERNEL 0
+#define WAVEFRONT_GENERATE 1
+#define WAVEFRONT_EXTEND 2
+#define WAVEFRONT_SHADE 3
+#define WAVEFRONT_SHADOW 4
+#define WAVEFRONT_RESOLVE 5
+#define WAVEFRONT_BIN_COUNT 6
+#define WAVEFRONT_BIN_SCAN 7
+#define WAVEFRONT_BIN_SCATTER 8
+layout(constant_id = 2) const int WAVEFRONT_STAGE = WAVEFRONT_MEGAKERNEL;
+
+#define WAVEFRONT_EXTEND_QUEUE 0u
+#define WAVEFRONT_HIT_QUEUE 1u
+#define WAVEFRONT_SHADOW_QUEUE 2u
+
+// Shadow rays are sorted into 8 direction octants times 8x8x8 origin cells, see RAY BINNING
+#define RAY_BIN_COUNT 4096u
+
+// Ray tracing or one pass of the shadow denoiser, values of DenoisePass in VulkanTypes.h
+#define DENOISE_NONE 0
+#define DENOISE_TEMPORAL 1
+#define DENOISE_ATROUS 2
+layout(constant_id = 3) const int DENOISE_PASS = DENOISE_NONE;
+
+// Set for the pass that scales a dynamic resolution trace up to the whole image, see UPSCALE
+layout(constant_id = 4) const bool UPSCALE_PASS = false;
+
+// Ray tracing or one pass of the reduced resolution shadows, values of ShadowResolutionPass in VulkanTypes.h
+#define SHADOW_RESOLUTION_NONE 0
+#define SHADOW_RESOLUTION_TRACE 1
+#define SHADOW_RESOLUTION_UPSAMPLE 2
+layout(constant_id = 5) const int SHADOW_RESOLUTION_PASS = SHADOW_RESOLUTION_NONE;
+
+// Set for the hybrid mode's pass that shades the rasterized G-buffer with shadow rays only, see HYBRID
+layout(constant_id = 6) const bool HYBRID_PASS = false;
+
+// Values of TriangleFormat in TriangleFormats.h
+#define TRIANGLE_FORMAT_TRIANGLES 0
+#define TRIANGLE_FORMAT_INDEXED 1
+#define TRIANGLE_FORMAT_PRECOMPUTED 2
+
 // ========== BUFFER SIZES ==========
 layout(push_constant, std430) uniform PushConstants
 {
@@ -15,11 +65,37 @@ layout(push_constant, std430) uniform PushConstants
     int triangleCount;
     int instanceCount;
     int lightCount;
+    int tlasRootIndex; // Top level BVH over the instances, -1 to loop over every instance
+    int useWideBVH;    // Non zero to traverse the compressed wide BVHs
+    int useCompactBVH; // Non zero to traverse the 32 byte depth first nodes instead of the binary ones
+    int triangleFormat; // TRIANGLE_FORMAT_* buffer the triangles are read from
+    int traversalHeatmap;    // Instrumented pipeline: 0 shades, 1 nodes visited, 2 triangles tested, 3 stack high-water mark
+    int traversalHeatmapMax; // Counter value drawn as the hottest color
+    int swizzledDispatch; // Non zero: workgroups take 16x16 tiles in Morton order, the host pads the dispatch to whole 8x8 tile blocks
+    int binRays;          // Non zero: the wavefront shadow stage reads the binned shadow queue
+    int shadowSampleCount;         // Shadow rays per pixel of the megakernel without the denoiser
+    int denoisedShadowSampleCount; // Shadow rays per pixel that the denoiser filters
+    int shadowDenoiser;            // 0 off, 1 on, 2 on without history (first frame)
+    int denoiseSplitX;             // Pixels left of it are not denoised, for side by side comparisons
+    int frameIndex;                // Frames traced so far: shadow jitter seed and history slot
+    int atrousIteration;           // A-trous pass being recorded, its taps are 2^iteration pixels apart
+    int atrousIterationCount;      // The last a-trous pass composites into the image
+    int progressiveSample;         // Sample of the progressive accumulation traced this frame, -1 when off
+    int progressiveConverged;      // Non zero: the accumulation is complete and only shown
+    int traceWidth;                // Pixels traced this frame, from the top left of outputImage
+    int traceHeight;
+    int shadowResolutionDivisor;   // 1 traces shadows per pixel, 2 or 4 per 2x2 or 4x4 block and upsamples them
 };
 
 // ========== OUTPUT IMAGE ==========
 layout(set = 0, binding = 0, rgba32f) uniform image2D outputImage;
 
+// Part of outputImage traced this frame, all of it unless dynamic resolution scaled it down
+ivec2 traceSize()
+{
+    return ivec2(traceWidth, traceHeight);
+}
+
 // ========== CAMERA ==========
 struct Camera
 {
@@ -36,6 +112,11 @@ struct Camera
 
     mat4 projectionMatrix;
     mat4 viewMatrix;
+
+    mat4 previousViewProjection; // Projection times view of the last frame, for reprojection
+    vec4 previousPosition;
+
+    mat4 inverseRasterViewProjection; // Rasterizer clip space back to world space, for the hybrid mode
 };
 
 layout(set = 0, binding = 1) uniform CameraBuffer
@@ -47,7 +128,7 @@ layout(set = 0, binding = 1) uniform CameraBuffer
 struct BVHNode
 {
     vec3 boundMin;
-    float pad0;
+    int parent; // -1 for BLAS and TLAS roots
 
     vec3 boundMax;
     float pad1;
@@ -86,7 +167,7 @@ struct BVHInstance
     int bvhRootNodeIndex;
     int triangleOffset;
     int triangleCount;
-    int pad0;
+    int wideRootNodeIndex;
 };
 
 layout(std430, set = 0, binding = 4) buffer InstanceBuffer
@@ -98,14 +179,14 @@ layout(std430, set = 0, binding = 4) buffer InstanceBuffer
 struct LightInstance
 {
     vec3 position;
-    float pad0;
+    float aliasProbability; // Chance that a pick of this slot keeps this light, see LIGHT SAMPLING
 
     vec3 color;
-    float pad1;
+    int aliasIndex;         // Light taken otherwise
 
     float intensity;
     float radius;
-    float pad2;
+    float selectionPdf;     // Chance of picking this light
     float pad3;
 };
 
@@ -114,6 +195,126 @@ layout(std430, set = 0, binding = 5) buffer LightBuffer
     LightInstance lights[];
 };
 
+// ========== WIDE BVH NODES ==========
+// Up to 8 children per node, boxes quantized to 8 bits on a power of two grid from origin
+struct WideBVHNode
+{
+    float origin[3];
+    uint exponentsAndCount; // Biased x, y, z grid exponents in bytes 0-2, child count in byte 3
+    uint childBaseIndex;    // Internal children are consecutive from here
+    uint triangleBaseIndex; // Leaf children triangles are consecutive from here
+    uint childMeta[4];      // 16 bits per child: 0x8000 | slot for internal children, count << 10 | offset for leaves
+    uint quantizedMin[6];   // 8 bits per child, word axis * 2 + child / 4
+    uint quantizedMax[6];
+};
+
+layout(std430, set = 0, binding = 6) buffer WideBVHBuffer
+{
+    WideBVHNode wideNodes[];
+};
+
+// ========== COMPACT BVH NODES ==========
+// Depth first copy of the binary nodes, same indices. The left child of an internal node is the next node.
+struct CompactBVHNode
+{
+    vec3 boundMin;
+    int rightOrFirstTriangle; // Right child for internal nodes, first triangle for leaves
+
+    vec3 boundMax;
+    int triangleCount;        // Internal nodes: -1 - (split axis | left child on the upper side << 2)
+};
+
+layout(std430, set = 0, binding = 7) buffer CompactBVHBuffer
+{
+    CompactBVHNode compactNodes[];
+};
+
+// ========== INDEXED TRIANGLES ==========
+// Packed xyz positions and three global position indices per triangle, in the order of the triangle buffer
+layout(std430, set = 0, binding = 8) buffer PositionBuffer
+{
+    float positions[];
+};
+
+layout(std430, set = 0, binding = 9) buffer TriangleIndexBuffer
+{
+    uint triangleIndices[];
+};
+
+// ========== TRAVERSAL COUNTERS ==========
+// Per pixel nodes visited, triangles tested, stack high-water mark and rays traced, and the frame totals
+// of the same four values, written by the instrumented pipeline only
+layout(std430, set = 0, binding = 11) buffer TraversalCounterBuffer
+{
+    uvec4 traversalCounters[];
+};
+
+layout(std430, set = 0, binding = 12) buffer TraversalTotalsBuffer
+{
+    uint totalRays;
+    uint maxStackHighWater;
+    uint totalNodesLow;        // Node and triangle totals pass 2^32 at 4K, they are 64 bit as low and high words
+    uint totalNodesHigh;
+    uint totalTrianglesLow;
+    uint totalTrianglesHigh;
+};
+
+uint pixelNodes = 0u;
+uint pixelTriangles = 0u;
+uint pixelStackHighWater = 0u;
+uint pixelRays = 0u;
+
+shared uint groupRays;
+shared uint groupNodes;
+shared uint groupTriangles;
+shared uint groupStackHighWater;
+
+void countNode()
+{
+    if (INSTRUMENTATION) pixelNodes++;
+}
+
+void countStack(int stackIndex)
+{
+    if (INSTRUMENTATION) pixelStackHighWater = max(pixelStackHighWater, uint(stackIndex));
+}
+
+vec4 loadPosition(uint vertexIndex)
+{
+    return vec4(positions[vertexIndex * 3u], positions[vertexIndex * 3u + 1u], positions[vertexIndex * 3u + 2u], 1.0);
+}
+
+// ========== PRECOMPUTED TRIANGLES ==========
+// First corner and both edges of every triangle in the order of the triangle buffer
+struct RayTriangle
+{
+    vec4 v0;    // w: geometric normal as two octahedral snorm16, bit cast
+    vec4 edge1; // w: material id bits
+    vec4 edge2;
+};
+
+layout(std430, set = 0, binding = 10) buffer RayTriangleBuffer
+{
+    RayTriangle rayTriangles[];
+};
+
+// Triangle i from the triangle or indexed buffers, the centroid is only used by the builders
+Triangle loadTriangle(int triangleIndex)
+{
+    if (triangleFormat != TRIANGLE_FORMAT_INDEXED)
+    {
+        return triangles[triangleIndex];
+    }
+
+    Triangle tri;
+    uint first = uint(triangleIndex) * 3u;
+    tri.v0 = loadPosition(triangleIndices[first]);
+    tri.v1 = loadPosition(triangleIndices[first + 1u]);
+    tri.v2 = loadPosition(triangleIndices[first + 2u]);
+    tri.c = vec4(0.0);
+    return tri;
+}
+
 // ========== UTILITY STRUCTS ==========
 // Simple ray structure
 struct Ray {
@@ -135,10 +336,10 @@ struct HitInfo {
 
 // ========== UTILITY FUNCTIONS ==========
 // AABB ray-box intersection
-bool intersectAABB(Ray ray, BVHNode node, out vec2 intersect)
+bool intersectAABB(Ray ray, vec3 boundMin, vec3 boundMax, out vec2 intersect)
 {
-    vec3 t0 = (node.boundMin - ray.origin) * ray.inverseDirection;
-    vec3 t1 = (node.boundMax - ray.origin) * ray.inverseDirection;
+    vec3 t0 = (boundMin - ray.origin) * ray.inverseDirection;
+    vec3 t1 = (boundMax - ray.origin) * ray.inverseDirection;
 
     vec3 temp = t0;
     t0 = min(t0, t1);  // tNear
@@ -151,17 +352,20 @@ bool intersectAABB(Ray ray, BVHNode node, out vec2 intersect)
     return intersect.x <= intersect.y + EPSILON && intersect.y >= 0.0;
 }
 
-// Möller–Trumbore ray-triangle intersection
-bool intersectRayTriangle(Ray ray, Triangle tri, out float t, out vec3 normal)
+bool intersectAABB(Ray ray, BVHNode node, out vec2 intersect)
+{
+    return intersectAABB(ray, node.boundMin, node.boundMax, intersect);
+}
+
+// Möller–Trumbore ray-triangle intersection on the first corner and both edges
+bool intersectRayTriangleEdges(Ray ray, vec3 v0, vec3 edge1, vec3 edge2, out float t)
 {
-    vec3 edge1 = (tri.v1 - tri.v0).xyz;
-    vec3 edge2 = (tri.v2 - tri.v0).xyz;
     vec3 h = cross(ray.direction, edge2);
     float a = dot(edge1, h);
     if (abs(a) < SMALL_EPSILON) return false;
 
     float f = 1.0 / a;
-    vec3 s = (ray.origin - tri.v0.xyz).xyz;
+    vec3 s = ray.origin - v0;
     a = f * dot(s, h);
     if (a < 0.0 || a > 1.0) return false;
 
@@ -170,12 +374,60 @@ bool intersectRayTriangle(Ray ray, Triangle tri, out float t, out vec3 normal)
     if (v < 0.0 || a + v > 1.0) return false;
 
     t = f * dot(edge2, s);
-    if (t > SMALL_EPSILON)
+    return t > SMALL_EPSILON;
+}
+
+bool intersectRayTriangle(Ray ray, Triangle tri, out float t, out vec3 normal)
+{
+    vec3 edge1 = (tri.v1 - tri.v0).xyz;
+    vec3 edge2 = (tri.v2 - tri.v0).xyz;
+    if (!intersectRayTriangleEdges(ray, tri.v0.xyz, edge1, edge2, t)) return false;
+
+    normal = normalize(cross(edge1, edge2));
+    return true;
+}
+
+vec3 decodeOctahedralNormal(uint packedNormal)
+{
+    vec2 p = unpackSnorm2x16(packedNormal);
+    vec3 n = vec3(p, 1.0 - abs(p.x) - abs(p.y));
+    if (n.z < 0.0)
+    {
+        n.xy = (1.0 - abs(n.yx)) * vec2(n.x >= 0.0 ? 1.0 : -1.0, n.y >= 0.0 ? 1.0 : -1.0);
+    }
+    return normalize(n);
+}
+
+// Triangle i in the current format. Precomputed triangles skip the edge subtractions and the normal cross product.
+bool intersectTriangleAt(Ray ray, int triangleIndex, out float t, out vec3 normal)
+{
+    if (INSTRUMENTATION) pixelTriangles++;
+
+    if (triangleFormat == TRIANGLE_FORMAT_PRECOMPUTED)
     {
-        normal = normalize(cross(edge1, edge2));
+        RayTriangle tri = rayTriangles[triangleIndex];
+        if (!intersectRayTriangleEdges(ray, tri.v0.xyz, tri.edge1.xyz, tri.edge2.xyz, t)) return false;
+
+        normal = decodeOctahedralNormal(floatBitsToUint(tri.v0.w));
         return true;
     }
-    return false;
+
+    return intersectRayTriangle(ray, loadTriangle(triangleIndex), t, normal);
+}
+
+// Distance only version of intersectTriangleAt for occlusion rays, no normal is decoded or computed
+bool intersectTriangleDistanceAt(Ray ray, int triangleIndex, out float t)
+{
+    if (INSTRUMENTATION) pixelTriangles++;
+
+    if (triangleFormat == TRIANGLE_FORMAT_PRECOMPUTED)
+    {
+        RayTriangle tri = rayTriangles[triangleIndex];
+        return intersectRayTriangleEdges(ray, tri.v0.xyz, tri.edge1.xyz, tri.edge2.xyz, t);
+    }
+
+    Triangle tri = loadTriangle(triangleIndex);
+    return intersectRayTriangleEdges(ray, tri.v0.xyz, (tri.v1 - tri.v0).xyz, (tri.v2 - tri.v0).xyz, t);
 }
 
 void IntersectTri(Ray ray, const Triangle tri)
@@ -322,10 +574,9 @@ HitInfo traceRay(Ray ray)
 
             for (int i = 0; i < currentNode.triangleCount; ++i)
             {
-                Triangle currentTriangle = triangles[instance.triangleOffset + currentNode.firstTriangle + i];
                 float t;
                 vec3 n;
-                if (intersectRayTriangle(ray, currentTriangle, t, n))
+                if (intersectTriangleAt(ray, instance.triangleOffset + currentNode.firstTriangle + i, t, n))
                 {
                     if (t < closestHit.t)
                     {
@@ -460,123 +711,833 @@ HitInfo visualizeBVHLeaves(Ray ray)
     return closestHit;
 }
 
-HitInfo traceRay2(Ray ray)
+// ========== SHORT STACK TRAVERSAL ==========
+// Binary BVH traversal with a few stack entries per invocation in shared memory instead of int stack[64].
+// Both children are tested and the far one is pushed, near and far come from the ray direction sign along
+// the axis the child boxes are furthest apart. A full stack drops its oldest entry; once that happened an
+// empty stack climbs the parent links to the next unvisited far sibling instead of ending the traversal.
+struct ShortStack
 {
-    HitInfo closestHit;
-    closestHit.t = 1e20;
-    closestHit.hit = false;
+    uint base; // First shared memory slot of this stack
+    uint size;
+    uint top;
+    uint count;
+    bool dropped;
+};
 
-	const int stackSize = 64;
+const uint SHORT_STACK_SLOTS = SHORT_STACK_TRAVERSAL ? (SHORT_STACK_SIZE + TLAS_SHORT_STACK_SIZE) * gl_WorkGroupSize.x * gl_WorkGroupSize.y : 1u;
+shared int shortStackEntries[SHORT_STACK_SLOTS];
 
-    for(int i = 0; i < instanceCount; ++i)
+ShortStack makeShortStack(uint base, uint size)
+{
+    return ShortStack(base, size, 0u, 0u, false);
+}
+
+uint shortStackSlot(ShortStack stack)
+{
+    return (stack.base + stack.top) * gl_WorkGroupSize.x * gl_WorkGroupSize.y + gl_LocalInvocationIndex;
+}
+
+void pushShortStack(inout ShortStack stack, int nodeIndex)
+{
+    shortStackEntries[shortStackSlot(stack)] = nodeIndex;
+    stack.top = stack.top + 1u == stack.size ? 0u : stack.top + 1u;
+    if (stack.count == stack.size) stack.dropped = true; // Overwrote the oldest entry
+    else stack.count++;
+    countStack(int(stack.count));
+}
+
+int popShortStack(inout ShortStack stack)
+{
+    if (stack.count == 0u) return -1;
+    stack.top = stack.top == 0u ? stack.size - 1u : stack.top - 1u;
+    stack.count--;
+    return shortStackEntries[shortStackSlot(stack)];
+}
+
+// Same answer for a node whether it is reached going down or climbing back up
+bool leftChildIsNear(Ray ray, BVHNode left, BVHNode right)
+{
+    vec3 separation = (right.boundMin + right.boundMax) - (left.boundMin + left.boundMax);
+    vec3 extent = abs(separation);
+    int axis = extent.x > extent.y ? (extent.x > extent.z ? 0 : 2) : (extent.y > extent.z ? 1 : 2);
+    return separation[axis] * ray.direction[axis] >= 0.0;
+}
+
+// Tests both children of an internal node, pushes the far one when both are hit and returns the one to visit next
+int descendShortStack(Ray ray, BVHNode node, float tMax, inout ShortStack stack)
+{
+    BVHNode left = nodes[node.left];
+    BVHNode right = nodes[node.right];
+    vec2 leftIntersect, rightIntersect;
+    bool hitLeft = intersectAABB(ray, left, leftIntersect) && leftIntersect.x <= tMax;
+    bool hitRight = intersectAABB(ray, right, rightIntersect) && rightIntersect.x <= tMax;
+
+    if (hitLeft && hitRight)
     {
-        BVHInstance instance = instances[i];
+        bool leftFirst = leftChildIsNear(ray, left, right);
+        pushShortStack(stack, leftFirst ? node.right : node.left);
+        return leftFirst ? node.left : node.right;
+    }
+    return hitLeft ? node.left : (hitRight ? node.right : -1);
+}
 
-        mat4 modelMatrix = instance.modelMatrix;
-        mat4 inverseModelMatrix = inverse(modelMatrix);
+// Next node after the subtree of nodeIndex is done and the stack ran empty: walk up until we leave a near
+// child whose far sibling is still hit. Far siblings are only visited after their near one, so they are unvisited.
+int climbShortStack(Ray ray, int nodeIndex, int rootIndex, float tMax)
+{
+    while (nodeIndex != rootIndex)
+    {
+        int parentIndex = nodes[nodeIndex].parent;
+        if (parentIndex < 0) break;
+
+        BVHNode parent = nodes[parentIndex];
+        countNode();
+        int far = leftChildIsNear(ray, nodes[parent.left], nodes[parent.right]) ? parent.right : parent.left;
+        vec2 intersect;
+        if (far != nodeIndex && intersectAABB(ray, nodes[far], intersect) && intersect.x <= tMax)
+        {
+            return far;
+        }
+        nodeIndex = parentIndex;
+    }
+    return -1;
+}
 
-        int stack[stackSize];
-        int stackIndex = 0;
-        stack[stackIndex++] = instance.bvhRootNodeIndex;
+// Node to visit after nodeIndex: its child, the stack top or a far sibling found over the parent links, -1 when done
+int nextShortStackNode(Ray ray, int nodeIndex, int next, int rootIndex, float tMax, inout ShortStack stack)
+{
+    if (next < 0) next = popShortStack(stack);
+    if (next < 0 && stack.dropped) next = climbShortStack(ray, nodeIndex, rootIndex, tMax);
+    return next;
+}
 
-        Ray localRay;
-        localRay.origin = (inverseModelMatrix * vec4(ray.origin, 1.0)).xyz;
-        localRay.direction = (inverseModelMatrix * vec4(ray.direction, 0.0)).xyz;
-        localRay.inverseDirection = 1.0 / max(abs(localRay.direction), vec3(1e-8)) * sign(localRay.direction);
+// Closest hit, or any hit closer than closestHit.t when anyHit is set, against one instance BLAS in its local space
+bool traceInstanceShortStack(Ray localRay, BVHInstance instance, bool anyHit, inout HitInfo closestHit)
+{
+    int rootIndex = instance.bvhRootNodeIndex;
+    vec2 intersect;
+    if (rootIndex < 0 || !intersectAABB(localRay, nodes[rootIndex], intersect) || intersect.x > closestHit.t)
+    {
+        return false;
+    }
 
-        while (stackIndex > 0)
+    ShortStack stack = makeShortStack(0u, SHORT_STACK_SIZE);
+    int nodeIndex = rootIndex;
+    while (nodeIndex >= 0)
+    {
+        BVHNode currentNode = nodes[nodeIndex];
+        countNode();
+        int next = -1;
+
+        if (currentNode.triangleCount <= 0)
         {
-            int nodeIndex = stack[--stackIndex];
-            if (nodeIndex < 0) continue;
+            next = descendShortStack(localRay, currentNode, closestHit.t, stack);
+        }
+        else
+        {
+            int triangleOffset = instance.triangleOffset + currentNode.firstTriangle;
+            for (int i = triangleOffset; i < triangleOffset + currentNode.triangleCount; ++i)
+            {
+                float t;
+                if (anyHit)
+                {
+                    if (intersectTriangleDistanceAt(localRay, i, t) && t < closestHit.t) return true;
+                    continue;
+                }
 
-            BVHNode currentNode = nodes[nodeIndex];
-            vec2 intersect;
-            bool rayIntersectsAABB = intersectAABB(localRay, currentNode, intersect);
+                vec3 n;
+                if (intersectTriangleAt(localRay, i, t, n) && t < closestHit.t)
+                {
+                    closestHit.t = t;
+                    closestHit.position = (instance.modelMatrix * vec4(localRay.origin + t * localRay.direction, 1.0)).xyz;
+                    closestHit.hit = true;
+                    closestHit.normal = normalize(mat3(instance.modelMatrix) * n);
+                }
+            }
+        }
 
-            if (!rayIntersectsAABB || intersect.x > closestHit.t)
+        nodeIndex = nextShortStackNode(localRay, nodeIndex, next, rootIndex, closestHit.t, stack);
+    }
+
+    return closestHit.hit;
+}
+
+// Closest hit against the compressed wide BVH of one instance. Every fetch tests all children,
+// leaves are intersected right away and internal children are pushed far to near.
+void traceInstanceWide(Ray ray, int instanceIndex, inout HitInfo closestHit)
+{
+    const int stackSize = 96;
+
+    BVHInstance instance = instances[instanceIndex];
+
+    mat4 modelMatrix = instance.modelMatrix;
+    mat4 inverseModelMatrix = instance.inverseModelMatrix;
+
+    uint stack[stackSize];
+    float stackDistance[stackSize];
+    int stackIndex = 0;
+    stack[stackIndex] = uint(instance.wideRootNodeIndex);
+    stackDistance[stackIndex++] = 0.0;
+
+    Ray localRay;
+    localRay.origin = (inverseModelMatrix * vec4(ray.origin, 1.0)).xyz;
+    localRay.direction = (inverseModelMatrix * vec4(ray.direction, 0.0)).xyz;
+    localRay.inverseDirection = 1.0 / max(abs(localRay.direction), vec3(1e-8)) * sign(localRay.direction);
+
+    while (stackIndex > 0)
+    {
+        --stackIndex;
+        if (stackDistance[stackIndex] > closestHit.t)
+        {
+            continue;
+        }
+
+        uint nodeIndex = stack[stackIndex];
+        countNode();
+        vec3 origin = vec3(wideNodes[nodeIndex].origin[0], wideNodes[nodeIndex].origin[1], wideNodes[nodeIndex].origin[2]);
+        uint exponentsAndCount = wideNodes[nodeIndex].exponentsAndCount;
+        uint childBase = wideNodes[nodeIndex].childBaseIndex;
+        uint triangleBase = wideNodes[nodeIndex].triangleBaseIndex;
+        int childCount = int(exponentsAndCount >> 24);
+
+        // Slab distances are affine in the quantized coordinates: t = q * scale / d + (origin - o) / d
+        vec3 scale = vec3(
+            uintBitsToFloat((exponentsAndCount & 0xFFu) << 23),
+            uintBitsToFloat(((exponentsAndCount >> 8) & 0xFFu) << 23),
+            uintBitsToFloat(((exponentsAndCount >> 16) & 0xFFu) << 23));
+        vec3 tScale = scale * localRay.inverseDirection;
+        vec3 tOffset = (origin - localRay.origin) * localRay.inverseDirection;
+
+        uint hitNodes[8];
+        float hitDistances[8];
+        int hitCount = 0;
+
+        for (int child = 0; child < childCount; ++child)
+        {
+            int word = child >> 2;
+            uint shift = uint(child & 3) * 8u;
+            vec3 quantizedMin = vec3(
+                (wideNodes[nodeIndex].quantizedMin[word] >> shift) & 0xFFu,
+                (wideNodes[nodeIndex].quantizedMin[2 + word] >> shift) & 0xFFu,
+                (wideNodes[nodeIndex].quantizedMin[4 + word] >> shift) & 0xFFu);
+            vec3 quantizedMax = vec3(
+                (wideNodes[nodeIndex].quantizedMax[word] >> shift) & 0xFFu,
+                (wideNodes[nodeIndex].quantizedMax[2 + word] >> shift) & 0xFFu,
+                (wideNodes[nodeIndex].quantizedMax[4 + word] >> shift) & 0xFFu);
+
+            vec3 t0 = quantizedMin * tScale + tOffset;
+            vec3 t1 = quantizedMax * tScale + tOffset;
+            vec3 tNear3 = min(t0, t1);
+            vec3 tFar3 = max(t0, t1);
+            float tNear = max(max(tNear3.x, tNear3.y), tNear3.z);
+            float tFar = min(min(tFar3.x, tFar3.y), tFar3.z);
+
+            if (tNear > tFar + EPSILON || tFar < 0.0 || tNear > closestHit.t)
             {
                 continue;
             }
 
-            if (currentNode.triangleCount <= 0)
+            uint meta = (wideNodes[nodeIndex].childMeta[child >> 1] >> (uint(child & 1) * 16u)) & 0xFFFFu;
+            if ((meta & 0x8000u) != 0u)
             {
-                // Internal node: push children
-                if (stackIndex < stackSize) stack[stackIndex++] = currentNode.left;
-                if (stackIndex < stackSize) stack[stackIndex++] = currentNode.right;
+                // Internal child: insertion sort by entry distance, nearest first
+                int j = hitCount++;
+                while (j > 0 && hitDistances[j - 1] > tNear)
+                {
+                    hitDistances[j] = hitDistances[j - 1];
+                    hitNodes[j] = hitNodes[j - 1];
+                    --j;
+                }
+                hitDistances[j] = tNear;
+                hitNodes[j] = childBase + (meta & 0x7FFFu);
                 continue;
             }
 
-            // Leaf node: check triangles
-			int triangleOffset = instance.triangleOffset + currentNode.firstTriangle;
-			int triangleCount = currentNode.triangleCount;
+            // Leaf child: check triangles
+            int triangleOffset = instance.triangleOffset + int(triangleBase + (meta & 0x3FFu));
+            int triangleCount = int(meta >> 10);
 
             for (int i = triangleOffset; i < triangleOffset + triangleCount; ++i)
             {
                 float t;
                 vec3 n;
-                bool intersected = intersectRayTriangle(localRay, triangles[i], t, n);
+                bool intersected = intersectTriangleAt(localRay, i, t, n);
                 if (intersected && t < closestHit.t)
                 {
                     closestHit.t = t;
                     closestHit.position = (modelMatrix * vec4(localRay.origin + t * localRay.direction, 1.0)).xyz;
                     closestHit.hit = true;
-					closestHit.normal = normalize(mat3(modelMatrix) * n);
+                    closestHit.normal = normalize(mat3(modelMatrix) * n);
                 }
             }
         }
-	}
 
-    return closestHit;
+        // Far to near, so the nearest child is popped first
+        for (int i = hitCount - 1; i >= 0; --i)
+        {
+            if (stackIndex < stackSize)
+            {
+                stack[stackIndex] = hitNodes[i];
+                stackDistance[stackIndex++] = hitDistances[i];
+            }
+        }
+        countStack(stackIndex);
+    }
 }
 
-HitInfo isInShadow(vec3 point, vec3 toLight, float maxDist)
+// Closest hit against the depth first BVH of one instance. The left child is the next node and the
+// split axis tells which child is nearer, the traversal steps into that one and pushes the other.
+void traceInstanceCompact(Ray ray, int instanceIndex, inout HitInfo closestHit)
 {
-    Ray shadowRay;
-    shadowRay.origin = point + 0.1 * toLight;
-    shadowRay.direction = toLight;
-    shadowRay.inverseDirection = 1.0 / shadowRay.direction;
+    const int stackSize = 64;
 
-    HitInfo shadowHit = traceRay2(shadowRay);
-    //return shadowHit.hit && shadowHit.t < maxDist;
-    //return shadowHit.t;
-    return shadowHit;
-}
+    BVHInstance instance = instances[instanceIndex];
 
-vec3 sampleDiskPosition(vec3 origin, vec3 observer, float radius, int number, int max_samples)
-{
-    float angle = float(number) / float(max_samples) * 6.2831853; // 2π
-    vec2 diskPos = vec2(cos(angle), sin(angle)) * radius;
+    mat4 modelMatrix = instance.modelMatrix;
+    mat4 inverseModelMatrix = instance.inverseModelMatrix;
 
-    // Disk direction: face observer
-    vec3 forward = normalize(observer - origin);
+    int stack[stackSize];
+    int stackIndex = 0;
+    int nodeIndex = instance.bvhRootNodeIndex;
+    if (nodeIndex < 0)
+    {
+        return;
+    }
 
-    // Project disk in a plane perpendicular to forward
-    vec3 up = vec3(0.0, 1.0, 0.0);
-    if (abs(dot(forward, up)) > 0.99) up = vec3(1.0, 0.0, 0.0); // avoid degenerate case
+    Ray localRay;
+    localRay.origin = (inverseModelMatrix * vec4(ray.origin, 1.0)).xyz;
+    localRay.direction = (inverseModelMatrix * vec4(ray.direction, 0.0)).xyz;
+    localRay.inverseDirection = 1.0 / max(abs(localRay.direction), vec3(1e-8)) * sign(localRay.direction);
 
-    vec3 right = normalize(cross(up, forward));
-    vec3 realUp = normalize(cross(forward, right));
+    while (true)
+    {
+        CompactBVHNode currentNode = compactNodes[nodeIndex];
+        countNode();
+        vec2 intersect;
+        if (intersectAABB(localRay, currentNode.boundMin, currentNode.boundMax, intersect) && intersect.x <= closestHit.t)
+        {
+            if (currentNode.triangleCount < 0)
+            {
+                // Internal node: continue with the nearer child, keep the other one for later
+                int split = -1 - currentNode.triangleCount;
+                bool leftFirst = (localRay.direction[split & 3] < 0.0) == ((split & 4) != 0);
+                int left = nodeIndex + 1;
+                if (stackIndex < stackSize) stack[stackIndex++] = leftFirst ? currentNode.rightOrFirstTriangle : left;
+                countStack(stackIndex);
+                nodeIndex = leftFirst ? left : currentNode.rightOrFirstTriangle;
+                continue;
+            }
 
-    // Construct rotated disk point
-    vec3 offset = diskPos.x * right + diskPos.y * realUp;
-    return origin + offset;
+            // Leaf node: check triangles
+            int triangleOffset = instance.triangleOffset + currentNode.rightOrFirstTriangle;
+            int triangleCount = currentNode.triangleCount;
+
+            for (int i = triangleOffset; i < triangleOffset + triangleCount; ++i)
+            {
+                float t;
+                vec3 n;
+                bool intersected = intersectTriangleAt(localRay, i, t, n);
+                if (intersected && t < closestHit.t)
+                {
+                    closestHit.t = t;
+                    closestHit.position = (modelMatrix * vec4(localRay.origin + t * localRay.direction, 1.0)).xyz;
+                    closestHit.hit = true;
+                    closestHit.normal = normalize(mat3(modelMatrix) * n);
+                }
+            }
+        }
+
+        if (stackIndex == 0)
+        {
+            break;
+        }
+        nodeIndex = stack[--stackIndex];
+    }
 }
 
-/*
-vec3 rayTrace3(Ray primaryRay)
+// Closest hit against one instance BLAS, the ray is moved into the instance local space
+void traceInstance(Ray ray, int instanceIndex, inout HitInfo closestHit)
 {
-    vec3 pixelColor = vec3(0.0);
+    const int stackSize = 64;
 
-    // Choose your poison
-    //HitInfo hit = traceRay(primaryRay);
-    //HitInfo hit = traceRayNoAS(primaryRay);
-	HitInfo hit = traceRay2(primaryRay);
-    //HitInfo hit = visualizeBVHRoot(primaryRay);
-    //HitInfo hit = visualizeBVHLeaves(primaryRay);
+    // The short stack walks the binary nodes, the wide and compact stacks would drop nodes once they fill
+    if (!SHORT_STACK_TRAVERSAL && useWideBVH != 0 && instances[instanceIndex].wideRootNodeIndex >= 0)
+    {
+        traceInstanceWide(ray, instanceIndex, closestHit);
+        return;
+    }
 
-    if (hit.hit)
+    if (!SHORT_STACK_TRAVERSAL && useCompactBVH != 0)
     {
-        //pixelColor = vec3(0, 1, 0);
+        traceInstanceCompact(ray, instanceIndex, closestHit);
+        return;
+    }
+
+    BVHInstance instance = instances[instanceIndex];
+
+    mat4 modelMatrix = instance.modelMatrix;
+    mat4 inverseModelMatrix = instance.inverseModelMatrix;
+
+    int stack[stackSize];
+    int stackIndex = 0;
+    stack[stackIndex++] = instance.bvhRootNodeIndex;
+
+    Ray localRay;
+    localRay.origin = (inverseModelMatrix * vec4(ray.origin, 1.0)).xyz;
+    localRay.direction = (inverseModelMatrix * vec4(ray.direction, 0.0)).xyz;
+    localRay.inverseDirection = 1.0 / max(abs(localRay.direction), vec3(1e-8)) * sign(localRay.direction);
+
+    if (SHORT_STACK_TRAVERSAL)
+    {
+        traceInstanceShortStack(localRay, instance, false, closestHit);
+        return;
+    }
+
+    while (stackIndex > 0)
+    {
+        int nodeIndex = stack[--stackIndex];
+        if (nodeIndex < 0) continue;
+
+        BVHNode currentNode = nodes[nodeIndex];
+        countNode();
+        vec2 intersect;
+        bool rayIntersectsAABB = intersectAABB(localRay, currentNode, intersect);
+
+        if (!rayIntersectsAABB || intersect.x > closestHit.t)
+        {
+            continue;
+        }
+
+        if (currentNode.triangleCount <= 0)
+        {
+            // Internal node: push children
+            if (stackIndex < stackSize) stack[stackIndex++] = currentNode.left;
+            if (stackIndex < stackSize) stack[stackIndex++] = currentNode.right;
+            countStack(stackIndex);
+            continue;
+        }
+
+        // Leaf node: check triangles
+        int triangleOffset = instance.triangleOffset + currentNode.firstTriangle;
+        int triangleCount = currentNode.triangleCount;
+
+        for (int i = triangleOffset; i < triangleOffset + triangleCount; ++i)
+        {
+            float t;
+            vec3 n;
+            bool intersected = intersectTriangleAt(localRay, i, t, n);
+            if (intersected && t < closestHit.t)
+            {
+                closestHit.t = t;
+                closestHit.position = (modelMatrix * vec4(localRay.origin + t * localRay.direction, 1.0)).xyz;
+                closestHit.hit = true;
+                closestHit.normal = normalize(mat3(modelMatrix) * n);
+            }
+        }
+    }
+}
+
+HitInfo traceRay2(Ray ray)
+{
+    HitInfo closestHit;
+    closestHit.t = 1e20;
+    closestHit.hit = false;
+    if (INSTRUMENTATION) pixelRays++;
+
+    if (tlasRootIndex < 0)
+    {
+        for (int i = 0; i < instanceCount; ++i)
+        {
+            traceInstance(ray, i, closestHit);
+        }
+        return closestHit;
+    }
+
+    // Walk the TLAS in world space, its leaves name the instance to descend into
+    Ray worldRay = ray;
+    worldRay.inverseDirection = 1.0 / max(abs(ray.direction), vec3(1e-8)) * sign(ray.direction);
+
+    if (SHORT_STACK_TRAVERSAL)
+    {
+        vec2 intersect;
+        if (!intersectAABB(worldRay, nodes[tlasRootIndex], intersect))
+        {
+            return closestHit;
+        }
+
+        ShortStack tlasStack = makeShortStack(SHORT_STACK_SIZE, TLAS_SHORT_STACK_SIZE);
+        int nodeIndex = tlasRootIndex;
+        while (nodeIndex >= 0)
+        {
+            BVHNode currentNode = nodes[nodeIndex];
+            countNode();
+            int next = -1;
+
+            if (currentNode.triangleCount <= 0)
+            {
+                next = descendShortStack(worldRay, currentNode, closestHit.t, tlasStack);
+            }
+            else
+            {
+                traceInstance(ray, currentNode.firstTriangle, closestHit);
+            }
+
+            nodeIndex = nextShortStackNode(worldRay, nodeIndex, next, tlasRootIndex, closestHit.t, tlasStack);
+        }
+        return closestHit;
+    }
+
+    const int stackSize = 64;
+    int stack[stackSize];
+    int stackIndex = 0;
+    stack[stackIndex++] = tlasRootIndex;
+
+    while (stackIndex > 0)
+    {
+        BVHNode currentNode = nodes[stack[--stackIndex]];
+        countNode();
+        vec2 intersect;
+        if (!intersectAABB(worldRay, currentNode, intersect) || intersect.x > closestHit.t)
+        {
+            continue;
+        }
+
+        if (currentNode.triangleCount <= 0)
+        {
+            if (stackIndex < stackSize) stack[stackIndex++] = currentNode.left;
+            if (stackIndex < stackSize) stack[stackIndex++] = currentNode.right;
+            countStack(stackIndex);
+            continue;
+        }
+
+        traceInstance(ray, currentNode.firstTriangle, closestHit);
+    }
+
+    return closestHit;
+}
+
+// ========== OCCLUSION ==========
+// Any hit traversals for shadow rays: they return at the first triangle closer than tMax,
+// visit children in stored order and never compute hit positions or normals.
+bool occludedInstanceWide(Ray localRay, BVHInstance instance, float tMax)
+{
+    const int stackSize = 96;
+
+    uint stack[stackSize];
+    int stackIndex = 0;
+    stack[stackIndex++] = uint(instance.wideRootNodeIndex);
+
+    while (stackIndex > 0)
+    {
+        uint nodeIndex = stack[--stackIndex];
+        countNode();
+        vec3 origin = vec3(wideNodes[nodeIndex].origin[0], wideNodes[nodeIndex].origin[1], wideNodes[nodeIndex].origin[2]);
+        uint exponentsAndCount = wideNodes[nodeIndex].exponentsAndCount;
+        uint childBase = wideNodes[nodeIndex].childBaseIndex;
+        uint triangleBase = wideNodes[nodeIndex].triangleBaseIndex;
+        int childCount = int(exponentsAndCount >> 24);
+
+        vec3 scale = vec3(
+            uintBitsToFloat((exponentsAndCount & 0xFFu) << 23),
+            uintBitsToFloat(((exponentsAndCount >> 8) & 0xFFu) << 23),
+            uintBitsToFloat(((exponentsAndCount >> 16) & 0xFFu) << 23));
+        vec3 tScale = scale * localRay.inverseDirection;
+        vec3 tOffset = (origin - localRay.origin) * localRay.inverseDirection;
+
+        for (int child = 0; child < childCount; ++child)
+        {
+            int word = child >> 2;
+            uint shift = uint(child & 3) * 8u;
+            vec3 quantizedMin = vec3(
+                (wideNodes[nodeIndex].quantizedMin[word] >> shift) & 0xFFu,
+                (wideNodes[nodeIndex].quantizedMin[2 + word] >> shift) & 0xFFu,
+                (wideNodes[nodeIndex].quantizedMin[4 + word] >> shift) & 0xFFu);
+            vec3 quantizedMax = vec3(
+                (wideNodes[nodeIndex].quantizedMax[word] >> shift) & 0xFFu,
+                (wideNodes[nodeIndex].quantizedMax[2 + word] >> shift) & 0xFFu,
+                (wideNodes[nodeIndex].quantizedMax[4 + word] >> shift) & 0xFFu);
+
+            vec3 t0 = quantizedMin * tScale + tOffset;
+            vec3 t1 = quantizedMax * tScale + tOffset;
+            vec3 tNear3 = min(t0, t1);
+            vec3 tFar3 = max(t0, t1);
+            float tNear = max(max(tNear3.x, tNear3.y), tNear3.z);
+            float tFar = min(min(tFar3.x, tFar3.y), tFar3.z);
+
+            if (tNear > tFar + EPSILON || tFar < 0.0 || tNear > tMax)
+            {
+                continue;
+            }
+
+            uint meta = (wideNodes[nodeIndex].childMeta[child >> 1] >> (uint(child & 1) * 16u)) & 0xFFFFu;
+            if ((meta & 0x8000u) != 0u)
+            {
+                if (stackIndex < stackSize) stack[stackIndex++] = childBase + (meta & 0x7FFFu);
+                continue;
+            }
+
+            int triangleOffset = instance.triangleOffset + int(triangleBase + (meta & 0x3FFu));
+            int triangleCount = int(meta >> 10);
+
+            for (int i = triangleOffset; i < triangleOffset + triangleCount; ++i)
+            {
+                float t;
+                if (intersectTriangleDistanceAt(localRay, i, t) && t < tMax)
+                {
+                    return true;
+                }
+            }
+        }
+        countStack(stackIndex);
+    }
+
+    return false;
+}
+
+bool occludedInstanceCompact(Ray localRay, BVHInstance instance, float tMax)
+{
+    const int stackSize = 64;
+
+    int stack[stackSize];
+    int stackIndex = 0;
+    int nodeIndex = instance.bvhRootNodeIndex;
+    if (nodeIndex < 0)
+    {
+        return false;
+    }
+
+    while (true)
+    {
+        CompactBVHNode currentNode = compactNodes[nodeIndex];
+        countNode();
+        vec2 intersect;
+        if (intersectAABB(localRay, currentNode.boundMin, currentNode.boundMax, intersect) && intersect.x <= tMax)
+        {
+            if (currentNode.triangleCount < 0)
+            {
+                // Internal node: the left child is the next node, no need to order them
+                if (stackIndex < stackSize) stack[stackIndex++] = currentNode.rightOrFirstTriangle;
+                countStack(stackIndex);
+                nodeIndex = nodeIndex + 1;
+                continue;
+            }
+
+            int triangleOffset = instance.triangleOffset + currentNode.rightOrFirstTriangle;
+            int triangleCount = currentNode.triangleCount;
+
+            for (int i = triangleOffset; i < triangleOffset + triangleCount; ++i)
+            {
+                float t;
+                if (intersectTriangleDistanceAt(localRay, i, t) && t < tMax)
+                {
+                    return true;
+                }
+            }
+        }
+
+        if (stackIndex == 0)
+        {
+            break;
+        }
+        nodeIndex = stack[--stackIndex];
+    }
+
+    return false;
+}
+
+// Any hit against one instance BLAS, same BVH choice as traceInstance
+bool occludedInstance(Ray ray, int instanceIndex, float tMax)
+{
+    const int stackSize = 64;
+
+    BVHInstance instance = instances[instanceIndex];
+
+    Ray localRay;
+    localRay.origin = (instance.inverseModelMatrix * vec4(ray.origin, 1.0)).xyz;
+    localRay.direction = (instance.inverseModelMatrix * vec4(ray.direction, 0.0)).xyz;
+    localRay.inverseDirection = 1.0 / max(abs(localRay.direction), vec3(1e-8)) * sign(localRay.direction);
+
+    if (!SHORT_STACK_TRAVERSAL && useWideBVH != 0 && instance.wideRootNodeIndex >= 0)
+    {
+        return occludedInstanceWide(localRay, instance, tMax);
+    }
+
+    if (!SHORT_STACK_TRAVERSAL && useCompactBVH != 0)
+    {
+        return occludedInstanceCompact(localRay, instance, tMax);
+    }
+
+    if (SHORT_STACK_TRAVERSAL)
+    {
+        HitInfo occluder;
+        occluder.t = tMax;
+        occluder.hit = false;
+        return traceInstanceShortStack(localRay, instance, true, occluder);
+    }
+
+    int stack[stackSize];
+    int stackIndex = 0;
+    stack[stackIndex++] = instance.bvhRootNodeIndex;
+
+    while (stackIndex > 0)
+    {
+        int nodeIndex = stack[--stackIndex];
+        if (nodeIndex < 0) continue;
+
+        BVHNode currentNode = nodes[nodeIndex];
+        countNode();
+        vec2 intersect;
+        if (!intersectAABB(localRay, currentNode, intersect) || intersect.x > tMax)
+        {
+            continue;
+        }
+
+        if (currentNode.triangleCount <= 0)
+        {
+            if (stackIndex < stackSize) stack[stackIndex++] = currentNode.left;
+            if (stackIndex < stackSize) stack[stackIndex++] = currentNode.right;
+            countStack(stackIndex);
+            continue;
+        }
+
+        int triangleOffset = instance.triangleOffset + currentNode.firstTriangle;
+        int triangleCount = currentNode.triangleCount;
+
+        for (int i = triangleOffset; i < triangleOffset + triangleCount; ++i)
+        {
+            float t;
+            if (intersectTriangleDistanceAt(localRay, i, t) && t < tMax)
+            {
+                return true;
+            }
+        }
+    }
+
+    return false;
+}
+
+// True as soon as anything is hit closer than tMax, walks the TLAS like traceRay2
+bool traceOcclusion(Ray ray, float tMax)
+{
+    if (INSTRUMENTATION) pixelRays++;
+
+    if (tlasRootIndex < 0)
+    {
+        for (int i = 0; i < instanceCount; ++i)
+        {
+            if (occludedInstance(ray, i, tMax)) return true;
+        }
+        return false;
+    }
+
+    Ray worldRay = ray;
+    worldRay.inverseDirection = 1.0 / max(abs(ray.direction), vec3(1e-8)) * sign(ray.direction);
+
+    if (SHORT_STACK_TRAVERSAL)
+    {
+        vec2 intersect;
+        if (!intersectAABB(worldRay, nodes[tlasRootIndex], intersect) || intersect.x > tMax)
+        {
+            return false;
+        }
+
+        ShortStack tlasStack = makeShortStack(SHORT_STACK_SIZE, TLAS_SHORT_STACK_SIZE);
+        int nodeIndex = tlasRootIndex;
+        while (nodeIndex >= 0)
+        {
+            BVHNode currentNode = nodes[nodeIndex];
+            countNode();
+            int next = -1;
+
+            if (currentNode.triangleCount <= 0)
+            {
+                next = descendShortStack(worldRay, currentNode, tMax, tlasStack);
+            }
+            else if (occludedInstance(ray, currentNode.firstTriangle, tMax))
+            {
+                return true;
+            }
+
+            nodeIndex = nextShortStackNode(worldRay, nodeIndex, next, tlasRootIndex, tMax, tlasStack);
+        }
+        return false;
+    }
+
+    const int stackSize = 64;
+    int stack[stackSize];
+    int stackIndex = 0;
+    stack[stackIndex++] = tlasRootIndex;
+
+    while (stackIndex > 0)
+    {
+        BVHNode currentNode = nodes[stack[--stackIndex]];
+        countNode();
+        vec2 intersect;
+        if (!intersectAABB(worldRay, currentNode, intersect) || intersect.x > tMax)
+        {
+            continue;
+        }
+
+        if (currentNode.triangleCount <= 0)
+        {
+            if (stackIndex < stackSize) stack[stackIndex++] = currentNode.left;
+            if (stackIndex < stackSize) stack[stackIndex++] = currentNode.right;
+            countStack(stackIndex);
+            continue;
+        }
+
+        if (occludedInstance(ray, currentNode.firstTriangle, tMax)) return true;
+    }
+
+    return false;
+}
+
+bool isInShadow(vec3 point, vec3 toLight, float maxDist)
+{
+    Ray shadowRay;
+    shadowRay.origin = point + 0.1 * toLight;
+    shadowRay.direction = toLight;
+    shadowRay.inverseDirection = 1.0 / shadowRay.direction;
+
+    return traceOcclusion(shadowRay, maxDist);
+}
+
+vec3 sampleDiskPosition(vec3 origin, vec3 observer, float radius, int number, int max_samples)
+{
+    float angle = float(number) / float(max_samples) * 6.2831853; // 2π
+    vec2 diskPos = vec2(cos(angle), sin(angle)) * radius;
+
+    // Disk direction: face observer
+    vec3 forward = normalize(observer - origin);
+
+    // Project disk in a plane perpendicular to forward
+    vec3 up = vec3(0.0, 1.0, 0.0);
+    if (abs(dot(forward, up)) > 0.99) up = vec3(1.0, 0.0, 0.0); // avoid degenerate case
+
+    vec3 right = normalize(cross(up, forward));
+    vec3 realUp = normalize(cross(forward, right));
+
+    // Construct rotated disk point
+    vec3 offset = diskPos.x * right + diskPos.y * realUp;
+    return origin + offset;
+}
+
+/*
+vec3 rayTrace3(Ray primaryRay)
+{
+    vec3 pixelColor = vec3(0.0);
+
+    // Choose your poison
+    //HitInfo hit = traceRay(primaryRay);
+    //HitInfo hit = traceRayNoAS(primaryRay);
+	HitInfo hit = traceRay2(primaryRay);
+    //HitInfo hit = visualizeBVHRoot(primaryRay);
+    //HitInfo hit = visualizeBVHLeaves(primaryRay);
+
+    if (hit.hit)
+    {
+        //pixelColor = vec3(0, 1, 0);
         
 
         LightInstance light;
@@ -637,100 +1598,1155 @@ float rand(vec2 co) {
     return fract(sin(dot(co.xy ,vec2(12.9898,78.233))) * 43758.5453);
 }
 
-vec3 rayTrace(Ray primaryRay)
-{
-    vec3 pixelColor = vec3(0.0);
-    HitInfo hit = traceRay2(primaryRay);
+// Shadow rays per pixel of rayTrace and the wavefront shade stage, each one toward a light of its own choosing
+#define SHADOW_SAMPLES 3
 
-    if (hit.hit)
-    {
-        LightInstance light;
-        light.position = vec3(1.0, 10035.0, 0.0);
-        light.color = vec3(1.0, 1.0, 1.0);
-        light.radius = 1000.0;
+// Weight of a fully visible light, SHADOW_SAMPLES of SHADOW_SAMPLES + 1 like the original shadow factor
+#define SHADOW_WEIGHT (float(SHADOW_SAMPLES) / (float(SHADOW_SAMPLES) + 1.0))
 
-        const int numShadowSamples = 3;
-        float shadowFactor = 0.0;
+// Hit point to the light disk point diskPos, given on the unit disk
+vec3 lightDiskVector(vec3 hitPosition, LightInstance light, vec2 diskPos)
+{
+    diskPos *= light.radius;
 
-        //double d = 0;
-        HitInfo shadowHit;
+    // Build disk aligned to light -> hit (more stable than camera-facing)
+    vec3 forward = normalize(hitPosition - light.position);
+    vec3 up = abs(dot(forward, vec3(0.0, 1.0, 0.0))) > 0.99 ? vec3(1.0, 0.0, 0.0) : vec3(0.0, 1.0, 0.0);
+    vec3 right = normalize(cross(up, forward));
+    vec3 realUp = normalize(cross(forward, right));
+    vec3 offset = diskPos.x * right + diskPos.y * realUp;
 
-        for (int i = 0; i < numShadowSamples; ++i)
+    vec3 samplePosition = light.position + offset;
+    return samplePosition - hitPosition;
+}
+
+// Hit point to shadow sample i of count on the light disk, unnormalized so the sample distance comes with it.
+// A non zero frameSeed moves the jitter every frame, for the temporal accumulation of the denoiser.
+vec3 shadowSampleVector(vec3 hitPosition, LightInstance light, int i, int count, int frameSeed)
+{
+    // Jittering (you can use a real seed per-pixel for better randomness)
+    vec2 seed = vec2(float(i), dot(hitPosition.xy, vec2(12.9898, 78.233)) + float(frameSeed) * 0.618034);
+    float angle = (float(i) + rand(seed)) / float(count) * 6.2831853;
+    float r = sqrt(rand(seed + 1.23));
+    vec2 diskPos = r * vec2(cos(angle), sin(angle));
+
+    return lightDiskVector(hitPosition, light, diskPos);
+}
+
+// ========== SHADOW DENOISER ==========
+// Temporal accumulation and an edge aware a-trous filter of the shadow visibility, after SVGF. The megakernel
+// writes each pixel's surface and raw visibility, the temporal pass reprojects into last frame's history and
+// blends, then a-trous passes with growing tap distances smooth what is left, stopped at normal, depth and
+// visibility edges. History and surfaces alternate between two slots by frame, the filter between two buffers.
+#define DENOISE_MAX_HISTORY 32.0
+#define DENOISE_MIN_ALPHA 0.05
+#define DENOISE_SIGMA_NORMAL 128.0
+#define DENOISE_SIGMA_DEPTH 0.02
+#define DENOISE_SIGMA_VISIBILITY 4.0
+
+struct DenoiseSurface
+{
+    vec3 normal;
+    float hitDistance; // Along the normalized camera ray, negative where there is nothing to denoise
+};
+
+layout(std430, set = 0, binding = 18) buffer DenoiseSurfaceBuffer
+{
+    DenoiseSurface denoiseSurfaces[]; // Two slots of a surface per pixel
+};
+
+layout(std430, set = 0, binding = 19) buffer ShadowHistoryBuffer
+{
+    vec4 shadowHistory[]; // Two slots of visibility, its first two moments and the history length per pixel
+};
+
+layout(std430, set = 0, binding = 20) buffer ShadowFilterBuffer
+{
+    vec2 shadowFilter[]; // Two ping pong slots of visibility and its variance per pixel
+};
+
+uint denoisePixelCount()
+{
+    ivec2 size = traceSize();
+    return uint(size.x * size.y);
+}
+
+uint currentDenoiseSlot()
+{
+    return uint(frameIndex) & 1u;
+}
+
+void writeDenoiseSurface(uint pixel, HitInfo hit, vec3 cameraPosition, bool denoised)
+{
+    DenoiseSurface surface;
+    surface.normal = hit.normal;
+    surface.hitDistance = hit.hit && denoised ? distance(hit.position, cameraPosition) : -1.0;
+    denoiseSurfaces[currentDenoiseSlot() * denoisePixelCount() + pixel] = surface;
+}
+
+// Raw visibility waits in this frame's history slot until the temporal pass replaces it
+void writeRawVisibility(uint pixel, float visibility)
+{
+    shadowHistory[currentDenoiseSlot() * denoisePixelCount() + pixel].x = visibility;
+}
+
+// Normalized camera ray through a point of the image, pixel centers are at + 0.5
+vec3 primaryRayDirection(vec2 pixelPosition, ivec2 imageSize)
+{
+    vec2 uv = pixelPosition / vec2(imageSize) * 2.0 - 1.0;
+    uv.y = -uv.y;
+
+    return normalize(
+        uv.x * camera.right.xyz +
+        uv.y * camera.up.xyz +
+        camera.direction.xyz
+    );
+}
+
+bool isDenoisedPixel(ivec2 pixelCoords, ivec2 imageSize)
+{
+    return pixelCoords.x >= denoiseSplitX && pixelCoords.x < imageSize.x && pixelCoords.y >= 0 && pixelCoords.y < imageSize.y;
+}
+
+// Step 1: blend the raw visibility into the reprojected history
+void denoiseTemporal(ivec2 pixelCoords, ivec2 imageSize)
+{
+    if (!isDenoisedPixel(pixelCoords, imageSize))
+    {
+        return;
+    }
+
+    uint pixelCount = denoisePixelCount();
+    uint pixel = uint(pixelCoords.y * imageSize.x + pixelCoords.x);
+    uint current = currentDenoiseSlot() * pixelCount;
+    uint previous = (currentDenoiseSlot() ^ 1u) * pixelCount;
+
+    DenoiseSurface surface = denoiseSurfaces[current + pixel];
+    if (surface.hitDistance < 0.0)
+    {
+        shadowFilter[pixel] = vec2(1.0, 0.0);
+        return;
+    }
+    float visibility = shadowHistory[current + pixel].x;
+
+    // Where the surface was on screen last frame, continuous pixel coordinates
+    vec3 worldPosition = camera.position.xyz + primaryRayDirection(vec2(pixelCoords) + 0.5, imageSize) * surface.hitDistance;
+    vec4 previousClip = camera.previousViewProjection * vec4(worldPosition, 1.0);
+    vec2 previousNdc = previousClip.xy / previousClip.w;
+    vec2 previousPixel = vec2(previousNdc.x * 0.5 + 0.5, 0.5 - previousNdc.y * 0.5) * vec2(imageSize) - 0.5;
+    float previousHitDistance = distance(worldPosition, camera.previousPosition.xyz);
+
+    // Bilinear history, taps of other surfaces are left out
+    vec4 history = vec4(0.0);
+    float historyWeight = 0.0;
+    ivec2 base = ivec2(floor(previousPixel));
+    vec2 fraction = previousPixel - vec2(base);
+    for (int tap = 0; tap < 4 && shadowDenoiser == 1 && previousClip.w > 0.0; ++tap)
+    {
+        ivec2 offset = ivec2(tap & 1, tap >> 1);
+        ivec2 tapCoords = base + offset;
+        if (!isDenoisedPixel(tapCoords, imageSize))
         {
-            // Jittering (you can use a real seed per-pixel for better randomness)
-            vec2 seed = vec2(float(i), dot(hit.position.xy, vec2(12.9898, 78.233)));
-            float angle = (float(i) + rand(seed)) / float(numShadowSamples) * 6.2831853;
-            float r = sqrt(rand(seed + 1.23));
-            vec2 diskPos = r * vec2(cos(angle), sin(angle)) * light.radius;
+            continue;
+        }
+
+        uint tapPixel = uint(tapCoords.y * imageSize.x + tapCoords.x);
+        DenoiseSurface previousSurface = denoiseSurfaces[previous + tapPixel];
+        bool sameSurface = previousSurface.hitDistance > 0.0
+            && dot(previousSurface.normal, surface.normal) > 0.9
+            && abs(previousSurface.hitDistance - previousHitDistance) < 0.05 * previousHitDistance;
+        if (!sameSurface)
+        {
+            continue;
+        }
 
-            // Build disk aligned to light -> hit (more stable than camera-facing)
-            vec3 forward = normalize(hit.position - light.position);
-            vec3 up = abs(dot(forward, vec3(0.0, 1.0, 0.0))) > 0.99 ? vec3(1.0, 0.0, 0.0) : vec3(0.0, 1.0, 0.0);
-            vec3 right = normalize(cross(up, forward));
-            vec3 realUp = normalize(cross(forward, right));
-            vec3 offset = diskPos.x * right + diskPos.y * realUp;
+        vec2 bilinear = mix(vec2(1.0) - fraction, fraction, vec2(offset));
+        float weight = bilinear.x * bilinear.y;
+        history += shadowHistory[previous + tapPixel] * weight;
+        historyWeight += weight;
+    }
 
-            vec3 samplePosition = light.position + offset;
+    float historyLength = 1.0;
+    vec3 moments = vec3(visibility, visibility, visibility * visibility);
+    if (historyWeight > 0.01)
+    {
+        history /= historyWeight;
+        historyLength = min(history.w + 1.0, DENOISE_MAX_HISTORY);
+        float alpha = max(1.0 / historyLength, DENOISE_MIN_ALPHA);
+        moments = mix(history.xyz, moments, alpha);
+    }
 
-            vec3 toSample = samplePosition - hit.position;
-            float sampleDist = length(toSample);
-            vec3 shadowRayDir = normalize(toSample);
+    // Short histories have too few samples for their moments, assume the largest variance of a binary visibility
+    float variance = max(moments.z - moments.y * moments.y, 0.0);
+    if (historyLength < 4.0)
+    {
+        variance = max(variance, 0.25 / historyLength);
+    }
 
-            vec3 shadowRayOrigin = hit.position + hit.normal * 0.001;
+    shadowHistory[current + pixel] = vec4(moments, historyLength);
+    shadowFilter[pixel] = vec2(moments.x, variance);
+}
 
-            //return shadowHit.hit && shadowHit.t < maxDist;
-            shadowHit = isInShadow(shadowRayOrigin, shadowRayDir, sampleDist);
-            //d = shadowHit.t;
-            if (!(shadowHit.hit && shadowHit.t < sampleDist))
+// Step 2: one a-trous pass of a 5x5 B3 spline kernel, taps 2^atrousIteration pixels apart
+void denoiseAtrous(ivec2 pixelCoords, ivec2 imageSize)
+{
+    if (!isDenoisedPixel(pixelCoords, imageSize))
+    {
+        return;
+    }
+
+    uint pixelCount = denoisePixelCount();
+    uint pixel = uint(pixelCoords.y * imageSize.x + pixelCoords.x);
+    uint current = currentDenoiseSlot() * pixelCount;
+    uint readSlot = (uint(atrousIteration) & 1u) * pixelCount;
+    uint writeSlot = pixelCount - readSlot;
+    bool last = atrousIteration == atrousIterationCount - 1;
+
+    DenoiseSurface surface = denoiseSurfaces[current + pixel];
+    vec2 center = shadowFilter[readSlot + pixel];
+    if (surface.hitDistance < 0.0)
+    {
+        shadowFilter[writeSlot + pixel] = center;
+        return;
+    }
+
+    const float kernel[3] = float[3](3.0 / 8.0, 1.0 / 4.0, 1.0 / 16.0);
+    int stepSize = 1 << atrousIteration;
+    float visibilitySigma = DENOISE_SIGMA_VISIBILITY * sqrt(center.y) + 0.0001;
+
+    vec2 sum = vec2(0.0);
+    float weightSum = 0.0;
+    for (int y = -2; y <= 2; ++y)
+    {
+        for (int x = -2; x <= 2; ++x)
+        {
+            ivec2 tapCoords = pixelCoords + ivec2(x, y) * stepSize;
+            if (!isDenoisedPixel(tapCoords, imageSize))
             {
-                shadowFactor += 1.0;
+                continue;
             }
+
+            uint tapPixel = uint(tapCoords.y * imageSize.x + tapCoords.x);
+            DenoiseSurface tapSurface = denoiseSurfaces[current + tapPixel];
+            if (tapSurface.hitDistance < 0.0)
+            {
+                continue;
+            }
+
+            vec2 tap = shadowFilter[readSlot + tapPixel];
+            float normalWeight = pow(max(dot(surface.normal, tapSurface.normal), 0.0), DENOISE_SIGMA_NORMAL);
+            float depthWeight = exp(-abs(surface.hitDistance - tapSurface.hitDistance) / (DENOISE_SIGMA_DEPTH * surface.hitDistance * float(stepSize) * length(vec2(x, y)) + 0.0001));
+            float visibilityWeight = exp(-abs(center.x - tap.x) / visibilitySigma);
+            float weight = kernel[abs(x)] * kernel[abs(y)] * normalWeight * depthWeight * visibilityWeight;
+
+            sum += vec2(tap.x * weight, tap.y * weight * weight);
+            weightSum += weight;
         }
+    }
 
-        shadowFactor /= float(numShadowSamples) + 1;
+    // The center tap always counts, so weightSum is above zero
+    vec2 filtered = vec2(sum.x / weightSum, sum.y / (weightSum * weightSum));
 
-        // Base lighting
-        vec3 toLight = light.position - hit.position;
-        float distToLight = length(toLight);
-        vec3 lightDir = normalize(toLight);
-        float ndotl = max(dot(hit.normal, lightDir), 0.0);
+    // Like SVGF the first pass is fed back as history, the later ones only smooth this frame
+    if (atrousIteration == 0)
+    {
+        shadowHistory[current + pixel].x = filtered.x;
+    }
+
+    if (last)
+    {
+        imageStore(outputImage, pixelCoords, vec4(imageLoad(outputImage, pixelCoords).rgb * filtered.x, 1.0));
+    }
+    else
+    {
+        shadowFilter[writeSlot + pixel] = filtered;
+    }
+}
+
+// ========== PROGRESSIVE REFINEMENT ==========
+// While camera and instances stay put, every frame traces one more sample per pixel and folds it into a
+// running average. Samples follow the R2 sequence, shifted per pixel so neighbours do not share a pattern:
+// camera rays jitter inside the pixel and shadow rays cover the light disk evenly as samples add up.
+#define PROGRESSIVE_DIMENSION_PIXEL 0u
+#define PROGRESSIVE_DIMENSION_LIGHT 1u
+#define PROGRESSIVE_DIMENSION_LIGHT_SELECT 2u
+
+layout(std430, set = 0, binding = 21) buffer AccumulationBuffer
+{
+    vec4 accumulation[]; // Running average per pixel
+};
+
+uint pcgHash(uint value)
+{
+    uint state = value * 747796405u + 2891336453u;
+    uint word = ((state >> ((state >> 28u) + 4u)) ^ state) * 277803737u;
+    return (word >> 22u) ^ word;
+}
+
+// Point index of the R2 sequence in [0, 1)^2, Cranley-Patterson rotated per pixel and dimension
+vec2 progressiveSample2D(uint pixel, uint dimension, uint index)
+{
+    uint hash = pcgHash(pixel ^ pcgHash(dimension));
+    vec2 rotation = vec2(hash & 0xFFFFu, hash >> 16u) / 65536.0;
+    return fract(rotation + float(index) * vec2(0.7548776662, 0.5698402910));
+}
+
+// Square to unit disk, polar and area preserving
+vec2 squareToDisk(vec2 u)
+{
+    float r = sqrt(u.x);
+    float angle = u.y * 6.2831853;
+    return r * vec2(cos(angle), sin(angle));
+}
+
+vec3 accumulateProgressive(uint pixel, vec3 color)
+{
+    vec3 average = progressiveSample == 0 ? color : mix(accumulation[pixel].rgb, color, 1.0 / float(progressiveSample + 1));
+    accumulation[pixel] = vec4(average, 1.0);
+    return average;
+}
+
+// ========== LIGHT SAMPLING ==========
+// The host lists the lights with an alias table built for them (LightAliasTable.h): slot i keeps light i with
+// aliasProbability and hands over to aliasIndex otherwise. Two uniform numbers pick a light in proportion to its
+// power for any light count, so a pixel casts the same shadow rays for one light or a thousand. Lighting from a
+// picked light is divided by its selectionPdf, which keeps the average the sum over all lights.
+LightInstance sampleLight(vec2 u, out float pdf)
+{
+    int slot = min(int(u.x * float(lightCount)), lightCount - 1);
+    int index = u.y < lights[slot].aliasProbability ? slot : lights[slot].aliasIndex;
+    pdf = max(lights[index].selectionPdf, 1e-8);
+    return lights[index];
+}
+
+// Two uniform numbers in [0, 1) from a seed
+vec2 hashSample2D(uint seed)
+{
+    uint first = pcgHash(seed);
+    uint second = pcgHash(first);
+    return vec2(first >> 8u, second >> 8u) / 16777216.0;
+}
 
-        float distToBlocker = length(shadowHit.position - hit.position);
+// The same light for a key every frame, for passes that keep a single visibility per pixel or block
+LightInstance pixelLight(uint key, out float pdf)
+{
+    return sampleLight(hashSample2D(key ^ pcgHash(PROGRESSIVE_DIMENSION_LIGHT_SELECT)), pdf);
+}
+
+// ========== SHADING ==========
+// Fraction of count jittered shadow rays from the hit that reach the light
+float shadowVisibility(HitInfo hit, LightInstance light, int count, int frameSeed)
+{
+    float visible = 0.0;
+    for (int i = 0; i < count; ++i)
+    {
+        vec3 toSample = shadowSampleVector(hit.position, light, i, count, frameSeed);
+        float sampleDist = length(toSample);
+        vec3 shadowRayDir = normalize(toSample);
+
+        vec3 shadowRayOrigin = hit.position + hit.normal * 0.001;
+
+        if (!isInShadow(shadowRayOrigin, shadowRayDir, sampleDist))
+        {
+            visible += 1.0;
+        }
+    }
+    return visible / float(max(count, 1));
+}
 
-        // Optional attenuation
-        float attenuation = 1.0;// / (distToLight * distToLight);
-        float penumbraBias = 1.0;//smoothstep(0.0, distToBlocker, distToLight);
+// Light reaching the hit, shadowFactor already holds the visibility
+vec3 directLighting(HitInfo hit, LightInstance light, float shadowFactor)
+{
+    // Base lighting
+    vec3 toLight = light.position - hit.position;
+    float distToLight = length(toLight);
+    vec3 lightDir = normalize(toLight);
+    float ndotl = max(dot(hit.normal, lightDir), 0.0);
+
+    // Optional attenuation
+    float attenuation = 1.0;// / (distToLight * distToLight);
+    float penumbraBias = 1.0;//smoothstep(0.0, distToBlocker, distToLight);
 
-        pixelColor += light.color * ndotl * shadowFactor * attenuation * penumbraBias;
+    return light.color * light.intensity * ndotl * shadowFactor * attenuation * penumbraBias;
+}
+
+// Average of count shadow rays, each toward a light picked for it and weighted by its pdf
+vec3 sampledLighting(HitInfo hit, int count)
+{
+    uint seed = pcgHash(floatBitsToUint(hit.position.x) ^ pcgHash(floatBitsToUint(hit.position.y) ^ pcgHash(floatBitsToUint(hit.position.z))));
+    vec3 lighting = vec3(0.0);
+    for (int i = 0; i < count; ++i)
+    {
+        float pdf;
+        LightInstance light = sampleLight(hashSample2D(seed + uint(i)), pdf);
+        vec3 toSample = shadowSampleVector(hit.position, light, i, count, 0);
+        if (!isInShadow(hit.position + hit.normal * 0.001, normalize(toSample), length(toSample)))
+        {
+            lighting += directLighting(hit, light, 1.0) / pdf;
+        }
+    }
+    return lighting * SHADOW_WEIGHT / float(max(count, 1));
+}
+
+// sampledLighting with this frame's count shadow rays, light picks and disk points continue the pixel's sequence
+vec3 progressiveLighting(HitInfo hit, uint pixel, int count)
+{
+    vec3 lighting = vec3(0.0);
+    for (int i = 0; i < count; ++i)
+    {
+        uint index = uint(progressiveSample * count + i);
+        float pdf;
+        LightInstance light = sampleLight(progressiveSample2D(pixel, PROGRESSIVE_DIMENSION_LIGHT_SELECT, index), pdf);
+        vec3 toSample = lightDiskVector(hit.position, light, squareToDisk(progressiveSample2D(pixel, PROGRESSIVE_DIMENSION_LIGHT, index)));
+        if (!isInShadow(hit.position + hit.normal * 0.001, normalize(toSample), length(toSample)))
+        {
+            lighting += directLighting(hit, light, 1.0) / pdf;
+        }
+    }
+    return lighting * SHADOW_WEIGHT / float(max(count, 1));
+}
+
+// Denoised pixels leave the shadow factor to the denoiser: visibility and surface go to its buffers and
+// the returned color is unshadowed, the last a-trous pass multiplies it in. pixel is -1 outside the image.
+// Those and reduced resolution shadows keep one visibility, so all their rays go to the light of lightKey.
+vec3 rayTrace(Ray primaryRay, int pixel, bool denoised, uint lightKey)
+{
+    vec3 pixelColor = vec3(0.0);
+    HitInfo hit = traceRay2(primaryRay);
+
+    if (shadowDenoiser != 0 && pixel >= 0)
+    {
+        writeDenoiseSurface(uint(pixel), hit, primaryRay.origin, denoised);
+    }
+    else if (shadowResolutionDivisor > 1 && pixel >= 0)
+    {
+        writeDenoiseSurface(uint(pixel), hit, primaryRay.origin, true);
+    }
+
+    if (hit.hit)
+    {
+        if (denoised || shadowResolutionDivisor > 1)
+        {
+            float pdf;
+            LightInstance light = pixelLight(lightKey, pdf);
+            if (denoised)
+            {
+                writeRawVisibility(uint(pixel), shadowVisibility(hit, light, denoisedShadowSampleCount, frameIndex));
+            }
+            // Otherwise visibility comes later from the reduced resolution shadow passes
+            pixelColor += directLighting(hit, light, SHADOW_WEIGHT) / pdf;
+        }
+        else if (progressiveSample >= 0 && pixel >= 0)
+        {
+            pixelColor += progressiveLighting(hit, uint(pixel), shadowSampleCount);
+        }
+        else
+        {
+            pixelColor += sampledLighting(hit, shadowSampleCount);
+        }
     }
 
     return pixelColor;
 }
 
+// ========== REDUCED RESOLUTION SHADOWS ==========
+// The megakernel shades every pixel without shadows and writes its surface like for the denoiser. The trace pass
+// then casts the shadow rays of one pixel per divisor x divisor block, the block center, into shadowVisibilityImage
+// and the upsample pass gives each pixel a joint bilateral blend of the 2x2 nearest blocks: bilinear weights
+// times depth and normal similarity to the full resolution surface, so shadows do not bleed across edges.
+#define SHADOW_UPSAMPLE_SIGMA_NORMAL 32.0
+#define SHADOW_UPSAMPLE_SIGMA_DEPTH 0.02
+
+layout(set = 0, binding = 23, r16f) uniform image2D shadowVisibilityImage; // Negative where the block center hit nothing
+
+ivec2 shadowBlockCount(ivec2 imageSize)
+{
+    return (imageSize + shadowResolutionDivisor - 1) / shadowResolutionDivisor;
+}
+
+// Light of all pixels of the block
+uint shadowBlockLightKey(ivec2 block)
+{
+    return uint(block.y) * 65536u + uint(block.x);
+}
+
+// Full resolution pixel whose shadow rays stand for the block
+ivec2 shadowBlockPixel(ivec2 block, ivec2 imageSize)
+{
+    return min(block * shadowResolutionDivisor + shadowResolutionDivisor / 2, imageSize - 1);
+}
+
+DenoiseSurface surfaceAt(ivec2 pixelCoords, ivec2 imageSize)
+{
+    return denoiseSurfaces[currentDenoiseSlot() * denoisePixelCount() + uint(pixelCoords.y * imageSize.x + pixelCoords.x)];
+}
+
+void shadowTraceReduced(ivec2 block, ivec2 imageSize)
+{
+    if (block.x >= shadowBlockCount(imageSize).x || block.y >= shadowBlockCount(imageSize).y)
+    {
+        return;
+    }
+
+    ivec2 pixelCoords = shadowBlockPixel(block, imageSize);
+    DenoiseSurface surface = surfaceAt(pixelCoords, imageSize);
+    if (surface.hitDistance < 0.0)
+    {
+        imageStore(shadowVisibilityImage, block, vec4(-1.0));
+        return;
+    }
+
+    // The surface buffer keeps the distance along the camera ray, enough to rebuild the hit
+    HitInfo hit;
+    hit.position = camera.position.xyz + primaryRayDirection(vec2(pixelCoords) + 0.5, imageSize) * surface.hitDistance;
+    hit.normal = surface.normal;
+    hit.hit = true;
+
+    float pdf;
+    LightInstance light = pixelLight(shadowBlockLightKey(block), pdf);
+    imageStore(shadowVisibilityImage, block, vec4(shadowVisibility(hit, light, shadowSampleCount, 0)));
+}
+
+void shadowUpsample(ivec2 pixelCoords, ivec2 imageSize)
+{
+    if (pixelCoords.x >= imageSize.x || pixelCoords.y >= imageSize.y)
+    {
+        return;
+    }
+
+    DenoiseSurface surface = surfaceAt(pixelCoords, imageSize);
+    if (surface.hitDistance < 0.0)
+    {
+        return;
+    }
+
+    // Step 1: the 2x2 blocks whose centers surround the pixel
+    vec2 position = (vec2(pixelCoords) - float(shadowResolutionDivisor / 2)) / float(shadowResolutionDivisor);
+    ivec2 base = ivec2(floor(position));
+    vec2 fraction = position - vec2(base);
+    ivec2 lastBlock = shadowBlockCount(imageSize) - 1;
+
+    // Step 2: bilinear weights, kept above zero so a matching block still counts when it is the far one,
+    // times how close the block's surface is in depth and normal
+    float visibility = 0.0;
+    float weightSum = 0.0;
+    float closestVisibility = 1.0;
+    float closestDepth = 1e30;
+    for (int i = 0; i < 4; ++i)
+    {
+        ivec2 offset = ivec2(i & 1, i >> 1);
+        ivec2 block = clamp(base + offset, ivec2(0), lastBlock);
+        float blockVisibility = imageLoad(shadowVisibilityImage, block).r;
+        if (blockVisibility < 0.0)
+        {
+            continue;
+        }
+
+        DenoiseSurface blockSurface = surfaceAt(shadowBlockPixel(block, imageSize), imageSize);
+        float depthDifference = abs(blockSurface.hitDistance - surface.hitDistance);
+        float bilinear = (offset.x == 0 ? 1.0 - fraction.x : fraction.x) * (offset.y == 0 ? 1.0 - fraction.y : fraction.y);
+        float normalWeight = pow(max(dot(surface.normal, blockSurface.normal), 0.0), SHADOW_UPSAMPLE_SIGMA_NORMAL);
+        float depthWeight = exp(-depthDifference / (SHADOW_UPSAMPLE_SIGMA_DEPTH * surface.hitDistance + EPSILON));
+        float weight = max(bilinear, 0.05) * normalWeight * depthWeight;
+
+        visibility += blockVisibility * weight;
+        weightSum += weight;
+
+        if (depthDifference < closestDepth)
+        {
+            closestDepth = depthDifference;
+            closestVisibility = blockVisibility;
+        }
+    }
+
+    // Step 3: no block looks like this surface, take the nearest in depth
+    visibility = weightSum > 1e-4 ? visibility / weightSum : closestVisibility;
+
+    vec4 color = imageLoad(outputImage, pixelCoords);
+    imageStore(outputImage, pixelCoords, vec4(color.rgb * visibility, color.a));
+}
+
+// ========== HYBRID ==========
+// The rasterizer writes the world space normal and depth of each visible surface into gBuffer. This pass rebuilds the
+// position from the depth with the inverse of the rasterizer's matrices and casts only the shadow rays from it, no camera
+// ray traverses the BVH. Pixels still at the cleared depth of 1 saw no surface and stay black, like missed camera rays.
+#define HYBRID_POSITION_BIAS 0.0005 // Offset along the normal per unit of camera distance, depth is less exact than a traced hit
+
+layout(set = 0, binding = 24, rgba32f) uniform readonly image2D gBuffer;
+
+void hybridShade(ivec2 pixelCoords, ivec2 imageSize)
+{
+    if (pixelCoords.x >= imageSize.x || pixelCoords.y >= imageSize.y)
+    {
+        return;
+    }
+
+    vec4 surface = imageLoad(gBuffer, pixelCoords);
+    if (surface.w >= 1.0)
+    {
+        imageStore(outputImage, pixelCoords, vec4(0.0, 0.0, 0.0, 1.0));
+        return;
+    }
+
+    // Step 1: pixel center and depth back to world space
+    vec2 ndc = (vec2(pixelCoords) + 0.5) / vec2(imageSize) * 2.0 - 1.0;
+    vec4 position = camera.inverseRasterViewProjection * vec4(ndc, surface.w, 1.0);
+
+    HitInfo hit;
+    hit.position = position.xyz / position.w;
+    hit.normal = normalize(surface.xyz);
+    hit.hit = true;
+    hit.position += hit.normal * HYBRID_POSITION_BIAS * distance(hit.position, camera.position.xyz);
+
+    // Step 2: shade it with the shadow rays of the megakernel
+    imageStore(outputImage, pixelCoords, vec4(sampledLighting(hit, shadowSampleCount), 1.0));
+}
+
+// ========== WAVEFRONT ==========
+// Alternative to the megakernel above: generate, extend (closest hit), shade and shadow (any hit) run as
+// separate dispatches of this shader, picked with WAVEFRONT_STAGE, and resolve combines the results.
+// Stages hand their work over through queues. Appending to a queue also grows the x group count of the
+// vkCmdDispatchIndirect that runs the next stage, so no stage is launched for more work than exists.
+struct QueuedRay
+{
+    vec4 origin;    // w: pixel index bits
+    vec4 direction;
+};
+
+struct QueuedHit
+{
+    vec4 position; // w: pixel index bits
+    vec4 normal;
+};
+
+struct QueuedShadowRay
+{
+    vec3 toSample; // Unnormalized, its length is the ray's tMax
+    uint hitIndex; // Hit queue entry the ray starts from
+};
+
+// VkDispatchIndirectCommand of the stage reading the queue, then the queue length
+struct WavefrontQueue
+{
+    uint groupCountX;
+    uint groupCountY;
+    uint groupCountZ;
+    uint entryCount;
+};
+
+layout(std430, set = 0, binding = 13) buffer WavefrontStateBuffer
+{
+    WavefrontQueue queues[3];
+    uint rayBins[RAY_BIN_COUNT]; // Shadow rays per bin, then the first binned queue entry of each bin
+    uint pixelVisibility[];      // Unoccluded shadow samples per pixel
+};
+
+layout(std430, set = 0, binding = 14) buffer WavefrontRayQueue
+{
+    QueuedRay extendQueue[];
+};
+
+layout(std430, set = 0, binding = 15) buffer WavefrontHitQueue
+{
+    QueuedHit hitQueue[];
+};
+
+layout(std430, set = 0, binding = 16) buffer WavefrontShadowQueue
+{
+    QueuedShadowRay shadowQueue[];
+};
+
+layout(std430, set = 0, binding = 17) buffer WavefrontBinnedShadowQueue
+{
+    QueuedShadowRay binnedShadowQueue[]; // The shadow queue sorted by bin
+};
+
+// Reserves count entries and returns the first one
+uint appendToQueue(uint queue, uint count)
+{
+    uint groupSize = gl_WorkGroupSize.x * gl_WorkGroupSize.y;
+    uint first = atomicAdd(queues[queue].entryCount, count);
+    atomicMax(queues[queue].groupCountX, (first + count + groupSize - 1u) / groupSize);
+    return first;
+}
+
+// Queue entry of this invocation in the 1D indirect dispatches, -1 past the end of the queue
+int queueEntry(uint queue)
+{
+    uint entry = gl_WorkGroupID.x * gl_WorkGroupSize.x * gl_WorkGroupSize.y + gl_LocalInvocationIndex;
+    return entry < queues[queue].entryCount ? int(entry) : -1;
+}
+
+ivec2 pixelFromIndex(uint pixel, ivec2 imageSize)
+{
+    return ivec2(int(pixel) % imageSize.x, int(pixel) / imageSize.x);
+}
+
+Ray makeRay(vec3 origin, vec3 direction)
+{
+    Ray ray;
+    ray.origin = origin;
+    ray.direction = direction;
+    ray.inverseDirection = 1.0 / direction;
+    return ray;
+}
+
+// Step 1: one camera ray per pixel, and the pixel cleared for the stages after
+void wavefrontGenerate(ivec2 pixelCoords, ivec2 imageSize, Ray primaryRay)
+{
+    if (pixelCoords.x >= imageSize.x || pixelCoords.y >= imageSize.y)
+    {
+        return;
+    }
+
+    uint pixel = uint(pixelCoords.y * imageSize.x + pixelCoords.x);
+    pixelVisibility[pixel] = 0u;
+    if (pixel < RAY_BIN_COUNT)
+    {
+        rayBins[pixel] = 0u;
+    }
+    imageStore(outputImage, pixelCoords, vec4(0.0, 0.0, 0.0, 1.0));
+
+    extendQueue[appendToQueue(WAVEFRONT_EXTEND_QUEUE, 1u)] = QueuedRay(vec4(primaryRay.origin, uintBitsToFloat(pixel)), vec4(primaryRay.direction, 0.0));
+}
+
+// Step 2: closest hit of every queued ray, only hits go on
+void wavefrontExtend()
+{
+    int entry = queueEntry(WAVEFRONT_EXTEND_QUEUE);
+    if (entry < 0)
+    {
+        return;
+    }
+
+    QueuedRay queued = extendQueue[entry];
+    HitInfo hit = traceRay2(makeRay(queued.origin.xyz, queued.direction.xyz));
+    if (hit.hit)
+    {
+        hitQueue[appendToQueue(WAVEFRONT_HIT_QUEUE, 1u)] = QueuedHit(vec4(hit.position, queued.origin.w), vec4(hit.normal, 0.0));
+    }
+}
+
+// Step 3: direct lighting without visibility, and the shadow rays that decide it
+void wavefrontShade(ivec2 imageSize)
+{
+    int entry = queueEntry(WAVEFRONT_HIT_QUEUE);
+    if (entry < 0)
+    {
+        return;
+    }
+
+    QueuedHit hit = hitQueue[entry];
+    uint pixel = floatBitsToUint(hit.position.w);
+    HitInfo shadeHit;
+    shadeHit.position = hit.position.xyz;
+    shadeHit.normal = hit.normal.xyz;
+    shadeHit.hit = true;
+
+    // The resolve pass scales one color by the visible count, so all rays of the pixel go to one light
+    float pdf;
+    LightInstance light = pixelLight(pixel, pdf);
+    imageStore(outputImage, pixelFromIndex(pixel, imageSize), vec4(directLighting(shadeHit, light, 1.0) / pdf, 1.0));
+
+    uint first = appendToQueue(WAVEFRONT_SHADOW_QUEUE, uint(SHADOW_SAMPLES));
+    for (int i = 0; i < SHADOW_SAMPLES; ++i)
+    {
+        shadowQueue[first + uint(i)] = QueuedShadowRay(shadowSampleVector(hit.position.xyz, light, i, SHADOW_SAMPLES, 0), uint(entry));
+    }
+}
+
+// Step 4: any hit of every shadow ray, unoccluded ones count for their pixel
+void wavefrontShadow()
+{
+    int entry = queueEntry(WAVEFRONT_SHADOW_QUEUE);
+    if (entry < 0)
+    {
+        return;
+    }
+
+    QueuedShadowRay shadowRay = binRays != 0 ? binnedShadowQueue[entry] : shadowQueue[entry];
+    QueuedHit hit = hitQueue[shadowRay.hitIndex];
+    vec3 shadowRayOrigin = hit.position.xyz + hit.normal.xyz * 0.001;
+    if (!isInShadow(shadowRayOrigin, normalize(shadowRay.toSample), length(shadowRay.toSample)))
+    {
+        atomicAdd(pixelVisibility[floatBitsToUint(hit.position.w)], 1u);
+    }
+}
+
+// Step 5: lighting times the visible fraction, the same weighting as rayTrace
+void wavefrontResolve(ivec2 pixelCoords, ivec2 imageSize)
+{
+    if (pixelCoords.x >= imageSize.x || pixelCoords.y >= imageSize.y)
+    {
+        return;
+    }
+
+    float shadowFactor = float(pixelVisibility[pixelCoords.y * imageSize.x + pixelCoords.x]) / (float(SHADOW_SAMPLES) + 1);
+    imageStore(outputImage, pixelCoords, vec4(imageLoad(outputImage, pixelCoords).rgb * shadowFactor, 1.0));
+}
+
+// ========== RAY BINNING ==========
+// Counting sort of the shadow queue between shade and shadow: count rays per bin, scan the counts into
+// offsets in one workgroup, then scatter. Rays of a bin leave from nearby points in similar directions,
+// so invocations traced together walk the same nodes.
+#define RAY_BIN_FALLBACK_EXTENT 64.0
+
+shared uint binScanTotals[gl_WorkGroupSize.x * gl_WorkGroupSize.y];
+
+// Interleaves the 3 low bits of v with two zero bits each
+uint spreadBits3(uint v)
+{
+    return (v & 1u) | ((v & 2u) << 2u) | ((v & 4u) << 4u);
+}
+
+// Direction octant in the high bits, Morton order of the origin cell on an 8x8x8 grid in the low 9 bits
+uint shadowRayBin(QueuedShadowRay shadowRay)
+{
+    vec3 origin = hitQueue[shadowRay.hitIndex].position.xyz;
+
+    // Cells span the TLAS root box, or a box around the camera when instances are traversed one by one
+    vec3 boundMin = camera.position.xyz - vec3(RAY_BIN_FALLBACK_EXTENT);
+    vec3 boundMax = camera.position.xyz + vec3(RAY_BIN_FALLBACK_EXTENT);
+    if (tlasRootIndex >= 0)
+    {
+        boundMin = nodes[tlasRootIndex].boundMin;
+        boundMax = nodes[tlasRootIndex].boundMax;
+    }
+
+    uvec3 cell = uvec3(clamp((origin - boundMin) / max(boundMax - boundMin, vec3(0.000001)) * 8.0, vec3(0.0), vec3(7.0)));
+    uint octant = (shadowRay.toSample.x < 0.0 ? 1u : 0u) | (shadowRay.toSample.y < 0.0 ? 2u : 0u) | (shadowRay.toSample.z < 0.0 ? 4u : 0u);
+    return (octant << 9u) | spreadBits3(cell.x) | (spreadBits3(cell.y) << 1u) | (spreadBits3(cell.z) << 2u);
+}
+
+// Step 1: rays per bin
+void wavefrontBinCount()
+{
+    int entry = queueEntry(WAVEFRONT_SHADOW_QUEUE);
+    if (entry < 0)
+    {
+        return;
+    }
+
+    atomicAdd(rayBins[shadowRayBin(shadowQueue[entry])], 1u);
+}
+
+// Step 2: exclusive prefix sum of the bin counts, a single workgroup
+void wavefrontBinScan()
+{
+    const uint invocationCount = gl_WorkGroupSize.x * gl_WorkGroupSize.y;
+    const uint binsPerInvocation = RAY_BIN_COUNT / invocationCount;
+    uint invocation = gl_LocalInvocationIndex;
+    uint firstBin = invocation * binsPerInvocation;
+
+    uint sum = 0u;
+    for (uint i = 0u; i < binsPerInvocation; ++i)
+    {
+        sum += rayBins[firstBin + i];
+    }
+    binScanTotals[invocation] = sum;
+    barrier();
+
+    // Inclusive scan of the per invocation sums
+    for (uint offset = 1u; offset < invocationCount; offset <<= 1u)
+    {
+        uint value = invocation >= offset ? binScanTotals[invocation - offset] : 0u;
+        barrier();
+        binScanTotals[invocation] += value;
+        barrier();
+    }
+
+    uint binOffset = binScanTotals[invocation] - sum;
+    for (uint i = 0u; i < binsPerInvocation; ++i)
+    {
+        uint count = rayBins[firstBin + i];
+        rayBins[firstBin + i] = binOffset;
+        binOffset += count;
+    }
+}
+
+// Step 3: every ray to the next free entry of its bin
+void wavefrontBinScatter()
+{
+    int entry = queueEntry(WAVEFRONT_SHADOW_QUEUE);
+    if (entry < 0)
+    {
+        return;
+    }
+
+    QueuedShadowRay shadowRay = shadowQueue[entry];
+    binnedShadowQueue[atomicAdd(rayBins[shadowRayBin(shadowRay)], 1u)] = shadowRay;
+}
+
+// ========== DISPATCH ORDER ==========
+// Row major tiles spread the workgroups running together over a long strip of the screen. Swizzled, each
+// run of 64 workgroups covers an 8x8 tile block in Morton order, and the invocations of a tile follow
+// Morton order too, so a subgroup traces a compact pixel block instead of one or two rows.
+#define SWIZZLE_BLOCK_TILES 8u
+
+// Odd bits of v packed into the low half
+uint compactBits2(uint v)
+{
+    v &= 0x55555555u;
+    v = (v | (v >> 1u)) & 0x33333333u;
+    v = (v | (v >> 2u)) & 0x0F0F0F0Fu;
+    v = (v | (v >> 4u)) & 0x00FF00FFu;
+    v = (v | (v >> 8u)) & 0x0000FFFFu;
+    return v;
+}
+
+uvec2 mortonDecode2(uint code)
+{
+    return uvec2(compactBits2(code), compactBits2(code >> 1u));
+}
+
+ivec2 dispatchPixel()
+{
+    if (swizzledDispatch == 0)
+    {
+        return ivec2(gl_GlobalInvocationID.xy);
+    }
+
+    const uint blockTileCount = SWIZZLE_BLOCK_TILES * SWIZZLE_BLOCK_TILES;
+    uint group = gl_WorkGroupID.y * gl_NumWorkGroups.x + gl_WorkGroupID.x;
+    uint block = group / blockTileCount;
+    uint blocksX = gl_NumWorkGroups.x / SWIZZLE_BLOCK_TILES;
+
+    uvec2 tile = uvec2(block % blocksX, block / blocksX) * SWIZZLE_BLOCK_TILES + mortonDecode2(group % blockTileCount);
+    return ivec2(tile * gl_WorkGroupSize.xy + mortonDecode2(gl_LocalInvocationIndex));
+}
+
+// ========== UPSCALE ==========
+// Dynamic resolution traces the top left traceSize of outputImage and this pass scales it to all of
+// upscaledImage, after the edge adaptive spatial upsampling of FSR1. The luma gradient of the 2x2 texels
+// around the sample point gives an edge direction and strength, a Lanczos-2 kernel over 12 taps is stretched
+// along that edge and narrowed across it, and the result is clamped to the 2x2 texels so the negative lobes
+// cannot ring.
+layout(set = 0, binding = 22, rgba32f) uniform image2D upscaledImage;
+
+float upscaleLuma(vec3 color)
+{
+    return dot(color, vec3(0.299, 0.587, 0.114));
+}
+
+vec3 upscaleTexel(ivec2 texel)
+{
+    return imageLoad(outputImage, clamp(texel, ivec2(0), traceSize() - 1)).rgb;
+}
+
+// Windowed Lanczos-2 of a squared distance, polynomial like FSR1's, lobe sets how far the window reaches
+float upscaleLanczos2(float distance2, float lobe)
+{
+    distance2 = min(distance2, 1.0 / lobe);
+    float base = 2.0 / 5.0 * distance2 - 1.0;
+    float window = lobe * distance2 - 1.0;
+    return (25.0 / 16.0 * base * base - (25.0 / 16.0 - 1.0)) * window * window;
+}
+
+void upscaleTrace(ivec2 pixelCoords)
+{
+    ivec2 outputSize = imageSize(upscaledImage);
+    if (pixelCoords.x >= outputSize.x || pixelCoords.y >= outputSize.y)
+    {
+        return;
+    }
+
+    // Step 1: sample point in trace texels, the 2x2 quad around it starts at base
+    vec2 position = (vec2(pixelCoords) + 0.5) * vec2(traceSize()) / vec2(outputSize) - 0.5;
+    ivec2 base = ivec2(floor(position));
+    vec2 fraction = position - vec2(base);
+
+    vec3 c00 = upscaleTexel(base);
+    vec3 c10 = upscaleTexel(base + ivec2(1, 0));
+    vec3 c01 = upscaleTexel(base + ivec2(0, 1));
+    vec3 c11 = upscaleTexel(base + ivec2(1, 1));
+    float l00 = upscaleLuma(c00);
+    float l10 = upscaleLuma(c10);
+    float l01 = upscaleLuma(c01);
+    float l11 = upscaleLuma(c11);
+
+    // Step 2: bilinear luma gradient as the edge normal, its size against the local contrast as the edge strength
+    vec2 gradient = vec2(mix(l10 - l00, l11 - l01, fraction.y), mix(l01 - l00, l11 - l10, fraction.x));
+    float contrast = max(max(l00, l10), max(l01, l11)) - min(min(l00, l10), min(l01, l11));
+    float edge = clamp(length(gradient) / max(contrast, 1e-4), 0.0, 1.0);
+    edge *= edge;
+
+    vec2 direction = dot(gradient, gradient) > 1e-10 ? normalize(gradient) : vec2(1.0, 0.0);
+    float stretch = 1.0 / max(abs(direction.x), abs(direction.y));
+    vec2 axisScale = vec2(1.0 + (stretch - 1.0) * edge, 1.0 - 0.5 * edge); // Narrower across the edge, wider along it
+    float lobe = 0.5 + ((1.0 / 4.0 - 0.04) - 0.5) * edge;
+
+    // Step 3: 12 taps, the 4x4 texels around the quad without the corners
+    vec3 color = vec3(0.0);
+    float weightSum = 0.0;
+    for (int y = -1; y <= 2; ++y)
+    {
+        for (int x = -1; x <= 2; ++x)
+        {
+            if ((x == -1 || x == 2) && (y == -1 || y == 2))
+            {
+                continue;
+            }
+
+            vec2 offset = vec2(x, y) - fraction;
+            vec2 rotated = vec2(dot(offset, direction), dot(offset, vec2(-direction.y, direction.x))) * axisScale;
+            float weight = upscaleLanczos2(dot(rotated, rotated), lobe);
+
+            color += upscaleTexel(base + ivec2(x, y)) * weight;
+            weightSum += weight;
+        }
+    }
+    color /= max(weightSum, 1e-4);
+
+    // Step 4: deringing
+    color = clamp(color, min(min(c00, c10), min(c01, c11)), max(max(c00, c10), max(c01, c11)));
+
+    imageStore(upscaledImage, pixelCoords, vec4(color, 1.0));
+}
+
+// ========== INSTRUMENTATION ==========
+// Blue to cyan to green to yellow to red
+vec3 heatmapColor(float value)
+{
+    value = clamp(value, 0.0, 1.0);
+    vec3 color = value < 0.25 ? mix(vec3(0.0, 0.0, 0.5), vec3(0.0, 0.6, 1.0), value * 4.0)
+        : value < 0.5 ? mix(vec3(0.0, 0.6, 1.0), vec3(0.0, 1.0, 0.2), value * 4.0 - 1.0)
+        : value < 0.75 ? mix(vec3(0.0, 1.0, 0.2), vec3(1.0, 1.0, 0.0), value * 4.0 - 2.0)
+        : mix(vec3(1.0, 1.0, 0.0), vec3(1.0, 0.0, 0.0), value * 4.0 - 3.0);
+    return color;
+}
+
+// Stores the pixel counters, replaces the color by a heatmap when asked and adds the workgroup sums to
+// the frame totals with one atomic per value and workgroup
+vec3 writeTraversalCounters(ivec2 pixelCoords, ivec2 imageSize, vec3 color)
+{
+    if (gl_LocalInvocationIndex == 0u)
+    {
+        groupRays = 0u;
+        groupNodes = 0u;
+        groupTriangles = 0u;
+        groupStackHighWater = 0u;
+    }
+    barrier();
+
+    bool inside = pixelCoords.x < imageSize.x && pixelCoords.y < imageSize.y;
+    if (inside)
+    {
+        traversalCounters[pixelCoords.y * imageSize.x + pixelCoords.x] = uvec4(pixelNodes, pixelTriangles, pixelStackHighWater, pixelRays);
+        atomicAdd(groupRays, pixelRays);
+        atomicAdd(groupNodes, pixelNodes);
+        atomicAdd(groupTriangles, pixelTriangles);
+        atomicMax(groupStackHighWater, pixelStackHighWater);
+    }
+    barrier();
+
+    if (gl_LocalInvocationIndex == 0u)
+    {
+        atomicAdd(totalRays, groupRays);
+        atomicMax(maxStackHighWater, groupStackHighWater);
+
+        // The add that wraps the low word carries into the high word
+        uint previousNodes = atomicAdd(totalNodesLow, groupNodes);
+        if (previousNodes + groupNodes < previousNodes)
+        {
+            atomicAdd(totalNodesHigh, 1u);
+        }
+        uint previousTriangles = atomicAdd(totalTrianglesLow, groupTriangles);
+        if (previousTriangles + groupTriangles < previousTriangles)
+        {
+            atomicAdd(totalTrianglesHigh, 1u);
+        }
+    }
+
+    if (traversalHeatmap == 0)
+    {
+        return color;
+    }
+    uint value = traversalHeatmap == 1 ? pixelNodes : (traversalHeatmap == 2 ? pixelTriangles : pixelStackHighWater);
+    return heatmapColor(float(value) / float(max(traversalHeatmapMax, 1)));
+}
+
 // ========== MAIN ==========
 
 void main()
 {
-    ivec2 pixelCoords = ivec2(gl_GlobalInvocationID.xy);
-    ivec2 imageSize = imageSize(outputImage);
+    ivec2 pixelCoords = dispatchPixel();
+    ivec2 imageSize = traceSize();
     //if (pixelCoords.x >= imageSize.x || pixelCoords.y >= imageSize.y)
     //{
     //    return;
     //}
 
-    vec2 uv = (vec2(pixelCoords) + 0.5) / vec2(imageSize) * 2.0 - 1.0;
-    uv.y = -uv.y;
+    // The 1D queue stages read their queues, the 2D ones start from the pixel
+    if (WAVEFRONT_STAGE == WAVEFRONT_EXTEND) { wavefrontExtend(); return; }
+    if (WAVEFRONT_STAGE == WAVEFRONT_SHADE) { wavefrontShade(imageSize); return; }
+    if (WAVEFRONT_STAGE == WAVEFRONT_SHADOW) { wavefrontShadow(); return; }
+    if (WAVEFRONT_STAGE == WAVEFRONT_BIN_COUNT) { wavefrontBinCount(); return; }
+    if (WAVEFRONT_STAGE == WAVEFRONT_BIN_SCAN) { wavefrontBinScan(); return; }
+    if (WAVEFRONT_STAGE == WAVEFRONT_BIN_SCATTER) { wavefrontBinScatter(); return; }
 
-    vec3 rayDir = normalize(
-        uv.x * camera.right.xyz +
-        uv.y * camera.up.xyz +
-        camera.direction.xyz
-    );
+    // Covers upscaledImage, not the trace
+    if (UPSCALE_PASS) { upscaleTrace(ivec2(gl_GlobalInvocationID.xy)); return; }
+
+    // Covers the G-buffer, no camera rays
+    if (HYBRID_PASS) { hybridShade(ivec2(gl_GlobalInvocationID.xy), imageSize); return; }
+
+    // Covers the shadow blocks, not the pixels
+    if (SHADOW_RESOLUTION_PASS == SHADOW_RESOLUTION_TRACE) { shadowTraceReduced(ivec2(gl_GlobalInvocationID.xy), imageSize); return; }
+
+    // Padding tiles of the swizzled dispatch, the whole workgroup leaves together
+    ivec2 tileOrigin = (pixelCoords / ivec2(gl_WorkGroupSize.xy)) * ivec2(gl_WorkGroupSize.xy);
+    if (tileOrigin.x >= imageSize.x || tileOrigin.y >= imageSize.y)
+    {
+        return;
+    }
+
+    if (WAVEFRONT_STAGE == WAVEFRONT_RESOLVE) { wavefrontResolve(pixelCoords, imageSize); return; }
+    if (DENOISE_PASS == DENOISE_TEMPORAL) { denoiseTemporal(pixelCoords, imageSize); return; }
+    if (DENOISE_PASS == DENOISE_ATROUS) { denoiseAtrous(pixelCoords, imageSize); return; }
+    if (SHADOW_RESOLUTION_PASS == SHADOW_RESOLUTION_UPSAMPLE) { shadowUpsample(pixelCoords, imageSize); return; }
+
+    bool insideImage = pixelCoords.x < imageSize.x && pixelCoords.y < imageSize.y;
+    int pixel = insideImage ? pixelCoords.y * imageSize.x + pixelCoords.x : -1;
+
+    // A converged accumulation is only shown again, the image does not keep it between frames
+    if (progressiveConverged != 0 && WAVEFRONT_STAGE == WAVEFRONT_MEGAKERNEL)
+    {
+        if (insideImage)
+        {
+            imageStore(outputImage, pixelCoords, vec4(accumulation[pixel].rgb, 1.0));
+        }
+        return;
+    }
+
+    // Progressive samples jitter inside the pixel
+    vec2 pixelPosition = vec2(pixelCoords) + 0.5;
+    if (progressiveSample >= 0 && insideImage && WAVEFRONT_STAGE == WAVEFRONT_MEGAKERNEL)
+    {
+        pixelPosition = vec2(pixelCoords) + progressiveSample2D(uint(pixel), PROGRESSIVE_DIMENSION_PIXEL, uint(progressiveSample));
+    }
+    vec3 rayDir = primaryRayDirection(pixelPosition, imageSize);
 
     Ray primaryRay;
     primaryRay.origin = camera.position.xyz;
     primaryRay.direction = rayDir;
     primaryRay.inverseDirection = 1.0 / primaryRay.direction;
 
-    imageStore(outputImage, pixelCoords, vec4(rayTrace(primaryRay), 1.0));
-}
\ No newline at end of file
+    if (WAVEFRONT_STAGE == WAVEFRONT_GENERATE)
+    {
+        wavefrontGenerate(pixelCoords, imageSize, primaryRay);
+        return;
+    }
+
+    uint lightKey = shadowResolutionDivisor > 1 ? shadowBlockLightKey(pixelCoords / shadowResolutionDivisor) : uint(max(pixel, 0));
+    vec3 color = rayTrace(primaryRay, pixel, shadowDenoiser != 0 && isDenoisedPixel(pixelCoords, imageSize), lightKey);
+    if (progressiveSample >= 0 && insideImage)
+    {
+        color = accumulateProgressive(uint(pixel), color);
+    }
+    if (INSTRUMENTATION)
+    {
+        color = writeTraversalCounters(pixelCoords, imageSize, color);
+    }
+
+    imageStore(outputImage, pixelCoords, vec4(color, 1.0));
+}
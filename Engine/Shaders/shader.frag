@@ -1,17 +1,25 @@
 #version 450
 
+// Only the fragments left after the depth test write the G-buffer. Storage writes of overlapping fragments are not
+// ordered, so the hybrid mode draws a depth pre-pass first and tests EQUAL here, leaving only the visible fragment.
+layout(early_fragment_tests) in;
+
 layout(binding = 0) uniform UniformBufferObject {
     mat4 model;
     mat4 view;
     mat4 proj;
     vec3 cameraPos;
     vec3 cameraLookAt;
+    int raytracingComposite; // 0 blend, 1 ray traced only, 2 hybrid
 } ubo;
 
 layout(binding = 1) uniform sampler2D texSampler;
 
 layout(binding = 2, rgba32f) uniform image2D raytracedImage;
 
+// Hybrid mode: world space normal and depth of the visible surface, the compute pass casts the shadow rays from it
+layout(binding = 3, rgba32f) uniform writeonly image2D gBuffer;
+
 layout(location = 0) in vec3 fragColor;
 layout(location = 1) in vec2 fragTexCoord;
 layout(location = 2) in vec3 fragPos;
@@ -67,6 +75,16 @@ void main()
 
     // Combine rasterized value and raytraced pixel
     vec3 combinedColor = mix(fragColor, rayColor.rgb, 0.8);
+    if (ubo.raytracingComposite == 1)
+    {
+        combinedColor = rayColor.rgb;
+    }
+    else if (ubo.raytracingComposite == 2)
+    {
+        // The hybrid pass shades this G-buffer after the frame, like the blend it shows the last frame's result
+        imageStore(gBuffer, pixelCoords, vec4(normalize(fragNormal), gl_FragCoord.z));
+        combinedColor = rayColor.rgb;
+    }
 
     outColor = vec4(combinedColor, 1.0);
     //outColor = vec4(rayColor.rgb, 1.0);
@@ -6,6 +6,7 @@ layout(binding = 0) uniform UniformBufferObject {
     mat4 proj;
     vec3 cameraPos;
     vec3 cameraLookAt;
+    int raytracingComposite;
 } ubo;
 
 layout(location = 0) in vec3 inPosition;
@@ -13,6 +14,9 @@ layout(location = 1) in vec3 inColor;
 layout(location = 2) in vec2 inTexCoord;
 layout(location = 3) in vec3 normal;
 
+// The hybrid mode's depth pre-pass and main pass must compute the same depth for their EQUAL test
+invariant gl_Position;
+
 layout(location = 0) out vec3 fragColor;
 layout(location = 1) out vec2 fragTexCoord;
 layout(location = 2) out vec3 fragPos;
@@ -23,6 +27,6 @@ void main() {
     fragColor = inColor;
     fragColor = vec3(0.5f, 0.5f, 0.5f);
     fragTexCoord = inTexCoord;
-    fragNormal = normal;
+    fragNormal = mat3(transpose(inverse(ubo.model))) * normal; // World space, for the hybrid mode's G-buffer
     fragPos = vec3(ubo.model * vec4(inPosition, 1.0));
 }
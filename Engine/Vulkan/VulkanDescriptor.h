@@ -33,7 +33,7 @@ namespace Engine
 
         void createDescriptorSetLayout()
         {
-            std::array<VkDescriptorSetLayoutBinding, 3> bindings{};
+            std::array<VkDescriptorSetLayoutBinding, 4> bindings{};
 
             bindings[0].binding = 0;
             bindings[0].descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
@@ -53,6 +53,12 @@ namespace Engine
             bindings[2].stageFlags = VK_SHADER_STAGE_ALL_GRAPHICS;
             bindings[2].pImmutableSamplers = nullptr;
 
+            bindings[3].binding = 3;
+            bindings[3].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_IMAGE;
+            bindings[3].descriptorCount = 1;
+            bindings[3].stageFlags = VK_SHADER_STAGE_ALL_GRAPHICS;
+            bindings[3].pImmutableSamplers = nullptr;
+
             VkDescriptorSetLayoutCreateInfo layoutInfo{};
             layoutInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
             layoutInfo.bindingCount = static_cast<uint32_t>(bindings.size());
@@ -258,7 +264,11 @@ namespace Engine
                     raytracedImageInfo.imageView = raytracingImageView;
                     raytracedImageInfo.imageLayout = VK_IMAGE_LAYOUT_GENERAL;
 
-                    std::array<VkWriteDescriptorSet, 3> descriptorWrites{};
+                    VkDescriptorImageInfo gBufferImageInfo{};
+                    gBufferImageInfo.imageView = gBufferImageView;
+                    gBufferImageInfo.imageLayout = VK_IMAGE_LAYOUT_GENERAL;
+
+                    std::array<VkWriteDescriptorSet, 4> descriptorWrites{};
 
                     descriptorWrites[0].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
                     descriptorWrites[0].dstSet = descriptorSets[i * descriptorCount + j];
@@ -284,6 +294,14 @@ namespace Engine
                     descriptorWrites[2].descriptorCount = 1;
                     descriptorWrites[2].pImageInfo = &raytracedImageInfo;
 
+                    descriptorWrites[3].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+                    descriptorWrites[3].dstSet = descriptorSets[i * descriptorCount + j];
+                    descriptorWrites[3].dstBinding = 3;
+                    descriptorWrites[3].dstArrayElement = 0;
+                    descriptorWrites[3].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_IMAGE;
+                    descriptorWrites[3].descriptorCount = 1;
+                    descriptorWrites[3].pImageInfo = &gBufferImageInfo;
+
                     vkUpdateDescriptorSets(device, static_cast<uint32_t>(descriptorWrites.size()), descriptorWrites.data(), 0, nullptr);
                 }
             }
@@ -307,7 +325,11 @@ namespace Engine
             raytracedImageInfo.imageView = raytracingImageView;
             raytracedImageInfo.imageLayout = VK_IMAGE_LAYOUT_GENERAL;
 
-            std::array<VkWriteDescriptorSet, 3> descriptorWrites{};
+            VkDescriptorImageInfo gBufferImageInfo{};
+            gBufferImageInfo.imageView = gBufferImageView;
+            gBufferImageInfo.imageLayout = VK_IMAGE_LAYOUT_GENERAL;
+
+            std::array<VkWriteDescriptorSet, 4> descriptorWrites{};
 
             descriptorWrites[0].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
             descriptorWrites[0].dstSet = descriptorSets[index];
@@ -330,7 +352,14 @@ namespace Engine
             descriptorWrites[2].descriptorCount = 1;
             descriptorWrites[2].pImageInfo = &raytracedImageInfo;
 
-            std::array<VkWriteDescriptorSet, 3> descriptorWrites2{};
+            descriptorWrites[3].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+            descriptorWrites[3].dstSet = descriptorSets[index];
+            descriptorWrites[3].dstBinding = 3;
+            descriptorWrites[3].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_IMAGE;
+            descriptorWrites[3].descriptorCount = 1;
+            descriptorWrites[3].pImageInfo = &gBufferImageInfo;
+
+            std::array<VkWriteDescriptorSet, 4> descriptorWrites2{};
 
             descriptorWrites2[0].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
             descriptorWrites2[0].dstSet = descriptorSets[descriptorCount + index];
@@ -353,16 +382,37 @@ namespace Engine
             descriptorWrites2[2].descriptorCount = 1;
             descriptorWrites2[2].pImageInfo = &raytracedImageInfo;
 
+            descriptorWrites2[3].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+            descriptorWrites2[3].dstSet = descriptorSets[descriptorCount + index];
+            descriptorWrites2[3].dstBinding = 3;
+            descriptorWrites2[3].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_IMAGE;
+            descriptorWrites2[3].descriptorCount = 1;
+            descriptorWrites2[3].pImageInfo = &gBufferImageInfo;
+
             vkUpdateDescriptorSets(device, static_cast<uint32_t>(descriptorWrites.size()), descriptorWrites.data(), 0, nullptr);
             vkUpdateDescriptorSets(device, static_cast<uint32_t>(descriptorWrites2.size()), descriptorWrites2.data(), 0, nullptr);
         }
 
         void updateRayTracingDescriptorSet()
         {
+            // Dynamic resolution traces into the trace image and upscales into the ray tracing image, the hybrid mode shades the full G-buffer
+            bool scaledTrace = useDynamicResolution && !useHybridRendering;
             VkDescriptorImageInfo imageInfo{};
-            imageInfo.imageView = raytracingImageView;
+            imageInfo.imageView = scaledTrace ? raytracingTraceImageView : raytracingImageView;
             imageInfo.imageLayout = VK_IMAGE_LAYOUT_GENERAL;
 
+            VkDescriptorImageInfo upscaledImageInfo{};
+            upscaledImageInfo.imageView = scaledTrace ? raytracingImageView : raytracingTraceImageView;
+            upscaledImageInfo.imageLayout = VK_IMAGE_LAYOUT_GENERAL;
+
+            VkDescriptorImageInfo shadowVisibilityImageInfo{};
+            shadowVisibilityImageInfo.imageView = shadowVisibilityImageView;
+            shadowVisibilityImageInfo.imageLayout = VK_IMAGE_LAYOUT_GENERAL;
+
+            VkDescriptorImageInfo gBufferImageInfo{};
+            gBufferImageInfo.imageView = gBufferImageView;
+            gBufferImageInfo.imageLayout = VK_IMAGE_LAYOUT_GENERAL;
+
             VkDescriptorBufferInfo cameraBufferInfo{};
             cameraBufferInfo.buffer = cameraBuffer;
             cameraBufferInfo.offset = 0;
@@ -371,7 +421,7 @@ namespace Engine
             VkDescriptorBufferInfo bvhBufferInfo{};
             bvhBufferInfo.buffer = bvhBuffer;
             bvhBufferInfo.offset = 0;
-            bvhBufferInfo.range = sizeof(uint32_t) + bvhNodes.size() * sizeof(BVHInstance); // VK_WHOLE_SIZE
+            bvhBufferInfo.range = VK_WHOLE_SIZE; // Model BVHs followed by the TLAS, which changes size with the instances
 
             VkDescriptorBufferInfo triangleBufferInfo{};
             triangleBufferInfo.buffer = triangleBuffer;
@@ -388,7 +438,69 @@ namespace Engine
             lightInstancesBufferInfo.offset = 0;
             lightInstancesBufferInfo.range = VK_WHOLE_SIZE;
 
-            std::array<VkWriteDescriptorSet, 6> descriptorWrites;
+            VkDescriptorBufferInfo wideBvhBufferInfo{};
+            wideBvhBufferInfo.buffer = wideBvhBuffer;
+            wideBvhBufferInfo.offset = 0;
+            wideBvhBufferInfo.range = VK_WHOLE_SIZE;
+
+            VkDescriptorBufferInfo compactBvhBufferInfo{};
+            compactBvhBufferInfo.buffer = compactBvhBuffer;
+            compactBvhBufferInfo.offset = 0;
+            compactBvhBufferInfo.range = VK_WHOLE_SIZE;
+
+            VkDescriptorBufferInfo positionBufferInfo{};
+            positionBufferInfo.buffer = positionBuffer;
+            positionBufferInfo.offset = 0;
+            positionBufferInfo.range = VK_WHOLE_SIZE;
+
+            VkDescriptorBufferInfo triangleIndexBufferInfo{};
+            triangleIndexBufferInfo.buffer = triangleIndexBuffer;
+            triangleIndexBufferInfo.offset = 0;
+            triangleIndexBufferInfo.range = VK_WHOLE_SIZE;
+
+            VkDescriptorBufferInfo rayTriangleBufferInfo{};
+            rayTriangleBufferInfo.buffer = rayTriangleBuffer;
+            rayTriangleBufferInfo.offset = 0;
+            rayTriangleBufferInfo.range = VK_WHOLE_SIZE;
+
+            VkDescriptorBufferInfo traversalCounterBufferInfo{};
+            traversalCounterBufferInfo.buffer = traversalCounterBuffer;
+            traversalCounterBufferInfo.offset = 0;
+            traversalCounterBufferInfo.range = VK_WHOLE_SIZE;
+
+            // Each frame in flight adds to its own totals, so the CPU can read them after that frame's fence
+            VkDescriptorBufferInfo traversalTotalsBufferInfo{};
+            traversalTotalsBufferInfo.buffer = traversalTotalsBuffer;
+            traversalTotalsBufferInfo.offset = traversalTotalsStride * currentFrame;
+            traversalTotalsBufferInfo.range = sizeof(TraversalTotals);
+
+            // Wavefront state and the extend, hit, shadow and binned shadow queues, shared by both frames like the image
+            VkBuffer wavefrontBuffers[5] = { wavefrontStateBuffer, wavefrontRayQueueBuffer, wavefrontHitQueueBuffer, wavefrontShadowQueueBuffer, wavefrontBinnedShadowQueueBuffer };
+            VkDescriptorBufferInfo wavefrontBufferInfos[5]{};
+            for (int i = 0; i < 5; ++i)
+            {
+                wavefrontBufferInfos[i].buffer = wavefrontBuffers[i];
+                wavefrontBufferInfos[i].offset = 0;
+                wavefrontBufferInfos[i].range = VK_WHOLE_SIZE;
+            }
+
+            // Shadow denoiser surfaces, history and filter, the frame index picks the slots
+            VkBuffer denoiseBuffers[3] = { denoiseSurfaceBuffer, shadowHistoryBuffer, shadowFilterBuffer };
+            VkDescriptorBufferInfo denoiseBufferInfos[3]{};
+            for (int i = 0; i < 3; ++i)
+            {
+                denoiseBufferInfos[i].buffer = denoiseBuffers[i];
+                denoiseBufferInfos[i].offset = 0;
+                denoiseBufferInfos[i].range = VK_WHOLE_SIZE;
+            }
+
+            // Progressive accumulation, shared by both frames like the image
+            VkDescriptorBufferInfo accumulationBufferInfo{};
+            accumulationBufferInfo.buffer = accumulationBuffer;
+            accumulationBufferInfo.offset = 0;
+            accumulationBufferInfo.range = VK_WHOLE_SIZE;
+
+            std::array<VkWriteDescriptorSet, 25> descriptorWrites;
             {
                 // Binding 0: storage image (output target)
                 {
@@ -449,6 +561,138 @@ namespace Engine
                     descriptorWrites[5].descriptorCount = 1;
                     descriptorWrites[5].pBufferInfo = &lightInstancesBufferInfo;
                 }
+
+                // Binding 6: wide BVH nodes buffer
+                {
+                    descriptorWrites[6] = { VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET };
+                    descriptorWrites[6].dstSet = rayTracingDescriptorSet[currentFrame];
+                    descriptorWrites[6].dstBinding = 6;
+                    descriptorWrites[6].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+                    descriptorWrites[6].descriptorCount = 1;
+                    descriptorWrites[6].pBufferInfo = &wideBvhBufferInfo;
+                }
+
+                // Binding 7: compact BVH nodes buffer
+                {
+                    descriptorWrites[7] = { VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET };
+                    descriptorWrites[7].dstSet = rayTracingDescriptorSet[currentFrame];
+                    descriptorWrites[7].dstBinding = 7;
+                    descriptorWrites[7].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+                    descriptorWrites[7].descriptorCount = 1;
+                    descriptorWrites[7].pBufferInfo = &compactBvhBufferInfo;
+                }
+
+                // Binding 8: packed positions buffer
+                {
+                    descriptorWrites[8] = { VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET };
+                    descriptorWrites[8].dstSet = rayTracingDescriptorSet[currentFrame];
+                    descriptorWrites[8].dstBinding = 8;
+                    descriptorWrites[8].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+                    descriptorWrites[8].descriptorCount = 1;
+                    descriptorWrites[8].pBufferInfo = &positionBufferInfo;
+                }
+
+                // Binding 9: triangle indices buffer
+                {
+                    descriptorWrites[9] = { VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET };
+                    descriptorWrites[9].dstSet = rayTracingDescriptorSet[currentFrame];
+                    descriptorWrites[9].dstBinding = 9;
+                    descriptorWrites[9].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+                    descriptorWrites[9].descriptorCount = 1;
+                    descriptorWrites[9].pBufferInfo = &triangleIndexBufferInfo;
+                }
+
+                // Binding 10: precomputed triangles buffer
+                {
+                    descriptorWrites[10] = { VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET };
+                    descriptorWrites[10].dstSet = rayTracingDescriptorSet[currentFrame];
+                    descriptorWrites[10].dstBinding = 10;
+                    descriptorWrites[10].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+                    descriptorWrites[10].descriptorCount = 1;
+                    descriptorWrites[10].pBufferInfo = &rayTriangleBufferInfo;
+                }
+
+                // Binding 11: per pixel traversal counters buffer
+                {
+                    descriptorWrites[11] = { VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET };
+                    descriptorWrites[11].dstSet = rayTracingDescriptorSet[currentFrame];
+                    descriptorWrites[11].dstBinding = 11;
+                    descriptorWrites[11].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+                    descriptorWrites[11].descriptorCount = 1;
+                    descriptorWrites[11].pBufferInfo = &traversalCounterBufferInfo;
+                }
+
+                // Binding 12: traversal totals buffer
+                {
+                    descriptorWrites[12] = { VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET };
+                    descriptorWrites[12].dstSet = rayTracingDescriptorSet[currentFrame];
+                    descriptorWrites[12].dstBinding = 12;
+                    descriptorWrites[12].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+                    descriptorWrites[12].descriptorCount = 1;
+                    descriptorWrites[12].pBufferInfo = &traversalTotalsBufferInfo;
+                }
+
+                // Bindings 13-17: wavefront state and queues
+                for (int i = 0; i < 5; ++i)
+                {
+                    descriptorWrites[13 + i] = { VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET };
+                    descriptorWrites[13 + i].dstSet = rayTracingDescriptorSet[currentFrame];
+                    descriptorWrites[13 + i].dstBinding = 13 + i;
+                    descriptorWrites[13 + i].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+                    descriptorWrites[13 + i].descriptorCount = 1;
+                    descriptorWrites[13 + i].pBufferInfo = &wavefrontBufferInfos[i];
+                }
+
+                // Bindings 18-20: shadow denoiser buffers
+                for (int i = 0; i < 3; ++i)
+                {
+                    descriptorWrites[18 + i] = { VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET };
+                    descriptorWrites[18 + i].dstSet = rayTracingDescriptorSet[currentFrame];
+                    descriptorWrites[18 + i].dstBinding = 18 + i;
+                    descriptorWrites[18 + i].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+                    descriptorWrites[18 + i].descriptorCount = 1;
+                    descriptorWrites[18 + i].pBufferInfo = &denoiseBufferInfos[i];
+                }
+
+                // Binding 21: progressive accumulation
+                {
+                    descriptorWrites[21] = { VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET };
+                    descriptorWrites[21].dstSet = rayTracingDescriptorSet[currentFrame];
+                    descriptorWrites[21].dstBinding = 21;
+                    descriptorWrites[21].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+                    descriptorWrites[21].descriptorCount = 1;
+                    descriptorWrites[21].pBufferInfo = &accumulationBufferInfo;
+                }
+
+                // Binding 22: upscaled storage image
+                {
+                    descriptorWrites[22] = { VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET };
+                    descriptorWrites[22].dstSet = rayTracingDescriptorSet[currentFrame];
+                    descriptorWrites[22].dstBinding = 22;
+                    descriptorWrites[22].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_IMAGE;
+                    descriptorWrites[22].descriptorCount = 1;
+                    descriptorWrites[22].pImageInfo = &upscaledImageInfo;
+                }
+
+                // Binding 23: reduced resolution shadow visibility
+                {
+                    descriptorWrites[23] = { VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET };
+                    descriptorWrites[23].dstSet = rayTracingDescriptorSet[currentFrame];
+                    descriptorWrites[23].dstBinding = 23;
+                    descriptorWrites[23].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_IMAGE;
+                    descriptorWrites[23].descriptorCount = 1;
+                    descriptorWrites[23].pImageInfo = &shadowVisibilityImageInfo;
+                }
+
+                // Binding 24: hybrid mode G-buffer
+                {
+                    descriptorWrites[24] = { VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET };
+                    descriptorWrites[24].dstSet = rayTracingDescriptorSet[currentFrame];
+                    descriptorWrites[24].dstBinding = 24;
+                    descriptorWrites[24].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_IMAGE;
+                    descriptorWrites[24].descriptorCount = 1;
+                    descriptorWrites[24].pImageInfo = &gBufferImageInfo;
+                }
             }
 
             vkUpdateDescriptorSets(device, static_cast<uint32_t>(descriptorWrites.size()), descriptorWrites.data(), 0, nullptr);
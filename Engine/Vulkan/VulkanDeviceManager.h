@@ -45,7 +45,7 @@ namespace Engine
             VkPhysicalDeviceFeatures supportedFeatures;
             vkGetPhysicalDeviceFeatures(device, &supportedFeatures);
 
-            return indices.isComplete() && extensionsSupported && swapChainAdequate && supportedFeatures.samplerAnisotropy;
+            return indices.isComplete() && extensionsSupported && swapChainAdequate && supportedFeatures.samplerAnisotropy && supportedFeatures.shaderStorageImageExtendedFormats;
         }
 
 		void pickPhysicalDevice()
@@ -131,6 +131,7 @@ namespace Engine
             VkPhysicalDeviceFeatures deviceFeatures{};
             deviceFeatures.samplerAnisotropy = VK_TRUE;
 			deviceFeatures.fragmentStoresAndAtomics = VK_TRUE;
+            deviceFeatures.shaderStorageImageExtendedFormats = VK_TRUE; // r16f shadow visibility image
 
             VkDeviceCreateInfo createInfo{};
             createInfo.sType = VK_STRUCTURE_TYPE_DEVICE_CREATE_INFO;
@@ -45,6 +45,8 @@ inline VkRenderPass renderPass;
 inline VkDescriptorSetLayout descriptorSetLayout;
 inline VkPipelineLayout pipelineLayout;
 inline VkPipeline graphicsPipeline;
+inline VkPipeline depthPrePassPipeline; // Hybrid mode: depth only, drawn before gBufferPipeline
+inline VkPipeline gBufferPipeline;      // Hybrid mode: EQUAL depth test without depth writes, only the visible fragment writes the G-buffer
 
 inline VkCommandPool commandPool;
 
@@ -62,6 +64,12 @@ inline std::vector<VkDescriptorSet> descriptorSets;
 inline VkDescriptorSetLayout rayTracingDescriptorSetLayout[MAX_FRAMES_IN_FLIGHT];
 inline VkPipelineLayout rayTracingPipelineLayout;
 inline VkPipeline rayTracingPipeline;
+inline VkPipeline rayTracingInstrumentedPipeline; // Same shader with the INSTRUMENTATION specialization constant set
+inline VkPipeline rayTracingWavefrontPipelines[static_cast<int>(WavefrontStage::Count)]; // Same shader per WAVEFRONT_STAGE, the megakernel slot is unused
+inline VkPipeline rayTracingDenoisePipelines[static_cast<int>(DenoisePass::Count)]; // Same shader per DENOISE_PASS, the None slot is unused
+inline VkPipeline rayTracingUpscalePipeline; // Same shader with UPSCALE_PASS set
+inline VkPipeline rayTracingShadowResolutionPipelines[static_cast<int>(ShadowResolutionPass::Count)]; // Same shader per SHADOW_RESOLUTION_PASS, the None slot is unused
+inline VkPipeline rayTracingHybridPipeline; // Same shader with HYBRID_PASS set, shadow rays from the rasterized G-buffer
 
 inline VkDescriptorPool rayTracingDescriptorPool;
 inline VkDescriptorSet rayTracingDescriptorSet[MAX_FRAMES_IN_FLIGHT];
@@ -71,13 +79,32 @@ inline std::vector<VkCommandBuffer> rayTracingCommandBuffers;
 // Descriptor sets
 // Push constants
 const uint32_t integerByteSize = sizeof(int);
-const uint32_t computePushConstantCountInteger = 4; // Number of push constants you want to use
+const uint32_t computePushConstantCountInteger = 24; // Number of push constants you want to use
 
 // 1: raytracing image
 inline VkImage raytracingImage;
 inline VkDeviceMemory raytracingImageMemory;
 inline VkImageView raytracingImageView;
 
+// 1: trace image of dynamic resolution, swapped with the ray tracing image at binding 0 while the trace is scaled down,
+// the upscale pass then fills the ray tracing image from it
+inline VkImage raytracingTraceImage;
+inline VkDeviceMemory raytracingTraceImageMemory;
+inline VkImageView raytracingTraceImageView;
+float dynamicResolutionScale = 1.0f; // Trace resolution per axis as a fraction of the swap chain
+double dynamicResolutionFrameMs = 0.0; // Smoothed GPU ray tracing time the scale reacts to
+VkExtent2D lastTraceExtent{};
+
+// 1: reduced resolution shadow visibility, one texel per shadow block
+inline VkImage shadowVisibilityImage;
+inline VkDeviceMemory shadowVisibilityImageMemory;
+inline VkImageView shadowVisibilityImageView;
+
+// 1: G-buffer of the hybrid mode, world space normal and depth per pixel written by the rasterizer
+inline VkImage gBufferImage;
+inline VkDeviceMemory gBufferImageMemory;
+inline VkImageView gBufferImageView;
+
 // 2: camera data
 CameraUBO cameraUBO{};
 VkBuffer cameraBuffer;
@@ -85,6 +112,15 @@ VkDeviceMemory cameraBufferMemory;
 
 // 3: BVH data
 std::vector<BVHNode> bvhNodes;
+// Global buffer ranges rewritten by GameModel::refitBVH, uploaded and cleared every frame
+struct BVHDirtyRange
+{
+    size_t nodeOffset, nodeCount;
+    size_t triangleOffset, triangleCount;
+    size_t wideNodeOffset, wideNodeCount;
+    size_t positionOffset, positionCount; // The triangle index range follows the triangle range
+};
+std::vector<BVHDirtyRange> bvhDirtyRanges;
 VkBuffer bvhBuffer;
 VkDeviceMemory bvhBufferMemory;
 // Staging buffer
@@ -107,8 +143,9 @@ VkDeviceMemory instanceBufferMemory;
 VkBuffer instanceStagingBuffer;
 VkDeviceMemory instanceStagingBufferMemory;
 
-// 6: light sources
+// 6: light sources, with the alias table of the light sampling filled in and rebuilt only when a light changes
 std::vector<LightInstance> lightInstances;
+std::vector<LightInstance> lightSourceCache; // Lights as last uploaded, before the alias table
 VkBuffer lightBuffer;
 VkDeviceMemory lightBufferMemory;
 // Staging buffer
@@ -117,6 +154,79 @@ VkDeviceMemory lightStagingBufferMemory;
 
 // 7: texture data
 std::vector<VkDescriptorSet> textures;
+
+// 8: wide BVH data
+std::vector<WideBVHNode> bvhWideNodes;
+VkBuffer wideBvhBuffer;
+VkDeviceMemory wideBvhBufferMemory;
+
+// 9: compact BVH data, index for index the same nodes as bvhNodes
+std::vector<CompactBVHNode> bvhCompactNodes;
+VkBuffer compactBvhBuffer;
+VkDeviceMemory compactBvhBufferMemory;
+
+// 10: indexed triangles, packed vertex positions and three global position indices per bvhTriangles entry
+std::vector<glm::vec3> bvhPositions;
+VkBuffer positionBuffer;
+VkDeviceMemory positionBufferMemory;
+std::vector<uint32_t> bvhTriangleIndices;
+VkBuffer triangleIndexBuffer;
+VkDeviceMemory triangleIndexBufferMemory;
+
+// 11: precomputed triangles, one RayTriangle per bvhTriangles entry
+std::vector<RayTriangle> bvhRayTriangles;
+VkBuffer rayTriangleBuffer;
+VkDeviceMemory rayTriangleBufferMemory;
+
+// 12: traversal counters of the instrumented pipeline, a uvec4 per pixel and one TraversalTotals per frame in flight
+VkBuffer traversalCounterBuffer;
+VkDeviceMemory traversalCounterBufferMemory;
+VkBuffer traversalTotalsBuffer;
+VkDeviceMemory traversalTotalsBufferMemory;
+const VkDeviceSize traversalTotalsStride = 256; // Above every minStorageBufferOffsetAlignment
+TraversalTotals traversalTotals{}; // Totals of the last finished instrumented frame, taken by the performance metrics
+bool traversalTotalsPending[MAX_FRAMES_IN_FLIGHT] = {}; // The frame in this slot was instrumented and is not read yet
+
+// 13: wavefront path tracing, queue heads, ray bins and a visibility count per pixel, then the ray, hit, shadow ray and binned shadow ray queues
+VkBuffer wavefrontStateBuffer;
+VkDeviceMemory wavefrontStateBufferMemory;
+VkBuffer wavefrontRayQueueBuffer;
+VkDeviceMemory wavefrontRayQueueBufferMemory;
+VkBuffer wavefrontHitQueueBuffer;
+VkDeviceMemory wavefrontHitQueueBufferMemory;
+VkBuffer wavefrontShadowQueueBuffer;
+VkDeviceMemory wavefrontShadowQueueBufferMemory;
+VkBuffer wavefrontBinnedShadowQueueBuffer;
+VkDeviceMemory wavefrontBinnedShadowQueueBufferMemory;
+const int wavefrontQueueCount = 3; // Extend, hit and shadow queues, in this order
+const uint32_t wavefrontShadowRaysPerHit = 3; // SHADOW_SAMPLES in compute.glsl
+const uint32_t wavefrontRayBinCount = 4096; // RAY_BIN_COUNT in compute.glsl
+const uint32_t swizzleBlockTiles = 8; // SWIZZLE_BLOCK_TILES in compute.glsl, swizzled dispatches are padded to multiples of it
+
+// 14: shadow denoiser, two slots per pixel each of surfaces, visibility history and filter ping pong
+VkBuffer denoiseSurfaceBuffer;
+VkDeviceMemory denoiseSurfaceBufferMemory;
+VkBuffer shadowHistoryBuffer;
+VkDeviceMemory shadowHistoryBufferMemory;
+VkBuffer shadowFilterBuffer;
+VkDeviceMemory shadowFilterBufferMemory;
+const VkDeviceSize denoiseSurfaceSize = 16; // DenoiseSurface in compute.glsl
+const VkDeviceSize shadowHistorySize = 16;  // vec4 of visibility, moments and history length
+const VkDeviceSize shadowFilterSize = 8;    // vec2 of visibility and variance
+CameraUBO previousCameraUBO{}; // Camera of the last ray traced frame
+bool hasPreviousCamera = false;
+uint32_t rayTracingFrameIndex = 0;
+bool shadowHistoryValid = false; // Cleared whenever the denoiser was off, the next denoised frame starts a new history
+
+// 15: progressive refinement, running average per pixel
+VkBuffer accumulationBuffer;
+VkDeviceMemory accumulationBufferMemory;
+const VkDeviceSize accumulationSize = 16; // vec4 in compute.glsl
+int progressiveSampleCount = 0; // Samples in the accumulation, reset whenever the camera or an instance moves
+double progressiveResetTime = 0.0; // glfwGetTime of the last reset
+double progressiveReportSeconds = -1.0; // Time to progressiveReportSamples, negative until reached
+bool progressiveWasActive = false;
+std::vector<BVHInstance> progressiveInstances; // Instances of the last upload, to detect moves
 #pragma endregion
 
 #pragma region Compositing
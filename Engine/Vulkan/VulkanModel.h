@@ -1,116 +1,28 @@
 #include "VulkanUtils.h"
 #include "../Core/Globals.h"
 #include "../Core/Game/GameModel.h"
+#include "../Core/Game/MeshLoader.h"
+#include "../Core/Raytracing/RayPacket.h"
+#include "../Core/Systems/MappedFile.h"
 
 namespace Engine
 {
-	struct MeshHeader {
-		uint32_t vertexCount;
-		uint32_t indexCount;
-		// Add material, AABB, LODs, etc. if needed
+	struct BVHCacheHeader {
+		uint32_t magic;
+		uint32_t version;
+		uint64_t key; // GameModel::computeBVHCacheKey
+		uint32_t nodeCount;
+		uint32_t triangleCount;
+		int32_t rootIndex;
+		uint32_t pad0;
 	};
 
+	inline constexpr uint32_t bvhCacheMagic = 0x48435642; // "BVCH"
+	inline constexpr uint32_t bvhCacheVersion = 3; // Bump whenever a builder changes its output
+
 	class VulkanModel
 	{
 	private:
-		void loadModel(std::string modelPath, std::vector<Vertex>& vertices, std::vector<uint32_t>& indices, bool debug = true)
-		{
-			tinyobj::attrib_t attrib;
-			std::vector<tinyobj::shape_t> shapes;
-			std::vector<tinyobj::material_t> materials;
-			std::string warn, err;
-
-			auto start = std::chrono::high_resolution_clock::now();
-
-			if (!tinyobj::LoadObj(&attrib, &shapes, nullptr, &warn, &err, modelPath.c_str()))
-			{
-				throw std::runtime_error(warn + err);
-			}
-
-			auto end1 = std::chrono::high_resolution_clock::now();
-			auto duration1 = std::chrono::duration_cast<std::chrono::milliseconds>(end1 - start).count();
-
-			std::unordered_map<Vertex, uint32_t> uniqueVertices{};
-
-			for (const auto& shape : shapes)
-			{
-				for (const auto& index : shape.mesh.indices)
-				{
-					Vertex vertex{};
-
-					vertex.pos =
-					{
-						attrib.vertices[3 * index.vertex_index + 0],
-						attrib.vertices[3 * index.vertex_index + 1],
-						attrib.vertices[3 * index.vertex_index + 2]
-					};
-
-					// Texture coordinates
-					if (index.texcoord_index >= 0 && attrib.texcoords.size() > 0)
-					{
-						vertex.texCoord =
-						{
-							attrib.texcoords[2 * index.texcoord_index + 0],
-							1.0f - attrib.texcoords[2 * index.texcoord_index + 1]
-						};
-					}
-					else
-					{
-						vertex.texCoord = { 0.0f, 0.0f }; // Default UV
-					}
-
-					// Normal coordinates
-					if (index.normal_index >= 0) // Check if normals are available
-					{
-						vertex.normal =
-						{
-							attrib.normals[3 * index.normal_index + 0],
-							attrib.normals[3 * index.normal_index + 1],
-							attrib.normals[3 * index.normal_index + 2]
-						};
-					}
-					else
-					{
-						vertex.normal = { 0.0f, 0.0f, 0.0f }; // Default normal if not available
-					}
-
-					vertex.color = { 1.0f, 1.0f, 1.0f };
-
-					if (uniqueVertices.count(vertex) == 0)
-					{
-						uniqueVertices[vertex] = static_cast<uint32_t>(vertices.size());
-						vertices.push_back(vertex);
-					}
-
-					indices.push_back(uniqueVertices[vertex]);
-				}
-			}
-
-			// Step 1: Compute AABB
-			glm::vec3 minPos = glm::vec3(FLT_MAX);
-			glm::vec3 maxPos = glm::vec3(-FLT_MAX);
-
-			for (const auto& v : vertices) {
-				minPos = glm::min(minPos, v.pos);
-				maxPos = glm::max(maxPos, v.pos);
-			}
-
-			// Step 2: Center and scale
-			glm::vec3 center = (minPos + maxPos) * 0.5f;
-			glm::vec3 extents = maxPos - minPos;
-			float maxExtent = std::max(extents.x, std::max(extents.y, extents.z));
-			float scale = 1.0f / maxExtent * 0.5f;
-
-			for (auto& v : vertices) {
-				v.pos = (v.pos - center) * scale;
-			}
-
-			auto end2 = std::chrono::high_resolution_clock::now();
-			auto duration2 = std::chrono::duration_cast<std::chrono::milliseconds>(end2 - start).count();
-
-			debug && printf("1: %lld\n2: %lld", duration1, duration2);
-		};
-
 		void processShapeParallel(const tinyobj::attrib_t& attrib, const tinyobj::shape_t& shape, std::vector<Vertex>& globalVertices, std::vector<uint32_t>& globalIndices)
 		{
 			const size_t threadCount = std::thread::hardware_concurrency();
@@ -212,47 +124,78 @@ namespace Engine
 			}
 		}
 
-		void saveMeshBinary(const std::string& path, const std::vector<Vertex>& vertices, const std::vector<uint32_t>& indices)
+		std::string bvhCachePath(const std::string& objName, const GameModel& gameModel)
+		{
+			return "Resources/Cache/BVH/" + objName + "." + bvhBuilderName(gameModel.bvhBuilder) + ".bvh";
+		}
+
+		void saveBVHBinary(const std::string& path, const GameModel& gameModel, uint64_t key)
 		{
+			std::filesystem::create_directories(std::filesystem::path(path).parent_path());
 			std::ofstream out(path, std::ios::binary);
 			if (!out) throw std::runtime_error("Failed to open file for writing");
 
-			MeshHeader header{};
-			header.vertexCount = static_cast<uint32_t>(vertices.size());
-			header.indexCount = static_cast<uint32_t>(indices.size());
+			BVHCacheHeader header{};
+			header.magic = bvhCacheMagic;
+			header.version = bvhCacheVersion;
+			header.key = key;
+			header.nodeCount = static_cast<uint32_t>(gameModel.nodes.size());
+			header.triangleCount = static_cast<uint32_t>(gameModel.triangles.size());
+			header.rootIndex = gameModel.localRoot;
+
+			// Nodes already point into the global buffer, store them with local links again
+			int nodeOffset = gameModel.bvhRootNodeIndex - gameModel.localRoot;
+			std::vector<BVHNode> localNodes = gameModel.nodes;
+			for (BVHNode& node : localNodes)
+			{
+				if (node.left != -1) node.left -= nodeOffset;
+				if (node.right != -1) node.right -= nodeOffset;
+			}
 
 			out.write(reinterpret_cast<const char*>(&header), sizeof(header));
-			out.write(reinterpret_cast<const char*>(vertices.data()), vertices.size() * sizeof(Vertex));
-			out.write(reinterpret_cast<const char*>(indices.data()), indices.size() * sizeof(uint32_t));
+			out.write(reinterpret_cast<const char*>(localNodes.data()), localNodes.size() * sizeof(BVHNode));
+			out.write(reinterpret_cast<const char*>(gameModel.triangles.data()), gameModel.triangles.size() * sizeof(Triangle));
 		}
 
-		void loadMeshBinary(const std::string& path, std::vector<Vertex>& vertices, std::vector<uint32_t>& indices)
+		// Maps the cache file and hands its arrays to the model, which copies them, false when missing or stale
+		bool loadBVHBinary(const std::string& path, GameModel& gameModel, uint64_t key)
 		{
-			std::ifstream in(path, std::ios::binary);
-			if (!in) throw std::runtime_error("Failed to open file for reading");
+			MappedFile file;
+			if (!file.open(path) || file.size() < sizeof(BVHCacheHeader)) return false;
 
-			MeshHeader header;
-			in.read(reinterpret_cast<char*>(&header), sizeof(header));
+			const BVHCacheHeader* header = reinterpret_cast<const BVHCacheHeader*>(file.data());
+			if (header->magic != bvhCacheMagic || header->version != bvhCacheVersion || header->key != key) return false;
 
-			vertices.resize(header.vertexCount);
-			indices.resize(header.indexCount);
+			size_t nodesBytes = size_t(header->nodeCount) * sizeof(BVHNode);
+			size_t trianglesBytes = size_t(header->triangleCount) * sizeof(Triangle);
+			if (file.size() != sizeof(BVHCacheHeader) + nodesBytes + trianglesBytes) return false;
+			if (header->rootIndex < 0 || header->rootIndex >= static_cast<int32_t>(header->nodeCount)) return false;
 
-			in.read(reinterpret_cast<char*>(vertices.data()), header.vertexCount * sizeof(Vertex));
-			in.read(reinterpret_cast<char*>(indices.data()), header.indexCount * sizeof(uint32_t));
+			const BVHNode* nodes = reinterpret_cast<const BVHNode*>(file.data() + sizeof(BVHCacheHeader));
+			const Triangle* triangles = reinterpret_cast<const Triangle*>(file.data() + sizeof(BVHCacheHeader) + nodesBytes);
+			gameModel.createCustomBVHFromCache(nodes, header->nodeCount, triangles, header->triangleCount, header->rootIndex);
+			return true;
 		}
 
-		void loadModelWithCache(const std::string& objPath, const std::string& objName, std::vector<Vertex>& vertices, std::vector<uint32_t>& indices, bool debug = false)
+		void createCustomBVHWithCache(GameModel& gameModel, const std::string& objName)
 		{
-			std::string cachedPath = "Resources/Cache/Models/" + objName + ".bin";
+			if (!useBVHCache)
+			{
+				gameModel.createCustomBVH(gameManager.models.size());
+				return;
+			}
+
+			uint64_t key = gameModel.computeBVHCacheKey();
+			std::string cachedPath = bvhCachePath(objName, gameModel);
 
-			if (std::filesystem::exists(cachedPath)) {
-				loadMeshBinary(cachedPath, vertices, indices);
+			if (loadBVHBinary(cachedPath, gameModel, key))
+			{
+				std::cout << "    BVH loaded from cache\n";
 				return;
 			}
 
-			// Fallback to OBJ load
-			loadModel(objPath, vertices, indices, debug);
-			saveMeshBinary(cachedPath, vertices, indices);
+			gameModel.createCustomBVH(gameManager.models.size());
+			saveBVHBinary(cachedPath, gameModel, key);
 		}
 
 		void loadModelMultiThreadedV2(std::string modelPath, std::vector<Vertex>& vertices, std::vector<uint32_t>& indices, bool debug = false)
@@ -342,7 +285,7 @@ namespace Engine
 			//loadModel(modelPath, gameModel.vertices, gameModel.indices);
 			//loadModelMultiThreaded(modelPath, gameModel.vertices, gameModel.indices);
 			//loadModelMultiThreadedV2(modelPath, gameModel.vertices, gameModel.indices);
-			loadModelWithCache(modelPath, modelName, gameModel.vertices, gameModel.indices);
+			MeshLoader::loadModelWithCache(modelPath, modelName, gameModel.vertices, gameModel.indices);
 			createVertexBuffer(gameModel.vertices, gameModel.vertexBuffer, gameModel.vertexBufferMemory);
 			createIndexBuffer(gameModel.indices, gameModel.indexBuffer, gameModel.indexBufferMemory);
 
@@ -354,7 +297,52 @@ namespace Engine
 			std::cout << "\nModel: " << modelName << "\n    Disk load time: " << duration << " ms\n";
 			//printf("Model: %d, load time: %d ms.\n", modelName, duration);
 
-			gameModel.createCustomBVH(gameManager.models.size());
+			if (showBVHBuilderReport)
+			{
+				gameModel.reportBVHBuilders();
+			}
+
+			createCustomBVHWithCache(gameModel, modelName);
+
+			if (showBVHLayoutReport)
+			{
+				gameModel.reportBVHLayout();
+			}
+
+			if (showTriangleFormatReport)
+			{
+				gameModel.reportTriangleFormats();
+			}
+
+			if (writeBVHStatistics)
+			{
+				gameModel.writeBVHStatistics(bvhStatisticsDirectory);
+			}
+
+			if (showWideBVHReport)
+			{
+				gameModel.reportWideBVH();
+			}
+
+			if (showBVHRefitReport)
+			{
+				gameModel.reportBVHRefit();
+			}
+
+			if (deformModelsAmplitude > 0.0f && gameModel.localRoot >= 0)
+			{
+				const BVHNode& root = gameModel.nodes[gameModel.localRoot];
+				glm::vec3 size = root.boundMax - root.boundMin;
+				gameModel.deformation = [size](float seconds, std::vector<glm::vec3>& positions)
+				{
+					GameModel::applyWave(positions, size, deformModelsAmplitude * std::sin(seconds));
+				};
+			}
+
+			if (showRayPacketBenchmark)
+			{
+				RayPacketTraversal::runBenchmark(bvhNodes, gameModel.bvhRootNodeIndex, bvhTriangles, gameModel.bvhTriangleIndex, modelName);
+			}
 
 			//GameModel gameModel(vertices, indices, vertexBuffer, vertexBufferMemory, indexBuffer, indexBufferMemory);
 			gameManager.models[modelName] = gameModel;
@@ -86,7 +86,14 @@ namespace Engine
             samplerLayoutBinding2.pImmutableSamplers = nullptr;
             samplerLayoutBinding2.stageFlags = VK_SHADER_STAGE_ALL_GRAPHICS;
 
-            std::array<VkDescriptorSetLayoutBinding, 3> bindings = { uboLayoutBinding, samplerLayoutBinding, samplerLayoutBinding2 };
+            VkDescriptorSetLayoutBinding gBufferLayoutBinding{};
+            gBufferLayoutBinding.binding = 3;
+            gBufferLayoutBinding.descriptorCount = 1;
+            gBufferLayoutBinding.descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_IMAGE;
+            gBufferLayoutBinding.pImmutableSamplers = nullptr;
+            gBufferLayoutBinding.stageFlags = VK_SHADER_STAGE_ALL_GRAPHICS;
+
+            std::array<VkDescriptorSetLayoutBinding, 4> bindings = { uboLayoutBinding, samplerLayoutBinding, samplerLayoutBinding2, gBufferLayoutBinding };
             VkDescriptorSetLayoutCreateInfo layoutInfo{};
             layoutInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
             layoutInfo.bindingCount = static_cast<uint32_t>(bindings.size());
@@ -220,12 +227,38 @@ namespace Engine
                 throw std::runtime_error("failed to create graphics pipeline!");
             }
 
+            // Hybrid mode depth pre-pass: vertex shader only, it writes the nearest depth of every pixel
+            pipelineInfo.stageCount = 1;
+            colorBlendAttachment.colorWriteMask = 0;
+            if (vkCreateGraphicsPipelines(device, VK_NULL_HANDLE, 1, &pipelineInfo, nullptr, &depthPrePassPipeline) != VK_SUCCESS)
+            {
+                throw std::runtime_error("failed to create depth pre-pass pipeline!");
+            }
+
+            // Hybrid mode main pass: only the fragment at the pre-pass depth passes and stores into the G-buffer
+            pipelineInfo.stageCount = 2;
+            colorBlendAttachment.colorWriteMask = VK_COLOR_COMPONENT_R_BIT | VK_COLOR_COMPONENT_G_BIT | VK_COLOR_COMPONENT_B_BIT | VK_COLOR_COMPONENT_A_BIT;
+            depthStencil.depthWriteEnable = VK_FALSE;
+            depthStencil.depthCompareOp = VK_COMPARE_OP_EQUAL;
+            if (vkCreateGraphicsPipelines(device, VK_NULL_HANDLE, 1, &pipelineInfo, nullptr, &gBufferPipeline) != VK_SUCCESS)
+            {
+                throw std::runtime_error("failed to create G-buffer pipeline!");
+            }
+
             vkDestroyShaderModule(device, fragShaderModule, nullptr);
             vkDestroyShaderModule(device, vertShaderModule, nullptr);
         }
 
         #pragma region Compute raytracing
         void createRayTracingImageBuffer()
+        {
+            createRayTracingStorageImage(raytracingImage, raytracingImageMemory, VK_FORMAT_R32G32B32A32_SFLOAT);
+            createRayTracingStorageImage(raytracingTraceImage, raytracingTraceImageMemory, VK_FORMAT_R32G32B32A32_SFLOAT);
+            createRayTracingStorageImage(shadowVisibilityImage, shadowVisibilityImageMemory, VK_FORMAT_R16_SFLOAT);
+            createRayTracingStorageImage(gBufferImage, gBufferImageMemory, VK_FORMAT_R32G32B32A32_SFLOAT);
+        }
+
+        void createRayTracingStorageImage(VkImage& image, VkDeviceMemory& imageMemory, VkFormat format)
         {
             VkImageCreateInfo imageInfo{};
             imageInfo.sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO;
@@ -235,22 +268,22 @@ namespace Engine
             imageInfo.extent.depth = 1;
             imageInfo.mipLevels = 1;
             imageInfo.arrayLayers = 1;
-            imageInfo.format = VK_FORMAT_R32G32B32A32_SFLOAT; // or VK_FORMAT_R8G8B8A8_UNORM
+            imageInfo.format = format;
             imageInfo.tiling = VK_IMAGE_TILING_OPTIMAL;
-            imageInfo.usage = VK_IMAGE_USAGE_STORAGE_BIT | VK_IMAGE_USAGE_SAMPLED_BIT | VK_IMAGE_USAGE_TRANSFER_SRC_BIT;
+            imageInfo.usage = VK_IMAGE_USAGE_STORAGE_BIT | VK_IMAGE_USAGE_SAMPLED_BIT | VK_IMAGE_USAGE_TRANSFER_SRC_BIT | VK_IMAGE_USAGE_TRANSFER_DST_BIT;
             imageInfo.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
             imageInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
             imageInfo.samples = VK_SAMPLE_COUNT_1_BIT;
             imageInfo.flags = 0; // Optional, but safe
 
-            auto result = vkCreateImage(device, &imageInfo, nullptr, &raytracingImage);
+            auto result = vkCreateImage(device, &imageInfo, nullptr, &image);
             if (result != VK_SUCCESS)
             {
                 throw std::runtime_error("failed to create image!");
             }
 
             VkMemoryRequirements memRequirements;
-            vkGetImageMemoryRequirements(device, raytracingImage, &memRequirements);
+            vkGetImageMemoryRequirements(device, image, &memRequirements);
 
             // 2. Allocate memory
             VkMemoryAllocateInfo allocInfo{};
@@ -261,28 +294,36 @@ namespace Engine
                 VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT
             );
 
-            if (vkAllocateMemory(device, &allocInfo, nullptr, &raytracingImageMemory) != VK_SUCCESS) {
+            if (vkAllocateMemory(device, &allocInfo, nullptr, &imageMemory) != VK_SUCCESS) {
                 throw std::runtime_error("failed to allocate ray tracing image memory!");
             }
 
             // 3. Bind memory to the image
-            vkBindImageMemory(device, raytracingImage, raytracingImageMemory, 0);
+            vkBindImageMemory(device, image, imageMemory, 0);
         }
 
         void createRayTracingImageView()
+        {
+            createRayTracingStorageImageView(raytracingImage, raytracingImageView, VK_FORMAT_R32G32B32A32_SFLOAT);
+            createRayTracingStorageImageView(raytracingTraceImage, raytracingTraceImageView, VK_FORMAT_R32G32B32A32_SFLOAT);
+            createRayTracingStorageImageView(shadowVisibilityImage, shadowVisibilityImageView, VK_FORMAT_R16_SFLOAT);
+            createRayTracingStorageImageView(gBufferImage, gBufferImageView, VK_FORMAT_R32G32B32A32_SFLOAT);
+        }
+
+        void createRayTracingStorageImageView(VkImage image, VkImageView& imageView, VkFormat format)
         {
             VkImageViewCreateInfo viewInfo{};
             viewInfo.sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO;
-            viewInfo.image = raytracingImage;
+            viewInfo.image = image;
             viewInfo.viewType = VK_IMAGE_VIEW_TYPE_2D;
-            viewInfo.format = VK_FORMAT_R32G32B32A32_SFLOAT; // Same format you used for the image
+            viewInfo.format = format; // Same format you used for the image
             viewInfo.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
             viewInfo.subresourceRange.baseMipLevel = 0;
             viewInfo.subresourceRange.levelCount = 1;
             viewInfo.subresourceRange.baseArrayLayer = 0;
             viewInfo.subresourceRange.layerCount = 1;
 
-            if (vkCreateImageView(device, &viewInfo, nullptr, &raytracingImageView) != VK_SUCCESS)
+            if (vkCreateImageView(device, &viewInfo, nullptr, &imageView) != VK_SUCCESS)
             {
                 throw std::runtime_error("failed to create ray tracing image view!");
             }
@@ -292,7 +333,7 @@ namespace Engine
         {
             for (int i = 0; i < MAX_FRAMES_IN_FLIGHT; ++i)
             {
-                std::array<VkDescriptorSetLayoutBinding, 6> bindings{};
+                std::array<VkDescriptorSetLayoutBinding, 25> bindings{};
 
                 // Binding 0: Storage Image
                 bindings[0].binding = 0;
@@ -336,6 +377,88 @@ namespace Engine
                 bindings[5].stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
                 bindings[5].pImmutableSamplers = nullptr;
 
+                // Binding 6: Wide BVH buffer
+                bindings[6].binding = 6;
+                bindings[6].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+                bindings[6].descriptorCount = 1;
+                bindings[6].stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+                bindings[6].pImmutableSamplers = nullptr;
+
+                // Binding 7: Compact BVH buffer
+                bindings[7].binding = 7;
+                bindings[7].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+                bindings[7].descriptorCount = 1;
+                bindings[7].stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+                bindings[7].pImmutableSamplers = nullptr;
+
+                // Binding 8: Position buffer
+                bindings[8].binding = 8;
+                bindings[8].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+                bindings[8].descriptorCount = 1;
+                bindings[8].stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+                bindings[8].pImmutableSamplers = nullptr;
+
+                // Binding 9: Triangle index buffer
+                bindings[9].binding = 9;
+                bindings[9].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+                bindings[9].descriptorCount = 1;
+                bindings[9].stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+                bindings[9].pImmutableSamplers = nullptr;
+
+                // Binding 10: Precomputed triangle buffer
+                bindings[10].binding = 10;
+                bindings[10].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+                bindings[10].descriptorCount = 1;
+                bindings[10].stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+                bindings[10].pImmutableSamplers = nullptr;
+
+                // Binding 11: Per pixel traversal counter buffer
+                bindings[11].binding = 11;
+                bindings[11].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+                bindings[11].descriptorCount = 1;
+                bindings[11].stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+                bindings[11].pImmutableSamplers = nullptr;
+
+                // Binding 12: Traversal totals buffer
+                bindings[12].binding = 12;
+                bindings[12].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+                bindings[12].descriptorCount = 1;
+                bindings[12].stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+                bindings[12].pImmutableSamplers = nullptr;
+
+                // Bindings 13-17: Wavefront state, extend, hit, shadow and binned shadow queues
+                // Bindings 18-20: Denoiser surfaces, shadow history and filter buffers
+                // Binding 21: Progressive accumulation buffer
+                for (uint32_t binding = 13; binding <= 21; ++binding)
+                {
+                    bindings[binding].binding = binding;
+                    bindings[binding].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+                    bindings[binding].descriptorCount = 1;
+                    bindings[binding].stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+                    bindings[binding].pImmutableSamplers = nullptr;
+                }
+
+                // Binding 22: Upscaled Storage Image
+                bindings[22].binding = 22;
+                bindings[22].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_IMAGE;
+                bindings[22].descriptorCount = 1;
+                bindings[22].stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+                bindings[22].pImmutableSamplers = nullptr;
+
+                // Binding 23: Shadow visibility Storage Image
+                bindings[23].binding = 23;
+                bindings[23].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_IMAGE;
+                bindings[23].descriptorCount = 1;
+                bindings[23].stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+                bindings[23].pImmutableSamplers = nullptr;
+
+                // Binding 24: G-buffer Storage Image
+                bindings[24].binding = 24;
+                bindings[24].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_IMAGE;
+                bindings[24].descriptorCount = 1;
+                bindings[24].stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+                bindings[24].pImmutableSamplers = nullptr;
+
                 // Create layout
                 VkDescriptorSetLayoutCreateInfo layoutInfo{};
                 layoutInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
@@ -379,6 +502,26 @@ namespace Engine
             shaderStageInfo.module = raytracingComputeShaderModule;
             shaderStageInfo.pName = "main";
 
+            // Specialization constants: INSTRUMENTATION (constant_id 0), SHORT_STACK_TRAVERSAL (constant_id 1), WAVEFRONT_STAGE (constant_id 2),
+            // DENOISE_PASS (constant_id 3), UPSCALE_PASS (constant_id 4), SHADOW_RESOLUTION_PASS (constant_id 5) and HYBRID_PASS (constant_id 6), all 4 bytes
+            uint32_t specializationData[7] = { VK_FALSE, useShortStackTraversal ? VK_TRUE : VK_FALSE, static_cast<uint32_t>(WavefrontStage::Megakernel), static_cast<uint32_t>(DenoisePass::None), VK_FALSE,
+                static_cast<uint32_t>(ShadowResolutionPass::None), VK_FALSE };
+
+            std::array<VkSpecializationMapEntry, 7> specializationEntries{};
+            for (uint32_t i = 0; i < specializationEntries.size(); ++i)
+            {
+                specializationEntries[i].constantID = i;
+                specializationEntries[i].offset = i * sizeof(uint32_t);
+                specializationEntries[i].size = sizeof(uint32_t);
+            }
+
+            VkSpecializationInfo specializationInfo{};
+            specializationInfo.mapEntryCount = static_cast<uint32_t>(specializationEntries.size());
+            specializationInfo.pMapEntries = specializationEntries.data();
+            specializationInfo.dataSize = sizeof(specializationData);
+            specializationInfo.pData = specializationData;
+            shaderStageInfo.pSpecializationInfo = &specializationInfo;
+
             VkComputePipelineCreateInfo pipelineInfo{};
             pipelineInfo.sType = VK_STRUCTURE_TYPE_COMPUTE_PIPELINE_CREATE_INFO;
             pipelineInfo.stage = shaderStageInfo;
@@ -390,6 +533,80 @@ namespace Engine
             {
                 throw std::runtime_error("failed to create ray tracing compute pipeline!");
             }
+
+            // Instrumented variant: same traversal with the counters compiled in
+            specializationData[0] = VK_TRUE;
+
+            result = vkCreateComputePipelines(device, VK_NULL_HANDLE, 1, &pipelineInfo, nullptr, &rayTracingInstrumentedPipeline);
+
+            if (result != VK_SUCCESS)
+            {
+                throw std::runtime_error("failed to create instrumented ray tracing compute pipeline!");
+            }
+
+            // Wavefront stages: one pipeline per WAVEFRONT_STAGE, without instrumentation
+            specializationData[0] = VK_FALSE;
+            for (int stage = static_cast<int>(WavefrontStage::Generate); stage < static_cast<int>(WavefrontStage::Count); ++stage)
+            {
+                specializationData[2] = static_cast<uint32_t>(stage);
+
+                result = vkCreateComputePipelines(device, VK_NULL_HANDLE, 1, &pipelineInfo, nullptr, &rayTracingWavefrontPipelines[stage]);
+
+                if (result != VK_SUCCESS)
+                {
+                    throw std::runtime_error("failed to create wavefront ray tracing compute pipeline!");
+                }
+            }
+
+            // Shadow denoiser passes
+            specializationData[2] = static_cast<uint32_t>(WavefrontStage::Megakernel);
+            for (int pass = static_cast<int>(DenoisePass::Temporal); pass < static_cast<int>(DenoisePass::Count); ++pass)
+            {
+                specializationData[3] = static_cast<uint32_t>(pass);
+
+                result = vkCreateComputePipelines(device, VK_NULL_HANDLE, 1, &pipelineInfo, nullptr, &rayTracingDenoisePipelines[pass]);
+
+                if (result != VK_SUCCESS)
+                {
+                    throw std::runtime_error("failed to create shadow denoiser compute pipeline!");
+                }
+            }
+
+            // Dynamic resolution upscale
+            specializationData[3] = static_cast<uint32_t>(DenoisePass::None);
+            specializationData[4] = VK_TRUE;
+
+            result = vkCreateComputePipelines(device, VK_NULL_HANDLE, 1, &pipelineInfo, nullptr, &rayTracingUpscalePipeline);
+
+            if (result != VK_SUCCESS)
+            {
+                throw std::runtime_error("failed to create upscale compute pipeline!");
+            }
+
+            // Reduced resolution shadow passes
+            specializationData[4] = VK_FALSE;
+            for (int pass = static_cast<int>(ShadowResolutionPass::Trace); pass < static_cast<int>(ShadowResolutionPass::Count); ++pass)
+            {
+                specializationData[5] = static_cast<uint32_t>(pass);
+
+                result = vkCreateComputePipelines(device, VK_NULL_HANDLE, 1, &pipelineInfo, nullptr, &rayTracingShadowResolutionPipelines[pass]);
+
+                if (result != VK_SUCCESS)
+                {
+                    throw std::runtime_error("failed to create reduced resolution shadow compute pipeline!");
+                }
+            }
+
+            // Hybrid mode shadow pass over the rasterized G-buffer
+            specializationData[5] = static_cast<uint32_t>(ShadowResolutionPass::None);
+            specializationData[6] = VK_TRUE;
+
+            result = vkCreateComputePipelines(device, VK_NULL_HANDLE, 1, &pipelineInfo, nullptr, &rayTracingHybridPipeline);
+
+            if (result != VK_SUCCESS)
+            {
+                throw std::runtime_error("failed to create hybrid shadow compute pipeline!");
+            }
         }
 
         void allocateComputeRayTracingPipelineBuffers()
@@ -397,7 +614,7 @@ namespace Engine
             // Create descriptor sets
             VkDescriptorSet descriptorSet;
             {
-                std::vector<VkDescriptorSetLayoutBinding> bindings(6);
+                std::vector<VkDescriptorSetLayoutBinding> bindings(25);
 
                 // Binding 0: Storage Image
                 bindings[0].binding = 0;
@@ -441,6 +658,86 @@ namespace Engine
                 bindings[5].stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
                 bindings[5].pImmutableSamplers = nullptr;
 
+                // Binding 6: Wide BVH Nodes (Storage Buffer)
+                bindings[6].binding = 6;
+                bindings[6].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+                bindings[6].descriptorCount = 1;
+                bindings[6].stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+                bindings[6].pImmutableSamplers = nullptr;
+
+                // Binding 7: Compact BVH Nodes (Storage Buffer)
+                bindings[7].binding = 7;
+                bindings[7].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+                bindings[7].descriptorCount = 1;
+                bindings[7].stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+                bindings[7].pImmutableSamplers = nullptr;
+
+                // Binding 8: Packed positions (Storage Buffer)
+                bindings[8].binding = 8;
+                bindings[8].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+                bindings[8].descriptorCount = 1;
+                bindings[8].stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+                bindings[8].pImmutableSamplers = nullptr;
+
+                // Binding 9: Triangle indices (Storage Buffer)
+                bindings[9].binding = 9;
+                bindings[9].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+                bindings[9].descriptorCount = 1;
+                bindings[9].stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+                bindings[9].pImmutableSamplers = nullptr;
+
+                // Binding 10: Precomputed triangles (Storage Buffer)
+                bindings[10].binding = 10;
+                bindings[10].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+                bindings[10].descriptorCount = 1;
+                bindings[10].stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+                bindings[10].pImmutableSamplers = nullptr;
+
+                // Binding 11: Per pixel traversal counters (Storage Buffer)
+                bindings[11].binding = 11;
+                bindings[11].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+                bindings[11].descriptorCount = 1;
+                bindings[11].stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+                bindings[11].pImmutableSamplers = nullptr;
+
+                // Binding 12: Traversal totals (Storage Buffer)
+                bindings[12].binding = 12;
+                bindings[12].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+                bindings[12].descriptorCount = 1;
+                bindings[12].stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+                bindings[12].pImmutableSamplers = nullptr;
+
+                // Bindings 13-21: Wavefront state and queues, denoiser and accumulation buffers (Storage Buffers)
+                for (uint32_t binding = 13; binding <= 21; ++binding)
+                {
+                    bindings[binding].binding = binding;
+                    bindings[binding].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+                    bindings[binding].descriptorCount = 1;
+                    bindings[binding].stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+                    bindings[binding].pImmutableSamplers = nullptr;
+                }
+
+                // Binding 22: Upscaled image (Storage Image)
+                bindings[22].binding = 22;
+                bindings[22].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_IMAGE;
+                bindings[22].descriptorCount = 1;
+                bindings[22].stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+                bindings[22].pImmutableSamplers = nullptr;
+
+                // Binding 23: Shadow visibility (Storage Image)
+                bindings[23].binding = 23;
+                bindings[23].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_IMAGE;
+                bindings[23].descriptorCount = 1;
+                bindings[23].stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+                bindings[23].pImmutableSamplers = nullptr;
+
+                // Binding 24: G-buffer (Storage Image)
+                bindings[24].binding = 24;
+                bindings[24].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_IMAGE;
+                bindings[24].descriptorCount = 1;
+                bindings[24].stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+                bindings[24].pImmutableSamplers = nullptr;
+
                 VkDescriptorSetLayoutCreateInfo layoutInfo = {};
                 layoutInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
                 layoutInfo.bindingCount = static_cast<uint32_t>(bindings.size());
@@ -450,9 +747,9 @@ namespace Engine
                 vkCreateDescriptorSetLayout(device, &layoutInfo, nullptr, &descriptorSetLayout);
 
                 std::array<VkDescriptorPoolSize, 3> poolSizes = { {
-                    { VK_DESCRIPTOR_TYPE_STORAGE_IMAGE, 1 },
+                    { VK_DESCRIPTOR_TYPE_STORAGE_IMAGE, 4 },
                     { VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, 1 },
-                    { VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 4 },
+                    { VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 20 },
                 } };
 
                 VkDescriptorPoolCreateInfo poolInfo = {};
@@ -509,7 +806,7 @@ namespace Engine
             }
 
             // Write to descriptor sets
-            std::array<VkWriteDescriptorSet, 6> descriptorWrites = {};
+            std::array<VkWriteDescriptorSet, 25> descriptorWrites = {};
             {
                 // Storage Image
                 {
@@ -525,6 +822,48 @@ namespace Engine
                     descriptorWrites[0].pImageInfo = &imageInfo;
                 }
 
+                // Upscaled Storage Image, the trace image until dynamic resolution swaps them
+                VkDescriptorImageInfo upscaledImageInfo{};
+                {
+                    upscaledImageInfo.imageView = raytracingTraceImageView;
+                    upscaledImageInfo.imageLayout = VK_IMAGE_LAYOUT_GENERAL;
+
+                    descriptorWrites[22] = { VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET };
+                    descriptorWrites[22].dstSet = descriptorSet;
+                    descriptorWrites[22].dstBinding = 22;
+                    descriptorWrites[22].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_IMAGE;
+                    descriptorWrites[22].descriptorCount = 1;
+                    descriptorWrites[22].pImageInfo = &upscaledImageInfo;
+                }
+
+                // Shadow visibility Storage Image
+                VkDescriptorImageInfo shadowVisibilityImageInfo{};
+                {
+                    shadowVisibilityImageInfo.imageView = shadowVisibilityImageView;
+                    shadowVisibilityImageInfo.imageLayout = VK_IMAGE_LAYOUT_GENERAL;
+
+                    descriptorWrites[23] = { VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET };
+                    descriptorWrites[23].dstSet = descriptorSet;
+                    descriptorWrites[23].dstBinding = 23;
+                    descriptorWrites[23].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_IMAGE;
+                    descriptorWrites[23].descriptorCount = 1;
+                    descriptorWrites[23].pImageInfo = &shadowVisibilityImageInfo;
+                }
+
+                // G-buffer Storage Image, written by the rasterizer for the hybrid shadow pass
+                VkDescriptorImageInfo gBufferImageInfo{};
+                {
+                    gBufferImageInfo.imageView = gBufferImageView;
+                    gBufferImageInfo.imageLayout = VK_IMAGE_LAYOUT_GENERAL;
+
+                    descriptorWrites[24] = { VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET };
+                    descriptorWrites[24].dstSet = descriptorSet;
+                    descriptorWrites[24].dstBinding = 24;
+                    descriptorWrites[24].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_IMAGE;
+                    descriptorWrites[24].descriptorCount = 1;
+                    descriptorWrites[24].pImageInfo = &gBufferImageInfo;
+                }
+
                 // Uniform Buffer (Camera)
                 {
                 createBuffer(
@@ -555,7 +894,7 @@ namespace Engine
                 // BVH Nodes
                 {
                     createBuffer(
-                        largeBufferSize,  // size of your BVH data
+                        compactBVHReplacesBinary() ? normalBufferSize : largeBufferSize,  // size of your BVH data, only the TLAS when the compact nodes replace the BLAS nodes
                         VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT,
                         VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT | VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
                         bvhBuffer,
@@ -643,6 +982,300 @@ namespace Engine
                     descriptorWrites[5].descriptorCount = 1;
                     descriptorWrites[5].pBufferInfo = &lightBufferInfo;
                 }
+
+                // Wide BVH Nodes
+                {
+                    createBuffer(
+                        largeBufferSize,  // size of the compressed wide BVH data
+                        VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+                        VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT | VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+                        wideBvhBuffer,
+                        wideBvhBufferMemory
+                    );
+
+                    VkDescriptorBufferInfo wideBvhBufferInfo = {};
+                    wideBvhBufferInfo.buffer = wideBvhBuffer;
+                    wideBvhBufferInfo.offset = 0;
+                    wideBvhBufferInfo.range = VK_WHOLE_SIZE;
+
+                    descriptorWrites[6] = { VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET };
+                    descriptorWrites[6].dstSet = descriptorSet;
+                    descriptorWrites[6].dstBinding = 6;
+                    descriptorWrites[6].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+                    descriptorWrites[6].descriptorCount = 1;
+                    descriptorWrites[6].pBufferInfo = &wideBvhBufferInfo;
+                }
+
+                // Compact BVH Nodes
+                {
+                    createBuffer(
+                        compactBVHReplacesBinary() ? largeBufferSize : normalBufferSize,  // size of the depth first 32 byte BVH data, unused unless compactBVHReplacesBinary
+                        VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+                        VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT | VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+                        compactBvhBuffer,
+                        compactBvhBufferMemory
+                    );
+
+                    VkDescriptorBufferInfo compactBvhBufferInfo = {};
+                    compactBvhBufferInfo.buffer = compactBvhBuffer;
+                    compactBvhBufferInfo.offset = 0;
+                    compactBvhBufferInfo.range = VK_WHOLE_SIZE;
+
+                    descriptorWrites[7] = { VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET };
+                    descriptorWrites[7].dstSet = descriptorSet;
+                    descriptorWrites[7].dstBinding = 7;
+                    descriptorWrites[7].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+                    descriptorWrites[7].descriptorCount = 1;
+                    descriptorWrites[7].pBufferInfo = &compactBvhBufferInfo;
+                }
+
+                // Packed positions
+                {
+                    createBuffer(
+                        largeBufferSize,  // size of the vertex positions of the indexed triangles
+                        VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+                        VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT | VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+                        positionBuffer,
+                        positionBufferMemory
+                    );
+
+                    VkDescriptorBufferInfo positionBufferInfo = {};
+                    positionBufferInfo.buffer = positionBuffer;
+                    positionBufferInfo.offset = 0;
+                    positionBufferInfo.range = VK_WHOLE_SIZE;
+
+                    descriptorWrites[8] = { VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET };
+                    descriptorWrites[8].dstSet = descriptorSet;
+                    descriptorWrites[8].dstBinding = 8;
+                    descriptorWrites[8].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+                    descriptorWrites[8].descriptorCount = 1;
+                    descriptorWrites[8].pBufferInfo = &positionBufferInfo;
+                }
+
+                // Triangle indices
+                {
+                    createBuffer(
+                        largeBufferSize,  // size of the reordered index data
+                        VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+                        VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT | VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+                        triangleIndexBuffer,
+                        triangleIndexBufferMemory
+                    );
+
+                    VkDescriptorBufferInfo triangleIndexBufferInfo = {};
+                    triangleIndexBufferInfo.buffer = triangleIndexBuffer;
+                    triangleIndexBufferInfo.offset = 0;
+                    triangleIndexBufferInfo.range = VK_WHOLE_SIZE;
+
+                    descriptorWrites[9] = { VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET };
+                    descriptorWrites[9].dstSet = descriptorSet;
+                    descriptorWrites[9].dstBinding = 9;
+                    descriptorWrites[9].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+                    descriptorWrites[9].descriptorCount = 1;
+                    descriptorWrites[9].pBufferInfo = &triangleIndexBufferInfo;
+                }
+
+                // Precomputed triangles
+                {
+                    createBuffer(
+                        largeBufferSize,  // size of the triangles with precomputed edges
+                        VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+                        VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT | VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+                        rayTriangleBuffer,
+                        rayTriangleBufferMemory
+                    );
+
+                    VkDescriptorBufferInfo rayTriangleBufferInfo = {};
+                    rayTriangleBufferInfo.buffer = rayTriangleBuffer;
+                    rayTriangleBufferInfo.offset = 0;
+                    rayTriangleBufferInfo.range = VK_WHOLE_SIZE;
+
+                    descriptorWrites[10] = { VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET };
+                    descriptorWrites[10].dstSet = descriptorSet;
+                    descriptorWrites[10].dstBinding = 10;
+                    descriptorWrites[10].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+                    descriptorWrites[10].descriptorCount = 1;
+                    descriptorWrites[10].pBufferInfo = &rayTriangleBufferInfo;
+                }
+
+                // Per pixel traversal counters
+                {
+                    createBuffer(
+                        largeBufferSize,  // size of a uvec4 per pixel
+                        VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
+                        VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
+                        traversalCounterBuffer,
+                        traversalCounterBufferMemory
+                    );
+
+                    VkDescriptorBufferInfo traversalCounterBufferInfo = {};
+                    traversalCounterBufferInfo.buffer = traversalCounterBuffer;
+                    traversalCounterBufferInfo.offset = 0;
+                    traversalCounterBufferInfo.range = VK_WHOLE_SIZE;
+
+                    descriptorWrites[11] = { VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET };
+                    descriptorWrites[11].dstSet = descriptorSet;
+                    descriptorWrites[11].dstBinding = 11;
+                    descriptorWrites[11].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+                    descriptorWrites[11].descriptorCount = 1;
+                    descriptorWrites[11].pBufferInfo = &traversalCounterBufferInfo;
+                }
+
+                // Traversal totals, read back by the CPU
+                {
+                    createBuffer(
+                        traversalTotalsStride * MAX_FRAMES_IN_FLIGHT,  // one TraversalTotals per frame in flight
+                        VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+                        VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+                        traversalTotalsBuffer,
+                        traversalTotalsBufferMemory
+                    );
+
+                    VkDescriptorBufferInfo traversalTotalsBufferInfo = {};
+                    traversalTotalsBufferInfo.buffer = traversalTotalsBuffer;
+                    traversalTotalsBufferInfo.offset = 0;
+                    traversalTotalsBufferInfo.range = sizeof(TraversalTotals);
+
+                    descriptorWrites[12] = { VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET };
+                    descriptorWrites[12].dstSet = descriptorSet;
+                    descriptorWrites[12].dstBinding = 12;
+                    descriptorWrites[12].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+                    descriptorWrites[12].descriptorCount = 1;
+                    descriptorWrites[12].pBufferInfo = &traversalTotalsBufferInfo;
+                }
+
+                // Wavefront state: queue heads, read as indirect dispatch arguments, ray bins, then a visibility count per pixel
+                VkDescriptorBufferInfo wavefrontBufferInfos[5] = {};
+                {
+                    VkDeviceSize pixelCount = VkDeviceSize(swapChainExtent.width) * swapChainExtent.height;
+
+                    createBuffer(
+                        sizeof(WavefrontQueue) * wavefrontQueueCount + sizeof(uint32_t) * (wavefrontRayBinCount + pixelCount),
+                        VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+                        VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
+                        wavefrontStateBuffer,
+                        wavefrontStateBufferMemory
+                    );
+
+                    // Extend queue: one camera ray per pixel
+                    createBuffer(
+                        sizeof(QueuedRay) * pixelCount,
+                        VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
+                        VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
+                        wavefrontRayQueueBuffer,
+                        wavefrontRayQueueBufferMemory
+                    );
+
+                    // Hit queue: at most one hit per camera ray
+                    createBuffer(
+                        sizeof(QueuedHit) * pixelCount,
+                        VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
+                        VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
+                        wavefrontHitQueueBuffer,
+                        wavefrontHitQueueBufferMemory
+                    );
+
+                    // Shadow queue: SHADOW_SAMPLES rays per hit
+                    createBuffer(
+                        sizeof(QueuedShadowRay) * wavefrontShadowRaysPerHit * pixelCount,
+                        VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
+                        VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
+                        wavefrontShadowQueueBuffer,
+                        wavefrontShadowQueueBufferMemory
+                    );
+
+                    // Binned shadow queue: the shadow queue sorted by ray bin
+                    createBuffer(
+                        sizeof(QueuedShadowRay) * wavefrontShadowRaysPerHit * pixelCount,
+                        VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
+                        VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
+                        wavefrontBinnedShadowQueueBuffer,
+                        wavefrontBinnedShadowQueueBufferMemory
+                    );
+
+                    VkBuffer wavefrontBuffers[5] = { wavefrontStateBuffer, wavefrontRayQueueBuffer, wavefrontHitQueueBuffer, wavefrontShadowQueueBuffer, wavefrontBinnedShadowQueueBuffer };
+                    for (int i = 0; i < 5; ++i)
+                    {
+                        wavefrontBufferInfos[i].buffer = wavefrontBuffers[i];
+                        wavefrontBufferInfos[i].offset = 0;
+                        wavefrontBufferInfos[i].range = VK_WHOLE_SIZE;
+
+                        descriptorWrites[13 + i] = { VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET };
+                        descriptorWrites[13 + i].dstSet = descriptorSet;
+                        descriptorWrites[13 + i].dstBinding = 13 + i;
+                        descriptorWrites[13 + i].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+                        descriptorWrites[13 + i].descriptorCount = 1;
+                        descriptorWrites[13 + i].pBufferInfo = &wavefrontBufferInfos[i];
+                    }
+                }
+
+                // Shadow denoiser: two slots per pixel of surfaces, history and filter
+                VkDescriptorBufferInfo denoiseBufferInfos[3] = {};
+                {
+                    VkDeviceSize pixelCount = VkDeviceSize(swapChainExtent.width) * swapChainExtent.height;
+
+                    createBuffer(
+                        denoiseSurfaceSize * 2 * pixelCount,
+                        VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
+                        VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
+                        denoiseSurfaceBuffer,
+                        denoiseSurfaceBufferMemory
+                    );
+
+                    createBuffer(
+                        shadowHistorySize * 2 * pixelCount,
+                        VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
+                        VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
+                        shadowHistoryBuffer,
+                        shadowHistoryBufferMemory
+                    );
+
+                    createBuffer(
+                        shadowFilterSize * 2 * pixelCount,
+                        VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
+                        VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
+                        shadowFilterBuffer,
+                        shadowFilterBufferMemory
+                    );
+
+                    VkBuffer denoiseBuffers[3] = { denoiseSurfaceBuffer, shadowHistoryBuffer, shadowFilterBuffer };
+                    for (int i = 0; i < 3; ++i)
+                    {
+                        denoiseBufferInfos[i].buffer = denoiseBuffers[i];
+                        denoiseBufferInfos[i].offset = 0;
+                        denoiseBufferInfos[i].range = VK_WHOLE_SIZE;
+
+                        descriptorWrites[18 + i] = { VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET };
+                        descriptorWrites[18 + i].dstSet = descriptorSet;
+                        descriptorWrites[18 + i].dstBinding = 18 + i;
+                        descriptorWrites[18 + i].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+                        descriptorWrites[18 + i].descriptorCount = 1;
+                        descriptorWrites[18 + i].pBufferInfo = &denoiseBufferInfos[i];
+                    }
+                }
+
+                // Progressive refinement: running average per pixel
+                VkDescriptorBufferInfo accumulationBufferInfo{};
+                {
+                    createBuffer(
+                        accumulationSize * VkDeviceSize(swapChainExtent.width) * swapChainExtent.height,
+                        VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
+                        VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
+                        accumulationBuffer,
+                        accumulationBufferMemory
+                    );
+
+                    accumulationBufferInfo.buffer = accumulationBuffer;
+                    accumulationBufferInfo.offset = 0;
+                    accumulationBufferInfo.range = VK_WHOLE_SIZE;
+
+                    descriptorWrites[21] = { VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET };
+                    descriptorWrites[21].dstSet = descriptorSet;
+                    descriptorWrites[21].dstBinding = 21;
+                    descriptorWrites[21].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+                    descriptorWrites[21].descriptorCount = 1;
+                    descriptorWrites[21].pBufferInfo = &accumulationBufferInfo;
+                }
             }
 
             vkUpdateDescriptorSets(device, static_cast<uint32_t>(descriptorWrites.size()), descriptorWrites.data(), 0, nullptr);
@@ -147,6 +147,7 @@ struct UniformBufferObject
     alignas(16) glm::mat4 proj;
     alignas(16) glm::vec3 cameraPos;
     alignas(16) glm::vec3 cameraLookAt;
+    int raytracingComposite; // 0 blends the ray traced image in, 1 shows only it, 2 hybrid: writes the G-buffer and shows the shadows traced from it
 };
 static_assert(sizeof(UniformBufferObject) % 16 == 0, "UniformBufferObject must be 16-byte aligned");
 
@@ -156,8 +157,105 @@ struct PushConstants
     int triangleSize;
     int instanceSize;
     int lightInstanceSize;
+    int tlasRootIndex; // -1 when instances are traversed one by one
+    int useWideBVH;    // Non zero to traverse the compressed wide BVHs instead of the binary ones
+    int useCompactBVH; // Non zero to traverse the 32 byte depth first nodes instead of the binary ones
+    int triangleFormat; // TriangleFormat the triangles are read in
+    int traversalHeatmap;    // Instrumented pipeline: 0 shades, 1 nodes visited, 2 triangles tested, 3 stack high-water mark
+    int traversalHeatmapMax; // Counter value drawn as the hottest color
+    int swizzledDispatch; // Non zero to map workgroups to tiles in Morton order, the dispatch is padded to whole 8x8 tile blocks
+    int binRays;          // Non zero when the wavefront shadow stage reads the binned shadow queue
+    int shadowSampleCount;         // Shadow rays per pixel without the denoiser
+    int denoisedShadowSampleCount; // Shadow rays per pixel that the denoiser filters
+    int shadowDenoiser;            // 0 off, 1 on, 2 on with the history discarded
+    int denoiseSplitX;             // Pixels left of it are not denoised
+    int frameIndex;                // Ray traced frames so far, seeds the shadow jitter and picks the history slot
+    int atrousIteration;           // A-trous pass being recorded
+    int atrousIterationCount;      // The last a-trous pass composites into the image
+    int progressiveSample;         // Sample of the progressive accumulation traced this frame, -1 when off
+    int progressiveConverged;      // Non zero: the accumulation is complete and only shown
+    int traceWidth;                // Pixels traced this frame, the whole image unless dynamic resolution scaled it down
+    int traceHeight;
+    int shadowResolutionDivisor;   // 1 traces shadows per pixel, 2 or 4 per 2x2 or 4x4 block and upsamples them
 };
 
+// Frame totals of the instrumented ray tracing pipeline, std430 layout of TraversalTotalsBuffer in compute.glsl
+struct TraversalTotals
+{
+    uint32_t rays;
+    uint32_t maxStackHighWater;
+    uint32_t nodesLow;      // Nodes and triangles are 64 bit totals split in low and high words
+    uint32_t nodesHigh;
+    uint32_t trianglesLow;
+    uint32_t trianglesHigh;
+
+    uint64_t nodes() const { return (uint64_t(nodesHigh) << 32) | nodesLow; }
+    uint64_t triangles() const { return (uint64_t(trianglesHigh) << 32) | trianglesLow; }
+};
+
+// Megakernel or one stage of the wavefront path tracer, values of WAVEFRONT_STAGE in compute.glsl
+enum class WavefrontStage
+{
+    Megakernel, // Single dispatch: camera ray, shading and shadow rays per pixel
+    Generate,   // Camera rays into the extend queue
+    Extend,     // Closest hits into the hit queue
+    Shade,      // Direct lighting, shadow rays into the shadow queue
+    Shadow,     // Any hit, counts unoccluded samples per pixel
+    Resolve,    // Lighting times the visible fraction
+    BinCount,   // Shadow rays per bin
+    BinScan,    // Bin counts to offsets, one workgroup
+    BinScatter, // Shadow queue sorted into the binned shadow queue
+    Count
+};
+
+// Ray tracing or one pass of the shadow denoiser, values of DENOISE_PASS in compute.glsl
+enum class DenoisePass
+{
+    None,     // Ray tracing, denoised pixels write their surface and raw shadow visibility
+    Temporal, // Reprojects the history and blends the raw visibility in
+    Atrous,   // One edge aware a-trous iteration, the last one composites
+    Count
+};
+
+// Ray tracing or one pass of the reduced resolution shadows, values of SHADOW_RESOLUTION_PASS in compute.glsl
+enum class ShadowResolutionPass
+{
+    None,     // Ray tracing, shades without shadows and writes the surfaces when the divisor is above 1
+    Trace,    // Shadow rays of one pixel per block into the visibility image
+    Upsample, // Joint bilateral upsample of the visibility, multiplied into the image
+    Count
+};
+
+// Head of WavefrontStateBuffer in compute.glsl: the indirect dispatch of the stage reading a queue and its entry count
+struct WavefrontQueue
+{
+    uint32_t groupCountX;
+    uint32_t groupCountY;
+    uint32_t groupCountZ;
+    uint32_t entryCount;
+};
+static_assert(sizeof(WavefrontQueue) == 16, "WavefrontQueue must match the std430 layout in compute.glsl");
+
+// Queue entries of the wavefront stages, same layouts as compute.glsl
+struct QueuedRay
+{
+    glm::vec4 origin; // w: pixel index bits
+    glm::vec4 direction;
+};
+
+struct QueuedHit
+{
+    glm::vec4 position; // w: pixel index bits
+    glm::vec4 normal;
+};
+
+struct QueuedShadowRay
+{
+    glm::vec3 toSample; // Unnormalized, its length is the ray's tMax
+    uint32_t hitIndex;
+};
+static_assert(sizeof(QueuedShadowRay) == 16, "QueuedShadowRay must match the std430 layout in compute.glsl");
+
 struct CameraUBO {
     alignas(16) glm::vec4 position;
     alignas(16) glm::vec4 direction;
@@ -173,6 +271,11 @@ struct CameraUBO {
 
     alignas(16) glm::mat4 projectionMatrix; // Projection matrix
     alignas(16) glm::mat4 viewMatrix;       // View matrix
+
+    alignas(16) glm::mat4 previousViewProjection; // Projection times view of the last frame, for the shadow denoiser's reprojection
+    alignas(16) glm::vec4 previousPosition;
+
+    alignas(16) glm::mat4 inverseRasterViewProjection; // Undoes the rasterizer's projection times view, the hybrid mode rebuilds positions from depth with it
 };
 static_assert(sizeof(CameraUBO) % 16 == 0, "CameraUBO must be 16-byte aligned");
 
@@ -181,10 +284,19 @@ struct Triangle
     glm::vec4 v0;
     glm::vec4 v1;
     glm::vec4 v2;
-	glm::vec4 centroid; // Precomputed centroid for the triangle
+	glm::vec4 centroid; // Precomputed centroid for the triangle, w is the source triangle (exact below 2^24 triangles)
 };
 static_assert(sizeof(Triangle) % 16 == 0, "Triangle must be 16-byte aligned");
 
+// Upload only copy of a Triangle laid out for intersection, the builders keep working on Triangle
+struct RayTriangle
+{
+    glm::vec4 v0;    // w: geometric normal as two octahedral snorm16, bit cast
+    glm::vec4 edge1; // v1 - v0, w: material id bits, 0 while meshes have no materials
+    glm::vec4 edge2; // v2 - v0, w: unused
+};
+static_assert(sizeof(RayTriangle) == 48, "RayTriangle must match the std430 layout in compute.glsl");
+
 struct AABB
 {
     alignas(16) glm::vec3 min;
@@ -216,7 +328,7 @@ struct AABB
 struct BVHNode
 {
     glm::vec3 boundMin;
-    float pad0;
+    int parent = -1; // Global index of the parent once placed, -1 for roots. Read by the short stack traversal.
     glm::vec3 boundMax;
     float pad1;
     int left = -1;
@@ -243,6 +355,16 @@ struct BVHNode
 };
 static_assert(sizeof(BVHNode) % 16 == 0, "BVHNode must be 16-byte aligned");
 
+// Binary BVH node in depth first order, the left child of an internal node is always the next node
+struct CompactBVHNode
+{
+    glm::vec3 boundMin;
+    int rightOrFirstTriangle; // Right child for internal nodes, first triangle for leaves
+    glm::vec3 boundMax;
+    int triangleCount;        // Internal nodes: -1 - (split axis | left child on the upper side << 2)
+};
+static_assert(sizeof(CompactBVHNode) == 32, "CompactBVHNode must match the std430 layout in compute.glsl");
+
 struct BVHInstance
 {
     glm::mat4 modelMatrix;
@@ -250,21 +372,35 @@ struct BVHInstance
     alignas(16) int bvhRootNodeIndex;
     int triangleOffset;
     int triangleCount;
-    int pad0;
+    int wideRootNodeIndex = -1; // Root in the wide BVH buffer, -1 when the model has no wide BVH
 };
 static_assert(sizeof(BVHInstance) % 16 == 0, "BVHInstance must be 16-byte aligned");
 
+// Compressed 8 wide BVH node, child boxes are 8 bit offsets on a power of two grid from origin.
+// Only 32 bit scalars so the std430 layout in compute.glsl matches without padding.
+struct WideBVHNode
+{
+    float origin[3];
+    uint32_t exponentsAndCount; // Biased x, y, z grid exponents in bytes 0-2, child count in byte 3
+    uint32_t childBaseIndex;    // Internal children are stored consecutively from here
+    uint32_t triangleBaseIndex; // Leaf children triangles are stored consecutively from here
+    uint32_t childMeta[4];      // 16 bits per child: 0x8000 | slot for internal children, count << 10 | offset for leaves
+    uint32_t quantizedMin[6];   // 8 bits per child, word axis * 2 + child / 4
+    uint32_t quantizedMax[6];
+};
+static_assert(sizeof(WideBVHNode) == 88, "WideBVHNode must match the std430 layout in compute.glsl");
+
 struct LightInstance
 {
     alignas(16) glm::vec3 position;
-    float pad0;
+    float aliasProbability; // Alias table slot of the same index: chance to keep this light, see LightAliasTable.h
 
     alignas(16) glm::vec3 color;
-    float pad1;
+    int aliasIndex;         // Light the slot hands over to otherwise
 
     float intensity;
     float radius;
-    float pad2;
+    float selectionPdf;     // Chance that a light sample picks this light
     float pad3;
 };
 static_assert(sizeof(LightInstance) % 16 == 0, "LightInstance must be 16-byte aligned");
@@ -68,6 +68,7 @@ namespace Engine {
             ubo.proj[1][1] *= -1;
             ubo.cameraPos = gameManager.getCurrentCamera().position;
             ubo.cameraLookAt = gameManager.getCurrentCamera().lookAt;
+            ubo.raytracingComposite = useHybridRendering ? 2 : showOnlyRaytracing ? 1 : 0;
 
 			uint32_t index = gameManager.getCurrentScene().gameObjects.size() * currentFrame + gameObjectIndex;
             if (index < uniformCount)
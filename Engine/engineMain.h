@@ -3,6 +3,7 @@
 #include <sstream>
 #include <string>
 #include "Core/Systems/Physics.h"
+#include "Core/Systems/ABTest.h"
 #include "Core/VulkanRenderer.h"
 
 namespace Engine
@@ -12,6 +13,15 @@ namespace Engine
 	private: 
 		bool gpuTimingInitialized = false;
 
+		// Registered A/B tests, each one cycles its setting while its run flag is set
+		std::vector<ABTest> abTests;
+
+		// Instrumented traversal totals summed over the current second
+		double traversalRays = 0;
+		double traversalNodes = 0;
+		double traversalTriangles = 0;
+		uint32_t traversalStackHighWater = 0;
+
 		void mainLoop()
 		{
 			while (!window.shouldClose())
@@ -43,9 +53,19 @@ namespace Engine
 
 			// Accumulate GPU timings
 			auto timestampPeriod = deviceProperties.limits.timestampPeriod;
-			computeTime += float(timestamps[4 * currentFrame + 1] - timestamps[4 * currentFrame + 0]) * timestampPeriod / 1'000'000.0;
+			double frameComputeMs = float(timestamps[4 * currentFrame + 1] - timestamps[4 * currentFrame + 0]) * timestampPeriod / 1'000'000.0;
+			computeTime += frameComputeMs;
 			rasterTime += float(timestamps[4 * currentFrame + 3] - timestamps[4 * currentFrame + 2]) * timestampPeriod / 1'000'000.0;
 
+			// Accumulate instrumented traversal totals, each finished frame hands them over once
+			traversalRays += traversalTotals.rays;
+			traversalNodes += double(traversalTotals.nodes());
+			traversalTriangles += double(traversalTotals.triangles());
+			traversalStackHighWater = std::max(traversalStackHighWater, traversalTotals.maxStackHighWater);
+			traversalTotals = {};
+
+			vulkanRenderer.updateDynamicResolution(frameComputeMs);
+
 			// Over the last second
 			if (timeSinceLastSecond >= 1.0)
 			{
@@ -65,7 +85,32 @@ namespace Engine
 				s << "FPS: " << FPS << ", " << totalFrameAverageMs << " ms"
 					<< "\nCPU: " << cpuFrameTimeMs << " ms"
 					<< "\nCompute ray trace: " << computeRayTraceMs << " ms"
-					<< "\nRasterization: " << rasterizationMs << " ms";
+					<< "\nCamera rays: " << double(swapChainExtent.width) * swapChainExtent.height / (computeRayTraceMs * 1000.0) << " M/s (" << (useWideBVH && !useShortStackTraversal ? "wide BVH" : "binary BVH") << ", " << triangleFormatName(triangleFormat) << ", " << (useWavefrontPathTracing ? "wavefront" : "megakernel")
+					<< (useSwizzledDispatch ? ", swizzled" : "") << (useWavefrontPathTracing && useRayBinning ? ", binned" : "") << ")"
+					<< "\nShadows: " << (useWavefrontPathTracing ? std::to_string(wavefrontShadowRaysPerHit) + " spp"
+						: useProgressiveRefinement ? std::to_string(progressiveShadowSamplesPerPixel) + " spp progressive"
+						: useShadowDenoiser ? std::to_string(denoisedShadowSamplesPerPixel) + " spp denoised" : std::to_string(shadowSamplesPerPixel) + " spp")
+					<< (useShadowDenoiser && shadowDenoiseSplitScreen && !useWavefrontPathTracing && !useProgressiveRefinement ? " (left " + std::to_string(shadowSamplesPerPixel) + " spp raw)" : "")
+					<< (vulkanRenderer.reducedResolutionShadowsActive() ? " at 1/" + std::to_string(shadowResolutionDivisor) + " resolution" : "")
+					<< ", " << lightInstances.size() << (lightInstances.size() == 1 ? " light" : " lights")
+					<< "\nRasterization: " << rasterizationMs << " ms (" << (useHybridRendering ? "hybrid G-buffer" : showOnlyRaytracing ? "ray traced only" : "blend") << ")";
+				if (useDynamicResolution)
+				{
+					VkExtent2D traceExtent = vulkanRenderer.rayTracingTraceExtent();
+					s << "\nResolution: " << int(dynamicResolutionScale * 100.0f + 0.5f) << "% (" << traceExtent.width << "x" << traceExtent.height << "), budget " << dynamicResolutionBudgetMs << " ms";
+				}
+				if (useProgressiveRefinement && !useWavefrontPathTracing)
+				{
+					s << "\nProgressive: " << progressiveSampleCount << " spp, " << glfwGetTime() - progressiveResetTime << " s";
+					if (progressiveReportSeconds >= 0.0)
+					{
+						s << " (" << progressiveReportSamples << " spp in " << progressiveReportSeconds << " s)";
+					}
+				}
+				if (useTraversalInstrumentation && traversalRays > 0)
+				{
+					s << "\nTraversal: " << traversalNodes / traversalRays << " nodes/ray, " << traversalTriangles / traversalRays << " tris/ray, stack " << traversalStackHighWater;
+				}
 				string str = s.str();
 				char* cstr = str.data();
 
@@ -78,8 +123,26 @@ namespace Engine
 					fpsText->text = str;
 				}
 
+				ABMetrics metrics;
+				metrics.computeMs = computeRayTraceMs;
+				metrics.rasterMs = rasterizationMs;
+				metrics.nodesPerRay = traversalRays > 0 ? traversalNodes / traversalRays : 0.0;
+				metrics.trianglesPerRay = traversalRays > 0 ? traversalTriangles / traversalRays : 0.0;
+				metrics.lights = static_cast<double>(lightInstances.size());
+				for (ABTest& test : abTests)
+				{
+					if (*test.run)
+					{
+						test.sample(metrics, abTestRounds);
+					}
+				}
+
 				computeTime = 0;
 				rasterTime = 0;
+				traversalRays = 0;
+				traversalNodes = 0;
+				traversalTriangles = 0;
+				traversalStackHighWater = 0;
 
 				globalDeltaTimeSum = 0;
 				currentFrameCounter = 0;
@@ -88,6 +151,126 @@ namespace Engine
 			}
 		}
 
+		// Each A/B only registers its modes, ABTest cycles them and averages the metrics per mode
+		void registerABTests()
+		{
+			// The buffers of every triangle format are uploaded while this one runs
+			abTests.emplace_back(&runTriangleFormatAB, static_cast<int>(TriangleFormat::Count),
+				[]() { return static_cast<int>(triangleFormat); },
+				[](int mode) { triangleFormat = static_cast<TriangleFormat>(mode); },
+				[](const std::vector<ABMetrics>& averages)
+				{
+					printf("Triangle format A/B, average compute ray trace time over %d seconds each:\n", abTestRounds);
+					for (int format = 0; format < static_cast<int>(averages.size()); ++format)
+					{
+						printf("    %-11s %8.3f ms\n", triangleFormatName(static_cast<TriangleFormat>(format)), averages[format].computeMs);
+					}
+				});
+
+			abTests.emplace_back(&runWavefrontAB, 2,
+				[]() { return useWavefrontPathTracing ? 1 : 0; },
+				[](int mode) { useWavefrontPathTracing = mode == 1; },
+				[](const std::vector<ABMetrics>& averages)
+				{
+					printf("Wavefront A/B, average compute ray trace time over %d seconds each:\n", abTestRounds);
+					printf("    %-11s %8.3f ms\n", "Megakernel", averages[0].computeMs);
+					printf("    %-11s %8.3f ms\n", "Wavefront", averages[1].computeMs);
+				});
+
+			// Bit 0 swizzles the dispatch and bit 1 bins the shadow rays. Reordering changes which rays run together, not
+			// their traversals, so with instrumentation the counters should match across orders while the times differ.
+			// Only the wavefront bins rays.
+			abTests.emplace_back(&runRayOrderAB, 4,
+				[]() { return (useSwizzledDispatch ? 1 : 0) | (useRayBinning ? 2 : 0); },
+				[](int mode)
+				{
+					useSwizzledDispatch = (mode & 1) != 0;
+					useRayBinning = (mode & 2) != 0;
+				},
+				[](const std::vector<ABMetrics>& averages)
+				{
+					const char* orderNames[] = { "Row major", "Swizzled", "Binned", "Both" };
+					printf("Ray order A/B (%s), average compute ray trace time over %d seconds each:\n", useWavefrontPathTracing ? "wavefront" : "megakernel", abTestRounds);
+					for (int i = 0; i < static_cast<int>(averages.size()); ++i)
+					{
+						printf("    %-11s %8.3f ms", orderNames[i], averages[i].computeMs);
+						if (useTraversalInstrumentation && !useWavefrontPathTracing)
+						{
+							printf(", %6.1f nodes/ray, %6.1f tris/ray", averages[i].nodesPerRay, averages[i].trianglesPerRay);
+						}
+						printf("\n");
+					}
+				});
+
+			// Raise denoisedShadowSamplesPerPixel or lower shadowSamplesPerPixel until both cost the same,
+			// then compare them side by side with the split screen
+			abTests.emplace_back(&runShadowDenoiseAB, 2,
+				[]() { return useShadowDenoiser ? 1 : 0; },
+				[](int mode) { useShadowDenoiser = mode == 1; },
+				[](const std::vector<ABMetrics>& averages)
+				{
+					printf("Shadow denoiser A/B, average compute ray trace time over %d seconds each:\n", abTestRounds);
+					printf("    Raw      %2d spp %8.3f ms\n", shadowSamplesPerPixel, averages[0].computeMs);
+					printf("    Denoised %2d spp %8.3f ms (%d a-trous passes)\n", denoisedShadowSamplesPerPixel, averages[1].computeMs, shadowDenoiseAtrousIterations);
+				});
+
+			// Full, half and quarter resolution shadows, the savings are against full resolution
+			abTests.emplace_back(&runShadowResolutionAB, 3,
+				[]() { return shadowResolutionDivisor >= 4 ? 2 : shadowResolutionDivisor - 1; },
+				[](int mode) { shadowResolutionDivisor = 1 << mode; },
+				[](const std::vector<ABMetrics>& averages)
+				{
+					printf("Shadow resolution A/B, average compute ray trace time over %d seconds each, %d spp:\n", abTestRounds, shadowSamplesPerPixel);
+					for (int i = 0; i < static_cast<int>(averages.size()); ++i)
+					{
+						printf("    1/%d resolution %8.3f ms, %7.3f ms saved\n", 1 << i, averages[i].computeMs, averages[0].computeMs - averages[i].computeMs);
+					}
+				});
+
+			// The blend and ray traced only modes trace the same camera rays and differ in the fragment shader only, the
+			// hybrid mode rasterizes the G-buffer and traces shadow rays alone, so both sides count
+			abTests.emplace_back(&runHybridAB, 3,
+				[]() { return useHybridRendering ? 2 : showOnlyRaytracing ? 1 : 0; },
+				[](int mode)
+				{
+					showOnlyRaytracing = mode == 1;
+					useHybridRendering = mode == 2;
+				},
+				[](const std::vector<ABMetrics>& averages)
+				{
+					const char* names[] = { "Blend          ", "Ray traced only", "Hybrid         " };
+					printf("Hybrid A/B, average GPU times over %d seconds each, %d spp:\n", abTestRounds, shadowSamplesPerPixel);
+					for (int i = 0; i < static_cast<int>(averages.size()); ++i)
+					{
+						printf("    %s compute %8.3f ms, raster %8.3f ms, total %8.3f ms\n", names[i], averages[i].computeMs, averages[i].rasterMs, averages[i].computeMs + averages[i].rasterMs);
+					}
+				});
+
+			// Light sampling picks a light per shadow ray, the ray trace time should stay flat from 1 to 1000 lights.
+			// A benchmark count outside the list counts as the last one.
+			static const int benchmarkCounts[] = { 0, 9, 99, 999 };
+			abTests.emplace_back(&runLightScalingAB, 4,
+				[]()
+				{
+					int step = 0;
+					while (step < 3 && benchmarkCounts[step] != lightBenchmarkCount)
+					{
+						++step;
+					}
+					return step;
+				},
+				[](int mode) { lightBenchmarkCount = benchmarkCounts[mode]; },
+				[](const std::vector<ABMetrics>& averages)
+				{
+					double baseMs = averages[0].computeMs;
+					printf("Light scaling A/B, average compute ray trace over %d seconds each, %d spp:\n", abTestRounds, shadowSamplesPerPixel);
+					for (const ABMetrics& average : averages)
+					{
+						printf("    %5.0f lights %8.3f ms, %5.2fx the first\n", average.lights, average.computeMs, baseMs > 0.0 ? average.computeMs / baseMs : 0.0);
+					}
+				});
+		}
+
 	public:
 		Window window;
 		Physics physics;
@@ -102,6 +285,7 @@ namespace Engine
 		EngineMain()
 			:vulkanRenderer(&window)
 		{
+			registerABTests();
 			vulkanRenderer.loadAssets("Resources/");
 		};
 
@@ -1,5 +1,6 @@
 #include <iostream>
 #include "Engine/engineMain.h"
+#include "Engine/Core/Raytracing/HeadlessReference.h"
 
 using namespace Engine;
 
@@ -56,10 +57,32 @@ void compileShadersIfNeeded()
     );
 }
 
-int main()
+int main(int argc, char** argv)
 {
     try
     {
+        // Headless CPU reference: GameEngine --cpu-reference <model.obj> [output.png] [width] [height]
+        if (argc >= 3 && std::string(argv[1]) == "--cpu-reference")
+        {
+            std::string outputPath = argc > 3 ? argv[3] : cpuReferenceDirectory + "reference.png";
+            int width = argc > 4 ? std::atoi(argv[4]) : 1280;
+            int height = argc > 5 ? std::atoi(argv[5]) : 720;
+            return HeadlessReference::renderImage(argv[2], outputPath, width, height) ? EXIT_SUCCESS : EXIT_FAILURE;
+        }
+
+        // SBVH depth cap self check: GameEngine --check-sbvh-depth
+        if (argc >= 2 && std::string(argv[1]) == "--check-sbvh-depth")
+        {
+            return GameModel::checkSBVHDepthLimit() ? EXIT_SUCCESS : EXIT_FAILURE;
+        }
+
+        // Headless BVH statistics: GameEngine --bvh-statistics <model.obj> [directory], writes <directory>/<model>.<builder>.json
+        if (argc >= 3 && std::string(argv[1]) == "--bvh-statistics")
+        {
+            std::string directory = argc > 3 ? argv[3] : bvhStatisticsDirectory;
+            return HeadlessReference::writeStatistics(argv[2], directory) ? EXIT_SUCCESS : EXIT_FAILURE;
+        }
+
         // Compile shaders into SPIR-V
 		printf("Compiling shaders:\n");
         auto start = std::chrono::high_resolution_clock::now();